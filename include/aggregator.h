@@ -0,0 +1,120 @@
+#ifndef _NEXRAN_AGGREGATOR_H_
+#define _NEXRAN_AGGREGATOR_H_
+
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <utility>
+#include <cstdint>
+
+#include "e2sm_kpm.h"
+
+namespace nexran {
+
+/**
+ * The most recent KPM state reported by one NodeB, plus the per-slice
+ * samples that have not yet been folded into the slice policies.
+ * Slices are kept by interned ID in the report's own column layout, so
+ * republishing reuses the vectors' capacity.
+ */
+class NodeBKpmState {
+ public:
+    NodeBKpmState()
+	: period_ms(0),available_dl_prbs(0),fresh(false) {};
+
+    long period_ms;
+    int available_dl_prbs;
+    std::vector<uint32_t> slice_id;
+    e2sm::kpm::EntityMetricsTable slices;
+    std::vector<std::pair<uint32_t,e2sm::kpm::entity_metrics_t>> pending;
+    bool fresh;
+};
+
+/**
+ * The slices the auto-equalizer manages, by interned slice ID, each
+ * with its weight in the shared byte split, or a negative weight if it
+ * takes no part in that split.  The equalizer keeps it current, so
+ * that KpmAggregator::merge() can gather the totals the equalizer needs
+ * as it folds rows in.
+ */
+class SliceWeights {
+ public:
+    /* Returns false if id is not equalized. */
+    bool find(uint32_t id,float *weight) const;
+    void set(uint32_t id,float weight);
+    void clear(uint32_t id);
+
+ private:
+    /* By ID slot (InternTable::index_of); NONE if unset. */
+    std::vector<uint32_t> ids;
+    std::vector<float> weights;
+};
+
+/**
+ * A merged view of all NodeB reports that arrived since the previous
+ * merge.  Per-slice metrics are summed across NodeBs into rows keyed by
+ * interned slice ID, and available_prbs is the sum of each NodeB's PRB
+ * capacity over its report period (period_ms * 2 * available_dl_prbs).
+ */
+class MergedKpmReport {
+ public:
+    MergedKpmReport()
+	: nodebs(0),period_ms(0),available_prbs(0),max_dl_prbs(0),
+	  shared_dl_bytes(0),shared_weight(0.0f),shared_slices(0) {};
+
+    void clear();
+    /* Returns the row for slice_id, adding a zeroed row if needed. */
+    size_t slice_row(uint32_t slice_id);
+    ssize_t find_slice(uint32_t slice_id) const;
+
+    int nodebs;
+    /* The longest report period among the merged NodeBs. */
+    long period_ms;
+    uint64_t available_prbs;
+    /* Over the equalized slices (see SliceWeights). */
+    uint64_t max_dl_prbs;
+    /* Totals over the slices in the shared byte split. */
+    uint64_t shared_dl_bytes;
+    float shared_weight;
+    int shared_slices;
+    std::vector<uint32_t> slice_id;
+    e2sm::kpm::EntityMetricsTable slices;
+    std::vector<std::pair<uint32_t,e2sm::kpm::entity_metrics_t>> samples;
+
+ private:
+    /* Slice ID slot (InternTable::index_of) to row + 1. */
+    std::vector<uint32_t> slice_index;
+};
+
+/**
+ * Holds per-NodeB KPM state in shards keyed by the same meid hash as
+ * the inbound Pipeline, so each pipeline worker only ever touches its
+ * own shard.  A shard's mutex is contended only by its worker and by
+ * merge(), never by the App resource lock.
+ */
+class KpmAggregator {
+ public:
+    KpmAggregator()
+	: shards() {};
+    virtual ~KpmAggregator();
+
+    void init(int num_shards);
+    void publish(int shard,const std::string& meid,
+		 e2sm::kpm::KpmReport *report);
+    bool merge(MergedKpmReport& merged,const SliceWeights& weights);
+    void forget(const std::string& meid);
+
+ private:
+    class Shard {
+     public:
+	std::mutex mutex;
+	std::map<std::string,NodeBKpmState> nodebs;
+    };
+
+    std::vector<Shard *> shards;
+};
+
+}
+
+#endif /* _NEXRAN_AGGREGATOR_H_ */
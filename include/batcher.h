@@ -0,0 +1,94 @@
+#ifndef _NEXRAN_BATCHER_H_
+#define _NEXRAN_BATCHER_H_
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+
+#include "rapidjson/prettywriter.h"
+
+#include "e2ap_trace.h"
+
+namespace nexran {
+
+class ControlBatcherHandler {
+ public:
+    virtual ~ControlBatcherHandler() = default;
+    /* Sends one SliceConfigRequest to meid carrying each slice's share. */
+    virtual void send_slice_configs(const std::string& meid,
+				    const std::map<std::string,int>& shares) = 0;
+};
+
+/**
+ * Coalesces slice configuration changes bound for the same NodeB.
+ * Each submit() queues a slice's new share on its NodeB's batch,
+ * replacing any share still queued for that slice; a batch is sent as
+ * a single SliceConfigRequest once it has waited for the flush window,
+ * or as soon as it holds max_batch slices.  Callers that send any other
+ * control to a NodeB must flush() it first, so that the NodeB sees
+ * changes in the order they were made.
+ */
+class ControlBatcher {
+ public:
+    ControlBatcher(ControlBatcherHandler *handler_)
+	: handler(handler_),window_ms(0),max_batch(0),running(false),
+	  should_stop(false),thread(NULL),submitted(0),superseded(0),
+	  requests(0),configs(0) {};
+    virtual ~ControlBatcher() { stop(); };
+
+    /* A window_ms of 0 disables batching; callers then send directly. */
+    bool start(int window_ms_,int max_batch_);
+    void stop();
+    bool is_enabled() { return running.load(std::memory_order_acquire); };
+    /*
+     * Sends the change directly once the batcher has stopped, so that a
+     * caller that saw is_enabled() just before stop() loses nothing.
+     */
+    void submit(const std::string& meid,const std::string& slice,int share);
+    void flush(const std::string& meid);
+    void flush_all();
+    void serialize(rapidjson::Writer<rapidjson::StringBuffer>& writer);
+
+ private:
+    class Batch {
+     public:
+	std::map<std::string,int> shares;
+	std::chrono::steady_clock::time_point deadline;
+	/* The first traced change in the batch; it is sent in that trace. */
+	e2ap::TraceContext trace;
+    };
+
+    void flusher();
+    /* Caller must hold send_mutex. */
+    void send(const std::string& meid,Batch& batch);
+
+    ControlBatcherHandler *handler;
+    int window_ms;
+    int max_batch;
+    /*
+     * Cleared under mutex, so that submit() either queues before the
+     * final flush or sends directly.
+     */
+    std::atomic<bool> running;
+    bool should_stop;
+    std::thread *thread;
+    /* Serializes sends, so that batches to a NodeB leave in order. */
+    std::mutex send_mutex;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<std::string,Batch> batches;
+
+    std::atomic<uint64_t> submitted;
+    std::atomic<uint64_t> superseded;
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> configs;
+};
+
+}
+
+#endif /* _NEXRAN_BATCHER_H_ */
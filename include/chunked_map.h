@@ -0,0 +1,208 @@
+#ifndef _NEXRAN_CHUNKED_MAP_H_
+#define _NEXRAN_CHUNKED_MAP_H_
+
+#include <string>
+#include <map>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <iterator>
+#include <cstddef>
+
+namespace nexran {
+
+/**
+ * An ordered map from names to values, held as a sorted run of small
+ * std::map chunks behind shared_ptrs.  Copying the map copies only the
+ * chunk pointers, and a copy shares every chunk with its source until
+ * one of them writes it; a write copies just the one chunk it touches
+ * if anything else still holds it.  So a snapshot can keep an old copy
+ * while the writer changes a single entry for O(CHUNK + chunks) work,
+ * instead of copying the whole map.
+ *
+ * A const ChunkedMap is safe to read from any thread; the writer must
+ * be the only thread holding its non-const instance.
+ */
+template <typename V>
+class ChunkedMap {
+ public:
+    typedef std::map<std::string,V> Chunk;
+    /* Chunks are split in two when they grow past twice this. */
+    static const size_t CHUNK = 64;
+
+    ChunkedMap()
+	: count_(0) {};
+
+    size_t size() const { return count_; };
+    bool empty() const { return count_ == 0; };
+
+    const V *find(const std::string& key) const
+    {
+	if (chunks.empty())
+	    return NULL;
+	const Chunk& chunk = *chunks[chunk_of(key)];
+	auto it = chunk.find(key);
+	return (it == chunk.end()) ? NULL : &it->second;
+    };
+    size_t count(const std::string& key) const
+    {
+	return find(key) ? 1 : 0;
+    };
+
+    /* Inserts key, or replaces its value. */
+    void set(const std::string& key,const V& value)
+    {
+	if (chunks.empty())
+	    chunks.push_back(std::make_shared<Chunk>());
+	size_t i = chunk_of(key);
+	Chunk& chunk = writable(i);
+	auto it = chunk.find(key);
+	if (it != chunk.end()) {
+	    it->second = value;
+	    return;
+	}
+	chunk.emplace(key,value);
+	++count_;
+	if (chunk.size() > 2 * CHUNK) {
+	    std::shared_ptr<Chunk> upper = std::make_shared<Chunk>();
+	    auto mid = std::next(chunk.begin(),chunk.size() / 2);
+	    upper->insert(mid,chunk.end());
+	    chunk.erase(mid,chunk.end());
+	    chunks.insert(chunks.begin() + i + 1,upper);
+	}
+    };
+    /* Returns false if key was not present. */
+    bool erase(const std::string& key)
+    {
+	if (chunks.empty())
+	    return false;
+	size_t i = chunk_of(key);
+	if (chunks[i]->count(key) < 1)
+	    return false;
+	Chunk& chunk = writable(i);
+	chunk.erase(key);
+	--count_;
+	if (chunk.empty())
+	    chunks.erase(chunks.begin() + i);
+	return true;
+    };
+    void clear()
+    {
+	chunks.clear();
+	count_ = 0;
+    };
+
+    /*
+     * Calls fn(key,value) for each entry whose key is greater than
+     * after (or for every entry, if after is empty), in key order,
+     * until fn returns false.
+     */
+    template <typename F>
+    void visit(const std::string& after,F fn) const
+    {
+	if (chunks.empty())
+	    return;
+	size_t i = after.empty() ? 0 : chunk_of(after);
+	for ( ; i < chunks.size(); ++i) {
+	    const Chunk& chunk = *chunks[i];
+	    auto it = after.empty() ? chunk.begin() : chunk.upper_bound(after);
+	    for ( ; it != chunk.end(); ++it)
+		if (!fn(it->first,it->second))
+		    return;
+	}
+    };
+    template <typename F>
+    void visit(F fn) const
+    {
+	visit(std::string(),fn);
+    };
+
+    /*
+     * Calls removed(key) for each key in from but not in to, and
+     * added(key) for each key in to but not in from, in key order.
+     * Chunks the two maps still share are skipped without being
+     * walked, so diffing a copy against its source after a few writes
+     * costs about as much as the writes did.
+     */
+    template <typename F,typename G>
+    static void diff(const ChunkedMap& from,const ChunkedMap& to,
+		     F removed,G added)
+    {
+	Cursor a(from),b(to);
+
+	while (!a.done() || !b.done()) {
+	    if (!a.done() && !b.done() && a.at_start() && b.at_start()
+		&& a.chunk() == b.chunk()) {
+		a.skip();
+		b.skip();
+	    }
+	    else if (b.done() || (!a.done() && a.key() < b.key())) {
+		removed(a.key());
+		a.next();
+	    }
+	    else if (a.done() || b.key() < a.key()) {
+		added(b.key());
+		b.next();
+	    }
+	    else {
+		a.next();
+		b.next();
+	    }
+	}
+    };
+
+ private:
+    class Cursor {
+     public:
+	Cursor(const ChunkedMap& map_)
+	    : map(map_),i(0)
+	{
+	    if (!done())
+		it = map.chunks[0]->begin();
+	};
+	bool done() const { return i >= map.chunks.size(); };
+	bool at_start() const { return it == map.chunks[i]->begin(); };
+	const Chunk *chunk() const { return map.chunks[i].get(); };
+	const std::string& key() const { return it->first; };
+	void next()
+	{
+	    if (++it == map.chunks[i]->end())
+		skip();
+	};
+	void skip()
+	{
+	    if (++i < map.chunks.size())
+		it = map.chunks[i]->begin();
+	};
+
+     private:
+	const ChunkedMap& map;
+	size_t i;
+	typename Chunk::const_iterator it;
+    };
+
+    /* The last chunk whose first key is not greater than key, or 0. */
+    size_t chunk_of(const std::string& key) const
+    {
+	auto it = std::upper_bound(
+	    chunks.begin() + 1,chunks.end(),key,
+	    [](const std::string& k,const std::shared_ptr<Chunk>& c) {
+		return k < c->begin()->first;
+	    });
+	return (it - chunks.begin()) - 1;
+    };
+    /* Copies chunk i first if any other map or snapshot shares it. */
+    Chunk& writable(size_t i)
+    {
+	if (chunks[i].use_count() > 1)
+	    chunks[i] = std::make_shared<Chunk>(*chunks[i]);
+	return *chunks[i];
+    };
+
+    std::vector<std::shared_ptr<Chunk>> chunks;
+    size_t count_;
+};
+
+}
+
+#endif /* _NEXRAN_CHUNKED_MAP_H_ */
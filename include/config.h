@@ -25,6 +25,28 @@ class Config {
 	ADMIN_HOST,
 	ADMIN_PORT,
 	RMR_NOWAIT,
+	PIPELINE_WORKERS,
+	PIPELINE_QUEUE_SIZE,
+	PIPELINE_OVERLOAD_POLICY,
+	KPM_DECODER,
+	E2_CONTROL_TIMEOUT,
+	E2_SUBSCRIPTION_TIMEOUT,
+	E2_REQUEST_RETRIES,
+	E2_MAX_CONTROLS,
+	E2_MAX_SUBSCRIPTIONS,
+	CONTROL_BATCH_WINDOW,
+	CONTROL_BATCH_SIZE,
+	EVENT_RING_SIZE,
+	EVENT_MAX_SUBSCRIBERS,
+	TRACE_RING_SIZE,
+	PDU_TRACE_SAMPLE,
+	PDU_TRACE_FORMAT,
+	PDU_TRACE_FILE,
+	PDU_TRACE_PROCEDURES,
+	PDU_TRACE_MEIDS,
+	UE_HISTORY_LENGTH,
+	UE_HISTORY_MAX_UES,
+	UE_HISTORY_IDLE,
 	__MAX__
     };
     enum ItemType {
@@ -0,0 +1,139 @@
+#ifndef _NEXRAN_EVENTS_H_
+#define _NEXRAN_EVENTS_H_
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+
+#include "rapidjson/prettywriter.h"
+
+namespace nexran {
+
+/**
+ * One consumer of the event stream, e.g. a northbound client holding
+ * an open text/event-stream response.  Only the EventStream's writer
+ * thread calls these.
+ */
+class EventSubscriber {
+ public:
+    virtual ~EventSubscriber() = default;
+    /* Writes frames; returns false once the consumer has gone away. */
+    virtual bool write(const std::string& frames) = 0;
+    virtual void close() = 0;
+};
+
+/**
+ * Fans compact JSON events (KPM metrics, share changes) out to any
+ * number of subscribers.  Each subscriber has a bounded, lock-free ring
+ * of pending frames, which a single writer thread drains.  publish()
+ * takes no lock: it loads an immutable snapshot of the subscriber list
+ * and pushes onto the rings, so publishers on different threads (the
+ * pipeline shards, the equalizer) never wait on each other or on a
+ * client.  A subscriber whose ring overflows is dropped rather than
+ * slowing the publisher.  Frames are in server-sent events format, and
+ * shared by every ring; event ids are unique, and each subscriber sees
+ * a publisher's events in the order it published them.
+ */
+class EventStream {
+ public:
+    typedef enum {
+	KpmEvent = 0,
+	ShareEvent,
+	__END__
+    } EventType;
+    static const unsigned ALL_EVENTS = (1u << EventType::__END__) - 1;
+
+    EventStream()
+	: ring_size(0),max_subscribers(0),running(false),should_stop(false),
+	  thread(NULL),rings(std::make_shared<const Rings>()),dirty(false),
+	  waiting(false),next_id(0),published(0),delivered(0),dropped(0) {
+	for (int i = 0; i < EventType::__END__; ++i)
+	    wanted[i] = 0;
+    };
+    virtual ~EventStream() { stop(); };
+
+    static const char *type_to_string(EventType type);
+    /* Parses a comma-separated list of event types into a mask. */
+    static bool types_from_string(const std::string& s,unsigned *types);
+
+    bool start(int ring_size_,int max_subscribers_);
+    void stop();
+    /* Whether subscribe() would currently succeed. */
+    bool accepting();
+    /* Takes ownership of sub; returns false (and deletes it) if full. */
+    bool subscribe(EventSubscriber *sub,unsigned types);
+    /* Whether anyone wants type, so publishers can skip building it. */
+    bool wants(EventType type) {
+	return wanted[type].load(std::memory_order_relaxed) > 0;
+    };
+    void publish(EventType type,const std::string& data);
+    void serialize(rapidjson::Writer<rapidjson::StringBuffer>& writer);
+
+ private:
+    /*
+     * A bounded multi-producer/single-consumer ring of frames, with a
+     * sequence number per cell like MessageRing.  Capacity is rounded
+     * up to a power of two.  Any thread may push; only the writer
+     * thread pops.
+     */
+    class Ring {
+     public:
+	Ring(EventSubscriber *sub_,unsigned types_,size_t size);
+
+	bool try_push(const std::shared_ptr<const std::string>& frame);
+	bool try_pop(std::shared_ptr<const std::string>& frame);
+
+	EventSubscriber *sub;
+	unsigned types;
+	std::atomic<bool> overflowed;
+
+     private:
+	struct Cell {
+	    std::atomic<size_t> sequence;
+	    std::shared_ptr<const std::string> frame;
+	};
+
+	size_t mask;
+	std::unique_ptr<Cell[]> cells;
+	alignas(64) std::atomic<size_t> enqueue_pos;
+	alignas(64) size_t dequeue_pos;
+    };
+    /*
+     * Replaced, never modified, under mutex; publishers atomic_load it.
+     * A removed ring lives on until no publisher still holds it.
+     */
+    typedef std::vector<std::shared_ptr<Ring>> Rings;
+
+    void writer_loop();
+    void remove(const std::shared_ptr<Ring>& ring,const char *why);
+
+    int ring_size;
+    int max_subscribers;
+    bool running;
+    bool should_stop;
+    std::thread *thread;
+    /* Serializes subscribe/remove, and the writer's sleep. */
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::shared_ptr<const Rings> rings;
+    /* Set by publishers; the writer only needs waking if waiting. */
+    std::atomic<bool> dirty;
+    std::atomic<bool> waiting;
+    std::atomic<uint64_t> next_id;
+    std::atomic<int> wanted[EventType::__END__];
+
+    std::atomic<uint64_t> published;
+    std::atomic<uint64_t> delivered;
+    std::atomic<uint64_t> dropped;
+};
+
+}
+
+#endif /* _NEXRAN_EVENTS_H_ */
@@ -4,9 +4,16 @@
 #include <string>
 #include <list>
 #include <map>
+#include <set>
+#include <memory>
+#include <vector>
 #include <mutex>
 #include <condition_variable>
 #include <thread>
+#include <atomic>
+#include <chrono>
+#include <queue>
+#include <functional>
 #include <cstring>
 #include <cstdint>
 #include <cstdio>
@@ -19,10 +26,17 @@
 
 #include "restserver.h"
 #include "config.h"
+#include "pipeline.h"
+#include "batcher.h"
+#include "events.h"
+#include "aggregator.h"
+#include "ue_history.h"
+#include "chunked_map.h"
 #include "e2ap.h"
 #include "e2sm.h"
 #include "e2sm_nexran.h"
 #include "e2sm_kpm.h"
+#include "e2sm_intern.h"
 
 namespace nexran {
 
@@ -40,13 +54,70 @@ class AppError : public RequestError {
 
 class AbstractResource {
  public:
+    /* Serializes one resource state; see get_renderer(). */
+    typedef std::function<std::shared_ptr<const std::string>()> Renderer;
+
+    AbstractResource()
+	: version(next_version()),fragment_version(0) {};
     virtual ~AbstractResource() = default;
     virtual std::string& getName() = 0;
     virtual void serialize(rapidjson::Writer<rapidjson::StringBuffer>& writer) {};
     virtual bool update(rapidjson::Document& d,
 			AppError **ae) { return false; };
+
+    /*
+     * Anything that changes what serialize() writes must call this.
+     * Versions are unique across resources, so a resource deleted and
+     * re-created under the same name never matches its old fragment.
+     */
+    void invalidate() { version = next_version(); };
+    uint64_t get_version() { return version; };
+    /*
+     * Returns a function that yields this resource's serialization as
+     * of now, and that may be called later without App::mutex.  By
+     * default it serializes up front; a resource whose serialization
+     * grows with its bindings may instead capture immutable state and
+     * leave the work to whichever reader first needs it.  Caller must
+     * hold App::mutex.
+     */
+    virtual Renderer get_renderer()
+    {
+	std::shared_ptr<const std::string> json = get_fragment();
+	return [json]() { return json; };
+    };
+    /*
+     * Returns the cached serialization, re-serializing only if the
+     * resource was invalidated since the last call; the same pointer
+     * comes back until then.  Caller must hold App::mutex.
+     */
+    std::shared_ptr<const std::string> get_fragment()
+    {
+	if (!fragment || fragment_version != version) {
+	    rapidjson::StringBuffer sb;
+	    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+	    serialize(writer);
+	    fragment = std::make_shared<const std::string>(
+		sb.GetString(),sb.GetSize());
+	    fragment_version = version;
+	}
+	return fragment;
+    };
+
+ private:
+    static uint64_t next_version()
+    {
+	static std::atomic<uint64_t> next(1);
+	return next++;
+    };
+
+    uint64_t version;
+    uint64_t fragment_version;
+    std::shared_ptr<const std::string> fragment;
 };
 
+/* The names of the resources bound to one, mapped to their interned IDs. */
+typedef ChunkedMap<uint32_t> BoundNames;
+
 typedef enum {
     STRING = 0,
     INT,
@@ -182,31 +253,49 @@ class Ue : public Resource<Ue> {
     static const bool propertyErrorImmediateAbort = false;
 
     Ue(const std::string& imsi_)
-	: imsi(imsi_) {};
+	: imsi(imsi_),id(e2sm::InternTable::NONE),
+	  bound_slice(e2sm::InternTable::NONE) {};
     Ue(const std::string& imsi_,const std::string& tmsi_,
        const std::string& crnti_)
-	: imsi(imsi_),tmsi(tmsi_),crnti(crnti_),bound_slice("") {};
+	: imsi(imsi_),tmsi(tmsi_),crnti(crnti_),
+	  id(e2sm::InternTable::NONE),
+	  bound_slice(e2sm::InternTable::NONE) {};
     virtual ~Ue() = default;
 
     std::string& getName() { return imsi; }
+    /* The interned IMSI; NONE until App::add commits the UE. */
+    uint32_t getId() { return id; }
+    /* Returns false if the intern table is full. */
+    bool intern_id() {
+	id = e2sm::imsis().intern(imsi);
+	return id != e2sm::InternTable::NONE;
+    };
+    void release_id() {
+	if (id != e2sm::InternTable::NONE)
+	    e2sm::imsis().release(id);
+	id = e2sm::InternTable::NONE;
+    };
     void serialize(rapidjson::Writer<rapidjson::StringBuffer>& writer);
-    static Ue *create(rapidjson::Document& d,AppError **ae);
+    static Ue *create(const rapidjson::Value& d,AppError **ae);
     bool update(rapidjson::Document& d,AppError **ae);
     bool is_bound() {
-	return !bound_slice.empty();
+	return bound_slice != e2sm::InternTable::NONE;
     };
-    std::string &get_bound_slice() {
+    /* The interned name of the bound slice, or NONE. */
+    uint32_t get_bound_slice() {
 	return bound_slice;
     };
-    bool bind_slice(std::string &slice_name) {
+    bool bind_slice(uint32_t slice_id) {
 	if (is_bound())
 	    return false;
-	bound_slice = slice_name;
+	bound_slice = slice_id;
+	return true;
     };
     bool unbind_slice() {
 	if (!is_bound())
 	    return false;
-	bound_slice.clear();
+	bound_slice = e2sm::InternTable::NONE;
+	return true;
     };
 
  private:
@@ -214,16 +303,26 @@ class Ue : public Resource<Ue> {
     std::string tmsi;
     std::string crnti;
     bool connected;
-    std::string bound_slice;
+    uint32_t id;
+    uint32_t bound_slice;
 };
 
 class AllocationPolicy {
  public:
     typedef enum {
 	Proportional = 1,
+	WeightedFair,
+	MinMaxGuarantee,
+	PrbTarget,
+	__END__
     } Type;
 
     static std::map<Type,const char *> type_to_string;
+    /*
+     * Creates a policy from an allocation_policy JSON object, by looking
+     * up its "type" in the policy registry (src/policy.cc).
+     */
+    static AllocationPolicy *create(const rapidjson::Value& obj,AppError **ae);
 
     virtual ~AllocationPolicy() = default;
     virtual const char *getName() = 0;
@@ -232,9 +331,15 @@ class AllocationPolicy {
     virtual bool update(const rapidjson::Value& obj,AppError **ae) = 0;
 };
 
+/*
+ * The base of all share-based policies: the NodeB scheduler only
+ * understands proportional shares, so every policy type ends up as a
+ * share, and they differ in how the equalizer moves it (see the
+ * PolicyKernel specializations in src/equalizer.cc).
+ */
 class ProportionalAllocationPolicy : public AllocationPolicy {
  public:
-    ProportionalAllocationPolicy(int share_,bool auto_equalize_ = false,
+    ProportionalAllocationPolicy(int share_ = 512,bool auto_equalize_ = false,
 				 bool throttle_ = false,int throttle_threshold_ = -1,
 				 int throttle_period_ = 1800,int throttle_share_ = 128)
 	: share(share_),auto_equalize(auto_equalize_),
@@ -242,7 +347,7 @@ class ProportionalAllocationPolicy : public AllocationPolicy {
 	  throttle_period(throttle_period_),throttle_share(throttle_share_),
 	  is_throttling(false),throttle_end(0),throttle_saved_share(-1),
 	  metrics(throttle_period_) {};
-    ~ProportionalAllocationPolicy() = default;
+    virtual ~ProportionalAllocationPolicy() = default;
 
     const char *getName() { return name; };
     int getShare() { return share; };
@@ -255,31 +360,29 @@ class ProportionalAllocationPolicy : public AllocationPolicy {
     bool isAutoEqualized() { return auto_equalize; }
     bool isThrottled() { return throttle; };
     bool isThrottling() { return is_throttling; };
-    int maybeEndThrottling();
-    int maybeStartThrottling();
+    int maybeEndThrottling(time_t now);
+    int maybeStartThrottling(time_t now);
     e2sm::kpm::MetricsIndex& getMetrics() { return metrics; };
     const AllocationPolicy::Type getType() { return AllocationPolicy::Type::Proportional; }
     void serialize(rapidjson::Writer<rapidjson::StringBuffer>& writer)
     {
 	writer.StartObject();
 	writer.String("type");
-	writer.String("proportional");
-	writer.String("share");
-	writer.Int(share);
-	writer.String("auto_equalize");
-	writer.Bool(auto_equalize);
-	writer.String("throttle");
-	writer.Bool(throttle);
-	writer.String("throttle_threshold");
-	writer.Int(throttle_threshold);
-	writer.String("throttle_period");
-	writer.Int(throttle_period);
-	writer.String("throttle_share");
-	writer.Int(throttle_share);
+	writer.String(getName());
+	serialize_properties(writer);
 	writer.EndObject();
     };
     bool update(const rapidjson::Value& obj,AppError **ae);
 
+ protected:
+    virtual void serialize_properties(rapidjson::Writer<rapidjson::StringBuffer>& writer);
+    /* Validates the subclass properties in obj, before anything changes. */
+    virtual bool validate_properties(const rapidjson::Value& obj,AppError **ae)
+    {
+	return true;
+    };
+    virtual void update_properties(const rapidjson::Value& obj) {};
+
  private:
     static constexpr const char *name = "proportional";
 
@@ -296,6 +399,87 @@ class ProportionalAllocationPolicy : public AllocationPolicy {
     e2sm::kpm::MetricsIndex metrics;
 };
 
+/*
+ * Equalizes downlink bytes in proportion to each slice's weight, rather
+ * than evenly.
+ */
+class WeightedFairAllocationPolicy : public ProportionalAllocationPolicy {
+ public:
+    WeightedFairAllocationPolicy(int share_ = 512,int weight_ = 1)
+	: ProportionalAllocationPolicy(share_,true),weight(weight_) {};
+    ~WeightedFairAllocationPolicy() = default;
+
+    const char *getName() { return name; };
+    const AllocationPolicy::Type getType() { return AllocationPolicy::Type::WeightedFair; }
+    int getWeight() { return weight; };
+
+ protected:
+    void serialize_properties(rapidjson::Writer<rapidjson::StringBuffer>& writer);
+    bool validate_properties(const rapidjson::Value& obj,AppError **ae);
+    void update_properties(const rapidjson::Value& obj);
+
+ private:
+    static constexpr const char *name = "weighted_fair";
+
+    int weight;
+};
+
+/*
+ * Equalizes like proportional, but keeps the share within
+ * [min_share,max_share] instead of the default [64,1024].
+ */
+class MinMaxGuaranteeAllocationPolicy : public ProportionalAllocationPolicy {
+ public:
+    MinMaxGuaranteeAllocationPolicy(int share_ = 512,int min_share_ = 64,
+				    int max_share_ = 1024)
+	: ProportionalAllocationPolicy(share_,true),
+	  min_share(min_share_),max_share(max_share_) {};
+    ~MinMaxGuaranteeAllocationPolicy() = default;
+
+    const char *getName() { return name; };
+    const AllocationPolicy::Type getType() { return AllocationPolicy::Type::MinMaxGuarantee; }
+    int getMinShare() { return min_share; };
+    int getMaxShare() { return max_share; };
+
+ protected:
+    void serialize_properties(rapidjson::Writer<rapidjson::StringBuffer>& writer);
+    bool validate_properties(const rapidjson::Value& obj,AppError **ae);
+    void update_properties(const rapidjson::Value& obj);
+
+ private:
+    static constexpr const char *name = "min_max";
+
+    int min_share;
+    int max_share;
+};
+
+/*
+ * Moves the share so that the slice's downlink PRB usage approaches
+ * target_prb_pct percent of the available PRBs, independent of the
+ * other slices.
+ */
+class PrbTargetAllocationPolicy : public ProportionalAllocationPolicy {
+ public:
+    PrbTargetAllocationPolicy(int share_ = 512,int target_prb_pct_ = -1)
+	: ProportionalAllocationPolicy(share_,true),
+	  target_prb_pct(target_prb_pct_) {};
+    ~PrbTargetAllocationPolicy() = default;
+
+    const char *getName() { return name; };
+    const AllocationPolicy::Type getType() { return AllocationPolicy::Type::PrbTarget; }
+    int getTargetPrbPct() { return target_prb_pct; };
+
+ protected:
+    void serialize_properties(rapidjson::Writer<rapidjson::StringBuffer>& writer);
+    bool validate_properties(const rapidjson::Value& obj,AppError **ae);
+    void update_properties(const rapidjson::Value& obj);
+
+ private:
+    static constexpr const char *name = "prb_target";
+
+    int target_prb_pct;
+};
+
 class Slice : public Resource<Slice> {
  public:
     static std::map<std::string,JsonTypeMap> propertyTypes;
@@ -306,40 +490,82 @@ class Slice : public Resource<Slice> {
     static const bool propertyErrorImmediateAbort = false;
 
     Slice(const std::string& name_)
-	: name(name_),
+	: name(name_),id(e2sm::InternTable::NONE),
 	  allocation_policy(new ProportionalAllocationPolicy(512)) {};
     Slice(const std::string& name_,AllocationPolicy *allocation_policy_)
-	: name(name_),
+	: name(name_),id(e2sm::InternTable::NONE),
 	  allocation_policy(allocation_policy_) {};
     virtual ~Slice() = default;
 
     std::string& getName() { return name; }
+    /*
+     * The interned name, shared with KPM reports; NONE until App::add
+     * commits the slice.
+     */
+    uint32_t getId() { return id; }
+    /* Returns false if the intern table is full. */
+    bool intern_id() {
+	id = e2sm::slice_names().intern(name);
+	return id != e2sm::InternTable::NONE;
+    };
+    void release_id() {
+	if (id != e2sm::InternTable::NONE)
+	    e2sm::slice_names().release(id);
+	id = e2sm::InternTable::NONE;
+    };
     AllocationPolicy *getPolicy() { return allocation_policy; }
     void serialize(rapidjson::Writer<rapidjson::StringBuffer>& writer);
+    /*
+     * Captures the bound IMSIs by sharing ue_names' chunks, so a bind
+     * costs a snapshot O(ues / CHUNK), not a re-serialization.
+     */
+    Renderer get_renderer();
     static Slice *create(rapidjson::Document& d,AppError **ae);
     bool update(rapidjson::Document& d,AppError **ae);
     bool bind_ue(Ue *ue) {
-	if (ues.count(ue->getName()) > 0)
+	if (ues.count(ue->getId()) > 0)
 	    return false;
-	ues[std::string(ue->getName())] = ue;
+	ues[ue->getId()] = ue;
+	ue_names.set(ue->getName(),ue->getId());
+	invalidate();
 	return true;
     };
-    bool unbind_ue(std::string& imsi) {
-	if (ues.count(imsi) < 1)
+    bool unbind_ue(uint32_t imsi_id) {
+	auto it = ues.find(imsi_id);
+	if (it == ues.end())
 	    return false;
-	ues.erase(imsi);
+	ue_names.erase(it->second->getName());
+	ues.erase(it);
+	invalidate();
 	return true;
     };
     void unbind_all_ues() {
 	for (auto it = ues.begin(); it != ues.end(); ++it)
 	    it->second->unbind_slice();
 	ues.clear();
+	ue_names.clear();
+	invalidate();
+    };
+    std::map<uint32_t,Ue *>& get_ues() {
+	return ues;
+    };
+    /* The bound UEs by IMSI, in IMSI order. */
+    const BoundNames& get_ue_names() {
+	return ue_names;
     };
 
  private:
+    static void serialize(rapidjson::Writer<rapidjson::StringBuffer>& writer,
+			  const std::string& name,const std::string& policy,
+			  const BoundNames& ue_names);
+    /* The allocation policy's JSON, or empty if there is none. */
+    std::string serialize_policy();
+
     std::string name;
+    uint32_t id;
     AllocationPolicy *allocation_policy;
-    std::map<std::string, Ue *> ues;
+    std::map<uint32_t,Ue *> ues;
+    BoundNames ue_names;
 };
 
 class NodeB : public Resource<NodeB> {
@@ -382,25 +608,34 @@ class NodeB : public Resource<NodeB> {
     static NodeB *create(rapidjson::Document& d,AppError **ae);
     bool update(rapidjson::Document& d,AppError **ae);
     bool bind_slice(Slice *slice) {
-	if (slices.count(slice->getName()) > 0)
+	if (slices.count(slice->getId()) > 0)
 	    return false;
-	slices[std::string(slice->getName())] = slice;
+	slices[slice->getId()] = slice;
+	slice_names.set(slice->getName(),slice->getId());
+	invalidate();
 	return true;
     };
-    bool unbind_slice(std::string& slice_name) {
-	if (slices.count(slice_name) < 1)
+    bool unbind_slice(uint32_t slice_id) {
+	auto it = slices.find(slice_id);
+	if (it == slices.end())
 	    return false;
-	slices.erase(slice_name);
+	slice_names.erase(it->second->getName());
+	slices.erase(it);
+	invalidate();
 	return true;
     };
-    bool is_slice_bound(std::string& slice_name) {
-	if (slices.count(slice_name) > 0)
+    bool is_slice_bound(uint32_t slice_id) {
+	if (slices.count(slice_id) > 0)
 	    return true;
 	return false;
     };
-    std::map<std::string,Slice *>& get_slices() {
+    std::map<uint32_t,Slice *>& get_slices() {
 	return slices;
     };
+    /* The bound slices by name, in name order. */
+    const BoundNames& get_slice_names() {
+	return slice_names;
+    };
 
  private:
     static const char *type_string_map[NodeB::Type::__END__];
@@ -413,7 +648,8 @@ class NodeB : public Resource<NodeB> {
     uint8_t id_len;
     bool connected;
     int total_prbs;
-    std::map<std::string,Slice *> slices;
+    std::map<uint32_t,Slice *> slices;
+    BoundNames slice_names;
 };
 
 class SliceMetrics {
@@ -426,12 +662,104 @@ class SliceMetrics {
     const Slice& slice;
 };
 
+/**
+ * Persistent auto-equalizer state.  Every slice with a share-based
+ * policy has an entry in a contiguous array, with its policy and kernel
+ * pointers cached, so a pass over a merged KPM report does no map
+ * lookups or RTTI.  The App keeps it current as slices are created,
+ * updated and deleted.  All methods must be called with the App mutex
+ * held.
+ */
+class EqualizerState {
+ public:
+    class Change {
+     public:
+	Slice *slice;
+	int old_share;
+	int new_share;
+    };
+
+    /* Per-pass totals over the slices that share the byte split. */
+    class Totals {
+     public:
+	uint64_t dl_bytes;
+	float weight;
+	uint64_t available_prbs;
+    };
+
+    /*
+     * A policy type's equalizer kernel: instantiations of the
+     * PolicyKernel template in src/equalizer.cc, indexed by
+     * AllocationPolicy::Type.
+     */
+    class Kernel {
+     public:
+	// Whether the slice takes part in the shared byte split.
+	bool shared;
+	float (*weight)(ProportionalAllocationPolicy *policy);
+	float (*factor)(ProportionalAllocationPolicy *policy,float weight,
+			const Totals& totals,uint64_t dl_bytes,uint64_t dl_prbs);
+	int (*clamp)(ProportionalAllocationPolicy *policy,int share);
+    };
+
+    EqualizerState()
+	: entries(),entry_pos(),weights(),pending(),pass_cost() {};
+    virtual ~EqualizerState() = default;
+
+    void add(Slice *slice);
+    void remove(Slice *slice);
+    void update(Slice *slice);
+    size_t size() { return entries.size(); };
+    /* For KpmAggregator::merge(); changes only under App::mutex. */
+    const SliceWeights& get_weights() { return weights; };
+    /*
+     * Applies report to the slice policies, and fills changes with each
+     * slice whose share changed.  The caller pushes the new shares out
+     * to the NodeBs.
+     */
+    void run(MergedKpmReport& report,std::vector<Change>& changes);
+    void serialize(rapidjson::Writer<rapidjson::StringBuffer>& writer);
+
+ private:
+    static const Kernel kernels[AllocationPolicy::Type::__END__];
+
+    class Entry {
+     public:
+	Slice *slice;
+	ProportionalAllocationPolicy *policy;
+	const Kernel *kernel;
+	float weight;
+    };
+
+    /* A slice whose share a pass may change; candidate is -1 if none. */
+    class Pending {
+     public:
+	Slice *slice;
+	ProportionalAllocationPolicy *policy;
+	int old_share;
+	int forced;
+	int candidate;
+    };
+
+    ssize_t find(uint32_t id);
+
+    std::vector<Entry> entries;
+    // Slice ID slot (InternTable::index_of) to index in entries + 1.
+    std::vector<uint32_t> entry_pos;
+    SliceWeights weights;
+    // Per-pass scratch.
+    std::vector<Pending> pending;
+    StageCounters pass_cost;
+};
+
 /*
  * This class tracks northbound requests that map to multiple requests
- * to different RAN nodes (NodeBs).  A watcher thread in the App looks
- * for completion/timeout and sends a response to the caller.  Note that
- * this does not handle the case where the caller disconnects before we
- * timeout; not our problem.
+ * to different RAN nodes (NodeBs).  The App's E2 response handlers
+ * resolve each request as its answer (or timeout) arrives, and the
+ * group responds to the caller as soon as the last one resolves, or at
+ * its deadline, whichever comes first.  Note that this does not handle
+ * the case where the caller disconnects before we timeout; not our
+ * problem.
  */
 class RequestGroup
 {
@@ -452,57 +780,185 @@ class RequestGroup
 	RequestState state;
     };
 
-    RequestGroup(std::shared_ptr<RequestContext> ctx_,int timeout_ = 8)
-	: ctx(ctx_),timeout(std::time(nullptr) + timeout_) {};
-    virtual ~RequestGroup() = default;
-
-    virtual bool add(std::shared_ptr<e2ap::Request> req) {
-	requests[req->instance_id] = new RequestStatus(req);
-    };
-    virtual void update(long instance_id,RequestState state) {
-	if (requests.count(instance_id) <= 0)
-	    return;
-	requests[instance_id]->state = state;
-    };
-    virtual bool is_done(int *succeeded,int *failed,int *pending) {
-	bool ret = true;
-	for (auto it = requests.begin(); it != requests.end(); ++it) {
-	    switch (it->second->state) {
-	    case PENDING:
-		if (pending)
-		    ++*pending;
-		ret = false;
-		break;
-	    case SUCCESS:
-		if (succeeded)
-		    ++*succeeded;
-		break;
-	    case FAILURE:
-		if (failed)
-		    ++*failed;
-		break;
-	    default:
-		break;
-	    }
-	}
-	return ret;
-    };
-    virtual bool is_expired() {
-	if (std::time(nullptr) > timeout)
-	    return true;
-	return false;
+    RequestGroup(std::shared_ptr<RequestContext> ctx_,
+		 std::chrono::milliseconds timeout_ = std::chrono::seconds(8))
+	: ctx(ctx_),deadline(std::chrono::steady_clock::now() + timeout_),
+	  outstanding(1),succeeded(0),failed(0),done(false) {};
+    virtual ~RequestGroup();
+
+    /* Adds req, which must not yet have been sent. */
+    virtual void add(std::shared_ptr<e2ap::Request> req);
+    /* Records a request to meid that could not be sent. */
+    virtual void add_unsent(const std::string& meid);
+    /*
+     * Resolves a request.  Returns true if that was the last one, in
+     * which case the group has responded.
+     */
+    virtual bool update(long instance_id,RequestState state);
+    /*
+     * Declares that no more requests will be added.  Returns true if
+     * they have all resolved already, in which case the group has
+     * responded.
+     */
+    virtual bool seal();
+    /*
+     * Responds now, with whatever has resolved so far; returns false if
+     * the group had already responded.
+     */
+    virtual bool finish();
+    /*
+     * Responds now with 503, e.g. because the App is stopping; returns
+     * false if the group had already responded.
+     */
+    virtual bool cancel();
+    virtual bool is_done(int *succeeded,int *failed,int *pending);
+    bool is_expired(std::chrono::steady_clock::time_point now) {
+	return now >= deadline;
     };
+    void get_pending(std::list<long>& instance_ids);
 
     std::shared_ptr<RequestContext> get_ctx() { return ctx; };
+    std::chrono::steady_clock::time_point get_deadline() { return deadline; };
 
  protected:
+    virtual void respond(bool cancelled = false);
+
     std::shared_ptr<RequestContext> ctx;
-    time_t timeout;
+    std::chrono::steady_clock::time_point deadline;
+    std::mutex mutex;
     std::map<long,RequestStatus *> requests;
+    std::list<std::string> unsent;
+    /* Unresolved requests, plus one until seal(). */
+    std::atomic<int> outstanding;
+    std::atomic<int> succeeded;
+    std::atomic<int> failed;
+    std::atomic<bool> done;
+};
+
+/**
+ * An immutable, versioned copy of the resource database, held as one
+ * JSON fragment per resource.  Writers, serialized by App::mutex,
+ * build the next snapshot by changing only the fragments and index
+ * entries of resources that changed; the maps are ChunkedMaps, so the
+ * rest is shared with the previous snapshot.  They publish it with an
+ * atomic shared_ptr store; readers serialize from whichever snapshot
+ * they loaded, without a lock.
+ */
+class DbSnapshot {
+ public:
+    class Fragment {
+     public:
+	/* A top-level member of the fragment, as its raw JSON value. */
+	class Field {
+	 public:
+	    std::string name;
+	    std::string json;
+	    rapidjson::Type type;
+	};
+	typedef std::vector<Field> Fields;
+
+	Fragment(AbstractResource::Renderer render,uint64_t source_,
+		 uint64_t version_)
+	    : source(source_),version(version_),
+	      state(std::make_shared<State>(render)) {};
+
+	/*
+	 * The resource's JSON, rendered on first use and then shared by
+	 * every snapshot holding this fragment.
+	 */
+	const std::string& json() const;
+	/*
+	 * The members of json(), split out on first use, so that a
+	 * fields= projection only copies them.
+	 */
+	const Fields& fields() const;
+
+	/* The resource version this fragment renders. */
+	uint64_t source;
+	/* The snapshot version that last changed this fragment. */
+	uint64_t version;
+
+     private:
+	class State {
+	 public:
+	    State(AbstractResource::Renderer render_)
+		: render(render_) {};
+	    AbstractResource::Renderer render;
+	    std::once_flag rendered;
+	    std::shared_ptr<const std::string> json;
+	    std::once_flag split;
+	    Fields fields;
+	};
+	std::shared_ptr<State> state;
+    };
+    typedef ChunkedMap<Fragment> Fragments;
+    /* Maps a resource name to the names of resources bound to it. */
+    typedef std::map<std::string,BoundNames> Index;
+    /* Maps a UE's IMSI to the name of the slice it is bound to. */
+    typedef ChunkedMap<std::string> ReverseIndex;
+    static const int NUM_TYPES = 3;
+
+    DbSnapshot()
+	: version(0),ues_by_slice(std::make_shared<const Index>()),
+	  slices_by_nodeb(std::make_shared<const Index>())
+    {
+	for (int i = 0; i < NUM_TYPES; ++i)
+	    versions[i] = 0;
+    };
+
+    const Fragment *find(int type,const std::string& name) const
+    {
+	return fragments[type].find(name);
+    };
+    static const BoundNames *lookup(const Index& index,
+				    const std::string& name)
+    {
+	auto it = index.find(name);
+	return (it == index.end()) ? NULL : &it->second;
+    };
+
+    uint64_t version;
+    /* Indexed by App::ResourceType. */
+    Fragments fragments[NUM_TYPES];
+    /* The snapshot version that last changed each type's map. */
+    uint64_t versions[NUM_TYPES];
+    /* Copied whole on change, but only one entry per bound resource. */
+    std::shared_ptr<const Index> ues_by_slice;
+    std::shared_ptr<const Index> slices_by_nodeb;
+    /* The inverse of ues_by_slice. */
+    ReverseIndex slice_of_ue;
+};
+
+/**
+ * Selects a page of a collection: the resources after cursor (in name
+ * order) that pass the filters, at most limit (if nonzero) of them,
+ * each projected onto fields (if any).
+ */
+class CollectionQuery {
+ public:
+    CollectionQuery()
+	: limit(0),bound(-1) {};
+
+    bool is_empty() const {
+	return limit == 0 && cursor.empty() && slice.empty() && nodeb.empty()
+	    && bound < 0 && fields.empty();
+    };
+
+    int limit;
+    std::string cursor;
+    /* UEs bound to this slice, or NodeBs it is bound to. */
+    std::string slice;
+    /* Slices bound to this NodeB. */
+    std::string nodeb;
+    /* UEs that are (1) or are not (0) bound to a slice; -1 for all. */
+    int bound;
+    std::set<std::string> fields;
 };
 
 class App
     : public xapp::Messenger,
+      public PipelineHandler,
+      public ControlBatcherHandler,
       public e2ap::AgentInterface,
       public e2sm::nexran::AgentInterface,
       public e2sm::kpm::AgentInterface
@@ -516,8 +972,11 @@ class App
 
     App(Config &config_, xAppSettings &settings_)
 	: e2ap(this),config(config_), settings(settings_),running(false),should_stop(false),
-	  rmr_thread(NULL),response_thread(NULL),
+	  rmr_thread(NULL),response_thread(NULL),equalizer_thread(NULL),
+	  equalizer_pending(false),
 	  xapp::Messenger(NULL,not config_[Config::ItemName::RMR_NOWAIT]->b),
+	  pipeline(this),batcher(this),group_timeout(std::chrono::seconds(8)),
+	  snapshot(std::make_shared<const DbSnapshot>()),
 	  nexran(new e2sm::nexran::NexRANModel(this)),
 	  kpm(new e2sm::kpm::KpmModel(this)) { };
     virtual ~App() = default;
@@ -525,6 +984,7 @@ class App
     virtual void start();
     virtual void stop();
     virtual void response_handler();
+    virtual void equalizer_handler();
 
 	// Register xApp in Appmgr
 	void register_xapp();
@@ -534,11 +994,18 @@ class App
     virtual void handle_rmr_message(
 	xapp::Message &msg,int mtype,int subid,int payload_len,
 	xapp::Msg_component &payload);
+    // PipelineHandler callback; invoked on a pipeline worker thread
+    virtual void handle_pipeline_message(PipelineMessage& msg);
+    // ControlBatcherHandler callback; must not take App locks
+    virtual void send_slice_configs(const std::string& meid,
+				    const std::map<std::string,int>& shares);
 
     // e2ap::RicAgentInterface util/handler functions
     bool send_message(const unsigned char *buf,ssize_t buf_len,
 		      int mtype,int subid,const std::string& meid,
 		      const std::string& xid);
+    bool send_message(e2ap::Message *m,int mtype,int subid,
+		      const std::string& meid,const std::string& xid);
     bool handle(e2ap::SubscriptionResponse *resp);
     bool handle(e2ap::SubscriptionFailure *resp);
     bool handle(e2ap::SubscriptionDeleteResponse *resp);
@@ -547,43 +1014,161 @@ class App
     bool handle(e2ap::ControlFailure *control);
     bool handle(e2ap::Indication *indication);
     bool handle(e2ap::ErrorIndication *ind);
+    bool handle_timeout(std::shared_ptr<e2ap::ControlRequest> req);
+    bool handle_timeout(std::shared_ptr<e2ap::SubscriptionRequest> req);
+    bool handle_timeout(std::shared_ptr<e2ap::SubscriptionDeleteRequest> req);
 
     // e2sm::nexran::AgentInterface handler functions
     bool handle(e2sm::nexran::SliceStatusIndication *ind);
     // e2sm::kpm::AgentInterface handler functions
     bool handle(e2sm::kpm::KpmIndication *ind);
+    bool autoequalize(MergedKpmReport& report);
 
+    std::shared_ptr<const DbSnapshot> get_snapshot() {
+	return std::atomic_load(&snapshot);
+    };
+    EventStream& get_events() { return events; };
     void serialize(ResourceType rt,
 		   rapidjson::Writer<rapidjson::StringBuffer>& writer);
     bool serialize(ResourceType rt,std::string& rname,
 		   rapidjson::Writer<rapidjson::StringBuffer>& writer,
 		   AppError **ae);
+    // Serialize from snap, e.g. one whose version the caller has checked.
+    void serialize(std::shared_ptr<const DbSnapshot> snap,ResourceType rt,
+		   rapidjson::Writer<rapidjson::StringBuffer>& writer);
+    void serialize(std::shared_ptr<const DbSnapshot> snap,ResourceType rt,
+		   const CollectionQuery& query,
+		   rapidjson::Writer<rapidjson::StringBuffer>& writer);
+    bool serialize(std::shared_ptr<const DbSnapshot> snap,ResourceType rt,
+		   std::string& rname,
+		   rapidjson::Writer<rapidjson::StringBuffer>& writer,
+		   AppError **ae);
+    void serialize_stats(rapidjson::Writer<rapidjson::StringBuffer>& writer);
+    void serialize_traces(rapidjson::Writer<rapidjson::StringBuffer>& writer,
+			  uint64_t trace_id);
+    void serialize_pdu_trace(rapidjson::Writer<rapidjson::StringBuffer>& writer);
+    bool update_pdu_trace(rapidjson::Document& d,AppError **ae);
+    bool serialize_ue_metrics(const std::string& imsi,size_t limit,
+			      rapidjson::Writer<rapidjson::StringBuffer>& writer,
+			      AppError **ae);
+    /*
+     * The mutating operations take an optional RequestGroup, in which
+     * they track the E2 requests they send; the caller then starts the
+     * group, which responds once the NodeBs have answered.
+     */
     bool add(ResourceType rt,AbstractResource *resource,
 	     rapidjson::Writer<rapidjson::StringBuffer>& writer,
-	     AppError **ae);
+	     AppError **ae,std::shared_ptr<RequestGroup> group = NULL);
     bool del(ResourceType rt,std::string& rname,
-	     AppError **ae);
+	     AppError **ae,std::shared_ptr<RequestGroup> group = NULL);
     bool create(std::shared_ptr<RequestContext> ctx,ResourceType rt,
 		rapidjson::Document& d);
     bool update(ResourceType rt,std::string& rname,
-		rapidjson::Document& d,AppError **ae);
+		rapidjson::Document& d,AppError **ae,
+		std::shared_ptr<RequestGroup> group = NULL);
 
     bool bind_slice_nodeb(std::string& slice_name,std::string& nodeb_name,
-			  AppError **ae);
+			  AppError **ae,
+			  std::shared_ptr<RequestGroup> group = NULL);
     bool unbind_slice_nodeb(std::string& slice_name,std::string& nodeb_name,
-			    AppError **ae);
+			    AppError **ae,
+			    std::shared_ptr<RequestGroup> group = NULL);
     bool bind_ue_slice(std::string& imsi,std::string& slice_name,
-		       AppError **ae);
+		       AppError **ae,
+		       std::shared_ptr<RequestGroup> group = NULL);
     bool unbind_ue_slice(std::string& imsi,std::string& slice_name,
-			 AppError **ae);
+			 AppError **ae,
+			 std::shared_ptr<RequestGroup> group = NULL);
+    bool bulk(rapidjson::Document& d,
+	      rapidjson::Writer<rapidjson::StringBuffer>& writer,
+	      AppError **ae,std::shared_ptr<RequestGroup> group = NULL);
+
+    void track_request(std::shared_ptr<RequestGroup> group,
+		       std::shared_ptr<e2ap::Request> req);
+    void start_group(std::shared_ptr<RequestGroup> group);
+    /*
+     * How long a group waits for its E2 requests: long enough for them
+     * to exhaust their retries and expire.
+     */
+    std::chrono::milliseconds get_group_timeout() { return group_timeout; };
 
     Config &config;
 	xAppSettings &settings;
 
  private:
+    /* Initial RMR payload size for sends that encode in place. */
+    static const int SEND_BUF_SIZE = 4096;
+
+    std::shared_ptr<unsigned char> get_meid_ref(const std::string& meid);
+    // Publish changes to db in a new snapshot; caller must hold mutex.
+    void publish(ResourceType rt,const std::list<std::string>& names);
+    void publish(ResourceType rt);
+    void resolve_request(long instance_id,RequestGroup::RequestState state);
+    void cancel_groups();
+    // Send E2 requests, tracking them in group if it is non-NULL.
+    int send_control(std::shared_ptr<e2sm::Control> control,
+		     const std::list<std::string>& meids,
+		     std::shared_ptr<RequestGroup> group);
+    bool send_control(std::shared_ptr<e2ap::ControlRequest> req,
+		      std::shared_ptr<RequestGroup> group);
+    bool send_subscription(std::shared_ptr<e2ap::SubscriptionRequest> req,
+			   std::shared_ptr<RequestGroup> group);
+    void publish_kpm_event(e2sm::kpm::KpmIndication *kind);
+    void publish_share_event(Slice *slice,int old_share,int new_share,
+			     const char *source);
+    void init_metrics();
+    void init_pdu_trace();
+    void map_ue_rntis(const std::string& meid,
+		      const std::list<e2sm::nexran::SliceStatus *>& statuses);
+    // Send slice's share to meids, via the batcher unless tracking.
+    void send_slice_config(Slice *slice,int share,
+			   const std::list<std::string>& meids,
+			   std::shared_ptr<RequestGroup> group);
+    // Maintain slice_index (by ID slot); caller must hold mutex.
+    void index_slice(Slice *slice) {
+	uint32_t slot = e2sm::InternTable::index_of(slice->getId());
+	if (slot >= slice_index.size())
+	    slice_index.resize(slot + 1,NULL);
+	slice_index[slot] = slice;
+    };
+    void unindex_slice(Slice *slice) {
+	uint32_t slot = e2sm::InternTable::index_of(slice->getId());
+	if (slot < slice_index.size() && slice_index[slot] == slice)
+	    slice_index[slot] = NULL;
+    };
+    Slice *get_slice_by_id(uint32_t slice_id) {
+	uint32_t slot = e2sm::InternTable::index_of(slice_id);
+	if (slot >= slice_index.size() || !slice_index[slot]
+	    || slice_index[slot]->getId() != slice_id)
+	    return NULL;
+	return slice_index[slot];
+    };
+
     std::thread *rmr_thread;
     std::thread *response_thread;
+    std::thread *equalizer_thread;
     bool should_stop;
+    Pipeline pipeline;
+    ControlBatcher batcher;
+    EventStream events;
+    /* Hot-path metrics; see init_metrics(). */
+    std::map<int,e2ap::Counter *> rmr_received;
+    e2ap::Counter *rmr_unsupported;
+    e2ap::Counter *rmr_queue_failures;
+    e2ap::Counter *kpm_indications;
+    e2ap::Histogram *kpm_handle_latency;
+    e2ap::Counter *equalizer_passes;
+    e2ap::Counter *equalizer_share_changes;
+    KpmAggregator kpm_aggregator;
+    UeHistory ue_history;
+    EqualizerState equalizer;
+    std::vector<EqualizerState::Change> equalizer_changes;
+    std::mutex equalizer_mutex;
+    std::condition_variable equalizer_cv;
+    bool equalizer_pending;
+    e2ap::TraceContext equalizer_trace;
+    std::mutex meid_cache_mutex;
+    std::map<std::string,std::shared_ptr<unsigned char>> meid_cache;
     e2ap::E2AP e2ap;
     e2sm::nexran::NexRANModel *nexran;
     e2sm::kpm::KpmModel *kpm;
@@ -591,8 +1176,26 @@ class App
     RestServer server;
     std::mutex mutex;
     std::condition_variable cv;
-    std::list<RequestGroup *> request_groups;
+    // Tracked E2 requests by instance ID, and group deadlines.
+    class GroupDeadlineLater {
+     public:
+	bool operator()(const std::shared_ptr<RequestGroup>& a,
+			const std::shared_ptr<RequestGroup>& b) const {
+	    return a->get_deadline() > b->get_deadline();
+	};
+    };
+    std::mutex request_mutex;
+    std::condition_variable request_cv;
+    std::map<long,std::shared_ptr<RequestGroup>> tracked_requests;
+    std::priority_queue<std::shared_ptr<RequestGroup>,
+			std::vector<std::shared_ptr<RequestGroup>>,
+			GroupDeadlineLater> group_deadlines;
+    std::chrono::milliseconds group_timeout;
     std::map<ResourceType,std::map<std::string,AbstractResource *>> db;
+    // What readers see of db; use atomic_load/atomic_store.
+    std::shared_ptr<const DbSnapshot> snapshot;
+    // Slices in db, indexed by interned name.
+    std::vector<Slice *> slice_index;
     std::map<ResourceType,const char *> rtype_to_label = {
 	{ ResourceType::NodeBResource, "nodeb" },
 	{ ResourceType::SliceResource, "slice" },
@@ -0,0 +1,270 @@
+#ifndef _NEXRAN_PIPELINE_H_
+#define _NEXRAN_PIPELINE_H_
+
+#include <atomic>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+#include "rmr/rmr.h"
+#include "rapidjson/prettywriter.h"
+
+namespace nexran {
+
+/**
+ * A copy of an inbound RMR message, detached from the RMR buffer so
+ * that the listener thread can hand it off and return to RMR.  The
+ * payload vector keeps its capacity across reuse, so once the ring
+ * slots have seen a message of a given size, copying into them does
+ * not allocate.  trace_id ties the message to the spans recorded while
+ * handling it (see e2ap_trace.h); zero if untraced.
+ */
+class PipelineMessage {
+ public:
+    PipelineMessage()
+	: mtype(-1),subid(-1),len(0),enqueue_ns(0),trace_id(0)
+    {
+	meid[0] = '\0';
+	xid[0] = '\0';
+    };
+
+    void set(int mtype_,int subid_,const char *meid_,const char *xid_,
+	     const unsigned char *buf,int len_,uint64_t trace_id_ = 0)
+    {
+	mtype = mtype_;
+	trace_id = trace_id_;
+	subid = subid_;
+	len = len_;
+	if (meid_)
+	    strncpy(meid,meid_,sizeof(meid) - 1);
+	else
+	    meid[0] = '\0';
+	meid[sizeof(meid) - 1] = '\0';
+	if (xid_)
+	    strncpy(xid,xid_,sizeof(xid) - 1);
+	else
+	    xid[0] = '\0';
+	xid[sizeof(xid) - 1] = '\0';
+	payload.assign(buf,buf + len_);
+    };
+
+    /* Moves msg into this message, giving msg our payload buffer. */
+    void take(PipelineMessage& msg)
+    {
+	mtype = msg.mtype;
+	subid = msg.subid;
+	len = msg.len;
+	enqueue_ns = msg.enqueue_ns;
+	trace_id = msg.trace_id;
+	memcpy(meid,msg.meid,sizeof(meid));
+	memcpy(xid,msg.xid,sizeof(xid));
+	payload.swap(msg.payload);
+    };
+
+    int mtype;
+    int subid;
+    int len;
+    char meid[RMR_MAX_MEID + 1];
+    char xid[RMR_MAX_XID + 1];
+    std::vector<unsigned char> payload;
+    uint64_t enqueue_ns;
+    uint64_t trace_id;
+};
+
+/**
+ * Per-stage counters.  All fields are updated with relaxed atomics;
+ * readers get a consistent-enough view for monitoring.
+ */
+class StageCounters {
+ public:
+    StageCounters()
+	: count(0),total_ns(0),max_ns(0) {};
+
+    void record(uint64_t ns)
+    {
+	count.fetch_add(1,std::memory_order_relaxed);
+	total_ns.fetch_add(ns,std::memory_order_relaxed);
+	uint64_t cur = max_ns.load(std::memory_order_relaxed);
+	while (ns > cur
+	       && !max_ns.compare_exchange_weak(cur,ns,std::memory_order_relaxed))
+	    ;
+    };
+    void serialize(rapidjson::Writer<rapidjson::StringBuffer>& writer);
+
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> total_ns;
+    std::atomic<uint64_t> max_ns;
+};
+
+/**
+ * A bounded, lock-free multi-producer/multi-consumer ring of
+ * preallocated message slots (the classic per-cell sequence number
+ * design).  Capacity is rounded up to a power of two.
+ */
+class MessageRing {
+ public:
+    MessageRing(size_t capacity_);
+    virtual ~MessageRing();
+
+    bool try_push(int mtype,int subid,const char *meid,const char *xid,
+		  const unsigned char *buf,int len,uint64_t now_ns,
+		  uint64_t trace_id = 0);
+    bool try_pop(PipelineMessage& msg);
+    /* Pops the oldest message only if its type is mtype. */
+    bool try_pop_if(int mtype,PipelineMessage& msg);
+    size_t size()
+    {
+	size_t e = enqueue_pos.load(std::memory_order_relaxed);
+	size_t d = dequeue_pos.load(std::memory_order_relaxed);
+	return (e > d) ? e - d : 0;
+    };
+    size_t get_capacity() { return capacity; };
+
+ private:
+    struct Cell {
+	std::atomic<size_t> sequence;
+	/* msg.mtype, readable before the cell is claimed. */
+	std::atomic<int> mtype;
+	PipelineMessage msg;
+    };
+
+    bool pop(PipelineMessage& msg,int mtype);
+
+    size_t capacity;
+    size_t mask;
+    Cell *cells;
+    alignas(64) std::atomic<size_t> enqueue_pos;
+    alignas(64) std::atomic<size_t> dequeue_pos;
+};
+
+class PipelineHandler {
+ public:
+    virtual ~PipelineHandler() = default;
+    virtual void handle_pipeline_message(PipelineMessage& msg) = 0;
+};
+
+/**
+ * Decouples the RMR listener thread from message processing.  The
+ * listener copies each message via submit() into one of N shards,
+ * chosen by hashing the message's meid, and each shard has a single
+ * worker that drains its ring and invokes the handler.  All messages
+ * from a given E2 node are therefore handled in order, by the same
+ * worker, while independent nodes proceed in parallel.
+ *
+ * When a shard's ring is full, the overload policy either drops the
+ * oldest queued message to make room, or blocks the listener until the
+ * worker frees a slot (backpressure, which pushes the queueing back
+ * into RMR).  Only indications are ever dropped: a newer one carries
+ * the same kind of state.  If the oldest message is anything else
+ * (e.g., a control ack), the listener waits for the worker instead.
+ * If the pipeline is started with zero shards, submit() invokes the
+ * handler inline on the caller's thread.
+ *
+ * Workers sleep until a message is pushed or the pipeline stops; stop()
+ * lets them finish what is already queued.
+ */
+class Pipeline {
+ public:
+    typedef enum {
+	Backpressure = 1,
+	DropOldest,
+    } OverloadPolicy;
+
+    static const char *overload_policy_to_string(OverloadPolicy policy)
+    {
+	switch (policy) {
+	case Backpressure: return "backpressure";
+	case DropOldest:   return "drop-oldest";
+	default:           return "unknown";
+	}
+    };
+    static bool overload_policy_from_string(const char *s,
+					    OverloadPolicy *policy);
+
+    static uint64_t now_ns()
+    {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+	    std::chrono::steady_clock::now().time_since_epoch()).count();
+    };
+
+    /* FNV-1a; stable, so other per-node state can shard the same way. */
+    static uint32_t hash_meid(const char *meid)
+    {
+	uint32_t h = 2166136261u;
+
+	if (!meid)
+	    return h;
+	for ( ; *meid != '\0'; ++meid) {
+	    h ^= (unsigned char)*meid;
+	    h *= 16777619u;
+	}
+	return h;
+    };
+
+    Pipeline(PipelineHandler *handler_)
+	: handler(handler_),num_shards(0),overload_policy(Backpressure),
+	  running(false),should_stop(false),enqueued(0) {};
+    virtual ~Pipeline();
+
+    bool start(int num_shards_,size_t queue_size,OverloadPolicy policy);
+    void stop();
+    int get_num_shards() { return num_shards; };
+    /* Messages queued across all shards. */
+    size_t get_queue_depth()
+    {
+	size_t depth = 0;
+	for (auto it = shards.begin(); it != shards.end(); ++it)
+	    depth += (*it)->ring.size();
+	return depth;
+    };
+    int shard_of(const char *meid)
+    {
+	return num_shards > 0 ? (int)(hash_meid(meid) % num_shards) : 0;
+    };
+    bool submit(int mtype,int subid,const char *meid,const char *xid,
+		const unsigned char *buf,int len,uint64_t trace_id = 0);
+    void serialize(rapidjson::Writer<rapidjson::StringBuffer>& writer);
+
+ private:
+    class Shard {
+     public:
+	Shard(size_t queue_size)
+	    : ring(queue_size),thread(NULL),idle(false),enqueued(0),
+	      dropped(0),stalls(0),high_water(0) {};
+
+	MessageRing ring;
+	std::thread *thread;
+	std::mutex wait_mutex;
+	std::condition_variable wait_cv;
+	std::atomic<bool> idle;
+	std::atomic<uint64_t> enqueued;
+	std::atomic<uint64_t> dropped;
+	std::atomic<uint64_t> stalls;
+	std::atomic<uint64_t> high_water;
+    };
+
+    void worker(Shard *shard);
+
+    PipelineHandler *handler;
+    int num_shards;
+    OverloadPolicy overload_policy;
+    bool running;
+    std::atomic<bool> should_stop;
+    std::vector<Shard *> shards;
+    PipelineMessage scratch;
+    std::atomic<uint64_t> enqueued;
+
+    /* Queue stage: time spent queued, across all shards. */
+    StageCounters queue_stage;
+    /* Process stage: time spent in the handler, across all shards. */
+    StageCounters process_stage;
+};
+
+}
+
+#endif /* _NEXRAN_PIPELINE_H_ */
@@ -11,6 +11,7 @@
 namespace nexran {
 
 class App;
+class RequestGroup;
 
 class RequestError {
  public:
@@ -60,6 +61,9 @@ class RequestContext {
     rapidjson::Writer<rapidjson::StringBuffer>& get_writer() { return writer; };
     Pistache::Http::Code get_code() { return code; };
     void set_code(Pistache::Http::Code code_) { code = code_; };
+    /* The JSON object the request would have returned without waiting. */
+    const std::string& get_body() { return body; };
+    void set_body(const std::string& body_) { body = body_; };
 
     virtual void send() { if (sent) return; response.send(code,sb.GetString()); sent = true; };
 
@@ -71,6 +75,7 @@ class RequestContext {
     Pistache::Http::ResponseWriter response;
     rapidjson::StringBuffer sb;
     rapidjson::Writer<rapidjson::StringBuffer> writer;
+    std::string body;
 };
 
 class RestServer {
@@ -86,9 +91,31 @@ class RestServer {
 
  private:
     void setupRoutes();
+    std::shared_ptr<RequestGroup> wait_group(
+	const Pistache::Rest::Request &request,
+	Pistache::Http::ResponseWriter& response,
+	Pistache::Http::Code code);
+    bool not_modified(const Pistache::Rest::Request &request,
+		      Pistache::Http::ResponseWriter& response,
+		      uint64_t version);
+    void getCollection(const Pistache::Rest::Request &request,
+		       Pistache::Http::ResponseWriter& response,
+		       int rt);
 
     void getVersion(const Pistache::Rest::Request &request,
 		    Pistache::Http::ResponseWriter response);
+    void getStats(const Pistache::Rest::Request &request,
+		  Pistache::Http::ResponseWriter response);
+    void getEvents(const Pistache::Rest::Request &request,
+		   Pistache::Http::ResponseWriter response);
+    void getMetrics(const Pistache::Rest::Request &request,
+		    Pistache::Http::ResponseWriter response);
+    void getTraces(const Pistache::Rest::Request &request,
+		   Pistache::Http::ResponseWriter response);
+    void getPduTrace(const Pistache::Rest::Request &request,
+		     Pistache::Http::ResponseWriter response);
+    void putPduTrace(const Pistache::Rest::Request &request,
+		     Pistache::Http::ResponseWriter response);
 
     void getNodeBs(const Pistache::Rest::Request &request,
 		   Pistache::Http::ResponseWriter response);
@@ -118,6 +145,8 @@ class RestServer {
 		Pistache::Http::ResponseWriter response);
     void putUe(const Pistache::Rest::Request &request,
 	       Pistache::Http::ResponseWriter response);
+    void getUeMetrics(const Pistache::Rest::Request &request,
+		      Pistache::Http::ResponseWriter response);
     void getUe(const Pistache::Rest::Request &request,
 	       Pistache::Http::ResponseWriter response);
     void deleteUe(const Pistache::Rest::Request &request,
@@ -133,11 +162,15 @@ class RestServer {
     void deleteSliceUeBinding(const Pistache::Rest::Request &request,
 			      Pistache::Http::ResponseWriter response);
 
+    void postBulk(const Pistache::Rest::Request &request,
+		  Pistache::Http::ResponseWriter response);
+
     bool running;
     App *app;
     Pistache::Http::Endpoint endpoint;
     Pistache::Rest::Router router;
     const std::string versionJson;
+    std::string etag_prefix;
 };
 
 }
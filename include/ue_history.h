@@ -0,0 +1,145 @@
+#ifndef _NEXRAN_UE_HISTORY_H_
+#define _NEXRAN_UE_HISTORY_H_
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+
+#include "rapidjson/prettywriter.h"
+
+#include "e2sm_kpm.h"
+
+namespace nexran {
+
+/* One UE's metrics from one KPM report, trimmed so that slabs stay small. */
+typedef struct ue_sample
+{
+    uint64_t time_ms;
+    uint64_t dl_bytes;
+    uint64_t ul_bytes;
+    uint32_t dl_prbs;
+    uint32_t ul_prbs;
+    float dl_cqi;
+    float ul_sinr;
+    float ul_mcs;
+    float ul_phr;
+} ue_sample_t;
+
+/**
+ * The most recent KPM samples of each UE, kept per NodeB and RNTI in a
+ * fixed-size ring.  Rings are carved out of slabs of SLAB_UES rings at
+ * a time, and freed back to a per-shard free list once their UE has
+ * not reported for the idle timeout, so memory is bounded by max_ues
+ * rings of length samples whatever the report rate.  RNTIs are mapped
+ * to IMSIs from NexRAN slice status reports (UeStatus::crnti), which is
+ * how the history is looked up.
+ *
+ * Sharded by the same meid hash as the inbound Pipeline, like
+ * KpmAggregator, so a worker only contends with readers of its shard.
+ */
+class UeHistory {
+ public:
+    static const int SLAB_UES = 256;
+
+    UeHistory()
+	: length(0),max_ues(0),idle_ms(0),shards(),used(0),dropped(0) {};
+    virtual ~UeHistory();
+
+    /* A length or max_ues of 0 disables the history. */
+    void init(int num_shards,int length_,int max_ues_,int idle_sec);
+    bool is_enabled() { return length > 0 && max_ues > 0; };
+    void record(int shard,const std::string& meid,
+		const e2sm::kpm::KpmReport *report,uint64_t now_ms);
+    /* Maps rnti on meid to imsi; an empty imsi removes the mapping. */
+    void map_rnti(int shard,const std::string& meid,long rnti,
+		  const std::string& imsi);
+    void forget(const std::string& meid);
+    /*
+     * Writes every ring kept for imsi (one per NodeB it was seen on),
+     * oldest sample first, at most limit samples each (0 for all).
+     * Returns false, writing nothing, if there are none.
+     */
+    bool serialize(const std::string& imsi,size_t limit,
+		   rapidjson::Writer<rapidjson::StringBuffer>& writer);
+
+    int get_used() { return used.load(std::memory_order_relaxed); };
+    uint64_t get_dropped() { return dropped.load(std::memory_order_relaxed); };
+
+ private:
+    /* A ring's samples are the ring'th run of length samples in the slabs. */
+    class Ring {
+     public:
+	std::string meid;
+	long rnti;
+	std::string imsi;
+	uint32_t head;
+	uint32_t count;
+	uint64_t last_ms;
+	bool in_use;
+    };
+
+    /*
+     * RNTIs (16 bits) map to ring + 1 by direct index, in pages of
+     * PAGE RNTIs allocated when a UE in them first reports, so a NodeB
+     * costs a page table plus the pages its UEs actually use.
+     */
+    class NodeBUes {
+     public:
+	static const int PAGE = 256;
+
+	uint32_t ring_of(long rnti) const {
+	    const std::unique_ptr<uint32_t[]>& page = pages[rnti / PAGE];
+	    return page ? page[rnti % PAGE] : 0;
+	};
+	void set_ring(long rnti,uint32_t ring) {
+	    std::unique_ptr<uint32_t[]>& page = pages[rnti / PAGE];
+	    if (!page) {
+		if (!ring)
+		    return;
+		page.reset(new uint32_t[PAGE]());
+	    }
+	    page[rnti % PAGE] = ring;
+	};
+
+	std::unique_ptr<uint32_t[]> pages[0x10000 / PAGE];
+	std::map<long,std::string> imsi_of_rnti;
+    };
+
+    class Shard {
+     public:
+	Shard()
+	    : last_sweep_ms(0) {};
+	~Shard();
+
+	std::mutex mutex;
+	std::map<std::string,NodeBUes> nodebs;
+	std::vector<ue_sample_t *> slabs;
+	std::vector<Ring> rings;
+	std::vector<uint32_t> free_rings;
+	std::multimap<std::string,uint32_t> rings_of_imsi;
+	uint64_t last_sweep_ms;
+    };
+
+    ue_sample_t *samples(Shard *s,uint32_t ring) {
+	return s->slabs[ring / SLAB_UES] + (size_t)(ring % SLAB_UES) * length;
+    };
+    bool alloc_ring(Shard *s,uint32_t *ring);
+    void free_ring(Shard *s,uint32_t ring);
+    void set_imsi(Shard *s,uint32_t ring,const std::string& imsi);
+    void sweep(Shard *s,uint64_t now_ms);
+
+    int length;
+    int max_ues;
+    uint64_t idle_ms;
+    std::vector<Shard *> shards;
+    std::atomic<int> used;
+    std::atomic<uint64_t> dropped;
+};
+
+}
+
+#endif /* _NEXRAN_UE_HISTORY_H_ */
@@ -6,10 +6,20 @@
 #include <mutex>
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <cstdlib>
 #include <ctime>
 #include <map>
 #include <memory>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+
+#include "e2ap_table.h"
+#include "e2ap_timer.h"
+#include "e2ap_metrics.h"
+#include "e2ap_trace.h"
+#include "e2ap_pdu_trace.h"
 
 #define E2AP_XER_PRINT(stream,type,pdu)					\
     do {								\
@@ -67,6 +77,13 @@ class Message
     virtual bool encode() = 0;
     virtual unsigned char *get_buf() { if (!encoded) encode(); return buf; };
     virtual ssize_t get_len() { if (!encoded) encode(); return len; };
+    /*
+     * Encodes into a caller-owned buffer (e.g. an RMR payload), returning
+     * the encoded length, or -1 on error or if dst_len is too small.
+     * The default copies our cached encoding; subclasses on hot paths
+     * encode in place instead.
+     */
+    virtual ssize_t encode_into(unsigned char *dst,size_t dst_len);
 
  protected:
     bool encoded;
@@ -110,11 +127,13 @@ public:
     Request()
 	: requestor_id(-1),instance_id(-1) {};
 
-    void set_meid(std::string &meid_) { meid = meid_; };
+    void set_meid(const std::string &meid_) { meid = meid_; };
 
     long requestor_id;
     long instance_id;
     std::string meid;
+    /* The trace that caused this request, if any. */
+    TraceContext trace;
 };
 
 class SubscriptionRequest : public Request
@@ -254,21 +273,60 @@ typedef enum ControlRequestAck
     CONTROL_REQUEST_NACK
 } ControlRequestAck_t;
 
+class ControlRequest;
+
+/**
+ * An encoded RICcontrolRequest shared by all the destinations of a
+ * fan-out.  The requests differ only in ricInstanceID, which APER
+ * encodes as two octet-aligned bytes, so each copy is the template with
+ * those two bytes patched.  It shares ownership of the control it was
+ * encoded from with every request built on it.
+ */
+class ControlTemplate
+{
+ public:
+    ControlTemplate(unsigned char *buf_,ssize_t len_,ssize_t instance_id_offset_,
+		    std::shared_ptr<e2sm::Control> control_)
+	: buf(buf_),len(len_),instance_id_offset(instance_id_offset_),
+	  control(control_) {};
+    virtual ~ControlTemplate() {
+	if (buf)
+	    free(buf);
+    }
+
+    /*
+     * Builds a template from req (whose instance ID is ignored), or
+     * returns NULL if its encoding cannot be patched.
+     */
+    static ControlTemplate *create(ControlRequest *req);
+
+    ssize_t patch_into(unsigned char *dst,size_t dst_len,long instance_id) const;
+
+    unsigned char *buf;
+    ssize_t len;
+    ssize_t instance_id_offset;
+    std::shared_ptr<e2sm::Control> control;
+};
+
 class ControlRequest : public Request
 {
  public:
     ControlRequest(
         long requestor_id_,long instance_id_,RanFunctionId function_id_,
-	e2sm::Control *control_,ControlRequestAck_t ack_request_)
+	std::shared_ptr<e2sm::Control> control_,ControlRequestAck_t ack_request_)
 	: function_id(function_id_),control(control_),
 	  ack_request(ack_request_),Request(requestor_id_,instance_id_) {};
     virtual ~ControlRequest() = default;
 
     virtual bool encode();
+    virtual ssize_t encode_into(unsigned char *dst,size_t dst_len);
 
     RanFunctionId function_id;
-    e2sm::Control *control;
+    /* Shared by every request of a fan-out, which may outlive the sender. */
+    std::shared_ptr<e2sm::Control> control;
     ControlRequestAck_t ack_request;
+    /* If set, encode by patching this instead of running the encoder. */
+    std::shared_ptr<const ControlTemplate> tmpl;
 };
 
 class ControlAck : public Message
@@ -378,11 +436,41 @@ class ErrorIndication : public Message
     long cause_detail;
 };
 
+/**
+ * A borrowed view of an inbound message.  Nothing is owned: buf, meid,
+ * and xid must remain valid until E2AP::handle_message returns, so
+ * callers can point straight into their transport buffers.
+ */
+class MessageView
+{
+ public:
+    MessageView(const unsigned char *buf_,ssize_t len_,int subid_,
+		std::string_view meid_,std::string_view xid_)
+	: buf(buf_),len(len_),subid(subid_),meid(meid_),xid(xid_) {};
+
+    const unsigned char *buf;
+    ssize_t len;
+    int subid;
+    std::string_view meid;
+    std::string_view xid;
+};
+
 class AgentInterface {
  public:
     virtual bool send_message(const unsigned char *buf,ssize_t buf_len,
 			      int mtype,int subid,const std::string& meid,
 			      const std::string& xid) = 0;
+    /*
+     * Agents that can hand out a transport buffer should override this
+     * and encode msg directly into it via Message::encode_into.
+     */
+    virtual bool send_message(Message *msg,int mtype,int subid,
+			      const std::string& meid,const std::string& xid)
+    {
+	if (!msg->encode())
+	    return false;
+	return send_message(msg->get_buf(),msg->get_len(),mtype,subid,meid,xid);
+    };
     virtual bool handle(SubscriptionResponse *resp) = 0;
     virtual bool handle(SubscriptionFailure *resp) = 0;
     virtual bool handle(SubscriptionDeleteResponse *resp) = 0;
@@ -391,30 +479,70 @@ class AgentInterface {
     virtual bool handle(ControlFailure *control) = 0;
     virtual bool handle(Indication *ind) = 0;
     virtual bool handle(ErrorIndication *ind) = 0;
+    /*
+     * Called when a request has gone unanswered through all its
+     * retransmissions.  E2AP has already stopped tracking it.
+     */
+    virtual bool handle_timeout(std::shared_ptr<ControlRequest> req) = 0;
+    virtual bool handle_timeout(std::shared_ptr<SubscriptionRequest> req) = 0;
+    virtual bool handle_timeout(std::shared_ptr<SubscriptionDeleteRequest> req) = 0;
 };
 
 class E2AP {
  public:
     E2AP(AgentInterface *agent_if_)
-	: agent_if(agent_if_),requestor_id(1),next_instance_id(1)
-    { requestor_id = 123; };
-    virtual ~E2AP() = default;
+	: requestor_id(123),next_instance_id(1),controls(4096),
+	  pending_subscriptions(256),subscriptions(1024),pending_deletes(256),
+	  timer_thread(NULL),timer_stop(false),retransmits(0),expirations(0),
+	  agent_if(agent_if_) { init_metrics(); };
+    virtual ~E2AP() { stop(); };
     virtual bool init();
+    virtual void stop();
+
+    /* Must be called before init(). */
+    void set_timeout(Procedure_t procedure,const RequestTimeout& timeout) {
+	timeouts[procedure] = timeout;
+    };
+    /*
+     * Must be called before init().  Sets how many requests of this
+     * procedure may be in flight at once; further sends are refused
+     * (and counted) until some are answered or expire.
+     */
+    void set_capacity(Procedure_t procedure,size_t capacity);
+    /*
+     * How long after it is first sent an unanswered request of this
+     * procedure is given up on: every attempt's wait, with backoff.
+     * Zero if requests never expire.
+     */
+    uint64_t get_expiry_ms(Procedure_t procedure);
+    uint64_t get_retransmits() { return retransmits; };
+    uint64_t get_expirations() { return expirations; };
+    size_t get_num_pending(Procedure_t procedure);
+    PduTracer& get_pdu_tracer() { return pdu_tracer; };
 
     long get_requestor_id() {
-	const std::lock_guard<std::mutex> lock(mutex);
 	return requestor_id;
     };
-    long get_next_instance_id() {
-	const std::lock_guard<std::mutex> lock(mutex);
-	return next_instance_id++;
-    };
+    /*
+     * RICrequestID instance IDs are 16 bits wide, so they wrap.  After
+     * a wrap, skip 0 and any ID still held by a request in flight.
+     */
+    long get_next_instance_id();
 
+    bool handle_message(const MessageView& msg);
     bool handle_message(const unsigned char *buf,ssize_t len,int subid,
-			std::string meid,std::string xid);
+			const std::string& meid,const std::string& xid)
+    {
+	return handle_message(MessageView(buf,len,subid,meid,xid));
+    };
 
     bool send_control_request(std::shared_ptr<ControlRequest> req,
 			      const std::string& meid);
+    int send_control_fanout(std::shared_ptr<e2sm::Control> control,
+			    const std::list<std::string>& meids,
+			    RanFunctionId function_id,
+			    ControlRequestAck_t ack_request,
+			    std::list<std::shared_ptr<ControlRequest>> *requests = NULL);
     bool send_subscription_request(std::shared_ptr<SubscriptionRequest> req,
 				   const std::string& meid);
     bool send_subscription_delete_request(std::shared_ptr<SubscriptionDeleteRequest> req,
@@ -426,29 +554,61 @@ class E2AP {
      * have to use the RMR subid.
      */
     std::shared_ptr<SubscriptionRequest> lookup_pending_subscription
-        (std::string& xid);
+        (std::string_view xid);
     std::shared_ptr<SubscriptionResponse> lookup_subscription
         (int subid);
     std::shared_ptr<SubscriptionDeleteRequest> lookup_pending_subscription_delete
-        (std::string& xid);
+        (std::string_view xid);
     bool delete_all_subscriptions
         (std::string& meid);
     std::shared_ptr<ControlRequest> lookup_control
         (long requestor_id,long instance_id);
 
  private:
-    bool _send_subscription_delete_request(std::shared_ptr<SubscriptionDeleteRequest> req,
-					   const std::string& meid, bool locked);
+    bool transmit(Procedure_t procedure,Request *req);
+    void answered(Request *req,const char *span_name);
+    void arm(Procedure_t procedure,std::shared_ptr<Request> req,
+	     unsigned int attempt);
+    void expire(const DeadlineWheel::Deadline& deadline);
+    void timer_handler();
+    void init_metrics();
+    void refused(Procedure_t procedure);
+
  protected:
-    std::mutex mutex;
-    long requestor_id;
-    long next_instance_id;
+    const long requestor_id;
+    std::atomic<long> next_instance_id;
     std::list<e2sm::Model *> models;
-    std::map<long,std::shared_ptr<ControlRequest>> controls;
-    std::map<std::string,std::shared_ptr<SubscriptionRequest>> pending_subscriptions;
-    std::map<int,std::shared_ptr<SubscriptionResponse>> subscriptions;
-    std::map<std::string,std::shared_ptr<SubscriptionDeleteRequest>> pending_deletes;
+    /*
+     * Requests in flight and established subscriptions.  Controls and
+     * pending requests are keyed by instance ID; subscriptions by the
+     * RMR subid the subscription manager assigned.  Lookups from the
+     * message handlers never take a lock.
+     */
+    RequestTable<ControlRequest> controls;
+    RequestTable<SubscriptionRequest> pending_subscriptions;
+    RequestTable<SubscriptionResponse> subscriptions;
+    RequestTable<SubscriptionDeleteRequest> pending_deletes;
+    RequestTimeout timeouts[PROCEDURE_MAX];
+    DeadlineWheel deadlines;
+    std::thread *timer_thread;
+    std::mutex timer_mutex;
+    std::condition_variable timer_cv;
+    bool timer_stop;
+    std::atomic<uint64_t> retransmits;
+    std::atomic<uint64_t> expirations;
     AgentInterface *agent_if;
+    PduTracer pdu_tracer;
+
+    Histogram *handle_latency;
+    Counter *decode_failures;
+    Histogram *control_send_latency;
+    Histogram *control_reaction_latency;
+    Counter *controls_sent;
+    Counter *control_send_failures;
+    Counter *control_acks;
+    Counter *control_failures;
+    Counter *control_timeouts;
+    Counter *table_full[PROCEDURE_MAX];
 };
 
 }
@@ -0,0 +1,198 @@
+#ifndef _E2AP_LOG_H_
+#define _E2AP_LOG_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "mdclog/mdclog.h"
+
+/*
+ * The most verbose mdclog level compiled in; calls above it compile to
+ * nothing, arguments and all.  Set from the build (LOG_MAX_LEVEL).
+ */
+#ifndef E2AP_LOG_MAX_LEVEL
+#define E2AP_LOG_MAX_LEVEL MDCLOG_DEBUG
+#endif
+
+/*
+ * Logs through the async logger.  The arguments are only evaluated if
+ * level is compiled in and enabled; they are then copied (strings by
+ * value) and formatted on the logger's thread.  Arguments must be
+ * printf-compatible; the if (0) branch has the compiler check them.
+ */
+#define E2AP_LOG(level,fmt,...)						\
+    do {								\
+	if ((level) <= E2AP_LOG_MAX_LEVEL && e2ap::log_enabled(level)) \
+	    e2ap::logger().log((level),0,fmt,##__VA_ARGS__);		\
+	if (0)								\
+	    e2ap::log_format_check(fmt,##__VA_ARGS__);		\
+    } while (0)
+
+/*
+ * Like E2AP_LOG, but this call site logs at most per_sec times a
+ * second; the next message it logs says how many were suppressed.
+ */
+#define E2AP_LOG_LIMIT(level,per_sec,fmt,...)				\
+    do {								\
+	if ((level) <= E2AP_LOG_MAX_LEVEL && e2ap::log_enabled(level)) { \
+	    static e2ap::LogRateLimit _e2ap_log_limit(per_sec);	\
+	    uint64_t _e2ap_log_suppressed = 0;				\
+	    if (_e2ap_log_limit.allow(&_e2ap_log_suppressed))		\
+		e2ap::logger().log((level),_e2ap_log_suppressed,fmt,##__VA_ARGS__); \
+	}								\
+	if (0)								\
+	    e2ap::log_format_check(fmt,##__VA_ARGS__);		\
+    } while (0)
+
+namespace e2ap
+{
+
+inline bool log_enabled(mdclog_severity_t level)
+{
+    return level <= mdclog_level_get();
+}
+
+inline void log_format_check(const char *fmt,...)
+    __attribute__((format(printf,1,2)));
+inline void log_format_check(const char *,...) {}
+
+/**
+ * A per-call-site token bucket: per_sec tokens a second, and bursts of
+ * up to per_sec.  Lock-free; a race may let a message or two too many
+ * through, which is fine for logging.
+ */
+class LogRateLimit
+{
+ public:
+    LogRateLimit(unsigned int per_sec_)
+	: per_sec(per_sec_ ? per_sec_ : 1),tokens(per_sec),last_ns(0),
+	  suppressed(0) {};
+
+    bool allow(uint64_t *suppressed_);
+
+ private:
+    const unsigned int per_sec;
+    std::atomic<int64_t> tokens;
+    std::atomic<uint64_t> last_ns;
+    std::atomic<uint64_t> suppressed;
+};
+
+/* A captured log call, formatted later on the logger's thread. */
+class LogRecord
+{
+ public:
+    LogRecord(mdclog_severity_t level_,uint64_t suppressed_,const char *fmt_)
+	: level(level_),suppressed(suppressed_),fmt(fmt_) {};
+    virtual ~LogRecord() = default;
+    virtual void format(std::string& out) = 0;
+
+    mdclog_severity_t level;
+    uint64_t suppressed;
+    /* Always a literal, so it outlives the record. */
+    const char *fmt;
+};
+
+/*
+ * Strings are copied at capture, since the caller's buffer may be gone
+ * by the time we format; everything else must be a plain value.
+ */
+inline std::string log_capture(const char *s) { return std::string(s ? s : "(null)"); }
+inline std::string log_capture(char *s) { return log_capture((const char *)s); }
+template <typename T>
+inline T log_capture(const T& v)
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+		  "log arguments must be printf-compatible");
+    return v;
+}
+
+inline const char *log_arg(const std::string& s) { return s.c_str(); }
+template <typename T>
+inline const T& log_arg(const T& v) { return v; }
+
+template <typename... Args>
+class FormattedLogRecord : public LogRecord
+{
+ public:
+    FormattedLogRecord(mdclog_severity_t level_,uint64_t suppressed_,
+		       const char *fmt_,const Args&... args_)
+	: LogRecord(level_,suppressed_,fmt_),args(log_capture(args_)...) {};
+
+    virtual void format(std::string& out)
+    {
+	std::apply([this,&out](const auto&... a) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#pragma GCC diagnostic ignored "-Wformat-security"
+	    int n = snprintf(NULL,0,fmt,log_arg(a)...);
+	    if (n < 0)
+		return;
+	    out.resize(n + 1);
+	    snprintf(&out[0],n + 1,fmt,log_arg(a)...);
+	    out.resize(n);
+#pragma GCC diagnostic pop
+	},args);
+    };
+
+ private:
+    std::tuple<decltype(log_capture(std::declval<const Args&>()))...> args;
+};
+
+/**
+ * Writes log records to mdclog from a background thread, so that the
+ * threads that log pay only for a capture and a queue push.  The queue
+ * is bounded; records that do not fit are dropped and counted, and the
+ * count is logged.  Before start() and after stop(), records are
+ * formatted and written on the caller's thread.
+ */
+class AsyncLogger
+{
+ public:
+    static const size_t QUEUE_SIZE = 4096;
+
+    AsyncLogger()
+	: thread(NULL),should_stop(false),dropped(0) {};
+    virtual ~AsyncLogger() { stop(); };
+
+    void start();
+    /* Writes whatever is still queued before returning. */
+    void stop();
+
+    template <typename... Args>
+    void log(mdclog_severity_t level,uint64_t suppressed,const char *fmt,
+	     const Args&... args)
+    {
+	submit(std::unique_ptr<LogRecord>(
+		   new FormattedLogRecord<Args...>(level,suppressed,fmt,args...)));
+    };
+    uint64_t get_dropped() { return dropped.load(std::memory_order_relaxed); };
+
+ private:
+    void submit(std::unique_ptr<LogRecord> record);
+    static void write(LogRecord *record);
+    void writer();
+
+    std::thread *thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool should_stop;
+    std::vector<std::unique_ptr<LogRecord>> queue;
+    std::atomic<uint64_t> dropped;
+};
+
+/* The process-wide logger. */
+AsyncLogger& logger();
+
+}
+
+#endif /* _E2AP_LOG_H_ */
@@ -0,0 +1,175 @@
+#ifndef _E2AP_METRICS_H_
+#define _E2AP_METRICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace e2ap
+{
+
+/*
+ * Hot-path metrics are sharded so that threads recording at the same
+ * time usually touch different cache lines; each thread is assigned a
+ * shard the first time it records anything.
+ */
+const int METRICS_SHARDS = 16;
+
+extern std::atomic<unsigned> metrics_next_shard;
+
+inline unsigned metrics_shard()
+{
+    static thread_local unsigned shard =
+	metrics_next_shard.fetch_add(1,std::memory_order_relaxed) % METRICS_SHARDS;
+    return shard;
+}
+
+inline uint64_t metrics_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+	std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class Counter
+{
+ public:
+    Counter()
+	: cells() {};
+    virtual ~Counter() = default;
+
+    void inc(uint64_t n = 1)
+    {
+	cells[metrics_shard()].value.fetch_add(n,std::memory_order_relaxed);
+    };
+    uint64_t get() const;
+
+ private:
+    class alignas(64) Cell {
+     public:
+	Cell()
+	    : value(0) {};
+	std::atomic<uint64_t> value;
+    };
+
+    Cell cells[METRICS_SHARDS];
+};
+
+/**
+ * A latency histogram in nanoseconds, with HDR-style log-linear
+ * buckets: four per power of two, so any value is counted in a bucket
+ * no more than 25% wider than itself.  Recording is two relaxed adds
+ * on the thread's shard.
+ */
+class Histogram
+{
+ public:
+    static const int NUM_BUCKETS = 252;
+
+    Histogram();
+    virtual ~Histogram();
+
+    void record(uint64_t ns)
+    {
+	Cell& cell = cells[metrics_shard()];
+	cell.buckets[bucket(ns)].fetch_add(1,std::memory_order_relaxed);
+	cell.sum.fetch_add(ns,std::memory_order_relaxed);
+    };
+    static int bucket(uint64_t ns)
+    {
+	if (ns < 4)
+	    return (int)ns;
+	int e = 63 - __builtin_clzll(ns);
+	return (e - 1) * 4 + (int)((ns >> (e - 2)) & 3);
+    };
+    /* The largest value counted in bucket i. */
+    static uint64_t bucket_max(int i);
+    /* Sums the shards: counts[i] for each bucket, and the total ns. */
+    void get(std::vector<uint64_t>& counts,uint64_t *sum) const;
+
+ private:
+    class alignas(64) Cell {
+     public:
+	Cell();
+	std::atomic<uint64_t> buckets[NUM_BUCKETS];
+	std::atomic<uint64_t> sum;
+    };
+
+    Cell *cells;
+};
+
+/* Records the time from construction to destruction in a Histogram. */
+class ScopedTimer
+{
+ public:
+    ScopedTimer(Histogram *histogram_)
+	: histogram(histogram_),start(metrics_now_ns()) {};
+    ~ScopedTimer() { histogram->record(metrics_now_ns() - start); };
+
+ private:
+    Histogram *histogram;
+    uint64_t start;
+};
+
+/**
+ * Named metrics, exported in the Prometheus text format.  Registration
+ * takes a lock and is meant for startup; callers keep the returned
+ * pointers, which live as long as the process, and record through them
+ * without locking.  labels is a preformatted label list, e.g.
+ * "outcome=\"ack\"", or empty.  Gauges are callbacks sampled at export.
+ */
+class MetricsRegistry
+{
+ public:
+    MetricsRegistry() = default;
+    virtual ~MetricsRegistry();
+
+    Counter *counter(const std::string& name,const std::string& help,
+		     const std::string& labels = std::string());
+    Histogram *histogram(const std::string& name,const std::string& help,
+			 const std::string& labels = std::string());
+    void gauge(const std::string& name,const std::string& help,
+	       const std::string& labels,std::function<double()> fn);
+    void write_prometheus(std::string& out);
+
+ private:
+    typedef enum {
+	COUNTER = 0,
+	GAUGE,
+	HISTOGRAM,
+    } MetricType;
+
+    class Entry {
+     public:
+	Entry()
+	    : counter(NULL),histogram(NULL) {};
+
+	Counter *counter;
+	Histogram *histogram;
+	std::function<double()> gauge;
+    };
+
+    class Family {
+     public:
+	MetricType type;
+	std::string help;
+	std::map<std::string,Entry> entries;
+    };
+
+    Entry& entry(const std::string& name,const std::string& help,
+		 MetricType type,const std::string& labels);
+
+    std::mutex mutex;
+    std::map<std::string,Family> families;
+};
+
+/* The process-wide registry. */
+MetricsRegistry& metrics();
+
+}
+
+#endif /* _E2AP_METRICS_H_ */
@@ -0,0 +1,139 @@
+#ifndef _E2AP_PDU_TRACE_H_
+#define _E2AP_PDU_TRACE_H_
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <condition_variable>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+
+namespace e2ap
+{
+
+typedef enum {
+    PDU_TRACE_BINARY = 0,
+    PDU_TRACE_XER,
+} PduTraceFormat_t;
+
+const char *pdu_trace_format_to_string(PduTraceFormat_t format);
+bool pdu_trace_format_from_string(const std::string& s,PduTraceFormat_t *format);
+
+/* The E2AP procedure code carried by messages of RMR type mtype, or -1. */
+long procedure_code_for_mtype(int mtype);
+
+/*
+ * What to trace.  A PDU is traced if its procedure code is in
+ * procedures and its meid in meids (an empty set matches anything),
+ * and it is the sample'th such PDU; a sample of 0 traces nothing.
+ */
+class PduTraceConfig
+{
+ public:
+    PduTraceConfig()
+	: sample(0),format(PDU_TRACE_BINARY) {};
+
+    unsigned int sample;
+    PduTraceFormat_t format;
+    std::set<long> procedures;
+    std::set<std::string> meids;
+};
+
+/**
+ * Captures raw E2AP PDUs, in and out, for debugging.  record() only
+ * filters and copies the encoded PDU onto a bounded queue (dropping it
+ * if the queue is full); a writer thread appends queued PDUs to the
+ * trace file, re-decoding them first if the format is XER.  When the
+ * sample is 0, record() is a single relaxed load.
+ *
+ * A binary trace is a sequence of records, each a BinaryHeader (in host
+ * byte order) followed by the meid and then the APER-encoded PDU.
+ */
+class PduTracer
+{
+ public:
+    typedef enum {
+	INBOUND = 0,
+	OUTBOUND,
+    } Direction_t;
+
+    static const size_t QUEUE_SIZE = 1024;
+    static const uint32_t BINARY_MAGIC = 0x54503245; /* "E2PT" */
+
+    struct BinaryHeader {
+	uint32_t magic;
+	uint8_t direction;
+	uint8_t reserved;
+	uint16_t meid_len;
+	int32_t procedure;
+	uint32_t pdu_len;
+	uint64_t time_ns;
+    };
+
+    PduTracer()
+	: sample(0),config(std::make_shared<const PduTraceConfig>()),
+	  thread(NULL),should_stop(false),file(NULL),matched(0),queued(0),
+	  written(0),dropped(0) {};
+    virtual ~PduTracer() { stop(); };
+
+    /* Starts the writer; path "-" means stderr.  Opened on first use. */
+    bool start(const std::string& path_);
+    void stop();
+    void configure(const PduTraceConfig& config_);
+    std::shared_ptr<const PduTraceConfig> get_config() {
+	return std::atomic_load(&config);
+    };
+    const std::string& get_path() { return path; };
+    bool is_enabled() { return sample.load(std::memory_order_relaxed) != 0; };
+    void record(Direction_t direction,long procedure,const char *meid,
+		size_t meid_len,const unsigned char *buf,size_t len)
+    {
+	if (is_enabled())
+	    enqueue(direction,procedure,meid,meid_len,buf,len);
+    };
+
+    uint64_t get_matched() { return matched.load(std::memory_order_relaxed); };
+    uint64_t get_queued() { return queued.load(std::memory_order_relaxed); };
+    uint64_t get_written() { return written.load(std::memory_order_relaxed); };
+    uint64_t get_dropped() { return dropped.load(std::memory_order_relaxed); };
+
+ private:
+    class Record {
+     public:
+	Direction_t direction;
+	PduTraceFormat_t format;
+	long procedure;
+	uint64_t time_ns;
+	std::string meid;
+	std::vector<unsigned char> pdu;
+    };
+
+    void enqueue(Direction_t direction,long procedure,const char *meid,
+		 size_t meid_len,const unsigned char *buf,size_t len);
+    void writer();
+    bool write(const Record& record);
+
+    std::atomic<unsigned int> sample;
+    std::shared_ptr<const PduTraceConfig> config;
+    std::string path;
+    std::thread *thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool should_stop;
+    std::deque<Record> queue;
+    FILE *file;
+
+    std::atomic<uint64_t> matched;
+    std::atomic<uint64_t> queued;
+    std::atomic<uint64_t> written;
+    std::atomic<uint64_t> dropped;
+};
+
+}
+
+#endif /* _E2AP_PDU_TRACE_H_ */
@@ -0,0 +1,403 @@
+#ifndef _E2AP_TABLE_H_
+#define _E2AP_TABLE_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+namespace e2ap
+{
+
+/* Eases a spin-wait on another core; yields the CPU after a while. */
+inline void spin_pause(unsigned int& spins)
+{
+    if (++spins > 64) {
+	std::this_thread::yield();
+	return;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+/**
+ * A fixed-capacity, open-addressing (linear probing) table of
+ * in-flight requests, keyed by a non-negative long: an instance ID or
+ * an RMR subid; negative keys are never stored.  Lookups take no lock:
+ * each slot carries a sequence number that writers bump around every
+ * change, and readers retry a slot whose sequence moved while they read
+ * it.  Slots hold raw pointers to heap-allocated shared_ptrs; a reader
+ * copies the shared_ptr inside an epoch, and a writer frees a
+ * replaced one only once every reader that might have seen it has left
+ * its epoch.  Writers serialize on a mutex private to the table, so
+ * they never block readers.
+ *
+ * erase() uses backward-shift deletion rather than tombstones, so a
+ * probe always ends at the first empty slot however many keys have
+ * come and gone.  Shifting can carry a key past a concurrent reader,
+ * so erases also bump a table-wide sequence, and a lookup that misses
+ * while it moved looks again.
+ */
+template <typename T>
+class RequestTable
+{
+ public:
+    /*
+     * Holds up to capacity entries, in at least twice as many slots (a
+     * power of two), so probe runs stay short even when full.
+     */
+    RequestTable(std::size_t capacity = 1024)
+	: limit(capacity),mask(round_up(2 * capacity) - 1),
+	  slots(new Slot[mask + 1]),count(0),shifts(0),epoch(0),
+	  draining_epoch(0) {};
+    RequestTable(const RequestTable&) = delete;
+    RequestTable& operator=(const RequestTable&) = delete;
+    ~RequestTable()
+    {
+	for (std::size_t i = 0; i <= mask; ++i)
+	    delete slots[i].value.load(std::memory_order_relaxed);
+	for (auto it = retired.begin(); it != retired.end(); ++it)
+	    delete *it;
+	for (auto it = draining.begin(); it != draining.end(); ++it)
+	    delete *it;
+    };
+
+    /*
+     * Empties the table and resizes it; only while nothing else can be
+     * using it (e.g., at startup).
+     */
+    void resize(std::size_t capacity)
+    {
+	const std::lock_guard<std::mutex> lock(write_mutex);
+	for (std::size_t i = 0; i <= mask; ++i)
+	    delete slots[i].value.load(std::memory_order_relaxed);
+	limit = capacity;
+	mask = round_up(2 * capacity) - 1;
+	slots.reset(new Slot[mask + 1]);
+	count = 0;
+    };
+
+    std::shared_ptr<T> find(long key) const
+    {
+	std::shared_ptr<T> value;
+
+	if (key < 0)
+	    return value;
+	ReadGuard guard(*this);
+	probe(key,&value);
+	return value;
+    };
+
+    bool contains(long key) const
+    {
+	if (key < 0)
+	    return false;
+	ReadGuard guard(*this);
+	return probe(key,NULL);
+    };
+
+    /* Returns false if key is already present, or the table is full. */
+    bool insert(long key,std::shared_ptr<T> value)
+    {
+	const std::lock_guard<std::mutex> lock(write_mutex);
+	return insert_locked(key,std::move(value));
+    };
+
+    /* Inserts key, or replaces its value if present. */
+    bool set(long key,std::shared_ptr<T> value)
+    {
+	const std::lock_guard<std::mutex> lock(write_mutex);
+	Slot *s = locate(key);
+	if (s) {
+	    Value *old = s->value.load(std::memory_order_relaxed);
+	    write(*s,key,new Value(std::move(value)));
+	    retire(old);
+	    return true;
+	}
+	return insert_locked(key,std::move(value));
+    };
+
+    /* Removes key, returning its value (NULL if absent). */
+    std::shared_ptr<T> erase(long key)
+    {
+	const std::lock_guard<std::mutex> lock(write_mutex);
+	Slot *s = locate(key);
+	if (!s)
+	    return NULL;
+	Value *old = s->value.load(std::memory_order_relaxed);
+	std::shared_ptr<T> value = *old;
+	shift_out((std::size_t)(s - slots.get()));
+	--count;
+	retire(old);
+	return value;
+    };
+
+    /*
+     * Calls f(key,value) for each present entry, under the writer lock
+     * (so each entry is seen once); f must not modify the table.
+     */
+    template <typename F>
+    void for_each(F f) const
+    {
+	const std::lock_guard<std::mutex> lock(write_mutex);
+	for (std::size_t i = 0; i <= mask; ++i) {
+	    long k = slots[i].key.load(std::memory_order_relaxed);
+	    Value *v = slots[i].value.load(std::memory_order_relaxed);
+	    if (k >= 0 && v && *v)
+		f(k,*v);
+	}
+    };
+
+    std::size_t size() const
+    {
+	return count.load(std::memory_order_relaxed);
+    };
+
+    std::size_t capacity() const
+    {
+	return limit;
+    };
+
+    bool full() const
+    {
+	return size() >= capacity();
+    };
+
+ private:
+    static const long EMPTY = -1;
+    /* Replaced values are freed in batches of this many. */
+    static const std::size_t RETIRE_BATCH = 32;
+    /* Readers spread their epoch counts over this many cache lines. */
+    static const std::size_t READER_SLOTS = 16;
+
+    typedef std::shared_ptr<T> Value;
+
+    struct Slot
+    {
+	std::atomic<uint64_t> seq {0};
+	std::atomic<long> key {EMPTY};
+	std::atomic<Value *> value {NULL};
+    };
+
+    struct alignas(64) ReaderCount
+    {
+	std::atomic<long> n[2] = { {0},{0} };
+    };
+
+    /*
+     * Counts the calling thread into the current epoch for its
+     * lifetime.  The epoch is rechecked after counting in, so a writer
+     * that has since moved on and seen the old count empty never
+     * misses us.
+     */
+    class ReadGuard
+    {
+     public:
+	ReadGuard(const RequestTable& table_)
+	    : table(table_),count(table.readers[reader_slot()].n)
+	{
+	    while (true) {
+		e = table.epoch.load();
+		count[e & 1].fetch_add(1);
+		if (table.epoch.load() == e)
+		    break;
+		count[e & 1].fetch_sub(1);
+	    }
+	};
+	~ReadGuard() { count[e & 1].fetch_sub(1,std::memory_order_release); };
+
+     private:
+	const RequestTable& table;
+	std::atomic<long> *count;
+	uint64_t e;
+    };
+
+    static std::size_t reader_slot()
+    {
+	static std::atomic<std::size_t> next {0};
+	thread_local std::size_t slot = next.fetch_add(1) % READER_SLOTS;
+	return slot;
+    };
+
+    static std::size_t round_up(std::size_t n)
+    {
+	std::size_t p = 16;
+	while (p < n)
+	    p <<= 1;
+	return p;
+    };
+
+    static std::size_t hash(long key)
+    {
+	uint64_t h = (uint64_t)key * 0x9e3779b97f4a7c15ULL;
+	return (std::size_t)(h ^ (h >> 32));
+    };
+
+    /* Finds key and copies its value into value, if non-NULL. */
+    bool probe(long key,std::shared_ptr<T> *value) const
+    {
+	unsigned int spins = 0;
+
+	while (true) {
+	    uint64_t seq = shifts.load(std::memory_order_acquire);
+	    if (seq & 1) {
+		spin_pause(spins);
+		continue;
+	    }
+	    for (std::size_t i = 0, n = hash(key); i <= mask; ++i, ++n) {
+		long k = read(slots[n & mask],key,value);
+		if (k == EMPTY)
+		    break;
+		if (k == key)
+		    return true;
+	    }
+	    std::atomic_thread_fence(std::memory_order_acquire);
+	    if (shifts.load(std::memory_order_relaxed) == seq)
+		return false;
+	}
+    };
+
+    /* Returns s's key, and copies its value if that is key. */
+    static long read(const Slot& s,long key,std::shared_ptr<T> *value)
+    {
+	unsigned int spins = 0;
+
+	while (true) {
+	    uint64_t seq = s.seq.load(std::memory_order_acquire);
+	    if (seq & 1) {
+		spin_pause(spins);
+		continue;
+	    }
+	    long k = s.key.load(std::memory_order_relaxed);
+	    Value *v = (k == key && value)
+		? s.value.load(std::memory_order_relaxed) : NULL;
+	    std::atomic_thread_fence(std::memory_order_acquire);
+	    if (s.seq.load(std::memory_order_relaxed) == seq) {
+		/* Not freed before our epoch ends, even if replaced. */
+		if (v)
+		    *value = *v;
+		return k;
+	    }
+	}
+    };
+
+    static void write(Slot& s,long key,Value *value)
+    {
+	uint64_t seq = s.seq.load(std::memory_order_relaxed);
+	s.seq.store(seq + 1,std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	s.key.store(key,std::memory_order_relaxed);
+	s.value.store(value,std::memory_order_relaxed);
+	s.seq.store(seq + 2,std::memory_order_release);
+    };
+
+    /*
+     * Frees value once no reader can still see it, without waiting for
+     * readers.  Once a batch has built up, we move to the next epoch and
+     * set the batch aside until every reader counted into the epoch
+     * before has left; readers from earlier epochs had already left
+     * before the previous batch was freed.  Caller holds write_mutex.
+     */
+    void retire(Value *value)
+    {
+	retired.push_back(value);
+
+	if (!draining.empty()) {
+	    for (std::size_t i = 0; i < READER_SLOTS; ++i)
+		if (readers[i].n[draining_epoch & 1].load() != 0)
+		    return;
+	    for (auto it = draining.begin(); it != draining.end(); ++it)
+		delete *it;
+	    draining.clear();
+	}
+	if (retired.size() < RETIRE_BATCH)
+	    return;
+	draining_epoch = epoch.load();
+	epoch.store(draining_epoch + 1);
+	draining.swap(retired);
+    };
+
+    Slot *locate(long key)
+    {
+	if (key < 0)
+	    return NULL;
+	for (std::size_t i = 0, n = hash(key); i <= mask; ++i, ++n) {
+	    Slot& s = slots[n & mask];
+	    long k = s.key.load(std::memory_order_relaxed);
+	    if (k == EMPTY)
+		break;
+	    if (k == key)
+		return &s;
+	}
+	return NULL;
+    };
+
+    bool insert_locked(long key,std::shared_ptr<T> value)
+    {
+	if (key < 0 || count.load(std::memory_order_relaxed) >= limit)
+	    return false;
+
+	for (std::size_t i = 0, n = hash(key); i <= mask; ++i, ++n) {
+	    Slot& s = slots[n & mask];
+	    long k = s.key.load(std::memory_order_relaxed);
+	    if (k == key)
+		return false;
+	    if (k == EMPTY) {
+		write(s,key,new Value(std::move(value)));
+		++count;
+		return true;
+	    }
+	}
+	return false;
+    };
+
+    /*
+     * Empties slot hole, moving later entries of its probe run back
+     * into it until the run ends, so no entry is left beyond an empty
+     * slot on its probe path.  An entry is copied into the hole before
+     * its old slot is reused, so it is briefly in both.
+     */
+    void shift_out(std::size_t hole)
+    {
+	shifts.fetch_add(1,std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for (std::size_t j = (hole + 1) & mask; ; j = (j + 1) & mask) {
+	    long k = slots[j].key.load(std::memory_order_relaxed);
+	    if (k == EMPTY)
+		break;
+	    std::size_t home = hash(k) & mask;
+	    /* Stays put if its home is cyclically in (hole,j]. */
+	    if (hole <= j ? (hole < home && home <= j)
+			  : (hole < home || home <= j))
+		continue;
+	    write(slots[hole],k,slots[j].value.load(std::memory_order_relaxed));
+	    hole = j;
+	}
+	write(slots[hole],EMPTY,NULL);
+	shifts.fetch_add(1,std::memory_order_release);
+    };
+
+    std::size_t limit;
+    std::size_t mask;
+    std::unique_ptr<Slot[]> slots;
+    mutable std::mutex write_mutex;
+    std::atomic<std::size_t> count;
+    /* Odd while erase() is shifting entries. */
+    std::atomic<uint64_t> shifts;
+    std::atomic<uint64_t> epoch;
+    mutable ReaderCount readers[READER_SLOTS];
+    /* Replaced values that readers may still be copying. */
+    std::vector<Value *> retired;
+    /* Retired before epoch moved past draining_epoch. */
+    std::vector<Value *> draining;
+    uint64_t draining_epoch;
+};
+
+}
+
+#endif /* _E2AP_TABLE_H_ */
@@ -0,0 +1,89 @@
+#ifndef _E2AP_TIMER_H_
+#define _E2AP_TIMER_H_
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+namespace e2ap
+{
+
+class Request;
+
+typedef enum Procedure
+{
+    PROCEDURE_CONTROL = 0,
+    PROCEDURE_SUBSCRIPTION,
+    PROCEDURE_SUBSCRIPTION_DELETE,
+    PROCEDURE_MAX
+} Procedure_t;
+
+const char *procedure_to_string(Procedure_t procedure);
+
+/**
+ * How long to wait for the answer to a request before retransmitting
+ * it, and how many times to do so before giving up.  Each retry waits
+ * backoff times longer than the previous attempt.  A timeout_ms of 0
+ * disables tracking for the procedure.
+ */
+class RequestTimeout
+{
+ public:
+    RequestTimeout(unsigned int timeout_ms_ = 0,unsigned int max_retries_ = 0,
+		   unsigned int backoff_ = 2)
+	: timeout_ms(timeout_ms_),max_retries(max_retries_),backoff(backoff_) {};
+
+    unsigned int timeout_ms;
+    unsigned int max_retries;
+    unsigned int backoff;
+};
+
+/**
+ * A hashed timing wheel of request deadlines.  Scheduling appends to
+ * the slot the deadline hashes to, and each tick drains one slot, so
+ * both are O(1) regardless of how many requests are outstanding;
+ * deadlines beyond one revolution stay put until their turn comes
+ * around.  Deadlines are never cancelled: they hold only a weak
+ * reference, and the owner checks at expiry whether the request is
+ * still outstanding.
+ */
+class DeadlineWheel
+{
+ public:
+    class Deadline
+    {
+     public:
+	Deadline(Procedure_t procedure_,std::weak_ptr<Request> req_,
+		 unsigned int attempt_,uint64_t expires_ms_)
+	    : procedure(procedure_),req(req_),attempt(attempt_),
+	      expires_ms(expires_ms_) {};
+
+	Procedure_t procedure;
+	std::weak_ptr<Request> req;
+	/* 0 for the original transmission, then 1..max_retries. */
+	unsigned int attempt;
+	uint64_t expires_ms;
+    };
+
+    DeadlineWheel(unsigned int tick_ms_ = 50,unsigned int num_slots = 1024);
+
+    unsigned int get_tick_ms() const { return tick_ms; };
+    void schedule(const Deadline& deadline);
+    /* Moves every deadline due by now_ms into expired. */
+    void advance(uint64_t now_ms,std::vector<Deadline>& expired);
+    size_t size();
+
+ private:
+    const unsigned int tick_ms;
+    const uint64_t mask;
+    std::mutex mutex;
+    /* The next tick to drain. */
+    uint64_t tick;
+    size_t count;
+    std::vector<std::vector<Deadline>> slots;
+};
+
+}
+
+#endif /* _E2AP_TIMER_H_ */
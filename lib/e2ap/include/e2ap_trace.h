@@ -0,0 +1,161 @@
+#ifndef _E2AP_TRACE_H_
+#define _E2AP_TRACE_H_
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+#include "e2ap_metrics.h"
+
+namespace e2ap
+{
+
+/*
+ * The trace a thread is currently working on behalf of: an ID assigned
+ * when the triggering RMR message arrived, and its arrival time.  Zero
+ * IDs mean untraced work (e.g. northbound requests).
+ */
+class TraceContext
+{
+ public:
+    TraceContext()
+	: id(0),start_ns(0) {};
+    TraceContext(uint64_t id_,uint64_t start_ns_)
+	: id(id_),start_ns(start_ns_) {};
+
+    uint64_t id;
+    uint64_t start_ns;
+};
+
+class Span
+{
+ public:
+    /* A static string; spans only ever point at literals. */
+    const char *name;
+    uint64_t trace_id;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    long instance_id;
+    uint32_t tid;
+};
+
+/**
+ * A single thread's spans.  Only its owner writes; readers may copy it
+ * at any time, and use the per-slot sequence number to skip any slot
+ * the owner is overwriting.
+ */
+class TraceRing
+{
+ public:
+    TraceRing(size_t size,uint32_t tid_);
+    virtual ~TraceRing();
+
+    void record(const Span& span)
+    {
+	uint64_t n = head.load(std::memory_order_relaxed);
+	Slot& slot = slots[n & mask];
+	slot.seq.store(2 * n + 1,std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.span = span;
+	slot.span.tid = tid;
+	slot.seq.store(2 * n + 2,std::memory_order_release);
+	head.store(n + 1,std::memory_order_release);
+    };
+    void collect(std::vector<Span>& spans,uint64_t trace_id);
+
+ private:
+    class Slot {
+     public:
+	Slot()
+	    : seq(0) {};
+	std::atomic<uint64_t> seq;
+	Span span;
+    };
+
+    Slot *slots;
+    uint64_t mask;
+    uint32_t tid;
+    std::atomic<uint64_t> head;
+};
+
+/**
+ * Hands each recording thread its own TraceRing, so recording never
+ * takes a lock; collect() gathers every ring's spans.  Tracing is off
+ * until enable() is called.
+ */
+class Tracer
+{
+ public:
+    Tracer()
+	: enabled(false),ring_size(0),next_id(1),next_tid(1) {};
+    virtual ~Tracer() = default;
+
+    void enable(size_t ring_size_);
+    bool is_enabled() { return enabled.load(std::memory_order_relaxed); };
+    uint64_t next_trace_id() {
+	return next_id.fetch_add(1,std::memory_order_relaxed);
+    };
+    void record(const char *name,uint64_t trace_id,uint64_t start_ns,
+		uint64_t end_ns,long instance_id = -1)
+    {
+	if (!is_enabled())
+	    return;
+	Span span = { name,trace_id,start_ns,end_ns,instance_id,0 };
+	ring()->record(span);
+    };
+    /* All spans still held, or only trace_id's if it is nonzero. */
+    void collect(std::vector<Span>& spans,uint64_t trace_id = 0);
+
+ private:
+    TraceRing *ring();
+
+    std::atomic<bool> enabled;
+    size_t ring_size;
+    std::atomic<uint64_t> next_id;
+    std::atomic<uint32_t> next_tid;
+    std::mutex mutex;
+    std::vector<TraceRing *> rings;
+};
+
+/* The process-wide tracer. */
+Tracer& tracer();
+
+/* The calling thread's current trace. */
+TraceContext& trace_context();
+
+/* Sets the calling thread's trace for the life of the scope. */
+class TraceScope
+{
+ public:
+    TraceScope(const TraceContext& ctx)
+	: saved(trace_context()) { trace_context() = ctx; };
+    ~TraceScope() { trace_context() = saved; };
+
+ private:
+    TraceContext saved;
+};
+
+/* Records a span over its scope, in the calling thread's trace. */
+class ScopedSpan
+{
+ public:
+    ScopedSpan(const char *name_,long instance_id_ = -1)
+	: name(name_),instance_id(instance_id_),
+	  start(tracer().is_enabled() ? metrics_now_ns() : 0) {};
+    ~ScopedSpan()
+    {
+	if (start)
+	    tracer().record(name,trace_context().id,start,metrics_now_ns(),
+			    instance_id);
+    };
+
+ private:
+    const char *name;
+    long instance_id;
+    uint64_t start;
+};
+
+}
+
+#endif /* _E2AP_TRACE_H_ */
@@ -2,11 +2,13 @@
 #include <cassert>
 #include <string>
 #include <functional>
+#include <chrono>
 
 #include "mdclog/mdclog.h"
 #include "rmr/RIC_message_types.h"
 
 #include "e2ap.h"
+#include "e2ap_log.h"
 #include "e2sm.h"
 
 #include "E2AP_E2AP-PDU.h"
@@ -20,7 +22,8 @@
 namespace e2ap
 {
 
-bool xer_print = true;
+/* Per-PDU XER dumps, for debugging only; see PduTracer instead. */
+bool xer_print = false;
 
 static RanFunctionId next_ran_function_id = 0;
 
@@ -56,6 +59,23 @@ ssize_t encode_pdu(E2AP_E2AP_PDU_t *pdu,unsigned char **buf,ssize_t *len)
     return encoded;
 }
 
+/*
+ * Encodes pdu into a caller-supplied buffer, without allocating.
+ * Returns the number of bytes written, or -1 if the encoding failed or
+ * did not fit.
+ */
+ssize_t encode_pdu_into(E2AP_E2AP_PDU_t *pdu,unsigned char *dst,size_t dst_len)
+{
+    asn_enc_rval_t er;
+
+    er = aper_encode_to_buffer(&asn_DEF_E2AP_E2AP_PDU,0,pdu,dst,dst_len);
+    if (er.encoded < 0)
+	return -1;
+
+    /* aper_encode_to_buffer reports bits, not bytes. */
+    return (er.encoded + 7) / 8;
+}
+
 int decode(
     const struct asn_TYPE_descriptor_s *td,
     void *ptr,const unsigned char *buf,const size_t len)
@@ -74,17 +94,17 @@ int decode(
 
 #define CASE_E2AP_I(id,name)						\
     case id:								\
-    mdclog_write(MDCLOG_INFO,"decoded initiating " #name " (%ld)\n",id); \
+    E2AP_LOG(MDCLOG_INFO,"decoded initiating " #name " (%ld)\n",id);	\
     break
 
 #define CASE_E2AP_S(id,name)						\
     case id:								\
-    mdclog_write(MDCLOG_INFO,"decoded successful outcome " #name " (%ld)\n",id); \
+    E2AP_LOG(MDCLOG_INFO,"decoded successful outcome " #name " (%ld)\n",id);	\
     break
 
 #define CASE_E2AP_U(id,name)						\
     case id:								\
-    mdclog_write(MDCLOG_INFO,"decoded unsuccessful outcome " #name " (%ld)\n",id); \
+    E2AP_LOG(MDCLOG_INFO,"decoded unsuccessful outcome " #name " (%ld)\n",id);	\
     break
 
 int decode_pdu(E2AP_E2AP_PDU_t *pdu,
@@ -160,9 +180,44 @@ int decode_pdu(E2AP_E2AP_PDU_t *pdu,
 
 bool E2AP::init()
 {
+    bool tracking = false;
+
+    for (int i = 0; i < PROCEDURE_MAX; ++i)
+	if (timeouts[i].timeout_ms > 0)
+	    tracking = true;
+    if (tracking && !timer_thread) {
+	timer_stop = false;
+	timer_thread = new std::thread(&E2AP::timer_handler,this);
+    }
+
     return true;
 }
 
+void E2AP::stop()
+{
+    if (!timer_thread)
+	return;
+
+    timer_mutex.lock();
+    timer_stop = true;
+    timer_mutex.unlock();
+    timer_cv.notify_all();
+    timer_thread->join();
+    delete timer_thread;
+    timer_thread = NULL;
+}
+
+ssize_t Message::encode_into(unsigned char *dst,size_t dst_len)
+{
+    if (!encode())
+	return -1;
+    if ((size_t)len > dst_len)
+	return -1;
+    memcpy(dst,buf,len);
+
+    return len;
+}
+
 /**
  * We don't want to expose any asn1c goo in the public library header,
  * so in lieu of exposing per-message class decode() functions (where we
@@ -340,8 +395,8 @@ static Indication *decode_indication(E2AP *e2ap,E2AP_E2AP_PDU_t *pdu,int subid)
     }
 
     if (subid < 0) {
-	mdclog_write(MDCLOG_WARN,"indication has invalid subscriptionID (%d); aborting processing",
-		     subid);
+	E2AP_LOG_LIMIT(MDCLOG_WARN,1,"indication has invalid subscriptionID (%d); aborting processing",
+		       subid);
 	delete ret;
 	return NULL;
     }
@@ -358,8 +413,8 @@ static Indication *decode_indication(E2AP *e2ap,E2AP_E2AP_PDU_t *pdu,int subid)
      */
     std::shared_ptr<SubscriptionResponse> resp = e2ap->lookup_subscription(subid);
     if (!resp) {
-	mdclog_write(MDCLOG_ERR,"indication subscriptionID not found (%d); ignoring",
-		     subid);
+	E2AP_LOG_LIMIT(MDCLOG_ERR,1,"indication subscriptionID not found (%d); ignoring",
+		       subid);
 	delete ret;
 	return NULL;
     }
@@ -371,7 +426,7 @@ static Indication *decode_indication(E2AP *e2ap,E2AP_E2AP_PDU_t *pdu,int subid)
 	e2sm::Indication *sm_ind = model->decode(
 	    ret,header,header_len,message,message_len);
 	if (!sm_ind) {
-	    mdclog_write(MDCLOG_ERR,"error decoding model indication header/message");
+	    E2AP_LOG_LIMIT(MDCLOG_ERR,1,"error decoding model indication header/message");
 	    delete ret;
 	    return NULL;
 	}
@@ -415,7 +470,7 @@ static ErrorIndication *decode_error_indication(E2AP *e2ap,E2AP_E2AP_PDU_t *pdu)
     return ret;
 }
 
-static SubscriptionResponse *decode_subscription_response(E2AP *e2ap,E2AP_E2AP_PDU_t *pdu,std::string& xid)
+static SubscriptionResponse *decode_subscription_response(E2AP *e2ap,E2AP_E2AP_PDU_t *pdu,std::string_view xid)
 {
     assert(pdu->present == E2AP_E2AP_PDU_PR_successfulOutcome
 	   && pdu->choice.successfulOutcome.procedureCode \
@@ -463,8 +518,8 @@ static SubscriptionResponse *decode_subscription_response(E2AP *e2ap,E2AP_E2AP_P
      */
     std::shared_ptr<SubscriptionRequest> req = e2ap->lookup_pending_subscription(xid);
     if (!req) {
-	mdclog_write(MDCLOG_ERR,"subscription xid (%s) not found; ignoring",
-		     xid.c_str());
+	mdclog_write(MDCLOG_ERR,"subscription xid (%.*s) not found; ignoring",
+		     (int)xid.size(),xid.data());
 	delete ret;
 	return NULL;
     }
@@ -474,7 +529,7 @@ static SubscriptionResponse *decode_subscription_response(E2AP *e2ap,E2AP_E2AP_P
     return ret;
 }
 
-static SubscriptionFailure *decode_subscription_failure(E2AP *e2ap,E2AP_E2AP_PDU_t *pdu,std::string& xid)
+static SubscriptionFailure *decode_subscription_failure(E2AP *e2ap,E2AP_E2AP_PDU_t *pdu,std::string_view xid)
 {
     assert(pdu->present == E2AP_E2AP_PDU_PR_unsuccessfulOutcome
 	   && pdu->choice.unsuccessfulOutcome.procedureCode \
@@ -533,8 +588,8 @@ static SubscriptionFailure *decode_subscription_failure(E2AP *e2ap,E2AP_E2AP_PDU
      */
     std::shared_ptr<SubscriptionRequest> req = e2ap->lookup_pending_subscription(xid);
     if (!req) {
-	mdclog_write(MDCLOG_ERR,"subscription xid (%s) not found; ignoring",
-		     xid.c_str());
+	mdclog_write(MDCLOG_ERR,"subscription xid (%.*s) not found; ignoring",
+		     (int)xid.size(),xid.data());
 	delete ret;
 	return NULL;
     }
@@ -544,7 +599,7 @@ static SubscriptionFailure *decode_subscription_failure(E2AP *e2ap,E2AP_E2AP_PDU
     return ret;
 }
 
-static SubscriptionDeleteResponse *decode_subscription_delete_response(E2AP *e2ap,E2AP_E2AP_PDU_t *pdu,std::string& xid)
+static SubscriptionDeleteResponse *decode_subscription_delete_response(E2AP *e2ap,E2AP_E2AP_PDU_t *pdu,std::string_view xid)
 {
     assert(pdu->present == E2AP_E2AP_PDU_PR_successfulOutcome
 	   && pdu->choice.successfulOutcome.procedureCode \
@@ -575,8 +630,8 @@ static SubscriptionDeleteResponse *decode_subscription_delete_response(E2AP *e2a
      */
     std::shared_ptr<SubscriptionDeleteRequest> req = e2ap->lookup_pending_subscription_delete(xid);
     if (!req) {
-	mdclog_write(MDCLOG_ERR,"subscription delete xid (%s) not found; ignoring",
-		     xid.c_str());
+	mdclog_write(MDCLOG_ERR,"subscription delete xid (%.*s) not found; ignoring",
+		     (int)xid.size(),xid.data());
 	delete ret;
 	return NULL;
     }
@@ -586,7 +641,7 @@ static SubscriptionDeleteResponse *decode_subscription_delete_response(E2AP *e2a
     return ret;
 }
 
-static SubscriptionDeleteFailure *decode_subscription_delete_failure(E2AP *e2ap,E2AP_E2AP_PDU_t *pdu,std::string& xid)
+static SubscriptionDeleteFailure *decode_subscription_delete_failure(E2AP *e2ap,E2AP_E2AP_PDU_t *pdu,std::string_view xid)
 {
     assert(pdu->present == E2AP_E2AP_PDU_PR_unsuccessfulOutcome
 	   && pdu->choice.unsuccessfulOutcome.procedureCode \
@@ -623,7 +678,8 @@ static SubscriptionDeleteFailure *decode_subscription_delete_failure(E2AP *e2ap,
      */
     std::shared_ptr<SubscriptionDeleteRequest> req = e2ap->lookup_pending_subscription_delete(xid);
     if (!req) {
-	mdclog_write(MDCLOG_ERR,"subscription delete xid (%s) not found; ignoring",xid.c_str());
+	mdclog_write(MDCLOG_ERR,"subscription delete xid (%.*s) not found; ignoring",
+		     (int)xid.size(),xid.data());
 	delete ret;
 	return NULL;
     }
@@ -633,18 +689,104 @@ static SubscriptionDeleteFailure *decode_subscription_delete_failure(E2AP *e2ap,
     return ret;
 }
 
-bool E2AP::handle_message(const unsigned char *buf,ssize_t len,int subid,
-			  std::string meid,std::string xid)
+void E2AP::init_metrics()
+{
+    MetricsRegistry& registry = metrics();
+
+    handle_latency = registry.histogram(
+	"nexran_e2ap_handle_seconds",
+	"Time to decode and dispatch an inbound E2AP message.");
+    decode_failures = registry.counter(
+	"nexran_e2ap_decode_failures_total",
+	"Inbound E2AP messages that could not be decoded.");
+    control_send_latency = registry.histogram(
+	"nexran_e2ap_control_send_seconds",
+	"Time to encode and send an E2 control request.");
+    control_reaction_latency = registry.histogram(
+	"nexran_e2ap_control_reaction_seconds",
+	"Time from receiving the message that triggered an E2 control request to its answer.");
+    controls_sent = registry.counter(
+	"nexran_e2ap_control_requests_total",
+	"E2 control requests sent.");
+    control_send_failures = registry.counter(
+	"nexran_e2ap_control_send_failures_total",
+	"E2 control requests that could not be sent.");
+    control_acks = registry.counter(
+	"nexran_e2ap_control_outcomes_total",
+	"Answers to E2 control requests, by outcome.","outcome=\"ack\"");
+    control_failures = registry.counter(
+	"nexran_e2ap_control_outcomes_total",
+	"Answers to E2 control requests, by outcome.","outcome=\"failure\"");
+    control_timeouts = registry.counter(
+	"nexran_e2ap_control_outcomes_total",
+	"Answers to E2 control requests, by outcome.","outcome=\"timeout\"");
+    table_full[PROCEDURE_CONTROL] = registry.counter(
+	"nexran_e2ap_table_full_total",
+	"E2 requests refused because too many were already in flight.",
+	"procedure=\"control\"");
+    table_full[PROCEDURE_SUBSCRIPTION] = registry.counter(
+	"nexran_e2ap_table_full_total",
+	"E2 requests refused because too many were already in flight.",
+	"procedure=\"subscription\"");
+    table_full[PROCEDURE_SUBSCRIPTION_DELETE] = registry.counter(
+	"nexran_e2ap_table_full_total",
+	"E2 requests refused because too many were already in flight.",
+	"procedure=\"subscription_delete\"");
+}
+
+void E2AP::refused(Procedure_t procedure)
+{
+    table_full[procedure]->inc();
+    mdclog_write(MDCLOG_ERR,
+		 "too many %s requests in flight (%lu); raise the table capacity\n",
+		 procedure == PROCEDURE_CONTROL ? "control"
+		   : (procedure == PROCEDURE_SUBSCRIPTION ? "subscription"
+		      : "subscription delete"),
+		 get_num_pending(procedure));
+}
+
+static long pdu_procedure_code(E2AP_E2AP_PDU_t *pdu)
 {
+    switch (pdu->present) {
+    case E2AP_E2AP_PDU_PR_initiatingMessage:
+	return pdu->choice.initiatingMessage.procedureCode;
+    case E2AP_E2AP_PDU_PR_successfulOutcome:
+	return pdu->choice.successfulOutcome.procedureCode;
+    case E2AP_E2AP_PDU_PR_unsuccessfulOutcome:
+	return pdu->choice.unsuccessfulOutcome.procedureCode;
+    default:
+	return -1;
+    }
+}
+
+/*
+ * Decodes and dispatches one inbound message.  msg is only borrowed;
+ * nothing here copies its buffer, meid, or xid.
+ */
+bool E2AP::handle_message(const MessageView& msg)
+{
+    ScopedTimer timer(handle_latency);
     E2AP_E2AP_PDU_t pdu;
     int ret;
     bool bret = false;
+    int subid = msg.subid;
+    std::string_view xid = msg.xid;
+    int meid_len = (int)msg.meid.size();
+    const char *meid = msg.meid.data();
 
     memset(&pdu,0,sizeof(pdu));
-    ret = decode_pdu(&pdu,buf,len);
+    {
+	ScopedSpan span("e2ap_decode");
+	ret = decode_pdu(&pdu,msg.buf,msg.len);
+    }
+    if (pdu_tracer.is_enabled())
+	pdu_tracer.record(PduTracer::INBOUND,
+			  (ret < 0) ? -1 : pdu_procedure_code(&pdu),
+			  meid,meid_len,msg.buf,msg.len);
     if (ret < 0) {
-	mdclog_write(MDCLOG_ERR,"failed to decode E2AP PDU from %s\n",
-		     meid.c_str());
+	decode_failures->inc();
+	mdclog_write(MDCLOG_ERR,"failed to decode E2AP PDU from %.*s\n",
+		     meid_len,meid);
 	return false;
     }
 
@@ -667,8 +809,8 @@ bool E2AP::handle_message(const unsigned char *buf,ssize_t len,int subid,
 	    break;
 	default:
 	    mdclog_write(MDCLOG_WARN,
-			 "unsupported initiatingMessage procedure %ld from %s\n",
-			 pdu.choice.initiatingMessage.procedureCode,meid.c_str());
+			 "unsupported initiatingMessage procedure %ld from %.*s\n",
+			 pdu.choice.initiatingMessage.procedureCode,meid_len,meid);
 	    ASN_STRUCT_FREE_CONTENTS_ONLY(asn_DEF_E2AP_E2AP_PDU,&pdu);
 	    return false;
 	};
@@ -679,12 +821,11 @@ bool E2AP::handle_message(const unsigned char *buf,ssize_t len,int subid,
 	    {
 		SubscriptionResponse *resp = decode_subscription_response(this,&pdu,xid);
 		if (resp) {
-		    mdclog_write(MDCLOG_DEBUG,"subscription request succeeded (xid=%s,subid=%d)\n",
-				 xid.c_str(),subid);
-		    mutex.lock();
-		    subscriptions[subid] = std::shared_ptr<SubscriptionResponse>(resp);
-		    pending_subscriptions.erase(xid);
-		    mutex.unlock();
+		    E2AP_LOG(MDCLOG_DEBUG,"subscription request succeeded (xid=%s,subid=%d)\n",
+			     std::string(xid).c_str(),subid);
+		    subscriptions.set(subid,std::shared_ptr<SubscriptionResponse>(resp));
+		    if (resp->req)
+			pending_subscriptions.erase(resp->req->instance_id);
 		    bret = agent_if->handle(resp);
 		}
 	    }
@@ -693,12 +834,11 @@ bool E2AP::handle_message(const unsigned char *buf,ssize_t len,int subid,
 	    {
 		SubscriptionDeleteResponse *resp = decode_subscription_delete_response(this,&pdu,xid);
 		if (resp) {
-		    mdclog_write(MDCLOG_DEBUG,"subscription delete request succeeded (xid=%s,subid=%d)\n",
-				 xid.c_str(),subid);
-		    mutex.lock();
+		    E2AP_LOG(MDCLOG_DEBUG,"subscription delete request succeeded (xid=%s,subid=%d)\n",
+			     std::string(xid).c_str(),subid);
 		    subscriptions.erase(subid);
-		    pending_deletes.erase(xid);
-		    mutex.unlock();
+		    if (resp->req)
+			pending_deletes.erase(resp->req->instance_id);
 		    bret = agent_if->handle(resp);
 		}
 	    }
@@ -707,6 +847,9 @@ bool E2AP::handle_message(const unsigned char *buf,ssize_t len,int subid,
 	    {
 		ControlAck *ack = decode_control_ack(this,&pdu);
 		if (ack) {
+		    control_acks->inc();
+		    if (ack->req != NULL)
+			answered(ack->req.get(),"control_ack");
 		    bret = agent_if->handle(ack);
 		    if (ack->req != NULL)
 			controls.erase(ack->req->instance_id);
@@ -716,8 +859,8 @@ bool E2AP::handle_message(const unsigned char *buf,ssize_t len,int subid,
 	    break;
 	default:
 	    mdclog_write(MDCLOG_WARN,
-			 "unsupported successfulOutcome procedure %ld from %s\n",
-			 pdu.choice.initiatingMessage.procedureCode,meid.c_str());
+			 "unsupported successfulOutcome procedure %ld from %.*s\n",
+			 pdu.choice.initiatingMessage.procedureCode,meid_len,meid);
 	    ASN_STRUCT_FREE_CONTENTS_ONLY(asn_DEF_E2AP_E2AP_PDU,&pdu);
 	    return false;
 	};
@@ -742,6 +885,9 @@ bool E2AP::handle_message(const unsigned char *buf,ssize_t len,int subid,
 	    {
 		ControlFailure *failure = decode_control_failure(this,&pdu);
 		if (failure) {
+		    control_failures->inc();
+		    if (failure->req != NULL)
+			answered(failure->req.get(),"control_failure");
 		    bret = agent_if->handle(failure);
 		    if (failure->req != NULL)
 			controls.erase(failure->req->instance_id);
@@ -751,15 +897,15 @@ bool E2AP::handle_message(const unsigned char *buf,ssize_t len,int subid,
 	    break;
 	default:
 	    mdclog_write(MDCLOG_WARN,
-			 "unsupported unsuccessfulOutcome procedure %ld from %s\n",
-			 pdu.choice.initiatingMessage.procedureCode,meid.c_str());
+			 "unsupported unsuccessfulOutcome procedure %ld from %.*s\n",
+			 pdu.choice.initiatingMessage.procedureCode,meid_len,meid);
 	    ASN_STRUCT_FREE_CONTENTS_ONLY(asn_DEF_E2AP_E2AP_PDU,&pdu);
 	    return false;
 	};
 	break;
     default:
-	mdclog_write(MDCLOG_ERR,"unsupported presence %u from %s\n",
-		     pdu.present,meid.c_str());
+	mdclog_write(MDCLOG_ERR,"unsupported presence %u from %.*s\n",
+		     pdu.present,meid_len,meid);
 	ASN_STRUCT_FREE_CONTENTS_ONLY(asn_DEF_E2AP_E2AP_PDU,&pdu);
 	return false;
     }
@@ -791,41 +937,133 @@ static std::string req_to_xid(long req_id,long inst_id)
     return std::string(std::to_string(req_id) + "." + std::to_string(inst_id));
 }
 
+/*
+ * Records the answer to a traced request as a span in the request's
+ * trace, covering the wait since the triggering message arrived.
+ */
+void E2AP::answered(Request *req,const char *span_name)
+{
+    if (req->trace.start_ns == 0)
+	return;
+
+    uint64_t now = metrics_now_ns();
+    control_reaction_latency->record(now - req->trace.start_ns);
+    tracer().record(span_name,req->trace.id,req->trace.start_ns,now,
+		    req->instance_id);
+}
+
+/*
+ * Retransmits run on the timer thread, so send in the request's own
+ * trace rather than the caller's.
+ */
+bool E2AP::transmit(Procedure_t procedure,Request *req)
+{
+    TraceScope scope(req->trace);
+
+    switch (procedure) {
+    case PROCEDURE_CONTROL:
+	return agent_if->send_message(
+	    req,RIC_CONTROL_REQ,req_to_subid(req->requestor_id,req->instance_id),
+	    req->meid,std::string());
+    case PROCEDURE_SUBSCRIPTION:
+	return agent_if->send_message(
+	    req,RIC_SUB_REQ,-1,req->meid,
+	    req_to_xid(req->requestor_id,req->instance_id));
+    case PROCEDURE_SUBSCRIPTION_DELETE:
+	return agent_if->send_message(
+	    req,RIC_SUB_DEL_REQ,req_to_subid(req->requestor_id,req->instance_id),
+	    req->meid,req_to_xid(req->requestor_id,req->instance_id));
+    default:
+	return false;
+    }
+}
+
 bool E2AP::send_control_request(std::shared_ptr<ControlRequest> req,
 				const std::string& meid)
 {
-    if (!req->encode())
+    ScopedTimer timer(control_send_latency);
+
+    /* The agent encodes the request directly into its send buffer. */
+    if (req->ack_request == CONTROL_REQUEST_ACK
+	&& !controls.insert(req->instance_id,req)) {
+	control_send_failures->inc();
+	if (controls.full())
+	    refused(PROCEDURE_CONTROL);
+	else
+	    mdclog_write(MDCLOG_ERR,
+			 "control request already pending; not sending" \
+			 " (requestor_id=%ld,instance_id=%ld,meid=%s)\n",
+			 req->requestor_id,req->instance_id,meid.c_str());
 	return false;
-
-    if (req->ack_request == CONTROL_REQUEST_ACK) {
-	mutex.lock();
-	if (controls.count(req->instance_id) > 0) {
-	    mutex.unlock();
-	    return false;
-	}
-
-	controls[req->instance_id] = req;
-	mutex.unlock();
     }
 
     int subid = req_to_subid(req->requestor_id,req->instance_id);
-    bool ret = agent_if->send_message(req->get_buf(),req->get_len(),
-				      RIC_CONTROL_REQ,subid,meid,
-				      std::string());
-    if (!ret && req->ack_request == CONTROL_REQUEST_ACK) {
-	mutex.lock();
-	controls.erase(req->instance_id);
-	mutex.unlock();
+    req->set_meid(meid);
+    req->trace = trace_context();
+    bool ret = transmit(PROCEDURE_CONTROL,req.get());
+    if (!ret) {
+	control_send_failures->inc();
+	if (req->ack_request == CONTROL_REQUEST_ACK)
+	    controls.erase(req->instance_id);
+    }
+    else {
+	controls_sent->inc();
+	if (req->ack_request == CONTROL_REQUEST_ACK)
+	    arm(PROCEDURE_CONTROL,req,0);
+	E2AP_LOG(MDCLOG_DEBUG,
+		 "sent control request" \
+		 " (subid=%d,requestor_id=%ld,instance_id=%ld,meid=%s)\n",
+		 subid,req->requestor_id,req->instance_id,meid.c_str());
     }
-    else
-	mdclog_write(MDCLOG_DEBUG,
-		     "sent control request" \
-		     " (subid=%d,requestor_id=%ld,instance_id=%ld,meid=%s)\n",
-		     subid,req->requestor_id,req->instance_id,meid.c_str());
 
     return ret;
 }
 
+/*
+ * Sends control to each of meids, as separate requests (each needs its
+ * own RICrequestID).  Rather than encoding the whole PDU once per
+ * destination, we encode a template once and patch the instance ID
+ * into each copy.  Returns the number of requests sent; if requests is
+ * non-NULL, the sent requests are appended to it.
+ */
+int E2AP::send_control_fanout(std::shared_ptr<e2sm::Control> control,
+			      const std::list<std::string>& meids,
+			      RanFunctionId function_id,
+			      ControlRequestAck_t ack_request,
+			      std::list<std::shared_ptr<ControlRequest>> *requests)
+{
+    std::shared_ptr<const ControlTemplate> tmpl;
+    long rid = get_requestor_id();
+    int sent = 0;
+
+    if (meids.size() > 1) {
+	ControlRequest probe(rid,0,function_id,control,ack_request);
+	tmpl.reset(ControlTemplate::create(&probe));
+	if (!tmpl)
+	    mdclog_write(MDCLOG_WARN,
+			 "cannot build control template; encoding %lu requests individually\n",
+			 meids.size());
+    }
+
+    for (auto it = meids.begin(); it != meids.end(); ++it) {
+	std::shared_ptr<ControlRequest> req = std::make_shared<ControlRequest>(
+	    rid,get_next_instance_id(),function_id,control,ack_request);
+	req->set_meid(*it);
+	req->tmpl = tmpl;
+	if (!send_control_request(req,*it)) {
+	    mdclog_write(MDCLOG_ERR,
+			 "control request not sent to %s (instance_id=%ld)\n",
+			 it->c_str(),req->instance_id);
+	    continue;
+	}
+	++sent;
+	if (requests)
+	    requests->push_back(req);
+    }
+
+    return sent;
+}
+
 bool E2AP::send_subscription_request(std::shared_ptr<SubscriptionRequest> req,
 				     const std::string& meid)
 {
@@ -833,36 +1071,35 @@ bool E2AP::send_subscription_request(std::shared_ptr<SubscriptionRequest> req,
 	return false;
 
     std::string xid = req_to_xid(req->requestor_id,req->instance_id);
-    mutex.lock();
-    if (pending_subscriptions.count(xid) > 0) {
-	mutex.unlock();
+    if (!pending_subscriptions.insert(req->instance_id,req)) {
+	if (pending_subscriptions.full()) {
+	    refused(PROCEDURE_SUBSCRIPTION);
+	    return false;
+	}
 	mdclog_write(MDCLOG_WARN,
 		     "subscription request already exists; not sending" \
 		     " (xid=%s,requestor_id=%ld,instance_id=%ld,meid=%s)\n",
 		     xid.c_str(),req->requestor_id,req->instance_id,meid.c_str());
 	return false;
     }
-    pending_subscriptions[xid] = req;
-    mutex.unlock();
 
-    bool ret = agent_if->send_message(req->get_buf(),req->get_len(),
-				      RIC_SUB_REQ,-1,meid,xid);
-    if (!ret) {
-	mutex.lock();
-	pending_subscriptions.erase(xid);
-	mutex.unlock();
+    req->set_meid(meid);
+    bool ret = transmit(PROCEDURE_SUBSCRIPTION,req.get());
+    if (!ret)
+	pending_subscriptions.erase(req->instance_id);
+    else {
+	arm(PROCEDURE_SUBSCRIPTION,req,0);
+	E2AP_LOG(MDCLOG_DEBUG,
+		 "sent subscription request" \
+		 " (xid=%s,requestor_id=%ld,instance_id=%ld,meid=%s)\n",
+		 xid.c_str(),req->requestor_id,req->instance_id,meid.c_str());
     }
-    else
-	mdclog_write(MDCLOG_DEBUG,
-		     "sent subscription request" \
-		     " (xid=%s,requestor_id=%ld,instance_id=%ld,meid=%s)\n",
-		     xid.c_str(),req->requestor_id,req->instance_id,meid.c_str());
 
     return ret;
 }
 
-bool E2AP::_send_subscription_delete_request(std::shared_ptr<SubscriptionDeleteRequest> req,
-					     const std::string& meid, bool locked)
+bool E2AP::send_subscription_delete_request(std::shared_ptr<SubscriptionDeleteRequest> req,
+					    const std::string& meid)
 {
     if (!req->encode())
 	return false;
@@ -870,203 +1107,500 @@ bool E2AP::_send_subscription_delete_request(std::shared_ptr<SubscriptionDeleteR
     std::string xid = req_to_xid(req->requestor_id,req->instance_id);
     int subid = req_to_subid(req->requestor_id,req->instance_id);
 
-    if (!locked)
-	mutex.lock();
-    if (pending_deletes.count(xid) > 0) {
-	if (!locked)
-	    mutex.unlock();
+    if (!pending_deletes.insert(req->instance_id,req)) {
+	if (pending_deletes.full()) {
+	    refused(PROCEDURE_SUBSCRIPTION_DELETE);
+	    return false;
+	}
 	mdclog_write(MDCLOG_WARN,
 		     "subscription delete request already exists; not sending" \
 		     " (subid=%d,requestor_id=%ld,instance_id=%ld,meid=%s)\n",
 		     subid,req->requestor_id,req->instance_id,meid.c_str());
 	return false;
     }
-    pending_deletes[xid] = req;
-    if (!locked)
-	mutex.unlock();
 
-    bool ret = agent_if->send_message(req->get_buf(),req->get_len(),
-				      RIC_SUB_DEL_REQ,subid,meid,xid);
-    if (!ret) {
-	if (!locked)
-	    mutex.lock();
-	pending_deletes.erase(xid);
-	if (!locked)
-	    mutex.unlock();
+    req->set_meid(meid);
+    bool ret = transmit(PROCEDURE_SUBSCRIPTION_DELETE,req.get());
+    if (!ret)
+	pending_deletes.erase(req->instance_id);
+    else {
+	arm(PROCEDURE_SUBSCRIPTION_DELETE,req,0);
+	E2AP_LOG(MDCLOG_DEBUG,
+		 "sent subscription delete request" \
+		 " (subid=%d,requestor_id=%ld,instance_id=%ld,meid=%s)\n",
+		 subid,req->requestor_id,req->instance_id,meid.c_str());
     }
-    else
-	mdclog_write(MDCLOG_DEBUG,
-		     "sent subscription delete request" \
-		     " (subid=%d,requestor_id=%ld,instance_id=%ld,meid=%s)\n",
-		     subid,req->requestor_id,req->instance_id,meid.c_str());
 
     return ret;
 }
 
-bool E2AP::send_subscription_delete_request(std::shared_ptr<SubscriptionDeleteRequest> req,
-					    const std::string& meid)
-{
-    const std::lock_guard<std::mutex> lock(mutex);
-
-    return _send_subscription_delete_request(req, meid, true);
-}
-
 bool E2AP::delete_all_subscriptions
     (std::string& meid)
 {
-    const std::lock_guard<std::mutex> lock(mutex);
+    std::list<std::shared_ptr<SubscriptionResponse>> matches;
 
-    for (auto it = subscriptions.begin(); it != subscriptions.end(); ++it) {
-	if (it->second->req->meid != meid)
-	    continue;
+    subscriptions.for_each(
+	[&](long subid,const std::shared_ptr<SubscriptionResponse>& resp) {
+	    if (resp->req && resp->req->meid == meid)
+		matches.push_back(resp);
+	});
 
+    for (auto it = matches.begin(); it != matches.end(); ++it) {
 	std::shared_ptr<e2ap::SubscriptionDeleteRequest> req = \
 	    std::make_shared<e2ap::SubscriptionDeleteRequest>(
-		it->second->requestor_id,it->second->instance_id,
-		it->second->function_id);
+		(*it)->requestor_id,(*it)->instance_id,(*it)->function_id);
 	req->set_meid(meid);
-	_send_subscription_delete_request(req, meid, true);
+	send_subscription_delete_request(req,meid);
     }
 
     return true;
 }
 
-std::shared_ptr<SubscriptionRequest> E2AP::lookup_pending_subscription
-    (std::string& xid)
+/*
+ * Our xids are "<requestor_id>.<instance_id>" (see req_to_xid); the
+ * pending tables are keyed by the instance ID.  Returns -1 if xid is
+ * not one of ours.
+ */
+static long xid_to_instance_id(std::string_view xid,long requestor_id)
 {
-    const std::lock_guard<std::mutex> lock(mutex);
+    std::string_view::size_type dot = xid.find('.');
+    if (dot == std::string_view::npos || dot == 0 || dot + 1 >= xid.size())
+	return -1;
 
-    if (pending_subscriptions.count(xid) > 0)
-	return pending_subscriptions[xid];
-    return NULL;
+    long rid = 0, iid = 0;
+    for (std::string_view::size_type i = 0; i < xid.size(); ++i) {
+	if (i == dot)
+	    continue;
+	if (xid[i] < '0' || xid[i] > '9' || rid > 0xffff || iid > 0xffff)
+	    return -1;
+	if (i < dot)
+	    rid = rid * 10 + (xid[i] - '0');
+	else
+	    iid = iid * 10 + (xid[i] - '0');
+    }
+    if (rid != requestor_id)
+	return -1;
+    return iid;
+}
+
+std::shared_ptr<SubscriptionRequest> E2AP::lookup_pending_subscription
+    (std::string_view xid)
+{
+    return pending_subscriptions.find(xid_to_instance_id(xid,requestor_id));
 }
 
 std::shared_ptr<SubscriptionResponse> E2AP::lookup_subscription
     (int subid)
 {
-    const std::lock_guard<std::mutex> lock(mutex);
-
-    if (subscriptions.count(subid) > 0)
-	return subscriptions[subid];
-    return NULL;
+    return subscriptions.find(subid);
 }
 
 std::shared_ptr<SubscriptionDeleteRequest> E2AP::lookup_pending_subscription_delete
-    (std::string& xid)
+    (std::string_view xid)
 {
-    const std::lock_guard<std::mutex> lock(mutex);
-
-    if (pending_deletes.count(xid) > 0)
-	return pending_deletes[xid];
-    return NULL;
+    return pending_deletes.find(xid_to_instance_id(xid,requestor_id));
 }
 
 std::shared_ptr<ControlRequest> E2AP::lookup_control
     (long requestor_id,long instance_id)
 {
-    const std::lock_guard<std::mutex> lock(mutex);
+    return controls.find(instance_id);
+}
 
-    if (controls.count(instance_id) > 0)
-	return controls[instance_id];
-    return NULL;
+long E2AP::get_next_instance_id()
+{
+    long id = 0;
+
+    /*
+     * The tables never hold anywhere near 64k requests, so this finds
+     * a free ID within a few tries even right after a wrap.
+     */
+    for (unsigned int tries = 0; tries < 0x10000; ++tries) {
+	id = next_instance_id.fetch_add(1,std::memory_order_relaxed) & 0xffff;
+	if (id == 0)
+	    continue;
+	if (controls.contains(id) || pending_subscriptions.contains(id)
+	    || pending_deletes.contains(id))
+	    continue;
+	return id;
+    }
+
+    /* Every ID is in flight; the insert will refuse the request. */
+    return id;
 }
 
-bool ControlRequest::encode()
+void E2AP::set_capacity(Procedure_t procedure,size_t capacity)
+{
+    switch (procedure) {
+    case PROCEDURE_CONTROL:
+	controls.resize(capacity);
+	break;
+    case PROCEDURE_SUBSCRIPTION:
+	pending_subscriptions.resize(capacity);
+	subscriptions.resize(capacity);
+	break;
+    case PROCEDURE_SUBSCRIPTION_DELETE:
+	pending_deletes.resize(capacity);
+	break;
+    default:
+	break;
+    }
+}
+
+uint64_t E2AP::get_expiry_ms(Procedure_t procedure)
+{
+    const RequestTimeout& timeout = timeouts[procedure];
+    uint64_t delay = timeout.timeout_ms;
+    uint64_t total = 0;
+
+    for (unsigned int i = 0; i <= timeout.max_retries; ++i) {
+	total += delay;
+	delay *= timeout.backoff;
+    }
+    return total;
+}
+
+size_t E2AP::get_num_pending(Procedure_t procedure)
+{
+    switch (procedure) {
+    case PROCEDURE_CONTROL:
+	return controls.size();
+    case PROCEDURE_SUBSCRIPTION:
+	return pending_subscriptions.size();
+    case PROCEDURE_SUBSCRIPTION_DELETE:
+	return pending_deletes.size();
+    default:
+	return 0;
+    }
+}
+
+static uint64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+	std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * Schedules the deadline for the given attempt at req.  Each retry
+ * waits backoff times longer than the last.
+ */
+void E2AP::arm(Procedure_t procedure,std::shared_ptr<Request> req,
+	       unsigned int attempt)
+{
+    const RequestTimeout& timeout = timeouts[procedure];
+    uint64_t delay = timeout.timeout_ms;
+
+    if (delay == 0 || !timer_thread)
+	return;
+    for (unsigned int i = 0; i < attempt; ++i)
+	delay *= timeout.backoff;
+    deadlines.schedule(
+	DeadlineWheel::Deadline(procedure,req,attempt,now_ms() + delay));
+}
+
+/*
+ * A deadline passed.  If the request has been answered (or replaced)
+ * in the meantime, there is nothing to do; otherwise, retransmit it or,
+ * once its retries are exhausted, stop tracking it and tell the agent.
+ */
+void E2AP::expire(const DeadlineWheel::Deadline& deadline)
+{
+    std::shared_ptr<Request> req = deadline.req.lock();
+    if (!req)
+	return;
+
+    Request *pending = NULL;
+    switch (deadline.procedure) {
+    case PROCEDURE_CONTROL:
+	pending = controls.find(req->instance_id).get();
+	break;
+    case PROCEDURE_SUBSCRIPTION:
+	pending = pending_subscriptions.find(req->instance_id).get();
+	break;
+    case PROCEDURE_SUBSCRIPTION_DELETE:
+	pending = pending_deletes.find(req->instance_id).get();
+	break;
+    default:
+	break;
+    }
+    if (pending != req.get())
+	return;
+
+    const char *pname = procedure_to_string(deadline.procedure);
+    if (deadline.attempt < timeouts[deadline.procedure].max_retries) {
+	mdclog_write(MDCLOG_INFO,
+		     "%s request unanswered; retransmitting" \
+		     " (requestor_id=%ld,instance_id=%ld,meid=%s,attempt=%u)\n",
+		     pname,req->requestor_id,req->instance_id,req->meid.c_str(),
+		     deadline.attempt + 1);
+	++retransmits;
+	if (!transmit(deadline.procedure,req.get()))
+	    mdclog_write(MDCLOG_WARN,"failed to retransmit %s request" \
+			 " (requestor_id=%ld,instance_id=%ld,meid=%s)\n",
+			 pname,req->requestor_id,req->instance_id,
+			 req->meid.c_str());
+	arm(deadline.procedure,req,deadline.attempt + 1);
+	return;
+    }
+
+    mdclog_write(MDCLOG_WARN,
+		 "%s request timed out" \
+		 " (requestor_id=%ld,instance_id=%ld,meid=%s,attempts=%u)\n",
+		 pname,req->requestor_id,req->instance_id,req->meid.c_str(),
+		 deadline.attempt + 1);
+    ++expirations;
+    switch (deadline.procedure) {
+    case PROCEDURE_CONTROL:
+	control_timeouts->inc();
+	controls.erase(req->instance_id);
+	agent_if->handle_timeout(std::static_pointer_cast<ControlRequest>(req));
+	break;
+    case PROCEDURE_SUBSCRIPTION:
+	pending_subscriptions.erase(req->instance_id);
+	agent_if->handle_timeout(
+	    std::static_pointer_cast<SubscriptionRequest>(req));
+	break;
+    case PROCEDURE_SUBSCRIPTION_DELETE:
+	pending_deletes.erase(req->instance_id);
+	agent_if->handle_timeout(
+	    std::static_pointer_cast<SubscriptionDeleteRequest>(req));
+	break;
+    default:
+	break;
+    }
+}
+
+void E2AP::timer_handler()
+{
+    std::vector<DeadlineWheel::Deadline> expired;
+    std::chrono::milliseconds tick(deadlines.get_tick_ms());
+    std::unique_lock<std::mutex> lock(timer_mutex);
+
+    while (!timer_stop) {
+	timer_cv.wait_for(lock,tick);
+	if (timer_stop)
+	    break;
+	lock.unlock();
+	deadlines.advance(now_ms(),expired);
+	for (auto it = expired.begin(); it != expired.end(); ++it)
+	    expire(*it);
+	expired.clear();
+	lock.lock();
+    }
+}
+
+/*
+ * RICcontrolRequest has at most six IEs: RICrequestID, RANfunctionID,
+ * RICcallProcessID, RICcontrolHeader, RICcontrolMessage, and
+ * RICcontrolAckRequest.
+ */
+#define CONTROL_REQUEST_MAX_IES 6
+
+/*
+ * Fills in a RICcontrolRequest PDU whose IEs live in caller-provided
+ * storage, and whose OCTET STRINGs borrow the Control's encoded
+ * buffers, so building it does not allocate.  The result must therefore
+ * never be passed to ASN_STRUCT_FREE*.
+ */
+static void build_control_request(ControlRequest *creq,E2AP_E2AP_PDU_t *pdu,
+				  E2AP_RICcontrolRequest_IEs_t *ies,
+				  E2AP_RICcontrolRequest_IEs_t **ie_ptrs)
 {
-    E2AP_E2AP_PDU_t pdu;
     E2AP_RICcontrolRequest_t *req;
     E2AP_RICcontrolRequest_IEs_t *ie;
     unsigned char *iebuf;
     size_t iebuflen;
+    int n = 0;
 
-    if (encoded)
-	return true;
+    memset(pdu,0,sizeof(*pdu));
+    memset(ies,0,sizeof(*ies) * CONTROL_REQUEST_MAX_IES);
+    pdu->present = E2AP_E2AP_PDU_PR_initiatingMessage;
+    pdu->choice.initiatingMessage.procedureCode = E2AP_ProcedureCode_id_RICcontrol;
+    pdu->choice.initiatingMessage.criticality = E2AP_Criticality_reject;
+    pdu->choice.initiatingMessage.value.present = E2AP_InitiatingMessage__value_PR_RICcontrolRequest;
+    req = &pdu->choice.initiatingMessage.value.choice.RICcontrolRequest;
 
-    memset(&pdu,0,sizeof(pdu));
-    pdu.present = E2AP_E2AP_PDU_PR_initiatingMessage;
-    pdu.choice.initiatingMessage.procedureCode = E2AP_ProcedureCode_id_RICcontrol;
-    pdu.choice.initiatingMessage.criticality = E2AP_Criticality_reject;
-    pdu.choice.initiatingMessage.value.present = E2AP_InitiatingMessage__value_PR_RICcontrolRequest;
-    req = &pdu.choice.initiatingMessage.value.choice.RICcontrolRequest;
-
-    ie = (E2AP_RICcontrolRequest_IEs_t *)calloc(1,sizeof(*ie));
+    ie = &ies[n];
     ie->id = E2AP_ProtocolIE_ID_id_RICrequestID;
     ie->criticality = E2AP_Criticality_reject;
     ie->value.present = E2AP_RICcontrolRequest_IEs__value_PR_RICrequestID;
-    ie->value.choice.RICrequestID.ricRequestorID = requestor_id;
-    ie->value.choice.RICrequestID.ricInstanceID = instance_id;
-    ASN_SEQUENCE_ADD(&req->protocolIEs.list,ie);
+    ie->value.choice.RICrequestID.ricRequestorID = creq->requestor_id;
+    ie->value.choice.RICrequestID.ricInstanceID = creq->instance_id;
+    ie_ptrs[n] = ie;
+    ++n;
 
-    ie = (E2AP_RICcontrolRequest_IEs_t *)calloc(1,sizeof(*ie));
+    ie = &ies[n];
     ie->id = E2AP_ProtocolIE_ID_id_RANfunctionID;
     ie->criticality = E2AP_Criticality_reject;
     ie->value.present = E2AP_RICcontrolRequest_IEs__value_PR_RANfunctionID;
-    ie->value.choice.RANfunctionID = function_id;
-    ASN_SEQUENCE_ADD(&req->protocolIEs.list,ie);
+    ie->value.choice.RANfunctionID = creq->function_id;
+    ie_ptrs[n] = ie;
+    ++n;
 
-    iebuf = control->get_call_process_id();
-    iebuflen = control->get_call_process_id_len();
+    iebuf = creq->control->get_call_process_id();
+    iebuflen = creq->control->get_call_process_id_len();
     if (iebuf && iebuflen > 0) {
-	ie = (E2AP_RICcontrolRequest_IEs_t *)calloc(1,sizeof(*ie));
+	ie = &ies[n];
 	ie->id = E2AP_ProtocolIE_ID_id_RICcallProcessID;
 	ie->criticality = E2AP_Criticality_reject;
 	ie->value.present = E2AP_RICcontrolRequest_IEs__value_PR_RICcallProcessID;
-	ie->value.choice.RICcallProcessID.buf = (uint8_t *)malloc(iebuflen);
-	memcpy(ie->value.choice.RICcallProcessID.buf,iebuf,iebuflen);
+	ie->value.choice.RICcallProcessID.buf = (uint8_t *)iebuf;
 	ie->value.choice.RICcallProcessID.size = iebuflen;
-	ASN_SEQUENCE_ADD(&req->protocolIEs.list,ie);
+	ie_ptrs[n] = ie;
+	++n;
     }
 
-    iebuf = control->get_header();
-    iebuflen = control->get_header_len();
-    ie = (E2AP_RICcontrolRequest_IEs_t *)calloc(1,sizeof(*ie));
+    ie = &ies[n];
     ie->id = E2AP_ProtocolIE_ID_id_RICcontrolHeader;
     ie->criticality = E2AP_Criticality_reject;
     ie->value.present = E2AP_RICcontrolRequest_IEs__value_PR_RICcontrolHeader;
-    ie->value.choice.RICcontrolHeader.buf = (uint8_t *)malloc(iebuflen);
-    memcpy(ie->value.choice.RICcontrolHeader.buf,iebuf,iebuflen);
-    ie->value.choice.RICcontrolHeader.size = iebuflen;
-    ASN_SEQUENCE_ADD(&req->protocolIEs.list,ie);
+    ie->value.choice.RICcontrolHeader.buf = (uint8_t *)creq->control->get_header();
+    ie->value.choice.RICcontrolHeader.size = creq->control->get_header_len();
+    ie_ptrs[n] = ie;
+    ++n;
 
-    iebuf = control->get_message();
-    iebuflen = control->get_message_len();
-    ie = (E2AP_RICcontrolRequest_IEs_t *)calloc(1,sizeof(*ie));
+    ie = &ies[n];
     ie->id = E2AP_ProtocolIE_ID_id_RICcontrolMessage;
     ie->criticality = E2AP_Criticality_reject;
     ie->value.present = E2AP_RICcontrolRequest_IEs__value_PR_RICcontrolMessage;
-    ie->value.choice.RICcontrolMessage.buf = (uint8_t *)malloc(iebuflen);
-    memcpy(ie->value.choice.RICcontrolMessage.buf,iebuf,iebuflen);
-    ie->value.choice.RICcontrolMessage.size = iebuflen;
-    ASN_SEQUENCE_ADD(&req->protocolIEs.list,ie);
+    ie->value.choice.RICcontrolMessage.buf = (uint8_t *)creq->control->get_message();
+    ie->value.choice.RICcontrolMessage.size = creq->control->get_message_len();
+    ie_ptrs[n] = ie;
+    ++n;
 
-    ie = (E2AP_RICcontrolRequest_IEs_t *)calloc(1,sizeof(*ie));
+    ie = &ies[n];
     ie->id = E2AP_ProtocolIE_ID_id_RICcontrolAckRequest;
     ie->criticality = E2AP_Criticality_reject;
     ie->value.present = E2AP_RICcontrolRequest_IEs__value_PR_RICcontrolAckRequest;
-    ie->value.choice.RICcontrolAckRequest = (E2AP_RICcontrolAckRequest_t)ack_request;
-    ASN_SEQUENCE_ADD(&req->protocolIEs.list,ie);
+    ie->value.choice.RICcontrolAckRequest = (E2AP_RICcontrolAckRequest_t)creq->ack_request;
+    ie_ptrs[n] = ie;
+    ++n;
 
-    E2AP_XER_PRINT(NULL,&asn_DEF_E2AP_E2AP_PDU,&pdu);
+    req->protocolIEs.list.array = ie_ptrs;
+    req->protocolIEs.list.count = n;
+    req->protocolIEs.list.size = CONTROL_REQUEST_MAX_IES;
+}
 
-    if (encode_pdu(&pdu,&buf,&len) < 0) {
-	ASN_STRUCT_FREE_CONTENTS_ONLY(asn_DEF_E2AP_E2AP_PDU,&pdu);
-	return false;
-    }
+bool ControlRequest::encode()
+{
+    E2AP_E2AP_PDU_t pdu;
+    E2AP_RICcontrolRequest_IEs_t ies[CONTROL_REQUEST_MAX_IES];
+    E2AP_RICcontrolRequest_IEs_t *ie_ptrs[CONTROL_REQUEST_MAX_IES];
 
-    /*
-    E2AP_E2AP_PDU_t pdud;
-    memset(&pdud,0,sizeof(pdud));
-    if (e2ap_decode_pdu(&pdud,*buffer,*len) < 0) {
-        E2AP_WARN("Failed to encode E2setupRequest\n");
+    if (encoded)
+	return true;
+
+    if (tmpl) {
+	buf = (unsigned char *)malloc(tmpl->len);
+	len = tmpl->patch_into(buf,tmpl->len,instance_id);
+	if (len < 0) {
+	    free(buf);
+	    buf = NULL;
+	    return false;
+	}
+	encoded = true;
+	return true;
     }
-    */
 
-    ASN_STRUCT_FREE_CONTENTS_ONLY(asn_DEF_E2AP_E2AP_PDU,&pdu);
+    build_control_request(this,&pdu,ies,ie_ptrs);
+
+    E2AP_XER_PRINT(NULL,&asn_DEF_E2AP_E2AP_PDU,&pdu);
+
+    if (encode_pdu(&pdu,&buf,&len) < 0)
+	return false;
 
     encoded = true;
     return true;
 }
 
+/*
+ * Encodes straight into dst (normally an RMR payload), so the steady
+ * state send path neither allocates nor copies.
+ */
+ssize_t ControlRequest::encode_into(unsigned char *dst,size_t dst_len)
+{
+    E2AP_E2AP_PDU_t pdu;
+    E2AP_RICcontrolRequest_IEs_t ies[CONTROL_REQUEST_MAX_IES];
+    E2AP_RICcontrolRequest_IEs_t *ie_ptrs[CONTROL_REQUEST_MAX_IES];
+
+    if (encoded) {
+	if ((size_t)len > dst_len)
+	    return -1;
+	memcpy(dst,buf,len);
+	return len;
+    }
+    if (tmpl)
+	return tmpl->patch_into(dst,dst_len,instance_id);
+
+    build_control_request(this,&pdu,ies,ie_ptrs);
+
+    E2AP_XER_PRINT(NULL,&asn_DEF_E2AP_E2AP_PDU,&pdu);
+
+    return encode_pdu_into(&pdu,dst,dst_len);
+}
+
+ssize_t ControlTemplate::patch_into(unsigned char *dst,size_t dst_len,
+				    long instance_id) const
+{
+    if (instance_id < 0 || instance_id > 0xffff || (size_t)len > dst_len)
+	return -1;
+
+    memcpy(dst,buf,len);
+    dst[instance_id_offset] = (instance_id >> 8) & 0xff;
+    dst[instance_id_offset + 1] = instance_id & 0xff;
+
+    return len;
+}
+
+/*
+ * Encodes req twice, with ricInstanceID 0 and 0xffff, and diffs the
+ * results to find the instance ID's offset.  Anything other than
+ * exactly two adjacent differing octets means the encoding isn't what
+ * we expect, and the caller must encode each request normally.
+ */
+ControlTemplate *ControlTemplate::create(ControlRequest *req)
+{
+    E2AP_E2AP_PDU_t pdu;
+    E2AP_RICcontrolRequest_IEs_t ies[CONTROL_REQUEST_MAX_IES];
+    E2AP_RICcontrolRequest_IEs_t *ie_ptrs[CONTROL_REQUEST_MAX_IES];
+    unsigned char *lo = NULL,*hi = NULL;
+    ssize_t lo_len = 0,hi_len = 0;
+    ssize_t i;
+    long instance_id = req->instance_id;
+
+    req->instance_id = 0;
+    build_control_request(req,&pdu,ies,ie_ptrs);
+    if (encode_pdu(&pdu,&lo,&lo_len) < 0)
+	goto errout;
+    req->instance_id = 0xffff;
+    build_control_request(req,&pdu,ies,ie_ptrs);
+    if (encode_pdu(&pdu,&hi,&hi_len) < 0)
+	goto errout;
+    req->instance_id = instance_id;
+
+    E2AP_XER_PRINT(NULL,&asn_DEF_E2AP_E2AP_PDU,&pdu);
+
+    if (lo_len != hi_len)
+	goto errout;
+    for (i = 0; i < lo_len && lo[i] == hi[i]; ++i)
+	;
+    if (i + 1 >= lo_len
+	|| lo[i] != 0 || lo[i + 1] != 0 || hi[i] != 0xff || hi[i + 1] != 0xff
+	|| memcmp(lo + i + 2,hi + i + 2,lo_len - i - 2) != 0)
+	goto errout;
+
+    free(hi);
+    return new ControlTemplate(lo,lo_len,i,req->control);
+
+ errout:
+    req->instance_id = instance_id;
+    if (lo)
+	free(lo);
+    if (hi)
+	free(hi);
+    return NULL;
+}
+
 bool SubscriptionRequest::encode()
 {
     E2AP_E2AP_PDU_t pdu;
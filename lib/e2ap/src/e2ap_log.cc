@@ -0,0 +1,125 @@
+
+#include "e2ap_log.h"
+#include "e2ap_metrics.h"
+
+namespace e2ap
+{
+
+bool LogRateLimit::allow(uint64_t *suppressed_)
+{
+    uint64_t now = metrics_now_ns();
+    uint64_t last = last_ns.load(std::memory_order_relaxed);
+
+    /* Refill a whole bucket's worth per elapsed second. */
+    if (now - last >= 1000000000ULL
+	&& last_ns.compare_exchange_strong(last,now,std::memory_order_relaxed))
+	tokens.store(per_sec,std::memory_order_relaxed);
+
+    if (tokens.fetch_sub(1,std::memory_order_relaxed) <= 0) {
+	suppressed.fetch_add(1,std::memory_order_relaxed);
+	return false;
+    }
+    *suppressed_ = suppressed.exchange(0,std::memory_order_relaxed);
+    return true;
+}
+
+void AsyncLogger::start()
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+
+    if (thread)
+	return;
+    should_stop = false;
+    queue.reserve(QUEUE_SIZE);
+    thread = new std::thread(&AsyncLogger::writer,this);
+}
+
+void AsyncLogger::stop()
+{
+    std::thread *t;
+
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!thread)
+	    return;
+	t = thread;
+	thread = NULL;
+	should_stop = true;
+	cv.notify_all();
+    }
+    t->join();
+    delete t;
+}
+
+void AsyncLogger::submit(std::unique_ptr<LogRecord> record)
+{
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (thread) {
+	    if (queue.size() >= QUEUE_SIZE)
+		dropped.fetch_add(1,std::memory_order_relaxed);
+	    else {
+		queue.push_back(std::move(record));
+		if (queue.size() == 1)
+		    cv.notify_one();
+	    }
+	    return;
+	}
+    }
+
+    write(record.get());
+}
+
+void AsyncLogger::write(LogRecord *record)
+{
+    std::string msg;
+
+    record->format(msg);
+    if (record->suppressed)
+	mdclog_write(record->level,"%s (%llu similar messages suppressed)",
+		     msg.c_str(),(unsigned long long)record->suppressed);
+    else
+	mdclog_write(record->level,"%s",msg.c_str());
+}
+
+/*
+ * Swaps the queue out under the lock and writes it without, so that
+ * loggers only ever wait for a swap.
+ */
+void AsyncLogger::writer()
+{
+    std::vector<std::unique_ptr<LogRecord>> work;
+    uint64_t reported_drops = 0;
+
+    work.reserve(QUEUE_SIZE);
+    while (true) {
+	bool stopping;
+	{
+	    std::unique_lock<std::mutex> lock(mutex);
+	    cv.wait(lock,[this] { return should_stop || !queue.empty(); });
+	    stopping = should_stop;
+	    work.swap(queue);
+	}
+
+	for (auto it = work.begin(); it != work.end(); ++it)
+	    write(it->get());
+	work.clear();
+
+	uint64_t drops = dropped.load(std::memory_order_relaxed);
+	if (drops != reported_drops) {
+	    mdclog_write(MDCLOG_WARN,"log queue full; dropped %llu messages",
+			 (unsigned long long)(drops - reported_drops));
+	    reported_drops = drops;
+	}
+	if (stopping)
+	    break;
+    }
+}
+
+AsyncLogger& logger()
+{
+    static AsyncLogger l;
+    return l;
+}
+
+}
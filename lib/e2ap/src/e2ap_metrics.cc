@@ -0,0 +1,200 @@
+
+#include <cstdio>
+
+#include "e2ap_metrics.h"
+
+namespace e2ap
+{
+
+std::atomic<unsigned> metrics_next_shard(0);
+
+uint64_t Counter::get() const
+{
+    uint64_t total = 0;
+
+    for (int i = 0; i < METRICS_SHARDS; ++i)
+	total += cells[i].value.load(std::memory_order_relaxed);
+    return total;
+}
+
+Histogram::Cell::Cell()
+    : sum(0)
+{
+    for (int i = 0; i < NUM_BUCKETS; ++i)
+	buckets[i].store(0,std::memory_order_relaxed);
+}
+
+Histogram::Histogram()
+    : cells(new Cell[METRICS_SHARDS])
+{
+}
+
+Histogram::~Histogram()
+{
+    delete [] cells;
+}
+
+uint64_t Histogram::bucket_max(int i)
+{
+    if (i < 4)
+	return i;
+    int e = i / 4 + 1;
+    uint64_t sub = i % 4;
+    if (e == 63 && sub == 3)
+	return UINT64_MAX;
+    return ((5 + sub) << (e - 2)) - 1;
+}
+
+void Histogram::get(std::vector<uint64_t>& counts,uint64_t *sum) const
+{
+    counts.assign(NUM_BUCKETS,0);
+    *sum = 0;
+    for (int s = 0; s < METRICS_SHARDS; ++s) {
+	for (int i = 0; i < NUM_BUCKETS; ++i)
+	    counts[i] += cells[s].buckets[i].load(std::memory_order_relaxed);
+	*sum += cells[s].sum.load(std::memory_order_relaxed);
+    }
+}
+
+MetricsRegistry::~MetricsRegistry()
+{
+    for (auto it = families.begin(); it != families.end(); ++it) {
+	for (auto it2 = it->second.entries.begin();
+	     it2 != it->second.entries.end();
+	     ++it2) {
+	    delete it2->second.counter;
+	    delete it2->second.histogram;
+	}
+    }
+}
+
+MetricsRegistry::Entry& MetricsRegistry::entry(
+    const std::string& name,const std::string& help,MetricType type,
+    const std::string& labels)
+{
+    auto it = families.find(name);
+    if (it == families.end()) {
+	it = families.emplace(name,Family()).first;
+	it->second.type = type;
+	it->second.help = help;
+    }
+    return it->second.entries[labels];
+}
+
+/*
+ * Registering the same name and labels twice returns the same metric,
+ * so independent callers may share one.
+ */
+Counter *MetricsRegistry::counter(const std::string& name,
+				  const std::string& help,
+				  const std::string& labels)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    Entry& e = entry(name,help,COUNTER,labels);
+
+    if (!e.counter)
+	e.counter = new Counter();
+    return e.counter;
+}
+
+Histogram *MetricsRegistry::histogram(const std::string& name,
+				      const std::string& help,
+				      const std::string& labels)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    Entry& e = entry(name,help,HISTOGRAM,labels);
+
+    if (!e.histogram)
+	e.histogram = new Histogram();
+    return e.histogram;
+}
+
+void MetricsRegistry::gauge(const std::string& name,const std::string& help,
+			    const std::string& labels,std::function<double()> fn)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+
+    entry(name,help,GAUGE,labels).gauge = fn;
+}
+
+static void append_sample(std::string& out,const std::string& name,
+			  const char *suffix,const std::string& labels,
+			  const char *extra_label,double value)
+{
+    char buf[64];
+
+    out += name;
+    out += suffix;
+    if (!labels.empty() || extra_label) {
+	out += '{';
+	out += labels;
+	if (extra_label) {
+	    if (!labels.empty())
+		out += ',';
+	    out += extra_label;
+	}
+	out += '}';
+    }
+    snprintf(buf,sizeof(buf)," %.15g\n",value);
+    out += buf;
+}
+
+/*
+ * Histograms are exported in seconds, with a bucket boundary every half
+ * power of two from 384 ns to 2^36 ns (about 69 s); the finer internal
+ * buckets below each boundary are summed into it.
+ */
+void MetricsRegistry::write_prometheus(std::string& out)
+{
+    static const int EXPORT_MIN_BUCKET = (8 - 1) * 4;
+    static const int EXPORT_MAX_BUCKET = (36 - 1) * 4;
+    std::vector<uint64_t> counts;
+    char le[64];
+    const std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto it = families.begin(); it != families.end(); ++it) {
+	const std::string& name = it->first;
+	Family& family = it->second;
+
+	out += "# HELP " + name + " " + family.help + "\n";
+	out += "# TYPE " + name + " ";
+	out += (family.type == COUNTER) ? "counter\n"
+	    : (family.type == GAUGE) ? "gauge\n" : "histogram\n";
+
+	for (auto it2 = family.entries.begin(); it2 != family.entries.end(); ++it2) {
+	    const std::string& labels = it2->first;
+	    Entry& e = it2->second;
+
+	    if (e.counter)
+		append_sample(out,name,"",labels,NULL,(double)e.counter->get());
+	    else if (e.gauge)
+		append_sample(out,name,"",labels,NULL,e.gauge());
+	    else if (e.histogram) {
+		uint64_t sum = 0;
+		uint64_t cumulative = 0;
+		e.histogram->get(counts,&sum);
+		for (int i = 0; i < Histogram::NUM_BUCKETS; ++i) {
+		    cumulative += counts[i];
+		    if (i < EXPORT_MIN_BUCKET || i > EXPORT_MAX_BUCKET
+			|| (i % 4 != 1 && i % 4 != 3))
+			continue;
+		    snprintf(le,sizeof(le),"le=\"%.9g\"",
+			     (Histogram::bucket_max(i) + 1) / 1e9);
+		    append_sample(out,name,"_bucket",labels,le,(double)cumulative);
+		}
+		append_sample(out,name,"_bucket",labels,"le=\"+Inf\"",
+			      (double)cumulative);
+		append_sample(out,name,"_sum",labels,NULL,sum / 1e9);
+		append_sample(out,name,"_count",labels,NULL,(double)cumulative);
+	    }
+	}
+    }
+}
+
+MetricsRegistry& metrics()
+{
+    static MetricsRegistry registry;
+    return registry;
+}
+
+}
@@ -0,0 +1,228 @@
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#include "mdclog/mdclog.h"
+#include "rmr/RIC_message_types.h"
+
+#include "e2ap_pdu_trace.h"
+
+#include "E2AP_E2AP-PDU.h"
+#include "E2AP_ProcedureCode.h"
+
+namespace e2ap
+{
+
+static const char *pdu_trace_format_strings[] = {
+    "binary","xer"
+};
+
+const char *pdu_trace_format_to_string(PduTraceFormat_t format)
+{
+    if (format < PDU_TRACE_BINARY || format > PDU_TRACE_XER)
+	return "unknown";
+    return pdu_trace_format_strings[format];
+}
+
+bool pdu_trace_format_from_string(const std::string& s,PduTraceFormat_t *format)
+{
+    if (s == "binary")
+	*format = PDU_TRACE_BINARY;
+    else if (s == "xer")
+	*format = PDU_TRACE_XER;
+    else
+	return false;
+    return true;
+}
+
+long procedure_code_for_mtype(int mtype)
+{
+    switch (mtype) {
+    case RIC_SUB_REQ:
+    case RIC_SUB_RESP:
+    case RIC_SUB_FAILURE:
+	return E2AP_ProcedureCode_id_RICsubscription;
+    case RIC_SUB_DEL_REQ:
+    case RIC_SUB_DEL_RESP:
+    case RIC_SUB_DEL_FAILURE:
+	return E2AP_ProcedureCode_id_RICsubscriptionDelete;
+    case RIC_SERVICE_UPDATE:
+    case RIC_SERVICE_UPDATE_ACK:
+    case RIC_SERVICE_UPDATE_FAILURE:
+	return E2AP_ProcedureCode_id_RICserviceUpdate;
+    case RIC_CONTROL_REQ:
+    case RIC_CONTROL_ACK:
+    case RIC_CONTROL_FAILURE:
+	return E2AP_ProcedureCode_id_RICcontrol;
+    case RIC_INDICATION:
+	return E2AP_ProcedureCode_id_RICindication;
+    case RIC_SERVICE_QUERY:
+	return E2AP_ProcedureCode_id_RICserviceQuery;
+    default:
+	return -1;
+    }
+}
+
+bool PduTracer::start(const std::string& path_)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+
+    if (thread)
+	return true;
+
+    path = path_;
+    should_stop = false;
+    thread = new std::thread(&PduTracer::writer,this);
+
+    return true;
+}
+
+/*
+ * Writes whatever is still queued before returning; PDUs recorded
+ * after this are dropped.
+ */
+void PduTracer::stop()
+{
+    std::thread *t;
+
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!thread)
+	    return;
+	t = thread;
+	thread = NULL;
+	should_stop = true;
+	cv.notify_all();
+    }
+    t->join();
+    delete t;
+
+    if (file && file != stderr)
+	fclose(file);
+    file = NULL;
+}
+
+void PduTracer::configure(const PduTraceConfig& config_)
+{
+    std::atomic_store(&config,std::make_shared<const PduTraceConfig>(config_));
+    sample.store(config_.sample,std::memory_order_relaxed);
+
+    if (config_.sample == 0)
+	mdclog_write(MDCLOG_INFO,"pdu tracing disabled");
+    else
+	mdclog_write(MDCLOG_INFO,"pdu tracing enabled (sample 1/%u, %s, %zu procedures, %zu meids)",
+		     config_.sample,pdu_trace_format_to_string(config_.format),
+		     config_.procedures.size(),config_.meids.size());
+}
+
+void PduTracer::enqueue(Direction_t direction,long procedure,
+			const char *meid,size_t meid_len,
+			const unsigned char *buf,size_t len)
+{
+    std::shared_ptr<const PduTraceConfig> cfg = std::atomic_load(&config);
+
+    if (cfg->sample == 0)
+	return;
+    if (!cfg->procedures.empty()
+	&& cfg->procedures.find(procedure) == cfg->procedures.end())
+	return;
+    if (!cfg->meids.empty()
+	&& cfg->meids.find(std::string(meid,meid_len)) == cfg->meids.end())
+	return;
+    if (matched.fetch_add(1,std::memory_order_relaxed) % cfg->sample != 0)
+	return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!thread || queue.size() >= QUEUE_SIZE) {
+	dropped.fetch_add(1,std::memory_order_relaxed);
+	return;
+    }
+    queue.emplace_back();
+    Record& record = queue.back();
+    record.direction = direction;
+    record.format = cfg->format;
+    record.procedure = procedure;
+    record.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+	std::chrono::system_clock::now().time_since_epoch()).count();
+    record.meid.assign(meid,meid_len);
+    record.pdu.assign(buf,buf + len);
+    queued.fetch_add(1,std::memory_order_relaxed);
+    cv.notify_one();
+}
+
+/*
+ * Takes the whole queue at once and writes it without the lock, so
+ * that enqueue() only ever waits for a swap.
+ */
+void PduTracer::writer()
+{
+    std::deque<Record> work;
+
+    while (true) {
+	bool stopping;
+	{
+	    std::unique_lock<std::mutex> lock(mutex);
+	    cv.wait(lock,[this] { return should_stop || !queue.empty(); });
+	    stopping = should_stop;
+	    work.swap(queue);
+	}
+
+	for (auto it = work.begin(); it != work.end(); ++it) {
+	    if (write(*it))
+		written.fetch_add(1,std::memory_order_relaxed);
+	}
+	work.clear();
+	if (file)
+	    fflush(file);
+	if (stopping)
+	    break;
+    }
+}
+
+bool PduTracer::write(const Record& record)
+{
+    if (!file) {
+	if (path.empty() || path == "-")
+	    file = stderr;
+	else if (!(file = fopen(path.c_str(),"a"))) {
+	    mdclog_write(MDCLOG_ERR,"failed to open pdu trace file %s: %s",
+			 path.c_str(),strerror(errno));
+	    return false;
+	}
+    }
+
+    if (record.format == PDU_TRACE_BINARY) {
+	BinaryHeader h;
+	memset(&h,0,sizeof(h));
+	h.magic = BINARY_MAGIC;
+	h.direction = (uint8_t)record.direction;
+	h.meid_len = (uint16_t)record.meid.size();
+	h.procedure = (int32_t)record.procedure;
+	h.pdu_len = (uint32_t)record.pdu.size();
+	h.time_ns = record.time_ns;
+	return fwrite(&h,sizeof(h),1,file) == 1
+	    && fwrite(record.meid.data(),1,h.meid_len,file) == h.meid_len
+	    && fwrite(record.pdu.data(),1,h.pdu_len,file) == h.pdu_len;
+    }
+
+    fprintf(file,"<!-- %llu.%09llu %s meid=%s procedure=%ld len=%zu -->\n",
+	    (unsigned long long)(record.time_ns / 1000000000ULL),
+	    (unsigned long long)(record.time_ns % 1000000000ULL),
+	    record.direction == INBOUND ? "in" : "out",
+	    record.meid.c_str(),record.procedure,record.pdu.size());
+
+    E2AP_E2AP_PDU_t *pdu = NULL;
+    asn_dec_rval_t dres = aper_decode(
+	NULL,&asn_DEF_E2AP_E2AP_PDU,(void **)&pdu,
+	record.pdu.data(),record.pdu.size(),0,0);
+    bool ret = (dres.code == RC_OK
+		&& xer_fprint(file,&asn_DEF_E2AP_E2AP_PDU,pdu) == 0);
+    if (dres.code != RC_OK)
+	fprintf(file,"<!-- undecodable -->\n");
+    ASN_STRUCT_FREE(asn_DEF_E2AP_E2AP_PDU,pdu);
+
+    return ret;
+}
+
+}
@@ -0,0 +1,79 @@
+
+#include "e2ap_timer.h"
+
+namespace e2ap
+{
+
+const char *procedure_to_string(Procedure_t procedure)
+{
+    switch (procedure) {
+    case PROCEDURE_CONTROL:
+	return "control";
+    case PROCEDURE_SUBSCRIPTION:
+	return "subscription";
+    case PROCEDURE_SUBSCRIPTION_DELETE:
+	return "subscription_delete";
+    default:
+	return "unknown";
+    }
+}
+
+static uint64_t round_up(uint64_t n)
+{
+    uint64_t p = 1;
+    while (p < n)
+	p <<= 1;
+    return p;
+}
+
+DeadlineWheel::DeadlineWheel(unsigned int tick_ms_,unsigned int num_slots)
+    : tick_ms(tick_ms_ ? tick_ms_ : 1),mask(round_up(num_slots) - 1),
+      tick(0),count(0),slots(mask + 1)
+{
+}
+
+void DeadlineWheel::schedule(const Deadline& deadline)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    uint64_t t = deadline.expires_ms / tick_ms;
+
+    /* Anything already due goes in the next slot we drain. */
+    if (t < tick)
+	t = tick;
+    slots[t & mask].push_back(deadline);
+    ++count;
+}
+
+void DeadlineWheel::advance(uint64_t now_ms,std::vector<Deadline>& expired)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    uint64_t now_tick = now_ms / tick_ms;
+
+    /*
+     * On the first call, or after a long stall, do not walk every
+     * missed tick: one revolution visits every slot.
+     */
+    if (tick == 0 || now_tick - tick > mask)
+	tick = (now_tick > mask) ? now_tick - mask : 0;
+
+    for ( ; tick <= now_tick; ++tick) {
+	std::vector<Deadline>& slot = slots[tick & mask];
+	size_t kept = 0;
+	for (size_t i = 0; i < slot.size(); ++i) {
+	    if (slot[i].expires_ms / tick_ms <= now_tick)
+		expired.push_back(std::move(slot[i]));
+	    else if (kept++ != i)
+		slot[kept - 1] = std::move(slot[i]);
+	}
+	count -= slot.size() - kept;
+	slot.erase(slot.begin() + kept,slot.end());
+    }
+}
+
+size_t DeadlineWheel::size()
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    return count;
+}
+
+}
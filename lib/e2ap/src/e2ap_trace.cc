@@ -0,0 +1,88 @@
+
+#include "e2ap_trace.h"
+
+namespace e2ap
+{
+
+TraceRing::TraceRing(size_t size,uint32_t tid_)
+    : tid(tid_),head(0)
+{
+    size_t n = 2;
+    while (n < size)
+	n <<= 1;
+    slots = new Slot[n];
+    mask = n - 1;
+}
+
+TraceRing::~TraceRing()
+{
+    delete [] slots;
+}
+
+void TraceRing::collect(std::vector<Span>& spans,uint64_t trace_id)
+{
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t begin = (end > mask + 1) ? end - (mask + 1) : 0;
+
+    for (uint64_t n = begin; n < end; ++n) {
+	Slot& slot = slots[n & mask];
+	uint64_t seq = slot.seq.load(std::memory_order_acquire);
+	if (seq != 2 * n + 2)
+	    continue;
+	Span span = slot.span;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (slot.seq.load(std::memory_order_relaxed) != seq)
+	    continue;
+	if (trace_id && span.trace_id != trace_id)
+	    continue;
+	spans.push_back(span);
+    }
+}
+
+void Tracer::enable(size_t ring_size_)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+
+    if (enabled.load(std::memory_order_relaxed) || ring_size_ == 0)
+	return;
+    ring_size = ring_size_;
+    enabled.store(true,std::memory_order_release);
+}
+
+/*
+ * Rings outlive their threads, so that a dump still shows what an
+ * exited thread recorded; threads here are few and long-lived.
+ */
+TraceRing *Tracer::ring()
+{
+    static thread_local TraceRing *mine = NULL;
+
+    if (!mine) {
+	const std::lock_guard<std::mutex> lock(mutex);
+	mine = new TraceRing(ring_size,next_tid.fetch_add(1,std::memory_order_relaxed));
+	rings.push_back(mine);
+    }
+    return mine;
+}
+
+void Tracer::collect(std::vector<Span>& spans,uint64_t trace_id)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto it = rings.begin(); it != rings.end(); ++it)
+	(*it)->collect(spans,trace_id);
+}
+
+Tracer& tracer()
+{
+    static Tracer t;
+    return t;
+}
+
+TraceContext& trace_context()
+{
+    static thread_local TraceContext ctx;
+    return ctx;
+}
+
+}
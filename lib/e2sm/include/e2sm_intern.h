@@ -0,0 +1,76 @@
+#ifndef _E2SM_INTERN_H_
+#define _E2SM_INTERN_H_
+
+#include <string>
+#include <string_view>
+#include <map>
+#include <vector>
+#include <atomic>
+#include <shared_mutex>
+#include <cstdint>
+
+namespace e2sm
+{
+
+/**
+ * Maps strings to 32-bit IDs.  The low INDEX_BITS of an ID are a dense
+ * slot number, so that index_of(id) can index plain vectors; the bits
+ * above are the slot's generation.  Each intern() takes a reference
+ * that release() drops; once the last reference is dropped the slot is
+ * reused by a later string, but under the next generation, so state
+ * still keyed by the old ID (e.g. in a report decoded before the
+ * release) never matches the new one.  Anything indexed by slot must
+ * therefore keep and compare the full ID.  Generations wrap after
+ * 4095 reuses of a slot.
+ *
+ * lookup() takes no lock once warm: each thread caches what it has
+ * looked up, and drops its cache whenever a name is added or removed.
+ * The table is capped so that a misbehaving client cannot grow it
+ * without bound.
+ */
+class InternTable
+{
+ public:
+    static const uint32_t NONE = 0xffffffff;
+    static const unsigned int INDEX_BITS = 20;
+    static const uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+
+    static uint32_t index_of(uint32_t id) { return id & INDEX_MASK; };
+
+    InternTable(size_t max_size_ = 65536);
+
+    /* Returns the ID for s, referencing it and assigning one if needed; NONE if full. */
+    uint32_t intern(std::string_view s);
+    /* Drops a reference taken by intern(). */
+    void release(uint32_t id);
+    /* Returns the ID for s, or NONE if s is not interned. */
+    uint32_t lookup(std::string_view s) const;
+    /* Returns a copy, since a released ID's slot may be reused. */
+    std::string name(uint32_t id) const;
+    size_t size() const;
+
+ private:
+    uint32_t lookup_locked(std::string_view s) const;
+
+    /* Distinguishes tables in the per-thread lookup caches. */
+    const unsigned int serial;
+    size_t max_size;
+    mutable std::shared_mutex mutex;
+    /* Bumped whenever a name is added or removed. */
+    std::atomic<uint64_t> version;
+    std::map<std::string,uint32_t,std::less<>> ids;
+    /* Per slot: the name, references, and the ID currently assigned. */
+    std::vector<std::string> names;
+    std::vector<uint32_t> refs;
+    std::vector<uint32_t> slot_ids;
+    std::vector<uint32_t> free_slots;
+};
+
+/* Names of the slices configured in NexRAN. */
+InternTable& slice_names();
+/* UE IMSIs, as configured in NexRAN. */
+InternTable& imsis();
+
+}
+
+#endif /* _E2SM_INTERN_H_ */
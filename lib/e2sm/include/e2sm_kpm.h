@@ -3,8 +3,10 @@
 
 #include <list>
 #include <map>
-#include <queue>
 #include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
 #include <cstdint>
 #include <ctime>
 
@@ -38,53 +40,237 @@ typedef struct entity_metrics
   int64_t  ul_samples;
 } entity_metrics_t;
 
+/**
+ * A sliding window over the last period seconds of entity_metrics_t
+ * samples.  Samples are summed into a preallocated ring of time buckets
+ * (a second wide, unless period is long enough that MAX_BUCKETS seconds
+ * would not cover it), sized once from period, so memory is fixed by the
+ * window and not by the sample rate.  Sums,
+ * means, minimums and maximums over the window, and an EWMA, are kept
+ * for every field and read in O(1); min/max use a monotonic wedge per
+ * field, with at most one entry per bucket.  Callers pass the clock.
+ */
 class MetricsIndex
 {
  public:
-    MetricsIndex(int period_)
-	: period(period_),queue() {};
+    typedef enum {
+	DL_BYTES = 0,
+	UL_BYTES,
+	DL_PRBS,
+	UL_PRBS,
+	TX_PKTS,
+	TX_ERRORS,
+	TX_BRATE,
+	RX_PKTS,
+	RX_ERRORS,
+	RX_BRATE,
+	DL_CQI,
+	DL_RI,
+	DL_PMI,
+	UL_PHR,
+	UL_SINR,
+	UL_MCS,
+	UL_SAMPLES,
+	NUM_FIELDS,
+    } Field_t;
 
-    void add(entity_metrics_t m);
-    entity_metrics_t& get_totals() { return totals; };
+    static const int MAX_BUCKETS = 128;
+
+    MetricsIndex(int period_,long report_period_ms_ = 1000)
+	: period(period_),report_period_ms(report_period_ms_)
+    {
+	reset(period_);
+    };
+
+    void add(const entity_metrics_t& m,time_t now);
+    /* Drops samples older than period seconds before now. */
+    void flush(time_t now);
+    void reset(int period_);
+    /* Reweights the EWMA; the window and its samples are kept. */
+    void set_report_period(long report_period_ms_);
+
+    const entity_metrics_t& get_totals() { return totals; };
     uint64_t get_total_bytes() { return totals.dl_bytes + totals.ul_bytes; };
-    int size() { return queue.size(); };
-    void flush();
-    void reset(int period_) { period = period_; flush(); };
+    int size() { return count; };
+    double sum(Field_t field) { return value(totals,field); };
+    double mean(Field_t field) {
+	return count ? value(totals,field) / count : 0.0;
+    };
+    double min(Field_t field) { return mins[field].front(); };
+    double max(Field_t field) { return maxes[field].front(); };
+    /* Not windowed; weighted so that a window's worth of samples dominates. */
+    double ewma(Field_t field) { return ewmas[field]; };
+
+    static double value(const entity_metrics_t& m,Field_t field);
 
  private:
+    class Bucket
+    {
+     public:
+	int64_t seq;
+	int count;
+	entity_metrics_t sum;
+    };
+
+    /*
+     * The candidate extremes of one field, oldest first: each is more
+     * extreme than everything after it, so the front is the answer.
+     */
+    class Wedge
+    {
+     public:
+	void init(int capacity,bool is_max_);
+	void push(int64_t seq,double v);
+	void expire(int64_t oldest_seq);
+	double front() { return n ? ring[first].v : 0.0; };
+
+     private:
+	struct Entry {
+	    int64_t seq;
+	    double v;
+	};
+
+	std::vector<Entry> ring;
+	size_t first;
+	size_t n;
+	bool is_max;
+    };
+
+    Bucket& bucket(int64_t seq) { return buckets[seq % buckets.size()]; };
+    bool expired(int64_t seq,int64_t now_seq,time_t now);
+    void set_ewma_alpha();
+
     int period;
-    std::queue<entity_metrics_t> queue;
-    entity_metrics_t totals = { };
+    long report_period_ms;
+    /* Seconds per bucket. */
+    int width;
+    std::vector<Bucket> buckets;
+    /* Buckets [oldest_seq,newest_seq] may hold samples. */
+    int64_t oldest_seq;
+    int64_t newest_seq;
+    int count;
+    entity_metrics_t totals;
+    Wedge mins[NUM_FIELDS];
+    Wedge maxes[NUM_FIELDS];
+    double ewmas[NUM_FIELDS];
+    double ewma_alpha;
+    bool ewma_primed;
+};
+
+/**
+ * Per-entity metrics stored column-wise, one row per UE or slice, so
+ * that summing a metric across entities is a pass over one vector.
+ * clear() keeps capacity; a recycled table does not allocate.
+ */
+class EntityMetricsTable
+{
+ public:
+    size_t size() const { return time.size(); };
+    void clear();
+    /* Appends a zeroed row stamped with now, and returns its index. */
+    size_t add(time_t now);
+    entity_metrics_t get(size_t row) const;
+
+    std::vector<time_t> time;
+    std::vector<uint64_t> dl_bytes;
+    std::vector<uint64_t> ul_bytes;
+    std::vector<uint64_t> dl_prbs;
+    std::vector<uint64_t> ul_prbs;
+    std::vector<int64_t> tx_pkts;
+    std::vector<int64_t> tx_errors;
+    std::vector<int64_t> tx_brate;
+    std::vector<int64_t> rx_pkts;
+    std::vector<int64_t> rx_errors;
+    std::vector<int64_t> rx_brate;
+    std::vector<double> dl_cqi;
+    std::vector<double> dl_ri;
+    std::vector<double> dl_pmi;
+    std::vector<double> ul_phr;
+    std::vector<double> ul_sinr;
+    std::vector<double> ul_mcs;
+    std::vector<int64_t> ul_samples;
 };
 
+class KpmReportPool;
+
+/**
+ * A decoded KPM report.  UE rows are keyed by RNTI (ue_rnti[row]) and
+ * slice rows by interned slice name ID (slice_id[row], see
+ * e2sm::slice_names()); slices that are not configured are skipped.
+ * Both have a direct-indexed row lookup.
+ * Reports come from a KpmReportPool and go back to it via release(),
+ * keeping their capacity, so steady-state decoding does not allocate.
+ */
 class KpmReport
 {
  public:
     KpmReport()
 	: period_ms(0),available_dl_prbs(0),available_ul_prbs(0),active_ues(0),
-	  ues(),slices() {};
+	  pool(NULL) {};
     virtual ~KpmReport() = default;
     std::string to_string(char group_delim = ' ',char item_delim = ',');
 
+    void reset();
+    /* Returns the row for rnti, adding a zeroed row stamped now if needed. */
+    size_t ue_row(long rnti,time_t now);
+    /* Returns the row for slice_id, adding a zeroed row stamped now if needed. */
+    size_t slice_row(uint32_t slice_id,time_t now);
+    ssize_t find_ue(long rnti) const;
+    ssize_t find_slice(uint32_t slice_id) const;
+    /* Returns this report to the pool it came from, or deletes it. */
+    void release();
+
     long period_ms;
     int available_dl_prbs;
     int available_ul_prbs;
     long active_ues;
-    std::map<long,entity_metrics_t> ues;
-    std::map<std::string,entity_metrics_t> slices;
+    std::vector<long> ue_rnti;
+    EntityMetricsTable ues;
+    std::vector<uint32_t> slice_id;
+    EntityMetricsTable slices;
+
+ private:
+    friend class KpmReportPool;
+
+    /* RNTI (16 bits) to row + 1, allocated on first use. */
+    std::vector<uint16_t> ue_index;
+    /* Slice ID slot (InternTable::index_of) to row + 1, grown as needed. */
+    std::vector<uint32_t> slice_index;
+    KpmReportPool *pool;
+};
+
+/**
+ * A free list of KpmReports, shared by the pipeline workers.  At most
+ * max_free idle reports are kept; extras are deleted on release.
+ */
+class KpmReportPool
+{
+ public:
+    KpmReportPool(size_t max_free_ = 64)
+	: max_free(max_free_),free_list() {};
+    virtual ~KpmReportPool();
+
+    KpmReport *get();
+    void put(KpmReport *report);
+
+ private:
+    size_t max_free;
+    std::mutex mutex;
+    std::vector<KpmReport *> free_list;
 };
 
 class KpmIndication : public e2sm::Indication
 {
  public:
     KpmIndication(e2sm::Model *model_)
-	: e2sm::Indication(model_) {};
+	: report(NULL),e2sm::Indication(model_) {};
     KpmIndication(e2sm::Model *model_,KpmReport *report_)
 	: report(report_),e2sm::Indication(model_) {};
-    virtual ~KpmIndication() { delete report; };
+    virtual ~KpmIndication() { if (report) report->release(); };
     virtual bool encode() { return false; };
 
     KpmReport *report;
+    std::string meid;
 };
 
 typedef enum KpmPeriod {
@@ -132,15 +318,46 @@ class AgentInterface
     virtual bool handle(e2sm::kpm::KpmIndication *ind) = 0;
 };
 
+/**
+ * How KpmModel decodes indication messages: with asn1c only; with the
+ * streaming decoder, falling back to asn1c on any message it rejects;
+ * or with both, comparing the results and keeping asn1c's.
+ */
+typedef enum KpmDecoderMode {
+    KPM_DECODER_ASN1C = 0,
+    KPM_DECODER_STREAM,
+    KPM_DECODER_VALIDATE,
+} KpmDecoderMode_t;
+
+const char *kpm_decoder_mode_to_string(KpmDecoderMode_t mode);
+bool kpm_decoder_mode_from_string(const char *s,KpmDecoderMode_t *mode);
+
+class KpmStreamDecoder;
+
 class KpmModel : public e2sm::Model
 {
  public:
     KpmModel(AgentInterface *agent_if_)
-	: agent_if(agent_if_),e2sm::Model("ORAN-E2SM-KPM","1.3.6.1.4.1.1.1.2.2") {};
-    virtual ~KpmModel() = default;
+	: agent_if(agent_if_),decoder_mode(KPM_DECODER_ASN1C),stream(NULL),
+	  stream_decodes(0),stream_fallbacks(0),validate_mismatches(0),
+	  decode_latency(e2ap::metrics().histogram(
+	      "nexran_kpm_decode_seconds",
+	      "Time to decode a KPM indication into a report.")),
+	  decode_failures(e2ap::metrics().counter(
+	      "nexran_kpm_decode_failures_total",
+	      "KPM indications that could not be decoded.")),
+	  e2sm::Model("ORAN-E2SM-KPM","1.3.6.1.4.1.1.1.2.2") {};
+    virtual ~KpmModel();
     virtual int init() { return 0; };
     virtual void stop() {};
 
+    /* Not thread-safe; call before indications start arriving. */
+    bool set_decoder_mode(KpmDecoderMode_t mode);
+    KpmDecoderMode_t get_decoder_mode() { return decoder_mode; };
+    uint64_t get_stream_decodes() { return stream_decodes.load(std::memory_order_relaxed); };
+    uint64_t get_stream_fallbacks() { return stream_fallbacks.load(std::memory_order_relaxed); };
+    uint64_t get_validate_mismatches() { return validate_mismatches.load(std::memory_order_relaxed); };
+
     Indication *decode(e2ap::Indication *ind,
 		       unsigned char *header,ssize_t header_len,
 		       unsigned char *message,ssize_t message_len);
@@ -150,7 +367,19 @@ class KpmModel : public e2sm::Model
 			   unsigned char *outcome,ssize_t outcome_len);
 
  protected:
+    bool decode_asn1c(unsigned char *header,ssize_t header_len,
+		      unsigned char *message,ssize_t message_len,
+		      KpmReport *report);
+
     AgentInterface *agent_if;
+    KpmDecoderMode_t decoder_mode;
+    KpmStreamDecoder *stream;
+    std::atomic<uint64_t> stream_decodes;
+    std::atomic<uint64_t> stream_fallbacks;
+    std::atomic<uint64_t> validate_mismatches;
+    e2ap::Histogram *decode_latency;
+    e2ap::Counter *decode_failures;
+    KpmReportPool report_pool;
 };
 
 }
@@ -0,0 +1,72 @@
+#ifndef _E2SM_KPM_STREAM_H_
+#define _E2SM_KPM_STREAM_H_
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "e2sm_kpm.h"
+
+struct asn_TYPE_descriptor_s;
+struct asn_per_constraints_s;
+
+namespace e2sm
+{
+namespace kpm
+{
+
+/**
+ * A pull-parser for the aligned PER encoding of an E2SM-KPM
+ * IndicationMessage that fills a KpmReport directly from the wire
+ * bytes, without building (and then freeing) the asn1c structs.
+ *
+ * We do not hand-code the KPM schema.  init() walks the asn1c type
+ * descriptors of the bindings we were built against and compiles a
+ * plan tree: one node per member on every path, carrying the PER
+ * constraints asn1c would use, and a capture tag on the handful of
+ * members decode_kpm_indication() reads (by ASN.1 member name, in the
+ * same containers).  Everything else is parsed only far enough to be
+ * skipped.  decode() then walks the plan over a bit cursor; it does not
+ * allocate, other than growing a fresh pooled KpmReport's rows.
+ *
+ * The plan is immutable once init() returns, so one decoder may be
+ * shared by all pipeline workers.  decode() returns false on anything
+ * it does not understand (fragmented lengths, unsupported string
+ * types, truncated input); callers fall back to asn1c.
+ */
+class KpmStreamDecoder
+{
+ public:
+    KpmStreamDecoder()
+	: root(NULL),nodes() {};
+    virtual ~KpmStreamDecoder();
+
+    bool init(const struct asn_TYPE_descriptor_s *td);
+    bool decode(const unsigned char *buf,size_t len,KpmReport *report);
+
+    class Node;
+    class Cursor;
+
+ private:
+    class Context;
+    class State;
+    class Item;
+
+    Node *compile(const struct asn_TYPE_descriptor_s *td,
+		  const struct asn_per_constraints_s *pc,
+		  const char *name,Context& ctx,int depth);
+    bool walk(const Node *n,Cursor& c,State& s,Item *item);
+    bool walk_sequence(const Node *n,Cursor& c,State& s,Item *item);
+    bool walk_choice(const Node *n,Cursor& c,State& s,Item *item);
+    bool walk_sequence_of(const Node *n,Cursor& c,State& s,Item *item);
+    bool walk_open(const Node *n,Cursor& c,State& s,Item *item);
+    void commit(const Node *n,State& s,Item& item);
+
+    Node *root;
+    std::vector<Node *> nodes;
+};
+
+}
+}
+
+#endif /* _E2SM_KPM_STREAM_H_ */
@@ -14,6 +14,9 @@ namespace e2sm
 namespace nexran
 {
 
+/* The most IMSIs a single bind or unbind request may carry (maxOfUes). */
+const int MAX_OF_UES = 256;
+
 class ProportionalAllocationPolicy
 {
  public:
@@ -31,7 +34,7 @@ class SliceConfig
  public:
     SliceConfig(std::string &name_,ProportionalAllocationPolicy *policy_)
 	: name(name_),policy(policy_) {};
-    virtual ~SliceConfig() = default;
+    virtual ~SliceConfig() { delete policy; };
 
     std::string name;
     ProportionalAllocationPolicy *policy;
@@ -81,7 +84,10 @@ class SliceConfigRequest : public e2sm::Control
 	: e2sm::Control(model_) { configs.push_back(slice_config); };
     SliceConfigRequest(e2sm::Model *model_,std::list<SliceConfig *> &configs_)
 	: configs(configs_),e2sm::Control(model_) {};
-    virtual ~SliceConfigRequest() = default;
+    virtual ~SliceConfigRequest() {
+	for (auto it = configs.begin(); it != configs.end(); ++it)
+	    delete *it;
+    };
 
     virtual bool encode();
 
@@ -163,6 +169,7 @@ class SliceStatusReport : public e2sm::Indication
     virtual ~SliceStatusReport() = default;
 
     bool encode() { return false; }
+    const std::list<SliceStatus *>& get_statuses() { return statuses; };
 
  private:
     std::list<SliceStatus *> statuses;
@@ -178,6 +185,7 @@ class SliceStatusControlOutcome : public e2sm::ControlOutcome
     virtual ~SliceStatusControlOutcome() = default;
 
     bool encode() { return false; };
+    const std::list<SliceStatus *>& get_statuses() { return statuses; };
 
  private:
     std::list<SliceStatus *> statuses;
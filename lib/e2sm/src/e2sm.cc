@@ -5,7 +5,8 @@
 namespace e2sm
 {
 
-bool xer_print = true;
+/* Per-PDU XER dumps, for debugging only. */
+bool xer_print = false;
 
 ssize_t encode(
     const struct asn_TYPE_descriptor_s *td,
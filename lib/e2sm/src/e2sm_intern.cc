@@ -0,0 +1,149 @@
+#include <mutex>
+
+#include "e2sm_intern.h"
+
+namespace e2sm
+{
+
+static std::atomic<unsigned int> next_serial(0);
+
+/* One thread's cached lookups from one table. */
+struct LookupCache
+{
+    uint64_t version = 0;
+    bool valid = false;
+    std::map<std::string,uint32_t,std::less<>> ids;
+};
+
+/* Unknown names are cached too; bound how many a thread keeps. */
+static const size_t MAX_CACHED = 4096;
+
+static LookupCache& lookup_cache(unsigned int serial)
+{
+    thread_local std::vector<LookupCache> caches;
+
+    if (serial >= caches.size())
+	caches.resize(serial + 1);
+    return caches[serial];
+}
+
+InternTable::InternTable(size_t max_size_)
+    : serial(next_serial.fetch_add(1)),max_size(max_size_),version(0),
+      ids(),names(),refs(),slot_ids(),free_slots()
+{
+    if (max_size > INDEX_MASK)
+	max_size = INDEX_MASK;
+}
+
+uint32_t InternTable::intern(std::string_view s)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    uint32_t slot;
+
+    auto it = ids.find(s);
+    if (it != ids.end()) {
+	++refs[index_of(it->second)];
+	return it->second;
+    }
+    if (ids.size() >= max_size)
+	return NONE;
+    if (!free_slots.empty()) {
+	slot = free_slots.back();
+	free_slots.pop_back();
+	names[slot] = std::string(s);
+    }
+    else {
+	slot = (uint32_t)names.size();
+	names.emplace_back(s);
+	refs.push_back(0);
+	slot_ids.push_back(slot);
+    }
+    refs[slot] = 1;
+    ids.emplace(names[slot],slot_ids[slot]);
+    version.fetch_add(1,std::memory_order_release);
+
+    return slot_ids[slot];
+}
+
+void InternTable::release(uint32_t id)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    uint32_t slot = index_of(id);
+
+    if (slot >= refs.size() || slot_ids[slot] != id || refs[slot] == 0
+	|| --refs[slot] > 0)
+	return;
+    ids.erase(names[slot]);
+    names[slot].clear();
+    /* The next generation; 0xfff would make the last slot's ID NONE. */
+    uint32_t gen = ((id >> INDEX_BITS) + 1) % 0xfff;
+    slot_ids[slot] = (gen << INDEX_BITS) | slot;
+    free_slots.push_back(slot);
+    version.fetch_add(1,std::memory_order_release);
+}
+
+uint32_t InternTable::lookup_locked(std::string_view s) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = ids.find(s);
+
+    return (it != ids.end()) ? it->second : NONE;
+}
+
+/*
+ * A cached answer is at most as stale as one read under the lock just
+ * before a concurrent change; the change bumps the version, and the
+ * next lookup starts over.
+ */
+uint32_t InternTable::lookup(std::string_view s) const
+{
+    LookupCache& cache = lookup_cache(serial);
+    uint64_t v = version.load(std::memory_order_acquire);
+
+    if (!cache.valid || cache.version != v || cache.ids.size() >= MAX_CACHED) {
+	cache.ids.clear();
+	cache.version = v;
+	cache.valid = true;
+    }
+    auto it = cache.ids.find(s);
+    if (it != cache.ids.end())
+	return it->second;
+
+    uint32_t id = lookup_locked(s);
+    cache.ids.emplace(s,id);
+
+    return id;
+}
+
+std::string InternTable::name(uint32_t id) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    uint32_t slot = index_of(id);
+
+    if (slot >= names.size() || slot_ids[slot] != id || refs[slot] == 0)
+	return std::string();
+    return names[slot];
+}
+
+size_t InternTable::size() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    return ids.size();
+}
+
+InternTable& slice_names()
+{
+    static InternTable table;
+
+    return table;
+}
+
+InternTable& imsis()
+{
+    static InternTable table(1 << 20);
+
+    return table;
+}
+
+}
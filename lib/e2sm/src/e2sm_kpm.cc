@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <cstring>
 #include <sstream>
 #include <ctime>
@@ -6,9 +7,12 @@
 #include "mdclog/mdclog.h"
 
 #include "e2ap.h"
+#include "e2ap_log.h"
 #include "e2sm.h"
 #include "e2sm_internal.h"
 #include "e2sm_kpm.h"
+#include "e2sm_kpm_stream.h"
+#include "e2sm_intern.h"
 
 #include "E2SM_KPM_RANfunction-Name.h"
 #include "E2SM_KPM_E2SM-KPM-EventTriggerDefinition.h"
@@ -34,40 +38,227 @@ namespace e2sm
 namespace kpm
 {
 
-void MetricsIndex::add(entity_metrics_t m)
+static void metrics_add(entity_metrics_t& a,const entity_metrics_t& b)
 {
-    queue.push(m);
-    totals.dl_bytes += m.dl_bytes;
-    totals.ul_bytes += m.ul_bytes;
-    totals.dl_prbs += m.dl_prbs;
-    totals.ul_prbs += m.ul_prbs;
-    totals.tx_pkts += m.tx_pkts;
-    totals.tx_errors += m.tx_errors;
-    totals.rx_pkts += m.rx_pkts;
-    totals.rx_errors += m.rx_errors;
-    flush();
+    a.dl_bytes += b.dl_bytes;
+    a.ul_bytes += b.ul_bytes;
+    a.dl_prbs += b.dl_prbs;
+    a.ul_prbs += b.ul_prbs;
+    a.tx_pkts += b.tx_pkts;
+    a.tx_errors += b.tx_errors;
+    a.tx_brate += b.tx_brate;
+    a.rx_pkts += b.rx_pkts;
+    a.rx_errors += b.rx_errors;
+    a.rx_brate += b.rx_brate;
+    a.dl_cqi += b.dl_cqi;
+    a.dl_ri += b.dl_ri;
+    a.dl_pmi += b.dl_pmi;
+    a.ul_phr += b.ul_phr;
+    a.ul_sinr += b.ul_sinr;
+    a.ul_mcs += b.ul_mcs;
+    a.ul_samples += b.ul_samples;
 }
 
-void MetricsIndex::flush()
+static void metrics_sub(entity_metrics_t& a,const entity_metrics_t& b)
 {
-    time_t now = std::time(nullptr);
+    a.dl_bytes -= b.dl_bytes;
+    a.ul_bytes -= b.ul_bytes;
+    a.dl_prbs -= b.dl_prbs;
+    a.ul_prbs -= b.ul_prbs;
+    a.tx_pkts -= b.tx_pkts;
+    a.tx_errors -= b.tx_errors;
+    a.tx_brate -= b.tx_brate;
+    a.rx_pkts -= b.rx_pkts;
+    a.rx_errors -= b.rx_errors;
+    a.rx_brate -= b.rx_brate;
+    a.dl_cqi -= b.dl_cqi;
+    a.dl_ri -= b.dl_ri;
+    a.dl_pmi -= b.dl_pmi;
+    a.ul_phr -= b.ul_phr;
+    a.ul_sinr -= b.ul_sinr;
+    a.ul_mcs -= b.ul_mcs;
+    a.ul_samples -= b.ul_samples;
+}
+
+double MetricsIndex::value(const entity_metrics_t& m,Field_t field)
+{
+    switch (field) {
+    case DL_BYTES: return (double)m.dl_bytes;
+    case UL_BYTES: return (double)m.ul_bytes;
+    case DL_PRBS: return (double)m.dl_prbs;
+    case UL_PRBS: return (double)m.ul_prbs;
+    case TX_PKTS: return (double)m.tx_pkts;
+    case TX_ERRORS: return (double)m.tx_errors;
+    case TX_BRATE: return (double)m.tx_brate;
+    case RX_PKTS: return (double)m.rx_pkts;
+    case RX_ERRORS: return (double)m.rx_errors;
+    case RX_BRATE: return (double)m.rx_brate;
+    case DL_CQI: return m.dl_cqi;
+    case DL_RI: return m.dl_ri;
+    case DL_PMI: return m.dl_pmi;
+    case UL_PHR: return m.ul_phr;
+    case UL_SINR: return m.ul_sinr;
+    case UL_MCS: return m.ul_mcs;
+    case UL_SAMPLES: return (double)m.ul_samples;
+    default: return 0.0;
+    }
+}
 
-    while (queue.size() > 0) {
-	entity_metrics_t& m = queue.front();
-	if (m.time < (now - period)) {
-	    totals.dl_bytes -= m.dl_bytes;
-	    totals.ul_bytes -= m.ul_bytes;
-	    totals.dl_prbs -= m.dl_prbs;
-	    totals.ul_prbs -= m.ul_prbs;
-	    totals.tx_pkts -= m.tx_pkts;
-	    totals.tx_errors -= m.tx_errors;
-	    totals.rx_pkts -= m.rx_pkts;
-	    totals.rx_errors -= m.rx_errors;
-	    queue.pop();
+void MetricsIndex::Wedge::init(int capacity,bool is_max_)
+{
+    ring.assign(capacity,Entry());
+    first = 0;
+    n = 0;
+    is_max = is_max_;
+}
+
+/*
+ * Anything no more extreme than v can never be the answer again, since
+ * v outlives it.  Within a bucket only the extreme matters, since the
+ * bucket expires as a whole; that keeps us to one entry per bucket.
+ */
+void MetricsIndex::Wedge::push(int64_t seq,double v)
+{
+    while (n) {
+	Entry& last = ring[(first + n - 1) % ring.size()];
+	if (is_max ? last.v > v : last.v < v) {
+	    if (last.seq == seq)
+		return;
+	    break;
 	}
+	--n;
+    }
+    ring[(first + n) % ring.size()] = { seq,v };
+    ++n;
+}
+
+void MetricsIndex::Wedge::expire(int64_t oldest_seq)
+{
+    while (n && ring[first].seq < oldest_seq) {
+	first = (first + 1) % ring.size();
+	--n;
+    }
+}
+
+void MetricsIndex::reset(int period_)
+{
+    period = period_ > 0 ? period_ : 1;
+
+    /*
+     * The width depends on period alone, so the ring is sized once; a
+     * report period longer than a bucket just leaves some buckets empty.
+     */
+    width = 1;
+    if (period > MAX_BUCKETS - 2)
+	width = (period + MAX_BUCKETS - 3) / (MAX_BUCKETS - 2);
+
+    /*
+     * A sample is live until it is period seconds old, so the window can
+     * straddle period / width + 1 buckets, plus the one being filled.
+     */
+    int nbuckets = (period + width - 1) / width + 2;
+    buckets.assign(nbuckets,Bucket());
+    for (auto it = buckets.begin(); it != buckets.end(); ++it) {
+	it->seq = -1;
+	it->count = 0;
+	it->sum = { };
+    }
+    for (int i = 0; i < NUM_FIELDS; ++i) {
+	mins[i].init(nbuckets,false);
+	maxes[i].init(nbuckets,true);
+	ewmas[i] = 0.0;
+    }
+    oldest_seq = 0;
+    newest_seq = -1;
+    count = 0;
+    totals = { };
+    ewma_primed = false;
+    set_ewma_alpha();
+}
+
+void MetricsIndex::set_ewma_alpha()
+{
+    long per_window = (long)period * 1000 / (report_period_ms > 0 ? report_period_ms : 1000);
+    ewma_alpha = 2.0 / ((per_window > 0 ? per_window : 1) + 1);
+}
+
+/*
+ * Only reweights the EWMA: the merged report period is that of the
+ * slowest fresh NodeB, so it can change from one pass to the next, and
+ * the window must survive that.
+ */
+void MetricsIndex::set_report_period(long report_period_ms_)
+{
+    if (report_period_ms_ <= 0 || report_period_ms_ == report_period_ms)
+	return;
+    report_period_ms = report_period_ms_;
+    set_ewma_alpha();
+}
+
+/* A bucket expires once the newest second it could hold is too old. */
+bool MetricsIndex::expired(int64_t seq,int64_t now_seq,time_t now)
+{
+    return (seq + 1) * width - 1 < (int64_t)now - period
+	|| seq + (int64_t)buckets.size() <= now_seq;
+}
+
+void MetricsIndex::flush(time_t now)
+{
+    int64_t now_seq = (int64_t)now / width;
+
+    while (oldest_seq <= newest_seq && expired(oldest_seq,now_seq,now)) {
+	Bucket& b = bucket(oldest_seq);
+	if (b.seq == oldest_seq && b.count) {
+	    metrics_sub(totals,b.sum);
+	    count -= b.count;
+	}
+	b.seq = -1;
+	b.count = 0;
+	++oldest_seq;
+    }
+    if (oldest_seq > newest_seq) {
+	/* Skip straight past an idle gap, and drop rounding residue. */
+	oldest_seq = newest_seq = std::max(newest_seq,now_seq - 1);
+	++oldest_seq;
+	totals = { };
+	count = 0;
+    }
+    for (int i = 0; i < NUM_FIELDS; ++i) {
+	mins[i].expire(oldest_seq);
+	maxes[i].expire(oldest_seq);
+    }
+}
+
+void MetricsIndex::add(const entity_metrics_t& m,time_t now)
+{
+    flush(now);
+
+    /* Never go back in time; a late sample joins the newest bucket. */
+    int64_t seq = std::max((int64_t)now / width,newest_seq);
+    Bucket& b = bucket(seq);
+    if (b.seq != seq) {
+	b.seq = seq;
+	b.count = 0;
+	b.sum = { };
+    }
+    if (count == 0)
+	oldest_seq = seq;
+    newest_seq = seq;
+
+    ++b.count;
+    ++count;
+    metrics_add(b.sum,m);
+    metrics_add(totals,m);
+    for (int i = 0; i < NUM_FIELDS; ++i) {
+	double v = value(m,(Field_t)i);
+	mins[i].push(seq,v);
+	maxes[i].push(seq,v);
+	if (ewma_primed)
+	    ewmas[i] += ewma_alpha * (v - ewmas[i]);
 	else
-	    break;
+	    ewmas[i] = v;
     }
+    ewma_primed = true;
 }
 
 long kpm_period_to_ms(KpmPeriod_t period)
@@ -97,16 +288,228 @@ long kpm_period_to_ms(KpmPeriod_t period)
     }
 }
 
-static KpmReport *decode_kpm_indication(
+void EntityMetricsTable::clear()
+{
+    time.clear();
+    dl_bytes.clear();
+    ul_bytes.clear();
+    dl_prbs.clear();
+    ul_prbs.clear();
+    tx_pkts.clear();
+    tx_errors.clear();
+    tx_brate.clear();
+    rx_pkts.clear();
+    rx_errors.clear();
+    rx_brate.clear();
+    dl_cqi.clear();
+    dl_ri.clear();
+    dl_pmi.clear();
+    ul_phr.clear();
+    ul_sinr.clear();
+    ul_mcs.clear();
+    ul_samples.clear();
+}
+
+size_t EntityMetricsTable::add(time_t now)
+{
+    time.push_back(now);
+    dl_bytes.push_back(0);
+    ul_bytes.push_back(0);
+    dl_prbs.push_back(0);
+    ul_prbs.push_back(0);
+    tx_pkts.push_back(0);
+    tx_errors.push_back(0);
+    tx_brate.push_back(0);
+    rx_pkts.push_back(0);
+    rx_errors.push_back(0);
+    rx_brate.push_back(0);
+    dl_cqi.push_back(0);
+    dl_ri.push_back(0);
+    dl_pmi.push_back(0);
+    ul_phr.push_back(0);
+    ul_sinr.push_back(0);
+    ul_mcs.push_back(0);
+    ul_samples.push_back(0);
+
+    return time.size() - 1;
+}
+
+entity_metrics_t EntityMetricsTable::get(size_t row) const
+{
+    return {
+	time[row],dl_bytes[row],ul_bytes[row],dl_prbs[row],ul_prbs[row],
+	tx_pkts[row],tx_errors[row],tx_brate[row],
+	rx_pkts[row],rx_errors[row],rx_brate[row],
+	dl_cqi[row],dl_ri[row],dl_pmi[row],ul_phr[row],ul_sinr[row],ul_mcs[row],
+	ul_samples[row]
+    };
+}
+
+void KpmReport::reset()
+{
+    period_ms = 0;
+    available_dl_prbs = 0;
+    available_ul_prbs = 0;
+    active_ues = 0;
+    if (!ue_index.empty())
+	for (auto it = ue_rnti.begin(); it != ue_rnti.end(); ++it)
+	    if (*it >= 0 && *it <= 0xffff)
+		ue_index[*it] = 0;
+    for (auto it = slice_id.begin(); it != slice_id.end(); ++it)
+	slice_index[InternTable::index_of(*it)] = 0;
+    ue_rnti.clear();
+    ues.clear();
+    slice_id.clear();
+    slices.clear();
+}
+
+ssize_t KpmReport::find_ue(long rnti) const
+{
+    if (rnti >= 0 && rnti <= 0xffff)
+	return ue_index.empty() ? -1 : (ssize_t)ue_index[rnti] - 1;
+    for (size_t i = 0; i < ue_rnti.size(); ++i)
+	if (ue_rnti[i] == rnti)
+	    return i;
+    return -1;
+}
+
+size_t KpmReport::ue_row(long rnti,time_t now)
+{
+    ssize_t row = find_ue(rnti);
+
+    if (row >= 0)
+	return row;
+
+    row = ues.add(now);
+    ue_rnti.push_back(rnti);
+    if (rnti >= 0 && rnti <= 0xffff && row < 0xffff) {
+	if (ue_index.empty())
+	    ue_index.resize(0x10000,0);
+	ue_index[rnti] = (uint16_t)(row + 1);
+    }
+
+    return row;
+}
+
+ssize_t KpmReport::find_slice(uint32_t id) const
+{
+    uint32_t slot = InternTable::index_of(id);
+
+    if (slot >= slice_index.size() || !slice_index[slot])
+	return -1;
+    ssize_t row = (ssize_t)slice_index[slot] - 1;
+    return (slice_id[row] == id) ? row : -1;
+}
+
+size_t KpmReport::slice_row(uint32_t id,time_t now)
+{
+    ssize_t row = find_slice(id);
+
+    if (row >= 0)
+	return row;
+
+    uint32_t slot = InternTable::index_of(id);
+    row = slices.add(now);
+    slice_id.push_back(id);
+    if (slot >= slice_index.size())
+	slice_index.resize(slot + 1,0);
+    slice_index[slot] = (uint32_t)(row + 1);
+
+    return row;
+}
+
+void KpmReport::release()
+{
+    if (pool)
+	pool->put(this);
+    else
+	delete this;
+}
+
+KpmReportPool::~KpmReportPool()
+{
+    for (auto it = free_list.begin(); it != free_list.end(); ++it)
+	delete *it;
+}
+
+KpmReport *KpmReportPool::get()
+{
+    KpmReport *report = NULL;
+
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!free_list.empty()) {
+	    report = free_list.back();
+	    free_list.pop_back();
+	}
+    }
+    if (!report) {
+	report = new KpmReport();
+	report->pool = this;
+    }
+
+    return report;
+}
+
+void KpmReportPool::put(KpmReport *report)
+{
+    report->reset();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (free_list.size() >= max_free) {
+	delete report;
+	return;
+    }
+    free_list.push_back(report);
+}
+
+/* The DU per-UE and per-slice items carry the same metrics. */
+template <typename T>
+static void set_du_metrics(EntityMetricsTable& t,size_t row,T *item)
+{
+    unsigned long dl_prbs = 0,ul_prbs = 0;
+
+    asn_INTEGER2ulong(&item->dl_PRBUsage,&dl_prbs);
+    asn_INTEGER2ulong(&item->ul_PRBUsage,&ul_prbs);
+    t.dl_prbs[row] = dl_prbs;
+    t.ul_prbs[row] = ul_prbs;
+    t.tx_pkts[row] = item->tx_pkts;
+    t.tx_errors[row] = item->tx_errors;
+    t.tx_brate[row] = item->tx_brate;
+    t.rx_pkts[row] = item->rx_pkts;
+    t.rx_errors[row] = item->rx_errors;
+    t.rx_brate[row] = item->rx_brate;
+    t.dl_cqi[row] = item->dl_cqi;
+    t.dl_ri[row] = item->dl_ri;
+    t.dl_pmi[row] = item->dl_pmi;
+    t.ul_phr[row] = item->ul_phr;
+    t.ul_sinr[row] = item->ul_sinr;
+    t.ul_mcs[row] = item->ul_mcs;
+    t.ul_samples[row] = item->ul_samples;
+}
+
+template <typename T>
+static void set_cuup_bytes(EntityMetricsTable& t,size_t row,T *item)
+{
+    unsigned long dl_bytes = 0,ul_bytes = 0;
+
+    asn_INTEGER2ulong(&item->bytesDL,&dl_bytes);
+    asn_INTEGER2ulong(&item->bytesUL,&ul_bytes);
+    t.dl_bytes[row] = dl_bytes;
+    t.ul_bytes[row] = ul_bytes;
+}
+
+static bool decode_kpm_indication(
     E2SM_KPM_E2SM_KPM_IndicationHeader_t& h,
-    E2SM_KPM_E2SM_KPM_IndicationMessage_t& m)
+    E2SM_KPM_E2SM_KPM_IndicationMessage_t& m,
+    KpmReport *report)
 {
     if (m.indicationMessage.present
 	!= E2SM_KPM_E2SM_KPM_IndicationMessage__indicationMessage_PR_indicationMessage_Format1)
-	return NULL;
+	return false;
 
-    KpmReport *report = new KpmReport();
     time_t now = std::time(nullptr);
+    InternTable& names = slice_names();
 
     E2SM_KPM_E2SM_KPM_IndicationMessage_Format1_t *imf = \
 	&m.indicationMessage.choice.indicationMessage_Format1;
@@ -138,31 +541,7 @@ static KpmReport *decode_kpm_indication(
 				(E2SM_KPM_PerUEReportListItem_t *)plmn_cell_item->du_PM_EPC->perUEReportList->list.array[x];
 			    if (pui->rnti < 1)
 				continue;
-			    unsigned long dl_prbs = 0,ul_prbs = 0;
-			    asn_INTEGER2ulong(&pui->dl_PRBUsage,&dl_prbs);
-			    asn_INTEGER2ulong(&pui->ul_PRBUsage,&ul_prbs);
-			    if (report->ues.count(pui->rnti) < 1) {
-				report->ues[pui->rnti] = {
-				    now,0,0,dl_prbs,ul_prbs
-				};
-			    }
-			    else {
-				report->ues[pui->rnti].dl_prbs = dl_prbs;
-				report->ues[pui->rnti].ul_prbs = ul_prbs;
-			    }
-			    report->ues[pui->rnti].tx_pkts = pui->tx_pkts;
-			    report->ues[pui->rnti].tx_errors = pui->tx_errors;
-			    report->ues[pui->rnti].tx_brate = pui->tx_brate;
-			    report->ues[pui->rnti].rx_pkts = pui->rx_pkts;
-			    report->ues[pui->rnti].rx_errors = pui->rx_errors;
-			    report->ues[pui->rnti].rx_brate = pui->rx_brate;
-			    report->ues[pui->rnti].dl_cqi = pui->dl_cqi;
-			    report->ues[pui->rnti].dl_ri = pui->dl_ri;
-			    report->ues[pui->rnti].dl_pmi = pui->dl_pmi;
-			    report->ues[pui->rnti].ul_phr = pui->ul_phr;
-			    report->ues[pui->rnti].ul_sinr = pui->ul_sinr;
-			    report->ues[pui->rnti].ul_mcs = pui->ul_mcs;
-			    report->ues[pui->rnti].ul_samples = pui->ul_samples;
+			    set_du_metrics(report->ues,report->ue_row(pui->rnti,now),pui);
 			}
 		    }
 		    if (plmn_cell_item->du_PM_EPC->perSliceReportList) {
@@ -171,32 +550,11 @@ static KpmReport *decode_kpm_indication(
 				(E2SM_KPM_PerSliceReportListItem_t *)plmn_cell_item->du_PM_EPC->perSliceReportList->list.array[x];
 			    if (psi->sliceName.size < 1)
 				continue;
-			    std::string slice_name = std::string((char *)psi->sliceName.buf,psi->sliceName.size);
-			    unsigned long dl_prbs = 0,ul_prbs = 0;
-			    asn_INTEGER2ulong(&psi->dl_PRBUsage,&dl_prbs);
-			    asn_INTEGER2ulong(&psi->ul_PRBUsage,&ul_prbs);
-			    if (report->slices.count(slice_name) < 1) {
-				report->slices[slice_name] = {
-				    now,0,0,dl_prbs,ul_prbs
-				};
-			    }
-			    else {
-				report->slices[slice_name].dl_prbs = dl_prbs;
-				report->slices[slice_name].ul_prbs = ul_prbs;
-			    }
-			    report->slices[slice_name].tx_pkts = psi->tx_pkts;
-			    report->slices[slice_name].tx_errors = psi->tx_errors;
-			    report->slices[slice_name].tx_brate = psi->tx_brate;
-			    report->slices[slice_name].rx_pkts = psi->rx_pkts;
-			    report->slices[slice_name].rx_errors = psi->rx_errors;
-			    report->slices[slice_name].rx_brate = psi->rx_brate;
-			    report->slices[slice_name].dl_cqi = psi->dl_cqi;
-			    report->slices[slice_name].dl_ri = psi->dl_ri;
-			    report->slices[slice_name].dl_pmi = psi->dl_pmi;
-			    report->slices[slice_name].ul_phr = psi->ul_phr;
-			    report->slices[slice_name].ul_sinr = psi->ul_sinr;
-			    report->slices[slice_name].ul_mcs = psi->ul_mcs;
-			    report->slices[slice_name].ul_samples = psi->ul_samples;
+			    uint32_t id = names.lookup(
+				std::string_view((char *)psi->sliceName.buf,psi->sliceName.size));
+			    if (id == InternTable::NONE)
+				continue;
+			    set_du_metrics(report->slices,report->slice_row(id,now),psi);
 			}
 		    }
 		}
@@ -225,18 +583,7 @@ static KpmReport *decode_kpm_indication(
 				(E2SM_KPM_PerUEReportListItemFormat_t *)cuup_plmn_item->cu_UP_PM_EPC->perUEReportList->list.array[x];
 			    if (pui->rnti < 1)
 				continue;
-			    unsigned long dl_bytes = 0,ul_bytes = 0;
-			    asn_INTEGER2ulong(&pui->bytesDL,&dl_bytes);
-			    asn_INTEGER2ulong(&pui->bytesUL,&ul_bytes);
-			    if (report->ues.count(pui->rnti) < 1) {
-				report->ues[pui->rnti] = {
-				    now,dl_bytes,ul_bytes,0,0
-				};
-			    }
-			    else {
-				report->ues[pui->rnti].dl_bytes = dl_bytes;
-				report->ues[pui->rnti].ul_bytes = ul_bytes;
-			    }
+			    set_cuup_bytes(report->ues,report->ue_row(pui->rnti,now),pui);
 			}
 		    }
 		    if (cuup_plmn_item->cu_UP_PM_EPC->perSliceReportList) {
@@ -245,19 +592,11 @@ static KpmReport *decode_kpm_indication(
 				(E2SM_KPM_PerSliceReportListItemFormat_t *)cuup_plmn_item->cu_UP_PM_EPC->perSliceReportList->list.array[x];
 			    if (psi->sliceName.size < 1)
 				continue;
-			    std::string slice_name = std::string((char *)psi->sliceName.buf,psi->sliceName.size);
-			    unsigned long dl_bytes = 0,ul_bytes = 0;
-			    asn_INTEGER2ulong(&psi->bytesDL,&dl_bytes);
-			    asn_INTEGER2ulong(&psi->bytesUL,&ul_bytes);
-			    if (report->slices.count(slice_name) < 1) {
-				report->slices[slice_name] = {
-				    now,dl_bytes,ul_bytes,0,0
-				};
-			    }
-			    else {
-				report->slices[slice_name].dl_bytes = dl_bytes;
-				report->slices[slice_name].ul_bytes = ul_bytes;
-			    }
+			    uint32_t id = names.lookup(
+				std::string_view((char *)psi->sliceName.buf,psi->sliceName.size));
+			    if (id == InternTable::NONE)
+				continue;
+			    set_cuup_bytes(report->slices,report->slice_row(id,now),psi);
 			}
 		    }
 		}
@@ -265,7 +604,29 @@ static KpmReport *decode_kpm_indication(
 	}
     }
 
-    return report;
+    return true;
+}
+
+static void metrics_to_stream(std::stringstream& ss,const entity_metrics_t& m,
+			      char item_delim)
+{
+    ss << "dl_bytes=" << m.dl_bytes << item_delim
+       << "ul_bytes=" << m.ul_bytes << item_delim
+       << "dl_prbs=" << m.dl_prbs << item_delim
+       << "ul_prbs=" << m.ul_prbs << item_delim
+       << "tx_pkts=" << m.tx_pkts << item_delim
+       << "tx_errors=" << m.tx_errors << item_delim
+       << "tx_brate=" << m.tx_brate << item_delim
+       << "rx_pkts=" << m.rx_pkts << item_delim
+       << "rx_errors=" << m.rx_errors << item_delim
+       << "rx_brate=" << m.rx_brate << item_delim
+       << "dl_cqi=" << m.dl_cqi << item_delim
+       << "dl_ri=" << m.dl_ri << item_delim
+       << "dl_pmi=" << m.dl_pmi << item_delim
+       << "ul_phr=" << m.ul_phr << item_delim
+       << "ul_sinr=" << m.ul_sinr << item_delim
+       << "ul_mcs=" << m.ul_mcs << item_delim
+       << "ul_samples=" << m.ul_samples << item_delim;
 }
 
 std::string KpmReport::to_string(char group_delim,char item_delim)
@@ -275,53 +636,105 @@ std::string KpmReport::to_string(char group_delim,char item_delim)
     ss << "KpmReport(period=" << period_ms << " ms)" << group_delim;
     ss << "available_dl_prbs=" << available_dl_prbs << group_delim;
     ss << "available_ul_prbs=" << available_ul_prbs << group_delim;
-    for (auto it = ues.begin(); it != ues.end(); ++it)
-	ss << "ue[" << it->first << "]={"
-	   << "dl_bytes=" << it->second.dl_bytes << item_delim
-	   << "ul_bytes=" << it->second.ul_bytes << item_delim
-	   << "dl_prbs=" << it->second.dl_prbs << item_delim
-	   << "ul_prbs=" << it->second.ul_prbs << item_delim
-	   << "tx_pkts=" << it->second.tx_pkts << item_delim
-	   << "tx_errors=" << it->second.tx_errors << item_delim
-	   << "tx_brate=" << it->second.tx_brate << item_delim
-	   << "rx_pkts=" << it->second.rx_pkts << item_delim
-	   << "rx_errors=" << it->second.rx_errors << item_delim
-	   << "rx_brate=" << it->second.rx_brate << item_delim
-	   << "dl_cqi=" << it->second.dl_cqi << item_delim
-	   << "dl_ri=" << it->second.dl_ri << item_delim
-	   << "dl_pmi=" << it->second.dl_pmi << item_delim
-	   << "ul_phr=" << it->second.ul_phr << item_delim
-	   << "ul_sinr=" << it->second.ul_sinr << item_delim
-	   << "ul_mcs=" << it->second.ul_mcs << item_delim
-	   << "ul_samples=" << it->second.ul_samples << item_delim
-	   << "}" << group_delim;
-    for (auto it = slices.begin(); it != slices.end(); ++it)
-	ss << "slice[" << it->first << "]={"
-	   << "dl_bytes=" << it->second.dl_bytes << item_delim
-	   << "ul_bytes=" << it->second.ul_bytes << item_delim
-	   << "dl_prbs=" << it->second.dl_prbs << item_delim
-	   << "ul_prbs=" << it->second.ul_prbs << item_delim
-	   << "tx_pkts=" << it->second.tx_pkts << item_delim
-	   << "tx_errors=" << it->second.tx_errors << item_delim
-	   << "tx_brate=" << it->second.tx_brate << item_delim
-	   << "rx_pkts=" << it->second.rx_pkts << item_delim
-	   << "rx_errors=" << it->second.rx_errors << item_delim
-	   << "rx_brate=" << it->second.rx_brate << item_delim
-	   << "dl_cqi=" << it->second.dl_cqi << item_delim
-	   << "dl_ri=" << it->second.dl_ri << item_delim
-	   << "dl_pmi=" << it->second.dl_pmi << item_delim
-	   << "ul_phr=" << it->second.ul_phr << item_delim
-	   << "ul_sinr=" << it->second.ul_sinr << item_delim
-	   << "ul_mcs=" << it->second.ul_mcs << item_delim
-	   << "ul_samples=" << it->second.ul_samples << item_delim
-	   << "}" << group_delim;
+    for (size_t i = 0; i < ue_rnti.size(); ++i) {
+	ss << "ue[" << ue_rnti[i] << "]={";
+	metrics_to_stream(ss,ues.get(i),item_delim);
+	ss << "}" << group_delim;
+    }
+    for (size_t i = 0; i < slice_id.size(); ++i) {
+	ss << "slice[" << slice_names().name(slice_id[i]) << "]={";
+	metrics_to_stream(ss,slices.get(i),item_delim);
+	ss << "}" << group_delim;
+    }
 
     return ss.str();
 }
 
-Indication *KpmModel::decode(e2ap::Indication *ind,
-			     unsigned char *header,ssize_t header_len,
-			     unsigned char *message,ssize_t message_len)
+const char *kpm_decoder_mode_to_string(KpmDecoderMode_t mode)
+{
+    switch (mode) {
+    case KPM_DECODER_ASN1C:    return "asn1c";
+    case KPM_DECODER_STREAM:   return "stream";
+    case KPM_DECODER_VALIDATE: return "validate";
+    default:                   return "unknown";
+    }
+}
+
+bool kpm_decoder_mode_from_string(const char *s,KpmDecoderMode_t *mode)
+{
+    if (!s)
+	return false;
+    if (strcmp(s,"asn1c") == 0)
+	*mode = KPM_DECODER_ASN1C;
+    else if (strcmp(s,"stream") == 0)
+	*mode = KPM_DECODER_STREAM;
+    else if (strcmp(s,"validate") == 0)
+	*mode = KPM_DECODER_VALIDATE;
+    else
+	return false;
+
+    return true;
+}
+
+static bool entity_metrics_match(const entity_metrics_t& a,
+				 const entity_metrics_t& b)
+{
+    return a.dl_bytes == b.dl_bytes && a.ul_bytes == b.ul_bytes
+	&& a.dl_prbs == b.dl_prbs && a.ul_prbs == b.ul_prbs
+	&& a.tx_pkts == b.tx_pkts && a.tx_errors == b.tx_errors
+	&& a.tx_brate == b.tx_brate && a.rx_pkts == b.rx_pkts
+	&& a.rx_errors == b.rx_errors && a.rx_brate == b.rx_brate
+	&& a.dl_cqi == b.dl_cqi && a.dl_ri == b.dl_ri && a.dl_pmi == b.dl_pmi
+	&& a.ul_phr == b.ul_phr && a.ul_sinr == b.ul_sinr
+	&& a.ul_mcs == b.ul_mcs && a.ul_samples == b.ul_samples;
+}
+
+static bool kpm_reports_match(const KpmReport& a,const KpmReport& b)
+{
+    if (a.available_dl_prbs != b.available_dl_prbs
+	|| a.available_ul_prbs != b.available_ul_prbs
+	|| a.active_ues != b.active_ues
+	|| a.ue_rnti.size() != b.ue_rnti.size()
+	|| a.slice_id.size() != b.slice_id.size())
+	return false;
+    for (size_t i = 0; i < a.ue_rnti.size(); ++i) {
+	ssize_t j = b.find_ue(a.ue_rnti[i]);
+	if (j < 0 || !entity_metrics_match(a.ues.get(i),b.ues.get(j)))
+	    return false;
+    }
+    for (size_t i = 0; i < a.slice_id.size(); ++i) {
+	ssize_t j = b.find_slice(a.slice_id[i]);
+	if (j < 0 || !entity_metrics_match(a.slices.get(i),b.slices.get(j)))
+	    return false;
+    }
+
+    return true;
+}
+
+KpmModel::~KpmModel()
+{
+    delete stream;
+}
+
+bool KpmModel::set_decoder_mode(KpmDecoderMode_t mode)
+{
+    if (mode != KPM_DECODER_ASN1C && !stream) {
+	stream = new KpmStreamDecoder();
+	if (!stream->init(&asn_DEF_E2SM_KPM_E2SM_KPM_IndicationMessage)) {
+	    mdclog_write(MDCLOG_ERR,"cannot build kpm stream decoder; keeping asn1c decoder\n");
+	    delete stream;
+	    stream = NULL;
+	    return false;
+	}
+    }
+    decoder_mode = mode;
+
+    return true;
+}
+
+bool KpmModel::decode_asn1c(unsigned char *header,ssize_t header_len,
+			    unsigned char *message,ssize_t message_len,
+			    KpmReport *report)
 {
     E2SM_KPM_E2SM_KPM_IndicationHeader_t h;
     E2SM_KPM_E2SM_KPM_IndicationMessage_t m;
@@ -341,7 +754,7 @@ Indication *KpmModel::decode(e2ap::Indication *ind,
 	if (dres.code != RC_OK) {
 	    mdclog_write(MDCLOG_ERR,"failed to decode kpm indication header (len %lu, code %d)\n",
 			 header_len,dres.code);
-	    return NULL;
+	    return false;
 	}
 	have_header = true;
 	E2SM_XER_PRINT(NULL,&asn_DEF_E2SM_KPM_E2SM_KPM_IndicationHeader,&h);
@@ -355,7 +768,7 @@ Indication *KpmModel::decode(e2ap::Indication *ind,
 	    mdclog_write(MDCLOG_ERR,"failed to decode kpm indication message (len %lu, code %d)\n",
 			 message_len,dres.code);
 	    ASN_STRUCT_FREE_CONTENTS_ONLY(asn_DEF_E2SM_KPM_E2SM_KPM_IndicationHeader,&h);
-	    return NULL;
+	    return false;
 	}
 	have_message = true;
 	E2SM_XER_PRINT(NULL,&asn_DEF_E2SM_KPM_E2SM_KPM_IndicationMessage,&m);
@@ -364,19 +777,74 @@ Indication *KpmModel::decode(e2ap::Indication *ind,
 	mdclog_write(MDCLOG_ERR,"missing kpm indication header; aborting\n");
 	ASN_STRUCT_FREE_CONTENTS_ONLY(asn_DEF_E2SM_KPM_E2SM_KPM_IndicationHeader,&h);
 	ASN_STRUCT_FREE_CONTENTS_ONLY(asn_DEF_E2SM_KPM_E2SM_KPM_IndicationMessage,&m);
-	return NULL;
+	return false;
     }
     if (!have_message) {
 	mdclog_write(MDCLOG_ERR,"missing kpm indication message; aborting\n");
 	ASN_STRUCT_FREE_CONTENTS_ONLY(asn_DEF_E2SM_KPM_E2SM_KPM_IndicationHeader,&h);
 	ASN_STRUCT_FREE_CONTENTS_ONLY(asn_DEF_E2SM_KPM_E2SM_KPM_IndicationMessage,&m);
-	return NULL;
+	return false;
     }
 
-    mdclog_write(MDCLOG_DEBUG,"kpm indication report style %ld\n",
-		 m.ric_Style_Type);
+    E2AP_LOG(MDCLOG_DEBUG,"kpm indication report style %ld\n",
+	     m.ric_Style_Type);
+
+    bool ret = decode_kpm_indication(h,m,report);
+    if (!ret)
+	mdclog_write(MDCLOG_ERR,"unsupported kpm indication message format %d\n",
+		     (int)m.indicationMessage.present);
+
+    ASN_STRUCT_FREE_CONTENTS_ONLY(asn_DEF_E2SM_KPM_E2SM_KPM_IndicationHeader,&h);
+    ASN_STRUCT_FREE_CONTENTS_ONLY(asn_DEF_E2SM_KPM_E2SM_KPM_IndicationMessage,&m);
+
+    return ret;
+}
+
+/*
+ * The stream decoder does not look at the header; nothing in it is
+ * used, so we only insist that one was sent.
+ */
+Indication *KpmModel::decode(e2ap::Indication *ind,
+			     unsigned char *header,ssize_t header_len,
+			     unsigned char *message,ssize_t message_len)
+{
+    e2ap::ScopedTimer timer(decode_latency);
+    e2ap::ScopedSpan span("e2sm_decode");
+    KpmReport *report = NULL;
+
+    if (decoder_mode != KPM_DECODER_ASN1C && stream
+	&& header && header_len > 0 && message && message_len > 0) {
+	report = report_pool.get();
+	if (stream->decode(message,message_len,report))
+	    stream_decodes.fetch_add(1,std::memory_order_relaxed);
+	else {
+	    stream_fallbacks.fetch_add(1,std::memory_order_relaxed);
+	    E2AP_LOG(MDCLOG_DEBUG,"kpm stream decoder rejected message (len %ld); using asn1c\n",
+		     message_len);
+	    report->release();
+	    report = NULL;
+	}
+    }
+    if (!report || decoder_mode == KPM_DECODER_VALIDATE) {
+	KpmReport *asn1c_report = report_pool.get();
+	if (!decode_asn1c(header,header_len,message,message_len,asn1c_report)) {
+	    decode_failures->inc();
+	    asn1c_report->release();
+	    if (report)
+		report->release();
+	    return NULL;
+	}
+	if (report) {
+	    if (!kpm_reports_match(*report,*asn1c_report)) {
+		validate_mismatches.fetch_add(1,std::memory_order_relaxed);
+		E2AP_LOG_LIMIT(MDCLOG_WARN,1,"kpm stream decoder mismatch: stream %s; asn1c %s\n",
+			       report->to_string().c_str(),asn1c_report->to_string().c_str());
+	    }
+	    report->release();
+	}
+	report = asn1c_report;
+    }
 
-    KpmReport *report = decode_kpm_indication(h,m);
     if (ind->subscription_request
 	&& ind->subscription_request->trigger
 	&& dynamic_cast<e2sm::kpm::EventTrigger *>(ind->subscription_request->trigger)) {
@@ -384,10 +852,11 @@ Indication *KpmModel::decode(e2ap::Indication *ind,
 	    dynamic_cast<e2sm::kpm::EventTrigger *>(ind->subscription_request->trigger)->period);
     }
 
-    ASN_STRUCT_FREE_CONTENTS_ONLY(asn_DEF_E2SM_KPM_E2SM_KPM_IndicationHeader,&h);
-    ASN_STRUCT_FREE_CONTENTS_ONLY(asn_DEF_E2SM_KPM_E2SM_KPM_IndicationMessage,&m);
+    KpmIndication *kind = new KpmIndication(this,report);
+    if (ind->subscription_request)
+	kind->meid = ind->subscription_request->meid;
 
-    return new KpmIndication(this,report);
+    return kind;
 }
 
 ControlOutcome *KpmModel::decode(e2ap::ControlAck *ack,
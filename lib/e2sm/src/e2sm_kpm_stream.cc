@@ -0,0 +1,1126 @@
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <ctime>
+#include <string>
+
+#include "mdclog/mdclog.h"
+
+#include "asn_application.h"
+#include "constr_SEQUENCE.h"
+#include "constr_CHOICE.h"
+#include "constr_SEQUENCE_OF.h"
+#include "INTEGER.h"
+#include "NativeInteger.h"
+#include "NativeEnumerated.h"
+#include "OCTET_STRING.h"
+
+#include "e2sm_kpm_stream.h"
+#include "e2sm_intern.h"
+
+/*
+ * The bindings only carry support code for the types the KPM spec
+ * actually uses, so refer to the optional ones weakly; an absent type
+ * just compares unequal to every descriptor.
+ */
+extern "C" {
+extern asn_TYPE_operation_t asn_OP_BOOLEAN __attribute__((weak));
+extern asn_TYPE_operation_t asn_OP_NULL __attribute__((weak));
+extern asn_TYPE_operation_t asn_OP_REAL __attribute__((weak));
+extern asn_TYPE_operation_t asn_OP_NativeReal __attribute__((weak));
+extern asn_TYPE_operation_t asn_OP_ENUMERATED __attribute__((weak));
+}
+
+#define KPM_STREAM_MAX_DEPTH 64
+#define KPM_STREAM_MAX_NODES 65536
+#define KPM_STREAM_MAX_NAME  256
+
+namespace e2sm
+{
+namespace kpm
+{
+
+namespace {
+
+typedef enum {
+    K_OPEN = 0,
+    K_SEQUENCE,
+    K_CHOICE,
+    K_SEQUENCE_OF,
+    K_INTEGER,
+    K_ENUMERATED,
+    K_BOOLEAN,
+    K_NULL,
+    K_REAL,
+    K_STRING,
+} Kind;
+
+typedef enum {
+    S_NONE = 0,
+    S_CELL,
+    S_CUCP,
+    S_DU_UE,
+    S_DU_SLICE,
+    S_CUUP_UE,
+    S_CUUP_SLICE,
+    S_MAX,
+} Scope;
+
+typedef enum {
+    F_NONE = 0,
+    F_FORMAT1,
+    F_CELL_LIST,
+    F_AVAIL_DL_PRBS,
+    F_AVAIL_UL_PRBS,
+    F_ACTIVE_UES,
+    F_RNTI,
+    F_SLICE_NAME,
+    F_DL_PRBS,
+    F_UL_PRBS,
+    F_TX_PKTS,
+    F_TX_ERRORS,
+    F_TX_BRATE,
+    F_RX_PKTS,
+    F_RX_ERRORS,
+    F_RX_BRATE,
+    F_DL_CQI,
+    F_DL_RI,
+    F_DL_PMI,
+    F_UL_PHR,
+    F_UL_SINR,
+    F_UL_MCS,
+    F_UL_SAMPLES,
+    F_DL_BYTES,
+    F_UL_BYTES,
+    F_MAX,
+} Field;
+
+/* asn1c nests these enums inside structs, which scopes them in C++. */
+static const int PER_SEMI_CONSTRAINED = asn_per_constraint_t::APC_SEMI_CONSTRAINED;
+static const int PER_CONSTRAINED = asn_per_constraint_t::APC_CONSTRAINED;
+static const int PER_EXTENSIBLE = asn_per_constraint_t::APC_EXTENSIBLE;
+static const int OS_BIT = asn_OCTET_STRING_specifics_t::ASN_OSUBV_BIT;
+static const int OS_STR = asn_OCTET_STRING_specifics_t::ASN_OSUBV_STR;
+
+typedef struct {
+    const char *name;
+    Field field;
+} FieldName;
+
+static const FieldName du_fields[] = {
+    { "dl_PRBUsage",F_DL_PRBS },
+    { "ul_PRBUsage",F_UL_PRBS },
+    { "tx_pkts",F_TX_PKTS },
+    { "tx_errors",F_TX_ERRORS },
+    { "tx_brate",F_TX_BRATE },
+    { "rx_pkts",F_RX_PKTS },
+    { "rx_errors",F_RX_ERRORS },
+    { "rx_brate",F_RX_BRATE },
+    { "dl_cqi",F_DL_CQI },
+    { "dl_ri",F_DL_RI },
+    { "dl_pmi",F_DL_PMI },
+    { "ul_phr",F_UL_PHR },
+    { "ul_sinr",F_UL_SINR },
+    { "ul_mcs",F_UL_MCS },
+    { "ul_samples",F_UL_SAMPLES },
+    { NULL,F_NONE }
+};
+
+static const FieldName cuup_fields[] = {
+    { "bytesDL",F_DL_BYTES },
+    { "bytesUL",F_UL_BYTES },
+    { NULL,F_NONE }
+};
+
+/* ASN.1 identifiers use '-' where the generated C members use '_'. */
+static bool name_is(const char *asn_name,const char *c_name)
+{
+    if (!asn_name)
+	return false;
+    for ( ; *asn_name != '\0' && *c_name != '\0'; ++asn_name, ++c_name) {
+	if (*asn_name != *c_name && !(*asn_name == '-' && *c_name == '_'))
+	    return false;
+    }
+    return *asn_name == *c_name;
+}
+
+static Field lookup_field(const FieldName *table,const char *name)
+{
+    for ( ; table->name; ++table)
+	if (name_is(name,table->name))
+	    return table->field;
+    return F_NONE;
+}
+
+static Field field_of(Scope scope,const char *name)
+{
+    switch (scope) {
+    case S_CELL:
+	if (name_is(name,"dl_TotalofAvailablePRBs"))
+	    return F_AVAIL_DL_PRBS;
+	if (name_is(name,"ul_TotalofAvailablePRBs"))
+	    return F_AVAIL_UL_PRBS;
+	return F_NONE;
+    case S_CUCP:
+	return name_is(name,"numberOfActive_UEs") ? F_ACTIVE_UES : F_NONE;
+    case S_DU_UE:
+	return name_is(name,"rnti") ? F_RNTI : lookup_field(du_fields,name);
+    case S_DU_SLICE:
+	return name_is(name,"sliceName") ? F_SLICE_NAME : lookup_field(du_fields,name);
+    case S_CUUP_UE:
+	return name_is(name,"rnti") ? F_RNTI : lookup_field(cuup_fields,name);
+    case S_CUUP_SLICE:
+	return name_is(name,"sliceName") ? F_SLICE_NAME : lookup_field(cuup_fields,name);
+    default:
+	return F_NONE;
+    }
+}
+
+typedef struct {
+    bool real;
+    int64_t i;
+    double d;
+
+    int64_t as_int() const { return real ? (int64_t)d : i; }
+    uint64_t as_uint() const { return real ? (uint64_t)d : (i < 0 ? 0 : (uint64_t)i); }
+    double as_double() const { return real ? d : (double)i; }
+} Value;
+
+}
+
+class KpmStreamDecoder::Node
+{
+ public:
+    Node()
+	: kind(K_OPEN),td(NULL),pc(NULL),field(F_NONE),scope(S_NONE),
+	  children(),optional(),first_extension(-1),roms_count(0),
+	  from_canonical(NULL),is_unsigned(false),enum_specs(NULL),
+	  subvariant(OS_STR) {};
+
+    Kind kind;
+    const asn_TYPE_descriptor_t *td;
+    const asn_per_constraints_t *pc;
+    Field field;
+    /* The scope this node opens, if it is a report list item. */
+    Scope scope;
+
+    /* SEQUENCE members, CHOICE alternatives, or the SEQUENCE OF element. */
+    std::vector<Node *> children;
+    std::vector<bool> optional;
+    /* SEQUENCE: first extension member; CHOICE: ext_start. */
+    int first_extension;
+    int roms_count;
+    const unsigned *from_canonical;
+    bool is_unsigned;
+    const asn_INTEGER_specifics_t *enum_specs;
+    int subvariant;
+};
+
+class KpmStreamDecoder::Context
+{
+ public:
+    Context()
+	: format1(false),du(false),cucp(false),cuup(false),du_epc(false),
+	  cuup_epc(false),scope(S_NONE),level(0) {};
+
+    Context descend(const char *name) const
+    {
+	Context c = *this;
+
+	++c.level;
+	if (name_is(name,"indicationMessage_Format1"))
+	    c.format1 = true;
+	else if (format1 && name_is(name,"oDU"))
+	    c.du = true;
+	else if (format1 && name_is(name,"oCU_CP"))
+	    c.cucp = true;
+	else if (format1 && name_is(name,"oCU_UP"))
+	    c.cuup = true;
+	else if (du && name_is(name,"du_PM_EPC"))
+	    c.du_epc = true;
+	else if (cuup && name_is(name,"cu_UP_PM_EPC"))
+	    c.cuup_epc = true;
+	else if (cucp && name_is(name,"cu_CP_Resource_Status")) {
+	    c.scope = S_CUCP;
+	    c.level = 0;
+	}
+	return c;
+    };
+
+    bool format1;
+    bool du;
+    bool cucp;
+    bool cuup;
+    bool du_epc;
+    bool cuup_epc;
+    Scope scope;
+    /* Depth below the innermost scope item; 1 for its own members. */
+    int level;
+};
+
+/*
+ * A bit cursor over a borrowed buffer.  The length and whole-number
+ * helpers below follow asn1c's aper_* routines rather than the letter
+ * of X.691 where the two differ, since asn1c is what encoded the
+ * message in the first place.
+ */
+class KpmStreamDecoder::Cursor
+{
+ public:
+    Cursor(const unsigned char *buf_,size_t len_)
+	: buf(buf_),nbits(len_ * 8),pos(0) {};
+
+    bool get_bits(int n,uint64_t *v)
+    {
+	uint64_t r = 0;
+
+	if (n < 0 || n > 64 || pos + n > nbits)
+	    return false;
+	while (n > 0) {
+	    int off = pos & 7;
+	    int take = 8 - off;
+	    if (take > n)
+		take = n;
+	    r = (r << take) | ((buf[pos >> 3] >> (8 - off - take)) & ((1 << take) - 1));
+	    pos += take;
+	    n -= take;
+	}
+	*v = r;
+	return true;
+    };
+    bool skip(uint64_t n)
+    {
+	if (n > nbits - pos)
+	    return false;
+	pos += n;
+	return true;
+    };
+    bool align()
+    {
+	return skip((8 - (pos & 7)) & 7);
+    };
+    /* Splits off the next len octets; the cursor must be aligned. */
+    bool split(uint64_t len,Cursor *sub)
+    {
+	if ((pos & 7) || len > (nbits - pos) / 8)
+	    return false;
+	*sub = Cursor(buf + (pos >> 3),len);
+	pos += len * 8;
+	return true;
+    };
+
+    bool get_nsnnwn(int64_t range,uint64_t *v)
+    {
+	if (range < 0)
+	    return false;
+	if (range <= 255) {
+	    int i;
+	    for (i = 1; i <= 8; ++i)
+		if ((1 << i) >= range)
+		    break;
+	    return get_bits(i,v);
+	}
+	else if (range == 256)
+	    return align() && get_bits(8,v);
+	else if (range <= 65536)
+	    return align() && get_bits(16,v);
+	return false;
+    };
+    bool get_length(int64_t range,int ebits,uint64_t *len,bool *repeat)
+    {
+	uint64_t v,v2;
+
+	*repeat = false;
+	if (range >= 0 && range <= 65536)
+	    return get_nsnnwn(range,len);
+	if (!align())
+	    return false;
+	if (ebits >= 0)
+	    return get_bits(ebits,len);
+	if (!get_bits(8,&v))
+	    return false;
+	if ((v & 0x80) == 0) {
+	    *len = v & 0x7f;
+	    return true;
+	}
+	if ((v & 0x40) == 0) {
+	    if (!get_bits(8,&v2))
+		return false;
+	    *len = ((v & 0x3f) << 8) | v2;
+	    return true;
+	}
+	v &= 0x3f;
+	if (v < 1 || v > 4)
+	    return false;
+	*repeat = true;
+	*len = 16384 * v;
+	return true;
+    };
+    bool get_nslength(uint64_t *len)
+    {
+	uint64_t b;
+	bool repeat;
+
+	if (!get_bits(1,&b))
+	    return false;
+	if (b == 0) {
+	    if (!get_bits(6,len))
+		return false;
+	    *len += 1;
+	    return true;
+	}
+	return get_length(-1,-1,len,&repeat) && !repeat;
+    };
+    bool get_normally_small(uint64_t *v)
+    {
+	uint64_t b,len;
+	bool repeat;
+
+	if (!get_bits(1,&b))
+	    return false;
+	if (b == 0)
+	    return get_bits(6,v);
+	if (!get_length(-1,-1,&len,&repeat) || repeat || len < 1 || len > 8)
+	    return false;
+	return get_bits(8 * len,v);
+    };
+    bool get_open(Cursor *sub)
+    {
+	uint64_t len;
+	bool repeat;
+
+	return get_length(-1,-1,&len,&repeat) && !repeat && split(len,sub);
+    };
+
+ private:
+    const unsigned char *buf;
+    size_t nbits;
+    size_t pos;
+};
+
+class KpmStreamDecoder::State
+{
+ public:
+    State(KpmReport *report_,time_t now_)
+	: report(report_),now(now_),format1(false),cell_count(0) {};
+
+    KpmReport *report;
+    time_t now;
+    bool format1;
+    long cell_count;
+};
+
+class KpmStreamDecoder::Item
+{
+ public:
+    Item()
+	: values(),name_len(0) {};
+
+    Value values[F_MAX];
+    char name[KPM_STREAM_MAX_NAME];
+    size_t name_len;
+};
+
+static Kind classify(const asn_TYPE_descriptor_t *td)
+{
+    const asn_TYPE_operation_t *op = td->op;
+
+    if (op == &asn_OP_SEQUENCE)
+	return K_SEQUENCE;
+    if (op == &asn_OP_CHOICE)
+	return K_CHOICE;
+    if (op == &asn_OP_SEQUENCE_OF || op == &asn_OP_SET_OF)
+	return K_SEQUENCE_OF;
+    if (op == &asn_OP_NativeInteger || op == &asn_OP_INTEGER)
+	return K_INTEGER;
+    if (op == &asn_OP_NativeEnumerated
+	|| (&asn_OP_ENUMERATED && op == &asn_OP_ENUMERATED))
+	return K_ENUMERATED;
+    if (&asn_OP_BOOLEAN && op == &asn_OP_BOOLEAN)
+	return K_BOOLEAN;
+    if (&asn_OP_NULL && op == &asn_OP_NULL)
+	return K_NULL;
+    if ((&asn_OP_NativeReal && op == &asn_OP_NativeReal)
+	|| (&asn_OP_REAL && op == &asn_OP_REAL))
+	return K_REAL;
+    /* All the restricted string types share the OCTET STRING codec. */
+    if (op->aper_decoder == asn_OP_OCTET_STRING.aper_decoder)
+	return K_STRING;
+
+    return K_OPEN;
+}
+
+KpmStreamDecoder::~KpmStreamDecoder()
+{
+    for (auto it = nodes.begin(); it != nodes.end(); ++it)
+	delete *it;
+}
+
+bool KpmStreamDecoder::init(const asn_TYPE_descriptor_t *td)
+{
+    Context ctx;
+    uint64_t wanted = 0;
+
+    if (root)
+	return true;
+
+    root = compile(td,NULL,td->name,ctx,0);
+    if (root) {
+	/*
+	 * If the member names did not line up with the containers we
+	 * read, the plan would silently produce empty reports.
+	 */
+	const Field required[] = {
+	    F_FORMAT1,F_CELL_LIST,F_AVAIL_DL_PRBS,F_ACTIVE_UES,F_RNTI,
+	    F_SLICE_NAME,F_DL_PRBS,F_DL_BYTES
+	};
+	for (auto it = nodes.begin(); it != nodes.end(); ++it)
+	    wanted |= 1ULL << (*it)->field;
+	for (size_t i = 0; i < sizeof(required) / sizeof(required[0]); ++i) {
+	    if (!(wanted & (1ULL << required[i]))) {
+		mdclog_write(MDCLOG_ERR,"kpm stream decoder: %s has no member for field %d",
+			     td->name,required[i]);
+		root = NULL;
+		break;
+	    }
+	}
+    }
+    if (!root) {
+	for (auto it = nodes.begin(); it != nodes.end(); ++it)
+	    delete *it;
+	nodes.clear();
+	return false;
+    }
+
+    mdclog_write(MDCLOG_INFO,"kpm stream decoder: compiled %lu plan nodes for %s",
+		 nodes.size(),td->name);
+    return true;
+}
+
+KpmStreamDecoder::Node *KpmStreamDecoder::compile(
+    const asn_TYPE_descriptor_t *td,const asn_per_constraints_t *pc,
+    const char *name,Context& ctx,int depth)
+{
+    if (depth > KPM_STREAM_MAX_DEPTH || nodes.size() >= KPM_STREAM_MAX_NODES) {
+	mdclog_write(MDCLOG_ERR,"kpm stream decoder: %s nests too deeply",
+		     td->name);
+	return NULL;
+    }
+
+    Node *n = new Node();
+    nodes.push_back(n);
+    n->td = td;
+    n->pc = pc ? pc : td->encoding_constraints.per_constraints;
+    n->kind = classify(td);
+    if (ctx.scope != S_NONE && ctx.level == 1)
+	n->field = field_of(ctx.scope,name);
+    else if (ctx.format1 && ctx.level > 0 && name_is(name,"indicationMessage_Format1"))
+	n->field = F_FORMAT1;
+
+    switch (n->kind) {
+    case K_SEQUENCE: {
+	const asn_SEQUENCE_specifics_t *specs = \
+	    (const asn_SEQUENCE_specifics_t *)td->specifics;
+	n->first_extension = specs ? specs->first_extension : -1;
+	n->roms_count = specs ? specs->roms_count : 0;
+	for (unsigned i = 0; i < td->elements_count; ++i) {
+	    const asn_TYPE_member_t *elm = &td->elements[i];
+	    Context cctx = ctx.descend(elm->name);
+	    Node *child;
+	    if (elm->flags & ATF_OPEN_TYPE) {
+		child = new Node();
+		nodes.push_back(child);
+		child->td = elm->type;
+	    }
+	    else
+		child = compile(elm->type,elm->encoding_constraints.per_constraints,
+				elm->name,cctx,depth + 1);
+	    if (!child)
+		return NULL;
+	    n->children.push_back(child);
+	    n->optional.push_back(elm->optional != 0);
+	}
+	break;
+    }
+    case K_CHOICE: {
+	const asn_CHOICE_specifics_t *specs = \
+	    (const asn_CHOICE_specifics_t *)td->specifics;
+	n->first_extension = specs ? specs->ext_start : -1;
+	n->from_canonical = specs ? specs->from_canonical_order : NULL;
+	for (unsigned i = 0; i < td->elements_count; ++i) {
+	    const asn_TYPE_member_t *elm = &td->elements[i];
+	    Context cctx = ctx.descend(elm->name);
+	    Node *child = compile(elm->type,elm->encoding_constraints.per_constraints,
+				  elm->name,cctx,depth + 1);
+	    if (!child)
+		return NULL;
+	    n->children.push_back(child);
+	}
+	break;
+    }
+    case K_SEQUENCE_OF: {
+	const asn_TYPE_member_t *elm = &td->elements[0];
+	Scope scope = S_NONE;
+	if (ctx.du && !ctx.du_epc && name_is(name,"cellResourceReportList")) {
+	    scope = S_CELL;
+	    n->field = F_CELL_LIST;
+	}
+	else if (ctx.du_epc && name_is(name,"perUEReportList"))
+	    scope = S_DU_UE;
+	else if (ctx.du_epc && name_is(name,"perSliceReportList"))
+	    scope = S_DU_SLICE;
+	else if (ctx.cuup_epc && name_is(name,"perUEReportList"))
+	    scope = S_CUUP_UE;
+	else if (ctx.cuup_epc && name_is(name,"perSliceReportList"))
+	    scope = S_CUUP_SLICE;
+	Context cctx = ctx.descend(elm->name);
+	if (scope != S_NONE) {
+	    cctx.scope = scope;
+	    cctx.level = 0;
+	}
+	Node *child = compile(elm->type,elm->encoding_constraints.per_constraints,
+			      elm->name,cctx,depth + 1);
+	if (!child)
+	    return NULL;
+	child->scope = scope;
+	n->children.push_back(child);
+	break;
+    }
+    case K_INTEGER:
+    case K_ENUMERATED: {
+	const asn_INTEGER_specifics_t *specs = \
+	    (const asn_INTEGER_specifics_t *)td->specifics;
+	n->is_unsigned = specs && specs->field_unsigned;
+	n->enum_specs = specs;
+	if (n->kind == K_ENUMERATED && (!specs || !n->pc)) {
+	    mdclog_write(MDCLOG_ERR,"kpm stream decoder: enumerated %s has no map",
+			 td->name);
+	    return NULL;
+	}
+	break;
+    }
+    case K_STRING: {
+	const asn_OCTET_STRING_specifics_t *specs = \
+	    (const asn_OCTET_STRING_specifics_t *)td->specifics;
+	n->subvariant = specs ? specs->subvariant : OS_STR;
+	if (n->subvariant != OS_STR && n->subvariant != OS_BIT) {
+	    mdclog_write(MDCLOG_ERR,"kpm stream decoder: unsupported string type %s",
+			 td->name);
+	    return NULL;
+	}
+	break;
+    }
+    case K_BOOLEAN:
+    case K_NULL:
+    case K_REAL:
+	break;
+    default:
+	mdclog_write(MDCLOG_ERR,"kpm stream decoder: unsupported type %s (member %s)",
+		     td->name,name ? name : "");
+	return NULL;
+    }
+
+    if (n->field == F_SLICE_NAME && n->kind != K_STRING) {
+	mdclog_write(MDCLOG_ERR,"kpm stream decoder: slice name %s is not a string",
+		     td->name);
+	return NULL;
+    }
+    else if (n->field >= F_AVAIL_DL_PRBS && n->field != F_SLICE_NAME
+	     && n->kind != K_INTEGER && n->kind != K_ENUMERATED
+	     && n->kind != K_REAL && n->kind != K_BOOLEAN) {
+	mdclog_write(MDCLOG_ERR,"kpm stream decoder: metric %s (%s) is not numeric",
+		     name ? name : "",td->name);
+	return NULL;
+    }
+
+    return n;
+}
+
+namespace {
+
+static bool get_integer(const KpmStreamDecoder::Node *n,
+			KpmStreamDecoder::Cursor& c,Value *v)
+{
+    const asn_per_constraint_t *ct = n->pc ? &n->pc->value : NULL;
+    uint64_t x,len;
+    bool repeat;
+
+    v->real = false;
+    if (ct && (ct->flags & PER_EXTENSIBLE)) {
+	if (!c.get_bits(1,&x))
+	    return false;
+	if (x)
+	    ct = NULL;
+    }
+    if (ct && (ct->flags & PER_CONSTRAINED)) {
+	if (ct->range_bits < 0)
+	    return false;
+	if (ct->range_bits > 16) {
+	    int max_range_bytes = (ct->range_bits >> 3) + ((ct->range_bits % 8) ? 1 : 0);
+	    int i;
+	    for (i = 1; ; ++i)
+		if ((1 << i) >= max_range_bytes)
+		    break;
+	    if (!c.get_bits(i,&len))
+		return false;
+	    len += 1;
+	    if (len > 8 || !c.align() || !c.get_bits(8 * len,&x))
+		return false;
+	}
+	else if (ct->range_bits < 8) {
+	    if (!c.get_bits(ct->range_bits,&x))
+		return false;
+	}
+	else if (ct->range_bits == 8) {
+	    if (!c.align() || !c.get_bits(8,&x))
+		return false;
+	}
+	else if (!c.align() || !c.get_bits(16,&x))
+	    return false;
+	v->i = (int64_t)(x + ct->lower_bound);
+	return true;
+    }
+
+    if (!c.get_length(-1,-1,&len,&repeat) || repeat || len > 8)
+	return false;
+    if (len == 0)
+	x = 0;
+    else if (!c.get_bits(8 * len,&x))
+	return false;
+    else if (!n->is_unsigned && len < 8 && (x >> (8 * len - 1)) & 1)
+	x |= ~0ULL << (8 * len);
+    v->i = (int64_t)x;
+    if (ct && ct->lower_bound)
+	v->i += ct->lower_bound;
+    return true;
+}
+
+static bool get_enumerated(const KpmStreamDecoder::Node *n,
+			   KpmStreamDecoder::Cursor& c,Value *v)
+{
+    const asn_INTEGER_specifics_t *specs = n->enum_specs;
+    const asn_per_constraint_t *ct = &n->pc->value;
+    uint64_t x;
+
+    v->real = false;
+    if (ct->flags & PER_EXTENSIBLE) {
+	if (!c.get_bits(1,&x))
+	    return false;
+	if (x)
+	    ct = NULL;
+    }
+    if (ct && ct->range_bits >= 0) {
+	if (!c.get_bits(ct->range_bits,&x))
+	    return false;
+	if (x >= (uint64_t)(specs->extension ? specs->extension - 1 : specs->map_count))
+	    return false;
+    }
+    else {
+	if (!specs->extension || !c.get_normally_small(&x))
+	    return false;
+	x += specs->extension - 1;
+	if (x >= (uint64_t)specs->map_count)
+	    return false;
+    }
+    v->i = specs->value2enum ? specs->value2enum[x].nat_value : (int64_t)x;
+    return true;
+}
+
+/* The X.690 REAL contents octets, as asn1c's APER codec carries them. */
+static bool get_real(KpmStreamDecoder::Cursor& c,Value *v)
+{
+    unsigned char b[32];
+    uint64_t len,x;
+    bool repeat;
+
+    v->real = true;
+    v->d = 0.0;
+    if (!c.get_length(-1,-1,&len,&repeat) || repeat || len > sizeof(b))
+	return false;
+    for (uint64_t i = 0; i < len; ++i) {
+	if (!c.get_bits(8,&x))
+	    return false;
+	b[i] = (unsigned char)x;
+    }
+    if (len == 0)
+	return true;
+
+    if (b[0] & 0x80) {
+	int base_bits = ((b[0] >> 4) & 0x3) == 0 ? 1 : (((b[0] >> 4) & 0x3) == 1 ? 3 : 4);
+	int scale = (b[0] >> 2) & 0x3;
+	size_t elen = (b[0] & 0x3) + 1;
+	size_t off = 1;
+	if ((b[0] & 0x3) == 3) {
+	    if (len < 2)
+		return false;
+	    elen = b[1];
+	    off = 2;
+	}
+	if (((b[0] >> 4) & 0x3) == 3 || elen < 1 || elen > 4 || off + elen > len)
+	    return false;
+	int64_t e = (b[off] & 0x80) ? -1 : 0;
+	for (size_t i = 0; i < elen; ++i)
+	    e = (e * 256) | b[off + i];
+	double m = 0.0;
+	for (size_t i = off + elen; i < len; ++i)
+	    m = m * 256.0 + b[i];
+	v->d = ldexp(m,(int)(e * base_bits + scale));
+	if (b[0] & 0x40)
+	    v->d = -v->d;
+	return true;
+    }
+    else if (b[0] & 0x40) {
+	switch (b[0]) {
+	case 0x40: v->d = HUGE_VAL; return true;
+	case 0x41: v->d = -HUGE_VAL; return true;
+	case 0x42: v->d = NAN; return true;
+	case 0x43: v->d = -0.0; return true;
+	default: return false;
+	}
+    }
+    else {
+	char s[sizeof(b)];
+	char *end;
+	size_t i;
+	for (i = 1; i < len; ++i)
+	    s[i - 1] = (b[i] == ',') ? '.' : (char)b[i];
+	s[i - 1] = '\0';
+	v->d = strtod(s,&end);
+	return end != s;
+    }
+}
+
+/*
+ * Skips or captures (into out, if set) an OCTET STRING family value.
+ * Character strings are always 8 bits per character in asn1c's
+ * aligned variant, whatever their permitted alphabet.
+ */
+static bool get_string(const KpmStreamDecoder::Node *n,
+		       KpmStreamDecoder::Cursor& c,
+		       char *out,size_t out_cap,size_t *out_len)
+{
+    int unit_bits = (n->subvariant == OS_BIT) ? 1 : 8;
+    int flags = PER_SEMI_CONSTRAINED;
+    int effective_bits = -1;
+    int64_t lb = 0,ub = 0;
+    uint64_t raw,x;
+    bool repeat;
+
+    if (n->pc) {
+	flags = n->pc->size.flags;
+	effective_bits = n->pc->size.effective_bits;
+	lb = n->pc->size.lower_bound;
+	ub = n->pc->size.upper_bound;
+    }
+    if (flags & PER_EXTENSIBLE) {
+	if (!c.get_bits(1,&x))
+	    return false;
+	if (x) {
+	    effective_bits = -1;
+	    lb = ub = 0;
+	}
+    }
+
+    if (effective_bits == 0) {
+	raw = ub;
+	if ((n->subvariant == OS_BIT ? (raw + 7) >> 3 : raw) > 2
+	    && !c.align())
+	    return false;
+    }
+    else {
+	if (!c.get_length((ub - lb == 0) ? -1 : ub - lb + 1,effective_bits,
+			  &raw,&repeat)
+	    || repeat)
+	    return false;
+	raw += lb;
+	if (raw > 2 && !c.align())
+	    return false;
+    }
+
+    if (!out)
+	return c.skip(raw * unit_bits);
+    if (unit_bits != 8 || raw > out_cap)
+	return false;
+    for (uint64_t i = 0; i < raw; ++i) {
+	if (!c.get_bits(8,&x))
+	    return false;
+	out[i] = (char)x;
+    }
+    *out_len = raw;
+    return true;
+}
+
+}
+
+bool KpmStreamDecoder::decode(const unsigned char *buf,size_t len,
+			      KpmReport *report)
+{
+    if (!root || !buf || len < 1)
+	return false;
+
+    Cursor c(buf,len);
+    State s(report,std::time(nullptr));
+
+    return walk(root,c,s,NULL) && s.format1;
+}
+
+bool KpmStreamDecoder::walk(const Node *n,Cursor& c,State& s,Item *item)
+{
+    Value v = { };
+    uint64_t x;
+
+    if (n->field == F_FORMAT1)
+	s.format1 = true;
+
+    switch (n->kind) {
+    case K_SEQUENCE:
+	return walk_sequence(n,c,s,item);
+    case K_CHOICE:
+	return walk_choice(n,c,s,item);
+    case K_SEQUENCE_OF:
+	return walk_sequence_of(n,c,s,item);
+    case K_OPEN:
+	return walk_open(n,c,s,item);
+    case K_NULL:
+	return true;
+    case K_STRING:
+	if (n->field == F_SLICE_NAME && item)
+	    return get_string(n,c,item->name,sizeof(item->name),&item->name_len);
+	return get_string(n,c,NULL,0,NULL);
+    case K_BOOLEAN:
+	if (!c.get_bits(1,&x))
+	    return false;
+	v.i = (int64_t)x;
+	break;
+    case K_INTEGER:
+	if (!get_integer(n,c,&v))
+	    return false;
+	break;
+    case K_ENUMERATED:
+	if (!get_enumerated(n,c,&v))
+	    return false;
+	break;
+    case K_REAL:
+	if (!get_real(c,&v))
+	    return false;
+	break;
+    default:
+	return false;
+    }
+
+    switch (n->field) {
+    case F_NONE:
+	break;
+    case F_AVAIL_DL_PRBS:
+	if (s.cell_count == 1)
+	    s.report->available_dl_prbs = (int)v.as_int();
+	break;
+    case F_AVAIL_UL_PRBS:
+	if (s.cell_count == 1)
+	    s.report->available_ul_prbs = (int)v.as_int();
+	break;
+    case F_ACTIVE_UES:
+	s.report->active_ues = (long)v.as_int();
+	break;
+    default:
+	if (item)
+	    item->values[n->field] = v;
+	break;
+    }
+
+    return true;
+}
+
+bool KpmStreamDecoder::walk_sequence(const Node *n,Cursor& c,State& s,
+				     Item *item)
+{
+    size_t root_count = (n->first_extension < 0) \
+	? n->children.size() : (size_t)n->first_extension;
+    uint64_t ext = 0,present,bmlen;
+
+    if (n->first_extension >= 0 && !c.get_bits(1,&ext))
+	return false;
+
+    Cursor bitmap = c;
+    if (!c.skip(n->roms_count))
+	return false;
+
+    for (size_t i = 0; i < root_count && i < n->children.size(); ++i) {
+	if (n->optional[i]) {
+	    if (!bitmap.get_bits(1,&present))
+		return false;
+	    if (!present)
+		continue;
+	}
+	if (!walk(n->children[i],c,s,item))
+	    return false;
+    }
+
+    if (!ext)
+	return true;
+
+    if (!c.get_nslength(&bmlen))
+	return false;
+    Cursor ebitmap = c;
+    if (!c.skip(bmlen))
+	return false;
+    for (uint64_t i = 0; i < bmlen; ++i) {
+	Cursor sub(NULL,0);
+	if (!ebitmap.get_bits(1,&present))
+	    return false;
+	if (!present)
+	    continue;
+	if (!c.get_open(&sub))
+	    return false;
+	size_t idx = root_count + i;
+	if (idx < n->children.size() && !walk(n->children[idx],sub,s,item))
+	    return false;
+    }
+
+    return true;
+}
+
+bool KpmStreamDecoder::walk_choice(const Node *n,Cursor& c,State& s,
+				   Item *item)
+{
+    const asn_per_constraint_t *ct = n->pc ? &n->pc->value : NULL;
+    uint64_t x,idx;
+
+    if (ct && (ct->flags & PER_EXTENSIBLE)) {
+	if (!c.get_bits(1,&x))
+	    return false;
+	if (x)
+	    ct = NULL;
+    }
+
+    if (ct && ct->range_bits >= 0) {
+	if (!c.get_bits(ct->range_bits,&idx) || (int64_t)idx > ct->upper_bound)
+	    return false;
+	if (n->from_canonical)
+	    idx = n->from_canonical[idx];
+	if (idx >= n->children.size())
+	    return false;
+	return walk(n->children[idx],c,s,item);
+    }
+
+    Cursor sub(NULL,0);
+    if (n->first_extension < 0 || !c.get_normally_small(&idx))
+	return false;
+    idx += n->first_extension;
+    if (idx >= n->children.size())
+	return false;
+    if (n->from_canonical)
+	idx = n->from_canonical[idx];
+    if (!c.get_open(&sub))
+	return false;
+    return walk(n->children[idx],sub,s,item);
+}
+
+bool KpmStreamDecoder::walk_sequence_of(const Node *n,Cursor& c,State& s,
+					Item *item)
+{
+    const asn_per_constraint_t *ct = n->pc ? &n->pc->size : NULL;
+    const Node *elm = n->children[0];
+    uint64_t x,nelems;
+    bool repeat = false,have_count = false;
+
+    if (ct && (ct->flags & PER_EXTENSIBLE)) {
+	if (!c.get_bits(1,&x))
+	    return false;
+	if (x)
+	    ct = NULL;
+    }
+    if (ct && ct->effective_bits >= 0) {
+	if (!c.get_nsnnwn(ct->upper_bound - ct->lower_bound + 1,&nelems))
+	    return false;
+	nelems += ct->lower_bound;
+	have_count = true;
+    }
+
+    do {
+	if (!have_count
+	    && !c.get_length(ct ? ct->upper_bound - ct->lower_bound + 1 : -1,
+			     ct ? ct->effective_bits : -1,&nelems,&repeat))
+	    return false;
+	have_count = false;
+	if (n->field == F_CELL_LIST)
+	    s.cell_count = repeat ? 0 : (long)nelems;
+
+	for (uint64_t i = 0; i < nelems; ++i) {
+	    if (elm->scope == S_DU_UE || elm->scope == S_DU_SLICE
+		|| elm->scope == S_CUUP_UE || elm->scope == S_CUUP_SLICE) {
+		Item scoped;
+		if (!walk(elm,c,s,&scoped))
+		    return false;
+		commit(elm,s,scoped);
+	    }
+	    else if (!walk(elm,c,s,item))
+		return false;
+	}
+    } while (repeat);
+
+    return true;
+}
+
+bool KpmStreamDecoder::walk_open(const Node *n,Cursor& c,State& s,
+				 Item *item)
+{
+    Cursor sub(NULL,0);
+
+    return c.get_open(&sub);
+}
+
+/*
+ * Applies one report list item exactly as decode_kpm_indication()
+ * would: DU items count only when the container has a single cell, and
+ * items without an RNTI or slice name are ignored.
+ */
+void KpmStreamDecoder::commit(const Node *n,State& s,Item& item)
+{
+    EntityMetricsTable *t;
+    size_t row;
+
+    if ((n->scope == S_DU_UE || n->scope == S_DU_SLICE) && s.cell_count != 1)
+	return;
+
+    if (n->scope == S_DU_UE || n->scope == S_CUUP_UE) {
+	long rnti = (long)item.values[F_RNTI].as_int();
+	if (rnti < 1)
+	    return;
+	t = &s.report->ues;
+	row = s.report->ue_row(rnti,s.now);
+    }
+    else {
+	if (item.name_len < 1)
+	    return;
+	uint32_t id = slice_names().lookup(std::string_view(item.name,item.name_len));
+	if (id == InternTable::NONE)
+	    return;
+	t = &s.report->slices;
+	row = s.report->slice_row(id,s.now);
+    }
+
+    if (n->scope == S_CUUP_UE || n->scope == S_CUUP_SLICE) {
+	t->dl_bytes[row] = item.values[F_DL_BYTES].as_uint();
+	t->ul_bytes[row] = item.values[F_UL_BYTES].as_uint();
+	return;
+    }
+
+    t->dl_prbs[row] = item.values[F_DL_PRBS].as_uint();
+    t->ul_prbs[row] = item.values[F_UL_PRBS].as_uint();
+    t->tx_pkts[row] = item.values[F_TX_PKTS].as_int();
+    t->tx_errors[row] = item.values[F_TX_ERRORS].as_int();
+    t->tx_brate[row] = item.values[F_TX_BRATE].as_int();
+    t->rx_pkts[row] = item.values[F_RX_PKTS].as_int();
+    t->rx_errors[row] = item.values[F_RX_ERRORS].as_int();
+    t->rx_brate[row] = item.values[F_RX_BRATE].as_int();
+    t->dl_cqi[row] = item.values[F_DL_CQI].as_double();
+    t->dl_ri[row] = item.values[F_DL_RI].as_double();
+    t->dl_pmi[row] = item.values[F_DL_PMI].as_double();
+    t->ul_phr[row] = item.values[F_UL_PHR].as_double();
+    t->ul_sinr[row] = item.values[F_UL_SINR].as_double();
+    t->ul_mcs[row] = item.values[F_UL_MCS].as_double();
+    t->ul_samples[row] = item.values[F_UL_SAMPLES].as_int();
+}
+}
+}
@@ -0,0 +1,179 @@
+#include "aggregator.h"
+#include "e2sm_intern.h"
+
+namespace nexran {
+
+bool SliceWeights::find(uint32_t id,float *weight) const
+{
+    uint32_t slot = e2sm::InternTable::index_of(id);
+
+    if (slot >= ids.size() || ids[slot] != id)
+	return false;
+    *weight = weights[slot];
+    return true;
+}
+
+void SliceWeights::set(uint32_t id,float weight)
+{
+    uint32_t slot = e2sm::InternTable::index_of(id);
+
+    if (slot >= ids.size()) {
+	ids.resize(slot + 1,e2sm::InternTable::NONE);
+	weights.resize(slot + 1,-1.0f);
+    }
+    ids[slot] = id;
+    weights[slot] = weight;
+}
+
+void SliceWeights::clear(uint32_t id)
+{
+    uint32_t slot = e2sm::InternTable::index_of(id);
+
+    if (slot < ids.size() && ids[slot] == id)
+	ids[slot] = e2sm::InternTable::NONE;
+}
+
+void MergedKpmReport::clear()
+{
+    nodebs = 0;
+    period_ms = 0;
+    available_prbs = 0;
+    max_dl_prbs = 0;
+    shared_dl_bytes = 0;
+    shared_weight = 0.0f;
+    shared_slices = 0;
+    for (auto it = slice_id.begin(); it != slice_id.end(); ++it)
+	slice_index[e2sm::InternTable::index_of(*it)] = 0;
+    slice_id.clear();
+    slices.clear();
+    samples.clear();
+}
+
+ssize_t MergedKpmReport::find_slice(uint32_t id) const
+{
+    uint32_t slot = e2sm::InternTable::index_of(id);
+
+    if (slot >= slice_index.size() || !slice_index[slot])
+	return -1;
+    ssize_t row = (ssize_t)slice_index[slot] - 1;
+    return (slice_id[row] == id) ? row : -1;
+}
+
+size_t MergedKpmReport::slice_row(uint32_t id)
+{
+    ssize_t row = find_slice(id);
+
+    if (row >= 0)
+	return row;
+
+    uint32_t slot = e2sm::InternTable::index_of(id);
+    row = slices.add(0);
+    slice_id.push_back(id);
+    if (slot >= slice_index.size())
+	slice_index.resize(slot + 1,0);
+    slice_index[slot] = (uint32_t)(row + 1);
+
+    return row;
+}
+
+KpmAggregator::~KpmAggregator()
+{
+    for (auto it = shards.begin(); it != shards.end(); ++it)
+	delete *it;
+}
+
+void KpmAggregator::init(int num_shards)
+{
+    if (num_shards < 1)
+	num_shards = 1;
+    for (int i = 0; i < num_shards; ++i)
+	shards.push_back(new Shard());
+}
+
+void KpmAggregator::publish(int shard,const std::string& meid,
+			    e2sm::kpm::KpmReport *report)
+{
+    Shard *s = shards[shard % shards.size()];
+
+    std::lock_guard<std::mutex> lock(s->mutex);
+    NodeBKpmState& state = s->nodebs[meid];
+    state.period_ms = report->period_ms;
+    state.available_dl_prbs = report->available_dl_prbs;
+    state.slice_id = report->slice_id;
+    state.slices = report->slices;
+    for (size_t i = 0; i < report->slice_id.size(); ++i)
+	state.pending.emplace_back(report->slice_id[i],report->slices.get(i));
+    state.fresh = true;
+}
+
+/*
+ * Folds every NodeB that reported since the last merge into merged,
+ * totalling the equalized slices by their weights as it goes.  Row sums
+ * only grow, so the running maximum is the final one.  Returns false
+ * if nothing new arrived.
+ */
+bool KpmAggregator::merge(MergedKpmReport& merged,const SliceWeights& weights)
+{
+    merged.clear();
+
+    for (auto it = shards.begin(); it != shards.end(); ++it) {
+	Shard *s = *it;
+
+	std::lock_guard<std::mutex> lock(s->mutex);
+	for (auto it2 = s->nodebs.begin(); it2 != s->nodebs.end(); ++it2) {
+	    NodeBKpmState& state = it2->second;
+	    if (!state.fresh)
+		continue;
+
+	    ++merged.nodebs;
+	    if (state.period_ms > merged.period_ms)
+		merged.period_ms = state.period_ms;
+	    merged.available_prbs += \
+		(uint64_t)state.period_ms * 2 * state.available_dl_prbs;
+	    const e2sm::kpm::EntityMetricsTable& t = state.slices;
+	    e2sm::kpm::EntityMetricsTable& m = merged.slices;
+	    for (size_t i = 0; i < state.slice_id.size(); ++i) {
+		uint32_t id = state.slice_id[i];
+		float weight = -1.0f;
+		bool equalized = weights.find(id,&weight);
+		ssize_t row = merged.find_slice(id);
+		if (row < 0) {
+		    row = merged.slice_row(id);
+		    if (weight >= 0.0f) {
+			merged.shared_weight += weight;
+			++merged.shared_slices;
+		    }
+		}
+		m.time[row] = t.time[i];
+		m.dl_bytes[row] += t.dl_bytes[i];
+		m.ul_bytes[row] += t.ul_bytes[i];
+		m.dl_prbs[row] += t.dl_prbs[i];
+		m.ul_prbs[row] += t.ul_prbs[i];
+		m.tx_pkts[row] += t.tx_pkts[i];
+		m.tx_errors[row] += t.tx_errors[i];
+		m.rx_pkts[row] += t.rx_pkts[i];
+		m.rx_errors[row] += t.rx_errors[i];
+		if (equalized && m.dl_prbs[row] > merged.max_dl_prbs)
+		    merged.max_dl_prbs = m.dl_prbs[row];
+		if (weight >= 0.0f)
+		    merged.shared_dl_bytes += t.dl_bytes[i];
+	    }
+	    merged.samples.insert(merged.samples.end(),
+				  state.pending.begin(),state.pending.end());
+	    state.pending.clear();
+	    state.fresh = false;
+	}
+    }
+
+    return merged.nodebs > 0;
+}
+
+void KpmAggregator::forget(const std::string& meid)
+{
+    for (auto it = shards.begin(); it != shards.end(); ++it) {
+	std::lock_guard<std::mutex> lock((*it)->mutex);
+	(*it)->nodebs.erase(meid);
+    }
+}
+
+}
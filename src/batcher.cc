@@ -0,0 +1,219 @@
+
+#include "mdclog/mdclog.h"
+
+#include "batcher.h"
+
+namespace nexran {
+
+bool ControlBatcher::start(int window_ms_,int max_batch_)
+{
+    if (running)
+	return true;
+
+    if (window_ms_ < 0 || max_batch_ < 1) {
+	mdclog_write(MDCLOG_ERR,"invalid control batcher config (window %d ms, max batch %d)",
+		     window_ms_,max_batch_);
+	return false;
+    }
+    if (window_ms_ == 0) {
+	mdclog_write(MDCLOG_INFO,"control batching disabled");
+	return true;
+    }
+
+    window_ms = window_ms_;
+    max_batch = max_batch_;
+    should_stop = false;
+    running = true;
+    thread = new std::thread(&ControlBatcher::flusher,this);
+
+    mdclog_write(MDCLOG_INFO,"started control batcher (window %d ms, max batch %d)",
+		 window_ms,max_batch);
+
+    return true;
+}
+
+void ControlBatcher::stop()
+{
+    if (!running)
+	return;
+
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	running = false;
+	should_stop = true;
+	cv.notify_all();
+    }
+    thread->join();
+    delete thread;
+    thread = NULL;
+
+    flush_all();
+}
+
+void ControlBatcher::submit(const std::string& meid,const std::string& slice,
+			    int share)
+{
+    bool full = false;
+
+    submitted.fetch_add(1,std::memory_order_relaxed);
+    {
+	std::unique_lock<std::mutex> lock(mutex);
+	if (!running) {
+	    lock.unlock();
+	    Batch batch;
+	    batch.shares[slice] = share;
+	    batch.trace = e2ap::trace_context();
+	    const std::lock_guard<std::mutex> send_lock(send_mutex);
+	    send(meid,batch);
+	    return;
+	}
+	auto it = batches.find(meid);
+	if (it == batches.end()) {
+	    it = batches.emplace(meid,Batch()).first;
+	    it->second.deadline = std::chrono::steady_clock::now()
+		+ std::chrono::milliseconds(window_ms);
+	    cv.notify_one();
+	}
+	auto it2 = it->second.shares.find(slice);
+	if (it2 != it->second.shares.end()) {
+	    it2->second = share;
+	    superseded.fetch_add(1,std::memory_order_relaxed);
+	}
+	else
+	    it->second.shares[slice] = share;
+	if (it->second.trace.id == 0)
+	    it->second.trace = e2ap::trace_context();
+	full = (int)it->second.shares.size() >= max_batch;
+    }
+
+    if (full)
+	flush(meid);
+}
+
+void ControlBatcher::flush(const std::string& meid)
+{
+    Batch batch;
+    const std::lock_guard<std::mutex> send_lock(send_mutex);
+
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = batches.find(meid);
+	if (it == batches.end())
+	    return;
+	batch.shares.swap(it->second.shares);
+	batch.trace = it->second.trace;
+	batches.erase(it);
+    }
+    send(meid,batch);
+}
+
+void ControlBatcher::flush_all()
+{
+    std::map<std::string,Batch> all;
+    const std::lock_guard<std::mutex> send_lock(send_mutex);
+
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	all.swap(batches);
+    }
+    for (auto it = all.begin(); it != all.end(); ++it)
+	send(it->first,it->second);
+}
+
+void ControlBatcher::send(const std::string& meid,Batch& batch)
+{
+    if (batch.shares.empty())
+	return;
+
+    e2ap::TraceScope scope(batch.trace);
+    requests.fetch_add(1,std::memory_order_relaxed);
+    configs.fetch_add(batch.shares.size(),std::memory_order_relaxed);
+    handler->send_slice_configs(meid,batch.shares);
+}
+
+/*
+ * Sleeps until the earliest batch is due, then sends every due batch.
+ * Like flush(), it takes send_mutex before emptying any batch, so that
+ * batches to the same NodeB are always sent in the order they were
+ * emptied.
+ */
+void ControlBatcher::flusher()
+{
+    while (true) {
+	{
+	    std::unique_lock<std::mutex> lock(mutex);
+	    while (!should_stop) {
+		auto now = std::chrono::steady_clock::now();
+		bool due = false;
+		auto next = now + std::chrono::milliseconds(window_ms);
+		for (auto it = batches.begin(); it != batches.end(); ++it) {
+		    if (it->second.deadline <= now)
+			due = true;
+		    else if (it->second.deadline < next)
+			next = it->second.deadline;
+		}
+		if (due)
+		    break;
+		if (batches.empty())
+		    cv.wait(lock);
+		else
+		    cv.wait_until(lock,next);
+	    }
+	    if (should_stop)
+		break;
+	}
+
+	std::map<std::string,Batch> due;
+	const std::lock_guard<std::mutex> send_lock(send_mutex);
+	{
+	    std::lock_guard<std::mutex> lock(mutex);
+	    auto now = std::chrono::steady_clock::now();
+	    for (auto it = batches.begin(); it != batches.end(); ) {
+		if (it->second.deadline <= now) {
+		    Batch& batch = due[it->first];
+		    batch.shares.swap(it->second.shares);
+		    batch.trace = it->second.trace;
+		    it = batches.erase(it);
+		}
+		else
+		    ++it;
+	    }
+	}
+	for (auto it = due.begin(); it != due.end(); ++it)
+	    send(it->first,it->second);
+    }
+}
+
+void ControlBatcher::serialize(rapidjson::Writer<rapidjson::StringBuffer>& writer)
+{
+    uint64_t nsubmitted = submitted.load(std::memory_order_relaxed);
+    uint64_t nrequests = requests.load(std::memory_order_relaxed);
+    size_t pending = 0;
+
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto it = batches.begin(); it != batches.end(); ++it)
+	    pending += it->second.shares.size();
+    }
+
+    writer.StartObject();
+    writer.String("window_ms");
+    writer.Int(window_ms);
+    writer.String("max_batch");
+    writer.Int(max_batch);
+    writer.String("submitted");
+    writer.Uint64(nsubmitted);
+    writer.String("superseded");
+    writer.Uint64(superseded.load(std::memory_order_relaxed));
+    writer.String("requests");
+    writer.Uint64(nrequests);
+    writer.String("configs");
+    writer.Uint64(configs.load(std::memory_order_relaxed));
+    writer.String("pending");
+    writer.Uint64(pending);
+    writer.String("ratio");
+    writer.Double(nrequests ? (double)nsubmitted / nrequests : 0.0);
+    writer.EndObject();
+}
+
+}
@@ -38,6 +38,73 @@ nexran::Config::Config()
     config[RMR_NOWAIT] = new Item(
 	BOOL,'R',"rmr-nowait","RMR_NOWAIT",false,new ItemValue(false),
 	"Do not wait for RMR route established (waits by default).");
+    config[PIPELINE_WORKERS] = new Item(
+	INTEGER,'w',"pipeline-workers","PIPELINE_WORKERS",false,new ItemValue(2),
+	"The number of inbound message worker shards; each E2 node is handled by one shard, in order (0 handles messages on the RMR thread).");
+    config[PIPELINE_QUEUE_SIZE] = new Item(
+	INTEGER,'q',"pipeline-queue-size","PIPELINE_QUEUE_SIZE",false,new ItemValue(1024),
+	"The number of inbound messages that may be queued for each shard.");
+    config[PIPELINE_OVERLOAD_POLICY] = new Item(
+	STRING,'o',"pipeline-overload-policy","PIPELINE_OVERLOAD_POLICY",false,
+	new ItemValue("backpressure"),
+	"What to do when the inbound queue is full (backpressure; or drop-oldest, which drops only indications).");
+    config[KPM_DECODER] = new Item(
+	STRING,'k',"kpm-decoder","KPM_DECODER",false,new ItemValue("asn1c"),
+	"How to decode KPM indications (asn1c; stream, which falls back to asn1c on error; or validate, which runs both and logs differences).");
+    config[E2_CONTROL_TIMEOUT] = new Item(
+	INTEGER,'c',"e2-control-timeout","E2_CONTROL_TIMEOUT",false,new ItemValue(5000),
+	"Milliseconds to wait for a control ack before retransmitting (0 disables).");
+    config[E2_SUBSCRIPTION_TIMEOUT] = new Item(
+	INTEGER,'s',"e2-subscription-timeout","E2_SUBSCRIPTION_TIMEOUT",false,new ItemValue(10000),
+	"Milliseconds to wait for a subscription or subscription delete response before retransmitting (0 disables).");
+    config[E2_REQUEST_RETRIES] = new Item(
+	INTEGER,'r',"e2-request-retries","E2_REQUEST_RETRIES",false,new ItemValue(2),
+	"How many times to retransmit an unanswered E2 request, doubling the wait each time, before giving up.");
+    config[E2_MAX_CONTROLS] = new Item(
+	INTEGER,'m',"e2-max-controls","E2_MAX_CONTROLS",false,new ItemValue(4096),
+	"How many acked E2 control requests may await an answer at once; further controls are refused.");
+    config[E2_MAX_SUBSCRIPTIONS] = new Item(
+	INTEGER,'S',"e2-max-subscriptions","E2_MAX_SUBSCRIPTIONS",false,new ItemValue(1024),
+	"How many E2 subscriptions (and subscription requests or deletes in flight) to allow at once.");
+    config[CONTROL_BATCH_WINDOW] = new Item(
+	INTEGER,'b',"control-batch-window","CONTROL_BATCH_WINDOW",false,new ItemValue(2),
+	"Milliseconds to hold slice config changes to a NodeB so they can be sent in one control (0 disables).");
+    config[CONTROL_BATCH_SIZE] = new Item(
+	INTEGER,'B',"control-batch-size","CONTROL_BATCH_SIZE",false,new ItemValue(32),
+	"Send a NodeB's held slice config changes once this many slices have changed.");
+    config[EVENT_RING_SIZE] = new Item(
+	INTEGER,'e',"event-ring-size","EVENT_RING_SIZE",false,new ItemValue(256),
+	"How many events to hold for each event stream subscriber; a subscriber that falls further behind is dropped (0 disables the stream).");
+    config[EVENT_MAX_SUBSCRIBERS] = new Item(
+	INTEGER,'E',"event-max-subscribers","EVENT_MAX_SUBSCRIBERS",false,new ItemValue(8),
+	"The most concurrent event stream subscribers.");
+    config[TRACE_RING_SIZE] = new Item(
+	INTEGER,'t',"trace-ring-size","TRACE_RING_SIZE",false,new ItemValue(4096),
+	"How many trace spans each thread keeps for /v1/traces (0 disables tracing).");
+    config[PDU_TRACE_SAMPLE] = new Item(
+	INTEGER,'P',"pdu-trace-sample","PDU_TRACE_SAMPLE",false,new ItemValue(0),
+	"Trace one in this many E2AP PDUs that pass the PDU trace filters (0 disables PDU tracing).");
+    config[PDU_TRACE_FORMAT] = new Item(
+	STRING,'F',"pdu-trace-format","PDU_TRACE_FORMAT",false,new ItemValue("binary"),
+	"PDU trace format (binary, xer).");
+    config[PDU_TRACE_FILE] = new Item(
+	STRING,'f',"pdu-trace-file","PDU_TRACE_FILE",false,new ItemValue("/tmp/nexran-pdus.trace"),
+	"File to append traced PDUs to (- for stderr).");
+    config[PDU_TRACE_PROCEDURES] = new Item(
+	STRING,'C',"pdu-trace-procedures","PDU_TRACE_PROCEDURES",false,new ItemValue(""),
+	"Comma-separated E2AP procedure codes to trace (all if empty).");
+    config[PDU_TRACE_MEIDS] = new Item(
+	STRING,'M',"pdu-trace-meids","PDU_TRACE_MEIDS",false,new ItemValue(""),
+	"Comma-separated meids to trace PDUs to and from (all if empty).");
+    config[UE_HISTORY_LENGTH] = new Item(
+	INTEGER,'u',"ue-history-length","UE_HISTORY_LENGTH",false,new ItemValue(64),
+	"How many KPM samples to keep for each UE in /v1/ues/{imsi}/metrics (0 disables the UE history).");
+    config[UE_HISTORY_MAX_UES] = new Item(
+	INTEGER,'U',"ue-history-max-ues","UE_HISTORY_MAX_UES",false,new ItemValue(16384),
+	"The most UEs to keep KPM history for; samples of further UEs are dropped.");
+    config[UE_HISTORY_IDLE] = new Item(
+	INTEGER,'i',"ue-history-idle","UE_HISTORY_IDLE",false,new ItemValue(10),
+	"Seconds after its last KPM report that a UE's history is freed.");
 
     optstr = (char *)calloc(config.size() + 2 + 1,2);
     long_options = (struct option *)calloc(config.size() + 2,
@@ -0,0 +1,305 @@
+#include <algorithm>
+
+#include "mdclog/mdclog.h"
+
+#include "e2ap_log.h"
+#include "nexran.h"
+
+namespace nexran {
+
+/*
+ * Per-policy equalizer kernels.  The default moves a slice toward its
+ * weighted part of the shared downlink bytes, and keeps its share in
+ * [64,1024]; policies specialize the pieces that differ.
+ */
+template <class P>
+class PolicyKernel
+{
+ public:
+    static bool shared() { return true; }
+    static float weight(P *policy) { return 1.0f; }
+    static float factor(P *policy,float weight,
+			const EqualizerState::Totals& totals,
+			uint64_t dl_bytes,uint64_t dl_prbs)
+    {
+	if (dl_bytes == 0 || totals.weight <= 0.0f)
+	    return 0.0f;
+	float target = (float)totals.dl_bytes * weight / totals.weight;
+	return (target - dl_bytes) / dl_bytes;
+    }
+    static int clamp(P *policy,int share)
+    {
+	return std::min(std::max(share,64),1024);
+    }
+};
+
+template <>
+float PolicyKernel<WeightedFairAllocationPolicy>::weight(
+    WeightedFairAllocationPolicy *policy)
+{
+    return (float)policy->getWeight();
+}
+
+template <>
+int PolicyKernel<MinMaxGuaranteeAllocationPolicy>::clamp(
+    MinMaxGuaranteeAllocationPolicy *policy,int share)
+{
+    return std::min(std::max(share,policy->getMinShare()),policy->getMaxShare());
+}
+
+template <>
+bool PolicyKernel<PrbTargetAllocationPolicy>::shared()
+{
+    return false;
+}
+
+template <>
+float PolicyKernel<PrbTargetAllocationPolicy>::factor(
+    PrbTargetAllocationPolicy *policy,float weight,
+    const EqualizerState::Totals& totals,uint64_t dl_bytes,uint64_t dl_prbs)
+{
+    if (dl_prbs == 0)
+	return 0.0f;
+    float target = (float)totals.available_prbs * policy->getTargetPrbPct() / 100;
+    return (target - dl_prbs) / dl_prbs;
+}
+
+/* Adapts PolicyKernel<P> to the Kernel table's signatures. */
+template <class P>
+class KernelThunk
+{
+ public:
+    static float weight(ProportionalAllocationPolicy *policy)
+    {
+	return PolicyKernel<P>::weight(static_cast<P *>(policy));
+    }
+    static float factor(ProportionalAllocationPolicy *policy,float weight,
+			const EqualizerState::Totals& totals,
+			uint64_t dl_bytes,uint64_t dl_prbs)
+    {
+	return PolicyKernel<P>::factor(static_cast<P *>(policy),weight,totals,
+				       dl_bytes,dl_prbs);
+    }
+    static int clamp(ProportionalAllocationPolicy *policy,int share)
+    {
+	return PolicyKernel<P>::clamp(static_cast<P *>(policy),share);
+    }
+    static EqualizerState::Kernel kernel()
+    {
+	return { PolicyKernel<P>::shared(),weight,factor,clamp };
+    }
+};
+
+const EqualizerState::Kernel EqualizerState::kernels[AllocationPolicy::Type::__END__] = {
+    { false,NULL,NULL,NULL },
+    KernelThunk<ProportionalAllocationPolicy>::kernel(),
+    KernelThunk<WeightedFairAllocationPolicy>::kernel(),
+    KernelThunk<MinMaxGuaranteeAllocationPolicy>::kernel(),
+    KernelThunk<PrbTargetAllocationPolicy>::kernel(),
+};
+
+/*
+ * Every AllocationPolicy type is a ProportionalAllocationPolicy
+ * subclass, so the type alone selects the kernel and the cast.
+ */
+void EqualizerState::add(Slice *slice)
+{
+    AllocationPolicy *base = slice->getPolicy();
+    uint32_t id = slice->getId();
+
+    if (!base || base->getType() < AllocationPolicy::Type::Proportional
+	|| base->getType() >= AllocationPolicy::Type::__END__)
+	return;
+
+    ProportionalAllocationPolicy *policy = \
+	static_cast<ProportionalAllocationPolicy *>(base);
+    const Kernel *kernel = &kernels[base->getType()];
+    float weight = kernel->weight(policy);
+
+    weights.set(id,(kernel->shared && policy->isAutoEqualized()) ? weight : -1.0f);
+
+    ssize_t pos = find(id);
+    if (pos >= 0) {
+	Entry& e = entries[pos];
+	e.policy = policy;
+	e.kernel = kernel;
+	e.weight = weight;
+	return;
+    }
+
+    uint32_t slot = e2sm::InternTable::index_of(id);
+    if (slot >= entry_pos.size())
+	entry_pos.resize(slot + 1,0);
+    entries.push_back({ slice,policy,kernel,weight });
+    entry_pos[slot] = entries.size();
+}
+
+void EqualizerState::remove(Slice *slice)
+{
+    ssize_t pos = find(slice->getId());
+
+    if (pos < 0)
+	return;
+
+    if ((size_t)pos != entries.size() - 1) {
+	entries[pos] = entries.back();
+	entry_pos[e2sm::InternTable::index_of(entries[pos].slice->getId())] = pos + 1;
+    }
+    entries.pop_back();
+    entry_pos[e2sm::InternTable::index_of(slice->getId())] = 0;
+    weights.clear(slice->getId());
+}
+
+/* Returns the entry for slice ID id, or -1; entry_pos is by ID slot. */
+ssize_t EqualizerState::find(uint32_t id)
+{
+    uint32_t slot = e2sm::InternTable::index_of(id);
+
+    if (slot >= entry_pos.size() || !entry_pos[slot])
+	return -1;
+    size_t pos = entry_pos[slot] - 1;
+    return (entries[pos].slice->getId() == id) ? (ssize_t)pos : -1;
+}
+
+/* A policy change may swap the policy object, its type, or its weight. */
+void EqualizerState::update(Slice *slice)
+{
+    remove(slice);
+    add(slice);
+}
+
+static int share_for(const EqualizerState::Kernel *kernel,
+		     ProportionalAllocationPolicy *policy,int cshare,float factor)
+{
+    float fshare = std::min(std::max(cshare + (cshare * factor),0.0f),1024.0f);
+    return kernel->clamp(policy,(int)fshare);
+}
+
+/*
+ * Shared slices are moved toward their weighted part of the total
+ * downlink bytes, once some slice uses more than 15% of an even PRB
+ * split; other kernels (e.g. PRB targets) are always evaluated.  If no
+ * factor is outside 5% of the current share, nothing changes.
+ * Throttling decisions take precedence.
+ *
+ * KpmAggregator::merge() has already gathered the totals (see
+ * SliceWeights), so a single pass resolves throttling and computes each
+ * slice's candidate share.  Whether candidates apply depends on all the
+ * factors, so the pass only notes the slices whose share may change,
+ * and those are settled at the end.
+ */
+void EqualizerState::run(MergedKpmReport& report,std::vector<Change>& changes)
+{
+    uint64_t start = Pipeline::now_ns();
+    time_t now = std::time(nullptr);
+    Totals totals = {
+	report.shared_dl_bytes,report.shared_weight,report.available_prbs
+    };
+    bool any_above_threshold = false;
+
+    changes.clear();
+    pending.clear();
+
+    // Every per-NodeB sample goes into the policy metrics, not just the
+    // merged totals.
+    for (auto it = report.samples.begin(); it != report.samples.end(); ++it) {
+	ssize_t pos = find(it->first);
+	if (pos < 0)
+	    continue;
+	e2sm::kpm::MetricsIndex& metrics = entries[pos].policy->getMetrics();
+	metrics.set_report_period(report.period_ms);
+	metrics.add(it->second,now);
+    }
+
+    // If no slice has utilized at least 15% of an even PRB allocation,
+    // do not equalize the shared slices.
+    uint64_t available_prbs_per_slice = 0;
+    if (report.shared_slices > 0)
+	available_prbs_per_slice = report.available_prbs / report.shared_slices;
+    uint64_t prb_threshold = (uint64_t)(0.15f * available_prbs_per_slice);
+    bool shared_open = available_prbs_per_slice > 0
+	&& report.max_dl_prbs > prb_threshold;
+
+    if (shared_open)
+	E2AP_LOG_LIMIT(MDCLOG_INFO,1,"PRB utilization threshold (%lu/%lu) reached; checking for new share factors",
+		       prb_threshold,available_prbs_per_slice);
+
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+	ProportionalAllocationPolicy *policy = it->policy;
+	ssize_t row = report.find_slice(it->slice->getId());
+	float forced_factor = 0.0f;
+
+	// Ensure we flush old metrics, even if we didn't add any new ones
+	// from the current report.  A slice released from throttling may
+	// immediately qualify again.
+	if (policy->isThrottled() && policy->isThrottling()) {
+	    policy->getMetrics().flush(now);
+	    int new_share = policy->maybeEndThrottling(now);
+	    if (new_share > -1) {
+		E2AP_LOG(MDCLOG_DEBUG,"stopping throttling slice '%s' (%d -> %d)",
+			 it->slice->getName().c_str(),policy->getShare(),new_share);
+		int cur_share = policy->getShare();
+		forced_factor = (new_share - cur_share) / (float)cur_share;
+	    }
+	}
+	if (policy->isThrottled() && !policy->isThrottling()) {
+	    e2sm::kpm::MetricsIndex& metrics = policy->getMetrics();
+	    metrics.flush(now);
+	    E2AP_LOG(MDCLOG_DEBUG,"considering throttle start for slice '%s': %ld (%d) (post flush)",
+		     it->slice->getName().c_str(),metrics.get_total_bytes(),metrics.size());
+	    int new_share = policy->maybeStartThrottling(now);
+	    if (new_share > -1) {
+		E2AP_LOG(MDCLOG_DEBUG,"starting throttling slice '%s' (%d -> %d)",
+			 it->slice->getName().c_str(),policy->getShare(),new_share);
+		int cur_share = policy->getShare();
+		forced_factor = (new_share - cur_share) / (float)cur_share;
+	    }
+	}
+
+	int cshare = policy->getShare();
+	Pending p = {
+	    it->slice,policy,cshare,
+	    share_for(it->kernel,policy,cshare,forced_factor),-1
+	};
+	// NB: only auto-eq amongst metrics for auto-eq'd slices.
+	if (forced_factor == 0.0f && row >= 0 && policy->isAutoEqualized()
+	    && (!it->kernel->shared || shared_open)) {
+	    float nf = it->kernel->factor(policy,it->weight,totals,
+					  report.slices.dl_bytes[row],
+					  report.slices.dl_prbs[row]);
+	    if (nf > 0.05f || nf < -0.05f)
+		any_above_threshold = true;
+	    E2AP_LOG(MDCLOG_DEBUG,"candidate %s share factor (%s): %f",
+		     policy->getName(),it->slice->getName().c_str(),nf);
+	    p.candidate = share_for(it->kernel,policy,cshare,nf);
+	}
+	if (p.forced != cshare || (p.candidate > -1 && p.candidate != cshare))
+	    pending.push_back(p);
+    }
+
+    for (auto it = pending.begin(); it != pending.end(); ++it) {
+	int nshare = it->forced;
+	if (any_above_threshold && it->candidate > -1)
+	    nshare = it->candidate;
+	it->policy->setShare(nshare);
+	if (nshare == it->old_share)
+	    continue;
+	E2AP_LOG(MDCLOG_INFO,"slice '%s' share: %d -> %d",
+		 it->slice->getName().c_str(),it->old_share,nshare);
+	changes.push_back({ it->slice,it->old_share,nshare });
+    }
+
+    pass_cost.record(Pipeline::now_ns() - start);
+}
+
+void EqualizerState::serialize(rapidjson::Writer<rapidjson::StringBuffer>& writer)
+{
+    writer.StartObject();
+    writer.String("slices");
+    writer.Uint64(entries.size());
+    writer.String("passes");
+    pass_cost.serialize(writer);
+    writer.EndObject();
+}
+
+}
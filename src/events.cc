@@ -0,0 +1,314 @@
+
+#include "mdclog/mdclog.h"
+
+#include "events.h"
+
+namespace nexran {
+
+/* How often to write a comment to idle subscribers, to notice closes. */
+static const std::chrono::seconds HEARTBEAT_INTERVAL(15);
+
+static const char *event_type_strings[EventStream::EventType::__END__] = {
+    "kpm","share"
+};
+
+const char *EventStream::type_to_string(EventType type)
+{
+    if (type < 0 || type >= EventType::__END__)
+	return "unknown";
+    return event_type_strings[type];
+}
+
+bool EventStream::types_from_string(const std::string& s,unsigned *types)
+{
+    size_t pos = 0;
+
+    *types = 0;
+    while (pos <= s.size()) {
+	size_t end = s.find(',',pos);
+	if (end == std::string::npos)
+	    end = s.size();
+	std::string name = s.substr(pos,end - pos);
+	int i;
+	for (i = 0; i < EventType::__END__; ++i) {
+	    if (name == event_type_strings[i]) {
+		*types |= 1u << i;
+		break;
+	    }
+	}
+	if (i == EventType::__END__)
+	    return false;
+	pos = end + 1;
+    }
+
+    return true;
+}
+
+bool EventStream::start(int ring_size_,int max_subscribers_)
+{
+    if (running)
+	return true;
+
+    if (ring_size_ < 0 || max_subscribers_ < 0) {
+	mdclog_write(MDCLOG_ERR,"invalid event stream config (ring size %d, max subscribers %d)",
+		     ring_size_,max_subscribers_);
+	return false;
+    }
+    if (ring_size_ == 0 || max_subscribers_ == 0) {
+	mdclog_write(MDCLOG_INFO,"event stream disabled");
+	return true;
+    }
+
+    ring_size = ring_size_;
+    max_subscribers = max_subscribers_;
+    should_stop = false;
+    running = true;
+    thread = new std::thread(&EventStream::writer_loop,this);
+
+    mdclog_write(MDCLOG_INFO,"started event stream (ring size %d, max subscribers %d)",
+		 ring_size,max_subscribers);
+
+    return true;
+}
+
+EventStream::Ring::Ring(EventSubscriber *sub_,unsigned types_,size_t size)
+    : sub(sub_),types(types_),overflowed(false),enqueue_pos(0),dequeue_pos(0)
+{
+    size_t capacity = 1;
+    while (capacity < size)
+	capacity <<= 1;
+    mask = capacity - 1;
+    cells.reset(new Cell[capacity]);
+    for (size_t i = 0; i < capacity; ++i)
+	cells[i].sequence.store(i,std::memory_order_relaxed);
+}
+
+bool EventStream::Ring::try_push(const std::shared_ptr<const std::string>& frame)
+{
+    Cell *cell;
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+
+    while (true) {
+	cell = &cells[pos & mask];
+	size_t seq = cell->sequence.load(std::memory_order_acquire);
+	intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+	if (diff == 0) {
+	    if (enqueue_pos.compare_exchange_weak(
+		    pos,pos + 1,std::memory_order_relaxed))
+		break;
+	}
+	else if (diff < 0)
+	    return false;
+	else
+	    pos = enqueue_pos.load(std::memory_order_relaxed);
+    }
+
+    cell->frame = frame;
+    cell->sequence.store(pos + 1,std::memory_order_release);
+    return true;
+}
+
+bool EventStream::Ring::try_pop(std::shared_ptr<const std::string>& frame)
+{
+    Cell *cell = &cells[dequeue_pos & mask];
+
+    if (cell->sequence.load(std::memory_order_acquire) != dequeue_pos + 1)
+	return false;
+    frame = std::move(cell->frame);
+    cell->frame.reset();
+    cell->sequence.store(dequeue_pos + mask + 1,std::memory_order_release);
+    ++dequeue_pos;
+    return true;
+}
+
+void EventStream::stop()
+{
+    if (!running)
+	return;
+
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	should_stop = true;
+	cv.notify_all();
+    }
+    thread->join();
+    delete thread;
+    thread = NULL;
+    running = false;
+
+    while (true) {
+	std::shared_ptr<const Rings> cur = std::atomic_load(&rings);
+	if (cur->empty())
+	    break;
+	remove(cur->back(),"stopping");
+    }
+}
+
+bool EventStream::accepting()
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    return running && !should_stop && (int)rings->size() < max_subscribers;
+}
+
+bool EventStream::subscribe(EventSubscriber *sub,unsigned types)
+{
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (running && !should_stop && (int)rings->size() < max_subscribers) {
+	    std::shared_ptr<Rings> next = std::make_shared<Rings>(*rings);
+	    next->push_back(std::make_shared<Ring>(sub,types,ring_size));
+	    std::atomic_store(&rings,std::shared_ptr<const Rings>(next));
+	    for (int i = 0; i < EventType::__END__; ++i)
+		if (types & (1u << i))
+		    ++wanted[i];
+	    mdclog_write(MDCLOG_INFO,"added event subscriber (%zu total)",
+			 next->size());
+	    return true;
+	}
+    }
+
+    sub->close();
+    delete sub;
+    return false;
+}
+
+/*
+ * Lock-free: the writer is woken through mutex only if it is (about
+ * to be) asleep.  dirty and waiting are seq_cst, so either this sees
+ * waiting, or the writer's predicate sees dirty.
+ */
+void EventStream::publish(EventType type,const std::string& data)
+{
+    const char *name = type_to_string(type);
+    std::shared_ptr<const Rings> cur = std::atomic_load(&rings);
+    std::shared_ptr<const std::string> frame;
+
+    for (auto it = cur->begin(); it != cur->end(); ++it) {
+	Ring *ring = it->get();
+	if (!(ring->types & (1u << type))
+	    || ring->overflowed.load(std::memory_order_relaxed))
+	    continue;
+	if (!frame)
+	    frame = std::make_shared<const std::string>(
+		std::string("id: ") + std::to_string(next_id++) + "\nevent: "
+		+ name + "\ndata: " + data + "\n\n");
+	if (!ring->try_push(frame)
+	    && !ring->overflowed.exchange(true,std::memory_order_relaxed))
+	    dropped.fetch_add(1,std::memory_order_relaxed);
+	dirty.store(true);
+    }
+    if (!frame)
+	return;
+
+    published.fetch_add(1,std::memory_order_relaxed);
+    if (waiting.load()) {
+	std::lock_guard<std::mutex> lock(mutex);
+	cv.notify_one();
+    }
+}
+
+/*
+ * Only the writer thread (or stop(), once it has exited) removes rings,
+ * and only it touches a ring's subscriber.
+ */
+void EventStream::remove(const std::shared_ptr<Ring>& ring,const char *why)
+{
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::shared_ptr<Rings> next = std::make_shared<Rings>();
+	for (auto it = rings->begin(); it != rings->end(); ++it)
+	    if (*it != ring)
+		next->push_back(*it);
+	std::atomic_store(&rings,std::shared_ptr<const Rings>(next));
+	for (int i = 0; i < EventType::__END__; ++i)
+	    if (ring->types & (1u << i))
+		--wanted[i];
+    }
+
+    mdclog_write(MDCLOG_INFO,"removed event subscriber (%s)",why);
+    ring->sub->close();
+    delete ring->sub;
+    ring->sub = NULL;
+}
+
+/*
+ * Drains each ring without any lock held, so that a slow write only
+ * ever delays other subscribers, never a publisher.
+ */
+void EventStream::writer_loop()
+{
+    std::vector<std::shared_ptr<Ring>> overflowed;
+    std::vector<std::shared_ptr<Ring>> closed;
+    std::string frames;
+
+    while (true) {
+	bool heartbeat = false;
+
+	overflowed.clear();
+	closed.clear();
+	{
+	    std::unique_lock<std::mutex> lock(mutex);
+	    waiting.store(true);
+	    heartbeat = !cv.wait_for(lock,HEARTBEAT_INTERVAL,[this] {
+		return should_stop || dirty.load();
+	    });
+	    waiting.store(false);
+	    if (should_stop)
+		break;
+	}
+	dirty.exchange(false);
+
+	std::shared_ptr<const Rings> cur = std::atomic_load(&rings);
+	for (auto it = cur->begin(); it != cur->end(); ++it) {
+	    Ring *ring = it->get();
+	    std::shared_ptr<const std::string> frame;
+	    size_t count = 0;
+
+	    if (ring->overflowed.load(std::memory_order_relaxed)) {
+		overflowed.push_back(*it);
+		continue;
+	    }
+	    frames.clear();
+	    while (ring->try_pop(frame)) {
+		frames += *frame;
+		++count;
+	    }
+	    if (count == 0 && !heartbeat)
+		continue;
+	    if (frames.empty())
+		frames = ":\n\n";
+	    if (ring->sub->write(frames))
+		delivered.fetch_add(count,std::memory_order_relaxed);
+	    else
+		closed.push_back(*it);
+	}
+	for (auto it = overflowed.begin(); it != overflowed.end(); ++it)
+	    remove(*it,"too slow");
+	for (auto it = closed.begin(); it != closed.end(); ++it)
+	    remove(*it,"closed");
+    }
+}
+
+void EventStream::serialize(rapidjson::Writer<rapidjson::StringBuffer>& writer)
+{
+    size_t subscribers = 0;
+
+    subscribers = std::atomic_load(&rings)->size();
+
+    writer.StartObject();
+    writer.String("ring_size");
+    writer.Int(ring_size);
+    writer.String("max_subscribers");
+    writer.Int(max_subscribers);
+    writer.String("subscribers");
+    writer.Uint64(subscribers);
+    writer.String("published");
+    writer.Uint64(published.load(std::memory_order_relaxed));
+    writer.String("delivered");
+    writer.Uint64(delivered.load(std::memory_order_relaxed));
+    writer.String("dropped_subscribers");
+    writer.Uint64(dropped.load(std::memory_order_relaxed));
+    writer.EndObject();
+}
+
+}
@@ -11,6 +11,7 @@
 
 #include "nexran.h"
 #include "e2ap.h"
+#include "e2ap_log.h"
 #include "e2sm.h"
 #include "e2sm_nexran.h"
 #include "e2sm_kpm.h"
@@ -31,9 +32,6 @@ void App::handle_rmr_message(
     xapp::Message &msg,int mtype,int subid,int payload_len,
     xapp::Msg_component &payload)
 {
-    mdclog_write(MDCLOG_DEBUG,"RMR message (type %d, source %s)",
-		 mtype,msg.Get_meid().get());
-
     switch (mtype) {
     case RIC_SUB_REQ:
     case RIC_SUB_RESP:
@@ -51,17 +49,90 @@ void App::handle_rmr_message(
     case RIC_SERVICE_QUERY:
 	break;
     default:
-	mdclog_write(MDCLOG_WARN,"unsupported RMR message type %d",mtype);
+	rmr_unsupported->inc();
+	E2AP_LOG_LIMIT(MDCLOG_WARN,1,"unsupported RMR message type %d",mtype);
 	return;
     }
+    /* init_metrics() registered a counter for every type above. */
+    rmr_received.find(mtype)->second->inc();
+
+    /* Each message starts a trace; see handle_pipeline_message(). */
+    e2ap::TraceContext trace;
+    if (e2ap::tracer().is_enabled())
+	trace = e2ap::TraceContext(e2ap::tracer().next_trace_id(),
+				   e2ap::metrics_now_ns());
+    e2ap::TraceScope scope(trace);
+    e2ap::ScopedSpan span("rmr_receive");
+
+    /*
+     * Copy the message into the pipeline and return to RMR; decode and
+     * policy work happens on the pipeline workers.  Only subscription
+     * responses are matched by transaction ID, so don't bother fetching
+     * it for anything else (in particular, the indication stream).
+     */
+    std::unique_ptr<unsigned char> meid = msg.Get_meid();
+    std::unique_ptr<unsigned char> xact;
+    switch (mtype) {
+    case RIC_SUB_RESP:
+    case RIC_SUB_FAILURE:
+    case RIC_SUB_DEL_RESP:
+    case RIC_SUB_DEL_FAILURE:
+	xact = msg.Get_xact();
+	break;
+    default:
+	break;
+    }
+
+    E2AP_LOG(MDCLOG_DEBUG,"RMR message (type %d, source %s)",
+	     mtype,(char *)meid.get());
 
-    e2ap.handle_message(payload.get(),payload_len,subid,
-			std::string((char *)msg.Get_meid().get()),
-			std::string((char *)msg.Get_xact().get()));
+    if (!pipeline.submit(mtype,subid,(char *)meid.get(),(char *)xact.get(),
+			 payload.get(),payload_len,trace.id)) {
+	rmr_queue_failures->inc();
+	E2AP_LOG_LIMIT(MDCLOG_WARN,1,"failed to queue RMR message (type %d)",mtype);
+    }
 
     return;
 }
 
+/*
+ * The view borrows the pipeline slot's buffers; msg outlives the call.
+ * Work done here, and any control it causes, is timed from when the
+ * message was queued (see E2AP::answered()), and is traced if the
+ * message was.
+ */
+void App::handle_pipeline_message(PipelineMessage& msg)
+{
+    e2ap::TraceScope scope(e2ap::TraceContext(msg.trace_id,msg.enqueue_ns));
+
+    if (msg.trace_id)
+	e2ap::tracer().record("pipeline_queue",msg.trace_id,msg.enqueue_ns,
+			      e2ap::metrics_now_ns());
+    e2ap.handle_message(e2ap::MessageView(msg.payload.data(),msg.len,msg.subid,
+					  msg.meid,msg.xid));
+}
+
+/*
+ * Returns a cached, NUL-terminated copy of meid suitable for
+ * Set_meid(), so that steady-state sends to a known NodeB do not
+ * allocate.  Set_meid() copies it into the RMR header.
+ */
+std::shared_ptr<unsigned char> App::get_meid_ref(const std::string& meid)
+{
+    std::lock_guard<std::mutex> lock(meid_cache_mutex);
+
+    auto it = meid_cache.find(meid);
+    if (it != meid_cache.end())
+	return it->second;
+
+    std::shared_ptr<unsigned char> ref(new unsigned char[meid.size() + 1],
+				       std::default_delete<unsigned char[]>());
+    memcpy(ref.get(),meid.c_str(),meid.size() + 1);
+    meid_cache[meid] = ref;
+
+    return ref;
+}
+
 bool App::send_message(const unsigned char *buf,ssize_t buf_len,
 		       int mtype,int subid,const std::string& meid,
 		       const std::string& xid)
@@ -74,12 +145,67 @@ bool App::send_message(const unsigned char *buf,ssize_t buf_len,
     memcpy((char *)payload.get(),(char *)buf,
 	   ((msg->Get_available_size() < buf_len)
 	    ? msg->Get_available_size() : buf_len));
-    std::shared_ptr<unsigned char> msg_meid((unsigned char *)strdup(meid.c_str()));
-    msg->Set_meid(msg_meid);
+    if (e2ap.get_pdu_tracer().is_enabled())
+	e2ap.get_pdu_tracer().record(
+	    e2ap::PduTracer::OUTBOUND,e2ap::procedure_code_for_mtype(mtype),
+	    meid.data(),meid.size(),buf,buf_len);
+    msg->Set_meid(get_meid_ref(meid));
     if (!xid.empty()) {
-	std::shared_ptr<unsigned char> msg_xid((unsigned char *)strdup(xid.c_str()));
+	std::shared_ptr<unsigned char> msg_xid(new unsigned char[xid.size() + 1],
+					       std::default_delete<unsigned char[]>());
+	memcpy(msg_xid.get(),xid.c_str(),xid.size() + 1);
 	msg->Set_xact(msg_xid);
     }
+    e2ap::ScopedSpan span("rmr_send");
+    return msg->Send();
+}
+
+/*
+ * Encodes m directly into the RMR-allocated payload, rather than into a
+ * malloc'd buffer that we then copy.  Messages that don't fit in
+ * SEND_BUF_SIZE fall back to the copying path above.
+ */
+bool App::send_message(e2ap::Message *m,int mtype,int subid,
+		       const std::string& meid,const std::string& xid)
+{
+    long instance_id = -1;
+    if (e2ap::tracer().is_enabled()) {
+	e2ap::Request *req = dynamic_cast<e2ap::Request *>(m);
+	if (req)
+	    instance_id = req->instance_id;
+    }
+
+    std::unique_ptr<xapp::Message> msg = Alloc_msg(SEND_BUF_SIZE);
+    xapp::Msg_component payload = msg->Get_payload();
+    ssize_t len;
+    {
+	e2ap::ScopedSpan span("e2ap_encode",instance_id);
+	len = m->encode_into(payload.get(),msg->Get_available_size());
+    }
+    if (len < 0) {
+	if (!m->encode()) {
+	    E2AP_LOG_LIMIT(MDCLOG_ERR,1,"failed to encode message (type %d) for %s",
+			   mtype,meid.c_str());
+	    return false;
+	}
+	return send_message(m->get_buf(),m->get_len(),mtype,subid,meid,xid);
+    }
+    if (e2ap.get_pdu_tracer().is_enabled())
+	e2ap.get_pdu_tracer().record(
+	    e2ap::PduTracer::OUTBOUND,e2ap::procedure_code_for_mtype(mtype),
+	    meid.data(),meid.size(),payload.get(),len);
+
+    msg->Set_mtype(mtype);
+    msg->Set_subid(subid);
+    msg->Set_len(len);
+    msg->Set_meid(get_meid_ref(meid));
+    if (!xid.empty()) {
+	std::shared_ptr<unsigned char> msg_xid(new unsigned char[xid.size() + 1],
+					       std::default_delete<unsigned char[]>());
+	memcpy(msg_xid.get(),xid.c_str(),xid.size() + 1);
+	msg->Set_xact(msg_xid);
+    }
+    e2ap::ScopedSpan span("rmr_send",instance_id);
     return msg->Send();
 }
 
@@ -92,50 +218,90 @@ bool App::send_message(const unsigned char *buf,ssize_t buf_len,
  */
 bool App::handle(e2ap::SubscriptionResponse *resp)
 {
-    mdclog_write(MDCLOG_DEBUG,"nexran SubscriptionResponse handler");
-	return false;
+    E2AP_LOG(MDCLOG_DEBUG,"nexran SubscriptionResponse handler");
+    resolve_request(resp->instance_id,RequestGroup::SUCCESS);
+    return true;
 }
 
 bool App::handle(e2ap::SubscriptionFailure *resp)
 {
-    mdclog_write(MDCLOG_DEBUG,"nexran SubscriptionFailure handler");
-	return false;
+    E2AP_LOG(MDCLOG_DEBUG,"nexran SubscriptionFailure handler");
+    resolve_request(resp->instance_id,RequestGroup::FAILURE);
+    return true;
 }
 
 bool App::handle(e2ap::SubscriptionDeleteResponse *resp)
 {
-    mdclog_write(MDCLOG_DEBUG,"nexran SubscriptionDeleteResponse handler");
-	return false;
+    E2AP_LOG(MDCLOG_DEBUG,"nexran SubscriptionDeleteResponse handler");
+    resolve_request(resp->instance_id,RequestGroup::SUCCESS);
+    return true;
 }
 
 bool App::handle(e2ap::SubscriptionDeleteFailure *resp)
 {
-    mdclog_write(MDCLOG_DEBUG,"nexran SubscriptionDeleteFailure handler");
-	return false;
+    E2AP_LOG(MDCLOG_DEBUG,"nexran SubscriptionDeleteFailure handler");
+    resolve_request(resp->instance_id,RequestGroup::FAILURE);
+    return true;
 }
     
 bool App::handle(e2ap::ControlAck *control)
 {
-    mdclog_write(MDCLOG_DEBUG,"nexran ControlAck handler");
-	return false;
+    E2AP_LOG(MDCLOG_DEBUG,"nexran ControlAck handler");
+    if (control->outcome && control->req) {
+	e2sm::nexran::SliceStatusControlOutcome *status = \
+	    dynamic_cast<e2sm::nexran::SliceStatusControlOutcome *>(control->outcome);
+	if (status)
+	    map_ue_rntis(control->req->meid,status->get_statuses());
+    }
+    resolve_request(control->instance_id,RequestGroup::SUCCESS);
+    return true;
 }
 
 bool App::handle(e2ap::ControlFailure *control)
 {
-    mdclog_write(MDCLOG_DEBUG,"nexran ControlFailure handler");
-	return false;
+    E2AP_LOG(MDCLOG_DEBUG,"nexran ControlFailure handler");
+    resolve_request(control->instance_id,RequestGroup::FAILURE);
+    return true;
+}
+
+bool App::handle_timeout(std::shared_ptr<e2ap::ControlRequest> req)
+{
+    E2AP_LOG(MDCLOG_DEBUG,"nexran ControlRequest timeout handler");
+    resolve_request(req->instance_id,RequestGroup::FAILURE);
+    return true;
+}
+
+bool App::handle_timeout(std::shared_ptr<e2ap::SubscriptionRequest> req)
+{
+    E2AP_LOG(MDCLOG_DEBUG,"nexran SubscriptionRequest timeout handler");
+    resolve_request(req->instance_id,RequestGroup::FAILURE);
+    return true;
+}
+
+bool App::handle_timeout(std::shared_ptr<e2ap::SubscriptionDeleteRequest> req)
+{
+    E2AP_LOG(MDCLOG_DEBUG,"nexran SubscriptionDeleteRequest timeout handler");
+    resolve_request(req->instance_id,RequestGroup::FAILURE);
+    return true;
 }
 
 bool App::handle(e2ap::Indication *ind)
 {
     bool retval = false;
 
-    mdclog_write(MDCLOG_DEBUG,"nexran Indication handler");
+    E2AP_LOG(MDCLOG_DEBUG,"nexran Indication handler");
     if (ind->model) {
 	e2sm::kpm::KpmIndication *kind = \
 	    dynamic_cast<e2sm::kpm::KpmIndication *>(ind->model);
+	e2sm::nexran::SliceStatusReport *report = \
+	    dynamic_cast<e2sm::nexran::SliceStatusReport *>(ind->model);
 	if (kind)
 	    retval = handle(kind);
+	else if (report && ind->subscription_request) {
+	    /* The report itself carries no meid; the subscription does. */
+	    map_ue_rntis(ind->subscription_request->meid,report->get_statuses());
+	    retval = true;
+	}
     }
 
     delete ind;
@@ -144,19 +310,201 @@ bool App::handle(e2ap::Indication *ind)
 
 bool App::handle(e2ap::ErrorIndication *ind)
 {
-    mdclog_write(MDCLOG_DEBUG,"nexran ErrorIndication handler");
+    E2AP_LOG_LIMIT(MDCLOG_WARN,1,
+		   "ErrorIndication (requestor %ld, instance %ld, function %ld,"
+		   " cause %ld/%ld)",ind->requestor_id,ind->instance_id,
+		   (long)ind->function_id,ind->cause,ind->cause_detail);
+    delete ind;
+    return true;
 }
 
+/*
+ * NexRANModel decodes slice status indications as SliceStatusReport,
+ * which handle(e2ap::Indication *) maps into the UE history; nothing
+ * produces this type, so there is nothing to do with it.
+ */
 bool App::handle(e2sm::nexran::SliceStatusIndication *ind)
 {
-    mdclog_write(MDCLOG_DEBUG,"nexran SliceStatusIndication handler");
+    E2AP_LOG(MDCLOG_DEBUG,"nexran SliceStatusIndication handler");
+    return false;
 }
 
 bool App::handle(e2sm::kpm::KpmIndication *kind)
 {
-    mdclog_write(MDCLOG_INFO,"KpmIndication: %s",
-		 kind->report->to_string('\n',',').c_str());
+    e2ap::ScopedTimer timer(kpm_handle_latency);
+
+    kpm_indications->inc();
+    /*
+     * The report is pooled and gone once we return, so it is rendered
+     * here -- but only when this site is due to log at all.
+     */
+    E2AP_LOG_LIMIT(MDCLOG_INFO,1,"KpmIndication: %s",
+		   kind->report->to_string('\n',',').c_str());
+    if (events.wants(EventStream::EventType::KpmEvent))
+	publish_kpm_event(kind);
+
+    /*
+     * Runs on the pipeline shard that owns this NodeB, so we only stash
+     * the report in that shard's per-NodeB state; the equalizer thread
+     * merges the shards and applies policy under the resource lock.
+     */
+    int shard = pipeline.shard_of(kind->meid.c_str());
+    kpm_aggregator.publish(shard,kind->meid,kind->report);
+    if (ue_history.is_enabled())
+	ue_history.record(
+	    shard,kind->meid,kind->report,
+	    std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count());
+
+    std::lock_guard<std::mutex> lock(equalizer_mutex);
+    equalizer_pending = true;
+    /* The next pass answers to the oldest report it merges. */
+    if (equalizer_trace.start_ns == 0)
+	equalizer_trace = e2ap::trace_context();
+    equalizer_cv.notify_one();
+
+    return true;
+}
+
+static void write_metrics(rapidjson::Writer<rapidjson::StringBuffer>& writer,
+			  const e2sm::kpm::entity_metrics_t& m)
+{
+    writer.String("time");
+    writer.Int64(m.time);
+    writer.String("dl_bytes");
+    writer.Uint64(m.dl_bytes);
+    writer.String("ul_bytes");
+    writer.Uint64(m.ul_bytes);
+    writer.String("dl_prbs");
+    writer.Uint64(m.dl_prbs);
+    writer.String("ul_prbs");
+    writer.Uint64(m.ul_prbs);
+    writer.String("tx_pkts");
+    writer.Int64(m.tx_pkts);
+    writer.String("tx_errors");
+    writer.Int64(m.tx_errors);
+    writer.String("tx_brate");
+    writer.Int64(m.tx_brate);
+    writer.String("rx_pkts");
+    writer.Int64(m.rx_pkts);
+    writer.String("rx_errors");
+    writer.Int64(m.rx_errors);
+    writer.String("rx_brate");
+    writer.Int64(m.rx_brate);
+    writer.String("dl_cqi");
+    writer.Double(m.dl_cqi);
+    writer.String("dl_ri");
+    writer.Double(m.dl_ri);
+    writer.String("dl_pmi");
+    writer.Double(m.dl_pmi);
+    writer.String("ul_phr");
+    writer.Double(m.ul_phr);
+    writer.String("ul_sinr");
+    writer.Double(m.ul_sinr);
+    writer.String("ul_mcs");
+    writer.Double(m.ul_mcs);
+    writer.String("ul_samples");
+    writer.Int64(m.ul_samples);
+}
+
+/*
+ * Runs on the report's pipeline shard, before the report is handed to
+ * the aggregator.
+ */
+void App::publish_kpm_event(e2sm::kpm::KpmIndication *kind)
+{
+    e2sm::kpm::KpmReport *report = kind->report;
+    rapidjson::StringBuffer sb;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+
+    writer.StartObject();
+    writer.String("nodeb");
+    writer.String(kind->meid.c_str());
+    writer.String("period_ms");
+    writer.Int64(report->period_ms);
+    writer.String("available_dl_prbs");
+    writer.Int(report->available_dl_prbs);
+    writer.String("available_ul_prbs");
+    writer.Int(report->available_ul_prbs);
+    writer.String("active_ues");
+    writer.Int64(report->active_ues);
+    writer.String("ues");
+    writer.StartArray();
+    for (size_t i = 0; i < report->ue_rnti.size(); ++i) {
+	writer.StartObject();
+	writer.String("rnti");
+	writer.Int64(report->ue_rnti[i]);
+	write_metrics(writer,report->ues.get(i));
+	writer.EndObject();
+    }
+    writer.EndArray();
+    writer.String("slices");
+    writer.StartArray();
+    for (size_t i = 0; i < report->slice_id.size(); ++i) {
+	writer.StartObject();
+	writer.String("name");
+	writer.String(e2sm::slice_names().name(report->slice_id[i]).c_str());
+	write_metrics(writer,report->slices.get(i));
+	writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+
+    events.publish(EventStream::EventType::KpmEvent,sb.GetString());
+}
+
+void App::publish_share_event(Slice *slice,int old_share,int new_share,
+			      const char *source)
+{
+    rapidjson::StringBuffer sb;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+
+    writer.StartObject();
+    writer.String("slice");
+    writer.String(slice->getName().c_str());
+    writer.String("old_share");
+    writer.Int(old_share);
+    writer.String("new_share");
+    writer.Int(new_share);
+    writer.String("source");
+    writer.String(source);
+    writer.EndObject();
+
+    events.publish(EventStream::EventType::ShareEvent,sb.GetString());
+}
+
+void App::equalizer_handler()
+{
+    MergedKpmReport merged;
+
+    while (true) {
+	e2ap::TraceContext trace;
+	{
+	    std::unique_lock<std::mutex> lock(equalizer_mutex);
+	    equalizer_cv.wait(lock,[this] {
+		return should_stop || equalizer_pending;
+	    });
+	    if (should_stop)
+		break;
+	    equalizer_pending = false;
+	    trace = equalizer_trace;
+	    equalizer_trace = e2ap::TraceContext();
+	}
 
+	e2ap::TraceScope scope(trace);
+	e2ap::ScopedSpan span("equalizer");
+	// The merge reads the equalizer's slice weights, and the pass may
+	// adjust the slice proportions.
+	const std::lock_guard<std::mutex> lock(mutex);
+	if (kpm_aggregator.merge(merged,equalizer.get_weights()))
+	    autoequalize(merged);
+    }
+}
+
+/* Caller must hold mutex. */
+
+bool App::autoequalize(MergedKpmReport& report)
+{
     // If we don't have BW reports for all slices, do not modify proportions?
     // Add up all slice dl_bytes, get proportions
     // map those to share proportions
@@ -177,389 +525,1059 @@ bool App::handle(e2sm::kpm::KpmIndication *kind)
     // but -- we could also keep a per-nodeb specialization :-D
     // maybe hide it from user, who knows
 
-    e2sm::kpm::KpmReport *report = kind->report;
-    if (report->slices.size() == 0) {
-	mdclog_write(MDCLOG_DEBUG,"no slices in KPM report; not autoequalizing");
-	if (mdclog_level_get() == MDCLOG_DEBUG) {
-	    mutex.lock();
-	    std::stringstream ss;
-	    for (auto it = db[ResourceType::SliceResource].begin();
-		 it != db[ResourceType::SliceResource].end();
-		 ++it) {
-		Slice *slice = (Slice *)it->second;
-		if (dynamic_cast<ProportionalAllocationPolicy *>(slice->getPolicy()) == NULL)
-		    continue;
-		ProportionalAllocationPolicy *policy = \
-		    dynamic_cast<ProportionalAllocationPolicy *>(slice->getPolicy());
-		if (false && !policy->isAutoEqualized())
-		    continue;
-		ss << it->first << "[share=" << policy->getShare() << "]" << std::endl;
-	    }
-	    mutex.unlock();
-	    mdclog_write(MDCLOG_DEBUG,"current shares: %s",ss.str().c_str());
-	}
+    // NB: with several NodeBs, report is the sum of every NodeB that
+    // reported since the last pass, since slice shares are global.
+    if (report.slice_id.size() == 0) {
+	E2AP_LOG_LIMIT(MDCLOG_DEBUG,1,"no slices in KPM report; not autoequalizing");
 	return true;
     }
 
-    // Have to lock at this point; we're going to iterate over
-    // and possibly adjust the slice proportions.
-    mutex.lock();
+    equalizer.run(report,equalizer_changes);
+    equalizer_passes->inc();
+    equalizer_share_changes->inc(equalizer_changes.size());
 
-    // Index some stuff locally for easier iteration; save share modification factors.
-    std::map<std::string,Slice *> slices;
-    std::map<std::string,Slice *> report_slices;
-    std::map<std::string,ProportionalAllocationPolicy *> policies;
-    std::map<std::string,float> new_share_factors;
-    //std::map<std::string,int> new_shares;
-    uint64_t slices_total = 0;
-    uint64_t slices_prb_total = 0;
-
-    // Create local indexes.
-    for (auto it = db[ResourceType::SliceResource].begin(); it != db[ResourceType::SliceResource].end(); ++it) {
-	std::string slice_name = it->first;
-	Slice *slice = (Slice *)it->second;
-	ProportionalAllocationPolicy *policy = \
-	    dynamic_cast<ProportionalAllocationPolicy *>(slice->getPolicy());
-	if (!policy)
-	    continue;
+    // Push out control messages to bound nodebs.
+    for (auto it = equalizer_changes.begin(); it != equalizer_changes.end(); ++it) {
+	Slice *slice = it->slice;
 
-	slices[slice_name] = slice;
-	policies[slice_name] = policy;
-	// placeholder until later iteration
-	new_share_factors[slice_name] = 0.0f;
+	std::list<std::string> meids;
+	for (auto it2 = db[ResourceType::NodeBResource].begin();
+	     it2 != db[ResourceType::NodeBResource].end();
+	     ++it2) {
+	    NodeB *nodeb = (NodeB *)it2->second;
+
+	    if (!nodeb->is_slice_bound(slice->getId()))
+		continue;
+
+	    meids.push_back(nodeb->getName());
+	}
+	send_slice_config(slice,it->new_share,meids,NULL);
+	if (events.wants(EventStream::EventType::ShareEvent))
+	    publish_share_event(slice,it->old_share,it->new_share,"autoequalize");
+    }
+    if (!equalizer_changes.empty()) {
+	std::list<std::string> names;
+	for (auto it = equalizer_changes.begin(); it != equalizer_changes.end(); ++it) {
+	    it->slice->invalidate();
+	    names.push_back(it->slice->getName());
+	}
+	publish(ResourceType::SliceResource,names);
     }
 
-    int num_autoeq_slices = 0;
-    for (auto it = report->slices.begin(); it != report->slices.end(); ++it) {
-	std::string slice_name = it->first;
-	// If this is not a slice we know of, ignore.
-	if (slices.count(slice_name) == 0)
-	    continue;
-	Slice *slice = (Slice *)slices[slice_name];
-	ProportionalAllocationPolicy *policy = \
-	    dynamic_cast<ProportionalAllocationPolicy *>(slice->getPolicy());
-	if (!policy)
-	    continue;
+    return true;
+}
 
-	report_slices[slice_name] = slice;
+void App::track_request(std::shared_ptr<RequestGroup> group,
+			std::shared_ptr<e2ap::Request> req)
+{
+    group->add(req);
+
+    const std::lock_guard<std::mutex> lock(request_mutex);
+    tracked_requests[req->instance_id] = group;
+}
 
-	// NB: only auto-eq amongst metrics for auto-eq'd slices.
-	// XXX: is this right?
-	if (policy->isAutoEqualized()) {
-	    slices_total += it->second.dl_bytes;
-	    slices_prb_total += it->second.dl_prbs;
-	    ++num_autoeq_slices;
+/*
+ * When tracking, these hold request_mutex across the sends, so that an
+ * answer that arrives before we record its request waits for us in
+ * resolve_request rather than missing its group.
+ */
+int App::send_control(std::shared_ptr<e2sm::Control> control,
+		      const std::list<std::string>& meids,
+		      std::shared_ptr<RequestGroup> group)
+{
+    if (batcher.is_enabled())
+	for (auto it = meids.begin(); it != meids.end(); ++it)
+	    batcher.flush(*it);
+
+    if (!group)
+	return e2ap.send_control_fanout(control,meids,1,e2ap::CONTROL_REQUEST_ACK);
+
+    std::list<std::shared_ptr<e2ap::ControlRequest>> requests;
+    const std::lock_guard<std::mutex> lock(request_mutex);
+    int sent = e2ap.send_control_fanout(
+	control,meids,1,e2ap::CONTROL_REQUEST_ACK,&requests);
+    for (auto it = requests.begin(); it != requests.end(); ++it) {
+	group->add(*it);
+	tracked_requests[(*it)->instance_id] = group;
+    }
+    if ((size_t)sent < meids.size()) {
+	for (auto it = meids.begin(); it != meids.end(); ++it) {
+	    bool found = false;
+	    for (auto it2 = requests.begin(); it2 != requests.end(); ++it2) {
+		if ((*it2)->meid == *it) {
+		    found = true;
+		    break;
+		}
+	    }
+	    if (!found)
+		group->add_unsent(*it);
 	}
+    }
+
+    return sent;
+}
 
-	policy->getMetrics().add(it->second);
+bool App::send_control(std::shared_ptr<e2ap::ControlRequest> req,
+		       std::shared_ptr<RequestGroup> group)
+{
+    if (batcher.is_enabled())
+	batcher.flush(req->meid);
+
+    if (!group)
+	return e2ap.send_control_request(req,req->meid);
+
+    const std::lock_guard<std::mutex> lock(request_mutex);
+    if (!e2ap.send_control_request(req,req->meid)) {
+	group->add_unsent(req->meid);
+	return false;
     }
+    group->add(req);
+    tracked_requests[req->instance_id] = group;
 
-    // First, check if any slices should be released from throttling.
-    for (auto it = slices.begin(); it != slices.end(); ++it) {
-	std::string slice_name = it->first;
-	Slice *slice = (Slice *)it->second;
-	ProportionalAllocationPolicy *policy = policies[slice_name];
-	if (!policy->isThrottled() || !policy->isThrottling())
-	    continue;
+    return true;
+}
+
+bool App::send_subscription(std::shared_ptr<e2ap::SubscriptionRequest> req,
+			    std::shared_ptr<RequestGroup> group)
+{
+    if (!group)
+	return e2ap.send_subscription_request(req,req->meid);
+
+    const std::lock_guard<std::mutex> lock(request_mutex);
+    if (!e2ap.send_subscription_request(req,req->meid)) {
+	group->add_unsent(req->meid);
+	return false;
+    }
+    group->add(req);
+    tracked_requests[req->instance_id] = group;
+
+    return true;
+}
 
-	// Ensure we flush old metrics, even if we didn't add any new ones
-	// from the current report.
-	policy->getMetrics().flush();
-
-	int new_share = policy->maybeEndThrottling();
-	if (new_share > -1) {
-	    mdclog_write(MDCLOG_DEBUG,"stopping throttling slice '%s' (%d -> %d)",
-			 slice_name.c_str(),policy->getShare(),new_share);
-	    // NB: we just compute a share factor, because that's what the
-	    // auto-equalizing code cares about.
-	    // nshare = cshare + (cshare * f)
-	    // n - c = c * f
-	    // (n - c) / c = f
-	    // 110 = 100 + 100 * .1
-	    // (110 - 100) / 100 = f
-	    int cur_share = policy->getShare();
-	    new_share_factors[slice_name] = (new_share - cur_share) / (float)cur_share;
+/*
+ * Changes tracked in a RequestGroup bypass the batcher, since the group
+ * must know its requests before it is started.
+ */
+void App::send_slice_config(Slice *slice,int share,
+			    const std::list<std::string>& meids,
+			    std::shared_ptr<RequestGroup> group)
+{
+    if (meids.empty())
+	return;
+
+    if (!group && batcher.is_enabled()) {
+	for (auto it = meids.begin(); it != meids.end(); ++it)
+	    batcher.submit(*it,slice->getName(),share);
+	return;
+    }
+
+    e2sm::nexran::ProportionalAllocationPolicy *npolicy = \
+	new e2sm::nexran::ProportionalAllocationPolicy(share);
+    e2sm::nexran::SliceConfig *sc = new e2sm::nexran::SliceConfig(slice->getName(),npolicy);
+    std::shared_ptr<e2sm::nexran::SliceConfigRequest> sreq = \
+	std::make_shared<e2sm::nexran::SliceConfigRequest>(nexran,sc);
+    sreq->encode();
+    send_control(sreq,meids,group);
+}
+
+void App::send_slice_configs(const std::string& meid,
+			     const std::map<std::string,int>& shares)
+{
+    std::list<e2sm::nexran::SliceConfig *> configs;
+
+    for (auto it = shares.begin(); it != shares.end(); ++it) {
+	std::string name(it->first);
+	e2sm::nexran::ProportionalAllocationPolicy *npolicy = \
+	    new e2sm::nexran::ProportionalAllocationPolicy(it->second);
+	configs.push_back(new e2sm::nexran::SliceConfig(name,npolicy));
+    }
+    std::shared_ptr<e2sm::nexran::SliceConfigRequest> sreq = \
+	std::make_shared<e2sm::nexran::SliceConfigRequest>(nexran,configs);
+    sreq->encode();
+    e2ap.send_control_fanout(sreq,std::list<std::string>({ meid }),
+			     1,e2ap::CONTROL_REQUEST_ACK);
+
+    E2AP_LOG(MDCLOG_DEBUG,"sent %lu batched slice configs to %s",
+	     shares.size(),meid.c_str());
+}
+
+void App::start_group(std::shared_ptr<RequestGroup> group)
+{
+    {
+	const std::lock_guard<std::mutex> lock(request_mutex);
+	group_deadlines.push(group);
+    }
+    request_cv.notify_one();
+    group->seal();
+}
+
+/*
+ * Responds 503 to every group still waiting, and stops tracking their
+ * requests.
+ */
+void App::cancel_groups()
+{
+    std::list<std::shared_ptr<RequestGroup>> groups;
+
+    {
+	const std::lock_guard<std::mutex> lock(request_mutex);
+	while (!group_deadlines.empty()) {
+	    groups.push_back(group_deadlines.top());
+	    group_deadlines.pop();
 	}
+	tracked_requests.clear();
+    }
+    for (auto it = groups.begin(); it != groups.end(); ++it)
+	(*it)->cancel();
+}
+
+void App::resolve_request(long instance_id,RequestGroup::RequestState state)
+{
+    std::shared_ptr<RequestGroup> group;
+
+    {
+	const std::lock_guard<std::mutex> lock(request_mutex);
+	auto it = tracked_requests.find(instance_id);
+	if (it == tracked_requests.end())
+	    return;
+	group = it->second;
+	tracked_requests.erase(it);
     }
+    group->update(instance_id,state);
+}
 
-    // Second, check if any slices should be newly throttled.
-    for (auto it = slices.begin(); it != slices.end(); ++it) {
-	std::string slice_name = it->first;
-	Slice *slice = (Slice *)it->second;
-	ProportionalAllocationPolicy *policy = policies[slice_name];
-	if (!policy->isThrottled() || policy->isThrottling())
+/*
+ * Groups respond as their requests resolve; this thread only expires
+ * the ones that run out of time, sleeping until the earliest deadline.
+ */
+/*
+ * Sleeps until the earliest group deadline, or until a group with an
+ * earlier one starts, or the App stops.
+ */
+void App::response_handler()
+{
+    std::unique_lock<std::mutex> lock(request_mutex);
+    std::list<std::shared_ptr<RequestGroup>> expired;
+
+    while (!should_stop) {
+	if (group_deadlines.empty())
+	    request_cv.wait(lock,[this] {
+		return should_stop || !group_deadlines.empty();
+	    });
+	else {
+	    auto deadline = group_deadlines.top()->get_deadline();
+	    request_cv.wait_until(lock,deadline,[this,deadline] {
+		return should_stop || group_deadlines.empty()
+		    || group_deadlines.top()->get_deadline() < deadline;
+	    });
+	}
+	if (should_stop)
+	    break;
+
+	auto now = std::chrono::steady_clock::now();
+	while (!group_deadlines.empty()
+	       && group_deadlines.top()->is_expired(now)) {
+	    expired.push_back(group_deadlines.top());
+	    group_deadlines.pop();
+	}
+	if (expired.empty())
 	    continue;
 
-	// Ensure we flush old metrics, even if we didn't add any new ones
-	// from the current report.
-	e2sm::kpm::MetricsIndex& metrics = policy->getMetrics();
-	mdclog_write(MDCLOG_DEBUG,"considering throttle start for slice '%s': %ld (%d)",
-		     slice_name.c_str(),metrics.get_total_bytes(),metrics.size());
-	metrics.flush();
-	mdclog_write(MDCLOG_DEBUG,"considering throttle start for slice '%s': %ld (%d) (post flush)",
-		     slice_name.c_str(),metrics.get_total_bytes(),metrics.size());
-
-	int new_share = policy->maybeStartThrottling();
-	if (new_share > -1) {
-	    mdclog_write(MDCLOG_DEBUG,"starting throttling slice '%s' (%d -> %d)",
-			 slice_name.c_str(),policy->getShare(),new_share);
-	    // NB: we just compute a share factor, because that's what the
-	    // auto-equalizing code cares about.
-	    int cur_share = policy->getShare();
-	    new_share_factors[slice_name] = (new_share - cur_share) / (float)cur_share;
+	for (auto it = expired.begin(); it != expired.end(); ++it) {
+	    std::list<long> instance_ids;
+	    (*it)->get_pending(instance_ids);
+	    for (auto it2 = instance_ids.begin(); it2 != instance_ids.end(); ++it2)
+		tracked_requests.erase(*it2);
 	}
+	lock.unlock();
+	for (auto it = expired.begin(); it != expired.end(); ++it)
+	    (*it)->finish();
+	expired.clear();
+	lock.lock();
     }
+}
 
-    // Begin auto-equalize checks.
-    bool any_above_threshold = false;
-    uint64_t available_prbs_per_slice = 0;
-    if (num_autoeq_slices > 0)
-	available_prbs_per_slice = (report->period_ms * 2 * report->available_dl_prbs) / num_autoeq_slices;
-    uint64_t prb_threshold = (uint64_t)(0.15f * available_prbs_per_slice);
+/*
+ * Registers the App's metrics in the process-wide registry, alongside
+ * those the E2AP and KPM libraries register for themselves.
+ */
+void App::init_metrics()
+{
+    static const std::pair<int,const char *> rmr_types[] = {
+	{ RIC_SUB_REQ,"RIC_SUB_REQ" },
+	{ RIC_SUB_RESP,"RIC_SUB_RESP" },
+	{ RIC_SUB_FAILURE,"RIC_SUB_FAILURE" },
+	{ RIC_SUB_DEL_REQ,"RIC_SUB_DEL_REQ" },
+	{ RIC_SUB_DEL_RESP,"RIC_SUB_DEL_RESP" },
+	{ RIC_SUB_DEL_FAILURE,"RIC_SUB_DEL_FAILURE" },
+	{ RIC_SERVICE_UPDATE,"RIC_SERVICE_UPDATE" },
+	{ RIC_SERVICE_UPDATE_ACK,"RIC_SERVICE_UPDATE_ACK" },
+	{ RIC_SERVICE_UPDATE_FAILURE,"RIC_SERVICE_UPDATE_FAILURE" },
+	{ RIC_CONTROL_REQ,"RIC_CONTROL_REQ" },
+	{ RIC_CONTROL_ACK,"RIC_CONTROL_ACK" },
+	{ RIC_CONTROL_FAILURE,"RIC_CONTROL_FAILURE" },
+	{ RIC_INDICATION,"RIC_INDICATION" },
+	{ RIC_SERVICE_QUERY,"RIC_SERVICE_QUERY" },
+    };
+    e2ap::MetricsRegistry& registry = e2ap::metrics();
+
+    for (auto& t : rmr_types)
+	rmr_received[t.first] = registry.counter(
+	    "nexran_rmr_messages_total","RMR messages received, by type.",
+	    std::string("mtype=\"") + t.second + "\"");
+    rmr_unsupported = registry.counter(
+	"nexran_rmr_unsupported_messages_total",
+	"RMR messages of a type we do not handle.");
+    rmr_queue_failures = registry.counter(
+	"nexran_rmr_queue_failures_total",
+	"RMR messages the pipeline could not queue.");
+    kpm_indications = registry.counter(
+	"nexran_kpm_indications_total",
+	"Decoded KPM indications handled.");
+    kpm_handle_latency = registry.histogram(
+	"nexran_kpm_handle_seconds",
+	"Time to handle a decoded KPM indication.");
+    equalizer_passes = registry.counter(
+	"nexran_equalizer_passes_total",
+	"Auto-equalizer passes over merged KPM reports.");
+    equalizer_share_changes = registry.counter(
+	"nexran_equalizer_share_changes_total",
+	"Slice share changes made by the auto-equalizer.");
+
+    registry.gauge("nexran_pipeline_queue_depth",
+		   "Messages queued for the pipeline workers.","",
+		   [this] { return (double)pipeline.get_queue_depth(); });
+    registry.gauge("nexran_e2ap_pending_requests",
+		   "E2 requests awaiting an answer, by procedure.",
+		   "procedure=\"control\"",
+		   [this] { return (double)e2ap.get_num_pending(e2ap::PROCEDURE_CONTROL); });
+    registry.gauge("nexran_e2ap_pending_requests",
+		   "E2 requests awaiting an answer, by procedure.",
+		   "procedure=\"subscription\"",
+		   [this] { return (double)e2ap.get_num_pending(e2ap::PROCEDURE_SUBSCRIPTION); });
+    registry.gauge("nexran_e2ap_pending_requests",
+		   "E2 requests awaiting an answer, by procedure.",
+		   "procedure=\"subscription_delete\"",
+		   [this] { return (double)e2ap.get_num_pending(e2ap::PROCEDURE_SUBSCRIPTION_DELETE); });
+}
 
-    if (available_prbs_per_slice > 0) {
-	// Check PRB utilization.  If no slice has utilized at least 15% of an
-	// even PRB allocation, do nothing.
-	for (auto it = report_slices.begin(); it != report_slices.end(); ++it) {
-	    std::string slice_name = it->first;
-	    uint64_t dl_prbs = report->slices[slice_name].dl_prbs;
+void App::init()
+{
+    Slice *slice = new Slice("default");
 
-	    if (dl_prbs > prb_threshold) {
-		any_above_threshold = true;
-		break;
-	    }
-	}
+    init_metrics();
+
+    mutex.lock();
+    slice->intern_id();
+    db[ResourceType::SliceResource][slice->getName()] = slice;
+    index_slice(slice);
+    equalizer.add(slice);
+    publish(ResourceType::SliceResource);
+    mutex.unlock();
+}
+
+void App::start()
+{
+    if (running)
+	return;
+
+    should_stop = false;
+    e2ap::logger().start();
+	register_xapp();
+
+    /*
+     * Init the E2.  Note there is nothing to do until we are configured
+     * via northbound interface with objects.  Eventually we should
+     * store config in the RNIB and restore things on startup, possibly.
+     */
+    /* Negative values disable tracking or retries, respectively. */
+    int control_timeout = config[Config::ItemName::E2_CONTROL_TIMEOUT]->i;
+    int subscription_timeout = config[Config::ItemName::E2_SUBSCRIPTION_TIMEOUT]->i;
+    int retries = config[Config::ItemName::E2_REQUEST_RETRIES]->i;
+    if (control_timeout < 0)
+	control_timeout = 0;
+    if (subscription_timeout < 0)
+	subscription_timeout = 0;
+    if (retries < 0)
+	retries = 0;
+    e2ap.set_timeout(e2ap::PROCEDURE_CONTROL,
+		     e2ap::RequestTimeout(control_timeout,retries));
+    e2ap.set_timeout(e2ap::PROCEDURE_SUBSCRIPTION,
+		     e2ap::RequestTimeout(subscription_timeout,retries));
+    e2ap.set_timeout(e2ap::PROCEDURE_SUBSCRIPTION_DELETE,
+		     e2ap::RequestTimeout(subscription_timeout,retries));
+    int max_controls = config[Config::ItemName::E2_MAX_CONTROLS]->i;
+    int max_subscriptions = config[Config::ItemName::E2_MAX_SUBSCRIPTIONS]->i;
+    if (max_controls < 1)
+	max_controls = 1;
+    if (max_subscriptions < 1)
+	max_subscriptions = 1;
+    e2ap.set_capacity(e2ap::PROCEDURE_CONTROL,max_controls);
+    e2ap.set_capacity(e2ap::PROCEDURE_SUBSCRIPTION,max_subscriptions);
+    e2ap.set_capacity(e2ap::PROCEDURE_SUBSCRIPTION_DELETE,max_subscriptions);
+    e2ap.init();
+
+    /*
+     * Groups track controls and subscriptions; give them until those
+     * expire, plus the batch window and a second for the last answer.
+     * If requests never expire, fall back to the default.
+     */
+    uint64_t expiry_ms = std::max(e2ap.get_expiry_ms(e2ap::PROCEDURE_CONTROL),
+				  e2ap.get_expiry_ms(e2ap::PROCEDURE_SUBSCRIPTION));
+    int batch_window = config[Config::ItemName::CONTROL_BATCH_WINDOW]->i;
+    if (expiry_ms > 0)
+	group_timeout = std::chrono::milliseconds(
+	    expiry_ms + std::max(batch_window,0) + 1000);
+
+    Add_msg_cb(RIC_SUB_RESP,rmr_callback,this);
+    Add_msg_cb(RIC_SUB_FAILURE,rmr_callback,this);
+    Add_msg_cb(RIC_SUB_DEL_RESP,rmr_callback,this);
+    Add_msg_cb(RIC_SUB_DEL_FAILURE,rmr_callback,this);
+    Add_msg_cb(RIC_CONTROL_ACK,rmr_callback,this);
+    Add_msg_cb(RIC_CONTROL_FAILURE,rmr_callback,this);
+    Add_msg_cb(RIC_INDICATION,rmr_callback,this);
+
+    Pipeline::OverloadPolicy overload_policy;
+    if (!Pipeline::overload_policy_from_string(
+	    config[Config::ItemName::PIPELINE_OVERLOAD_POLICY]->s,&overload_policy)) {
+	mdclog_write(MDCLOG_WARN,"unknown pipeline overload policy '%s'; using backpressure",
+		     config[Config::ItemName::PIPELINE_OVERLOAD_POLICY]->s);
+	overload_policy = Pipeline::OverloadPolicy::Backpressure;
     }
+    e2sm::kpm::KpmDecoderMode_t kpm_decoder_mode;
+    if (!e2sm::kpm::kpm_decoder_mode_from_string(
+	    config[Config::ItemName::KPM_DECODER]->s,&kpm_decoder_mode)) {
+	mdclog_write(MDCLOG_WARN,"unknown kpm decoder '%s'; using asn1c",
+		     config[Config::ItemName::KPM_DECODER]->s);
+	kpm_decoder_mode = e2sm::kpm::KPM_DECODER_ASN1C;
+    }
+    kpm->set_decoder_mode(kpm_decoder_mode);
+
+    pipeline.start(config[Config::ItemName::PIPELINE_WORKERS]->i,
+		   config[Config::ItemName::PIPELINE_QUEUE_SIZE]->i,
+		   overload_policy);
+
+    kpm_aggregator.init(pipeline.get_num_shards());
+    ue_history.init(pipeline.get_num_shards(),
+		    config[Config::ItemName::UE_HISTORY_LENGTH]->i,
+		    config[Config::ItemName::UE_HISTORY_MAX_UES]->i,
+		    config[Config::ItemName::UE_HISTORY_IDLE]->i);
+    batcher.start(config[Config::ItemName::CONTROL_BATCH_WINDOW]->i,
+		  config[Config::ItemName::CONTROL_BATCH_SIZE]->i);
+    events.start(config[Config::ItemName::EVENT_RING_SIZE]->i,
+		 config[Config::ItemName::EVENT_MAX_SUBSCRIBERS]->i);
+    if (config[Config::ItemName::TRACE_RING_SIZE]->i > 0)
+	e2ap::tracer().enable(config[Config::ItemName::TRACE_RING_SIZE]->i);
+    init_pdu_trace();
+    equalizer_thread = new std::thread(&App::equalizer_handler,this);
 
-    // Create the new share factors.
-    if (any_above_threshold) {
-	mdclog_write(MDCLOG_INFO,"PRB utilization threshold (%lu/%lu) reached; checking for new share factors",
-		     prb_threshold,available_prbs_per_slice);
-	any_above_threshold = false;
-	for (auto it = report_slices.begin(); it != report_slices.end(); ++it) {
-	    std::string slice_name = it->first;
-	    uint64_t dl_bytes = report->slices[slice_name].dl_bytes;
-	    ProportionalAllocationPolicy *policy = policies[slice_name];
-	    if (!policy->isAutoEqualized()) {
-		mdclog_write(MDCLOG_DEBUG,"skipping slice '%s'; not autoequalized",
-			     slice_name.c_str());
-		continue;
-	    }
+    rmr_thread = new std::thread(&App::Listen,this);
+    response_thread = new std::thread(&App::response_handler,this);
 
-	    if (new_share_factors[slice_name] != 0.0f) {
-		mdclog_write(MDCLOG_DEBUG,"skipping slice '%s' with existing new_share_factor %f",
-			     slice_name.c_str(),new_share_factors[slice_name]);
+    /*
+     * Init and start the northbound interface.
+     * NB: the RMR Messenger superclass is already running at this point.
+     */
+    server.init(this);
+    server.start();
+    running = true;
+}
+
+void App::stop()
+{
+    /* Answer requests still waiting on E2 while we still can. */
+    cancel_groups();
+    /* Stop the northbound interface. */
+    server.stop();
+	/* Deregister the xApp*/
+	deregister_xapp();
+    /*
+     * Send any held slice configs while RMR is still up; the equalizer
+     * may still submit, and those are sent directly from now on.
+     */
+    batcher.stop();
+    /* Stop the RMR Messenger superclass. */
+    Stop();
+    rmr_thread->join();
+    delete rmr_thread;
+    rmr_thread = NULL;
+    /* Stop the pipeline workers once nothing more can be submitted. */
+    pipeline.stop();
+    e2ap.stop();
+    e2ap.get_pdu_tracer().stop();
+    mutex.lock();
+    should_stop = true;
+    mutex.unlock();
+    equalizer_mutex.lock();
+    equalizer_cv.notify_all();
+    equalizer_mutex.unlock();
+    equalizer_thread->join();
+    delete equalizer_thread;
+    equalizer_thread = NULL;
+    /* Nothing publishes events once the workers and equalizer are gone. */
+    events.stop();
+    request_mutex.lock();
+    request_cv.notify_all();
+    request_mutex.unlock();
+    response_thread->join();
+    delete response_thread;
+    response_thread = NULL;
+    /* Any group started before the northbound interface stopped. */
+    cancel_groups();
+    /* Flush hot-path logging last; later messages are written inline. */
+    e2ap::logger().stop();
+    running = false;
+    should_stop = false;
+}
+
+/*
+ * Refreshes the fragments of the named resources (dropping those no
+ * longer in db) and, if any changed, publishes a snapshot whose maps
+ * differ from the current one's only in those entries.  Resources that
+ * were not invalidated keep their fragment, and so their version; a
+ * changed one gets a fragment that is rendered when first read.  A
+ * changed slice or NodeB also gets a new entry in the index of what is
+ * bound to it, and a slice's UEs are moved in the reverse index by
+ * diffing its old and new bindings, which mostly share chunks.
+ */
+void App::publish(ResourceType rt,const std::list<std::string>& names)
+{
+    std::shared_ptr<const DbSnapshot> cur = std::atomic_load(&snapshot);
+    std::shared_ptr<DbSnapshot> next;
+    std::shared_ptr<DbSnapshot::Index> index;
+    uint64_t version = cur->version + 1;
+
+    for (auto it = names.begin(); it != names.end(); ++it) {
+	auto it2 = db[rt].find(*it);
+	const DbSnapshot::Fragment *old = cur->find(rt,*it);
+	AbstractResource *resource = NULL;
+
+	if (it2 != db[rt].end()) {
+	    resource = it2->second;
+	    if (old && old->source == resource->get_version())
 		continue;
-	    }
+	}
+	else if (!old)
+	    continue;
 
-	    float nf = ((float)slices_total / num_autoeq_slices - dl_bytes) / dl_bytes;
-	    if (nf > 0.05f || nf < -0.05f) {
-		any_above_threshold = true;
-		mdclog_write(MDCLOG_DEBUG,"candidate proportional share factor above threshold (%s): %f",
-			     slice_name.c_str(),nf);
-	    }
-	    else
-		mdclog_write(MDCLOG_DEBUG,"candidate proportional share factor below threshold (%s): %f",
-			     slice_name.c_str(),nf);
+	if (!next)
+	    next = std::make_shared<DbSnapshot>(*cur);
+	if (resource)
+	    next->fragments[rt].set(
+		*it,DbSnapshot::Fragment(resource->get_renderer(),
+					 resource->get_version(),version));
+	else
+	    next->fragments[rt].erase(*it);
 
+	if (rt == ResourceType::UeResource)
+	    continue;
+	if (!index)
+	    index = std::make_shared<DbSnapshot::Index>(
+		(rt == ResourceType::SliceResource)
+		? *cur->ues_by_slice : *cur->slices_by_nodeb);
+
+	static const BoundNames none;
+	const BoundNames *was = DbSnapshot::lookup(*index,*it);
+	const BoundNames& bound = !resource ? none
+	    : (rt == ResourceType::SliceResource)
+	    ? ((Slice *)resource)->get_ue_names()
+	    : ((NodeB *)resource)->get_slice_names();
+	if (rt == ResourceType::SliceResource) {
+	    DbSnapshot::ReverseIndex& reverse = next->slice_of_ue;
+	    BoundNames::diff(
+		was ? *was : none,bound,
+		[&](const std::string& imsi) {
+		    const std::string *slice = reverse.find(imsi);
+		    if (slice && *slice == *it)
+			reverse.erase(imsi);
+		},
+		[&](const std::string& imsi) { reverse.set(imsi,*it); });
 	}
+	if (resource)
+	    (*index)[*it] = bound;
+	else
+	    index->erase(*it);
     }
-    // XXX: have to do a second time through the loop to actually set the
-    // new share factors, sigh
-    if (any_above_threshold) {
-	for (auto it = report->slices.begin(); it != report->slices.end(); ++it) {
-	    std::string slice_name = it->first;
-	    uint64_t dl_bytes = report->slices[slice_name].dl_bytes;
-	    if (policies.count(slice_name) == 0)
-		continue;
-	    ProportionalAllocationPolicy *policy = policies[slice_name];
-	    if (!policy->isAutoEqualized())
-		continue;
+    if (!next)
+	return;
 
-	    if (new_share_factors[slice_name] != 0.0f)
-		continue;
+    if (index && rt == ResourceType::SliceResource)
+	next->ues_by_slice = index;
+    else if (index)
+	next->slices_by_nodeb = index;
+    next->versions[rt] = version;
+    next->version = version;
+    std::atomic_store(&snapshot,std::shared_ptr<const DbSnapshot>(next));
+}
+
+void App::publish(ResourceType rt)
+{
+    std::list<std::string> names;
+    std::shared_ptr<const DbSnapshot> cur = std::atomic_load(&snapshot);
+
+    for (auto it = db[rt].begin(); it != db[rt].end(); ++it)
+	names.push_back(it->first);
+    cur->fragments[rt].visit(
+	[&](const std::string& name,const DbSnapshot::Fragment& fragment) {
+	    if (db[rt].count(name) < 1)
+		names.push_back(name);
+	    return true;
+	});
+    publish(rt,names);
+}
+
+void App::serialize(ResourceType rt,
+		    rapidjson::Writer<rapidjson::StringBuffer>& writer)
+{
+    serialize(get_snapshot(),rt,writer);
+}
+
+bool App::serialize(ResourceType rt,std::string& rname,
+		    rapidjson::Writer<rapidjson::StringBuffer>& writer,
+		    AppError **ae)
+{
+    return serialize(get_snapshot(),rt,rname,writer,ae);
+}
+
+void App::serialize(std::shared_ptr<const DbSnapshot> snap,ResourceType rt,
+		    rapidjson::Writer<rapidjson::StringBuffer>& writer)
+{
+    serialize(snap,rt,CollectionQuery(),writer);
+}
+
+const std::string& DbSnapshot::Fragment::json() const
+{
+    std::call_once(state->rendered,[this] {
+	state->json = state->render();
+	state->render = nullptr;
+    });
+    return *state->json;
+}
 
-	    new_share_factors[slice_name] = ((float)slices_total / num_autoeq_slices - dl_bytes) / dl_bytes;
-	    mdclog_write(MDCLOG_DEBUG,"new proportional share factor (%s): %f",
-			 slice_name.c_str(),new_share_factors[slice_name]);
+const DbSnapshot::Fragment::Fields& DbSnapshot::Fragment::fields() const
+{
+    std::call_once(state->split,[this] {
+	rapidjson::Document d;
+	d.Parse(json().c_str());
+	if (!d.IsObject())
+	    return;
+	for (auto it = d.MemberBegin(); it != d.MemberEnd(); ++it) {
+	    rapidjson::StringBuffer sb;
+	    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+	    it->value.Accept(writer);
+	    state->fields.push_back(
+		{ it->name.GetString(),sb.GetString(),it->value.GetType() });
 	}
+    });
+    return state->fields;
+}
+
+static void write_fragment(const DbSnapshot::Fragment& fragment,
+			   const std::set<std::string>& fields,
+			   rapidjson::Writer<rapidjson::StringBuffer>& writer)
+{
+    if (fields.empty()) {
+	const std::string& json = fragment.json();
+	writer.RawValue(json.c_str(),json.size(),rapidjson::kObjectType);
+	return;
     }
 
-    // Handle any updates; log either way.
-    for (auto it = new_share_factors.begin(); it != new_share_factors.end(); ++it) {
-	std::string slice_name = it->first;
-	// Update the policies and push out control messages to bound
-	// nodebs.
-	Slice *slice = slices[slice_name];
-	ProportionalAllocationPolicy *policy = policies[slice_name];
-	int cshare = policy->getShare();
-	int nshare = std::min((int)(cshare + (cshare * it->second)),1024);
-	if (nshare < 1 || nshare < 64)
-	    //nshare = 1;
-	    nshare = 64;
-	policy->setShare(nshare);
-	if (cshare == nshare) {
-	    mdclog_write(MDCLOG_INFO,"slice '%s' share unchanged: %d",
-			 slice_name.c_str(),nshare);
+    const DbSnapshot::Fragment::Fields& all = fragment.fields();
+    writer.StartObject();
+    for (auto it = all.begin(); it != all.end(); ++it) {
+	if (fields.count(it->name) < 1)
 	    continue;
-	}
-	mdclog_write(MDCLOG_INFO,"slice '%s' share: %d -> %d",
-		     slice_name.c_str(),cshare,nshare);
-	e2sm::nexran::ProportionalAllocationPolicy *npolicy = \
-	    new e2sm::nexran::ProportionalAllocationPolicy(nshare);
-	e2sm::nexran::SliceConfig *sc = new e2sm::nexran::SliceConfig(slice_name,npolicy);
-	e2sm::nexran::SliceConfigRequest *sreq = new e2sm::nexran::SliceConfigRequest(nexran,sc);
-	sreq->encode();
-
-	for (auto it2 = db[ResourceType::NodeBResource].begin();
-	     it2 != db[ResourceType::NodeBResource].end();
-	     ++it2) {
-	    NodeB *nodeb = (NodeB *)it2->second;
+	writer.String(it->name.c_str());
+	writer.RawValue(it->json.c_str(),it->json.size(),it->type);
+    }
+    writer.EndObject();
+}
 
-	    if (!nodeb->is_slice_bound(slice_name))
-		continue;
+/*
+ * The slice and nodeb filters walk the relevant index entry rather than
+ * the whole collection; the others test each resource in name order.
+ */
+void App::serialize(std::shared_ptr<const DbSnapshot> snap,ResourceType rt,
+		    const CollectionQuery& query,
+		    rapidjson::Writer<rapidjson::StringBuffer>& writer)
+{
+    static const BoundNames none;
+    const DbSnapshot::Fragments& fragments = snap->fragments[rt];
+    const BoundNames *names = NULL;
+    int count = 0;
+    std::string last;
+    bool more = false;
+
+    if (rt == ResourceType::UeResource && !query.slice.empty()) {
+	names = DbSnapshot::lookup(*snap->ues_by_slice,query.slice);
+	if (!names)
+	    names = &none;
+    }
+    else if (rt == ResourceType::SliceResource && !query.nodeb.empty()) {
+	names = DbSnapshot::lookup(*snap->slices_by_nodeb,query.nodeb);
+	if (!names)
+	    names = &none;
+    }
 
-	    // Each request needs a different RequestId, so we have to
-	    // re-encode each time.
-	    std::shared_ptr<e2ap::ControlRequest> creq = std::make_shared<e2ap::ControlRequest>(
-                e2ap.get_requestor_id(),e2ap.get_next_instance_id(),
-		1,sreq,e2ap::CONTROL_REQUEST_ACK);
-	    creq->set_meid(nodeb->getName());
-	    e2ap.send_control_request(creq,nodeb->getName());
+    auto matches = [&](const std::string& name) {
+	if (rt == ResourceType::UeResource && query.bound >= 0) {
+	    bool is_bound = snap->slice_of_ue.count(name) > 0;
+	    if (is_bound != (query.bound > 0))
+		return false;
 	}
-    }
+	if (rt == ResourceType::NodeBResource && !query.slice.empty()) {
+	    const BoundNames *slices =
+		DbSnapshot::lookup(*snap->slices_by_nodeb,name);
+	    if (!slices || slices->count(query.slice) < 1)
+		return false;
+	}
+	return true;
+    };
+    /* Returns false once the page is full. */
+    auto visit = [&](const std::string& name,const DbSnapshot::Fragment& fragment) {
+	if (!matches(name))
+	    return true;
+	if (query.limit > 0 && count == query.limit) {
+	    more = true;
+	    return false;
+	}
+	write_fragment(fragment,query.fields,writer);
+	last = name;
+	++count;
+	return true;
+    };
 
-    mutex.unlock();
-    return true;
+    writer.StartObject();
+    writer.String(rtype_to_label_plural[rt]);
+    writer.StartArray();
+    if (names)
+	names->visit(query.cursor,[&](const std::string& name,uint32_t id) {
+	    const DbSnapshot::Fragment *fragment = fragments.find(name);
+	    return !fragment || visit(name,*fragment);
+	});
+    else
+	fragments.visit(query.cursor,visit);
+    writer.EndArray();
+    if (more) {
+	writer.String("next_cursor");
+	writer.String(last.c_str());
+    }
+    writer.EndObject();
 }
 
-void App::response_handler()
+bool App::serialize(std::shared_ptr<const DbSnapshot> snap,ResourceType rt,
+		    std::string& rname,
+		    rapidjson::Writer<rapidjson::StringBuffer>& writer,
+		    AppError **ae)
 {
-    std::unique_lock<std::mutex> lock(mutex);
+    const DbSnapshot::Fragment *fragment = snap->find(rt,rname);
 
-    while (!should_stop) {
-	if (cv.wait_for(lock,std::chrono::seconds(1)) == std::cv_status::timeout)
-	    continue;
-	for (auto it = request_groups.begin(); it != request_groups.end(); ++it) {
-	    int succeeded = 0,failed = 0,pending = 0;
-	    RequestGroup *group = *it;
-	    if (group->is_done(&succeeded,&failed,&pending)
-		|| group->is_expired()) {
-		std::shared_ptr<RequestContext> ctx = group->get_ctx();
-		Pistache::Http::ResponseWriter& response = ctx->get_response();
-		if (pending)
-		    response.send(static_cast<Pistache::Http::Code>(504));
-		else if (failed)
-		    response.send(static_cast<Pistache::Http::Code>(502));
-		else
-		    response.send(static_cast<Pistache::Http::Code>(200));
-
-		request_groups.erase(it);
-	    }
+    if (!fragment) {
+	if (ae) {
+	    if (*ae == NULL)
+		*ae = new AppError(404);
+	    (*ae)->add(std::string(rtype_to_label[rt])
+		       + std::string(" does not exist"));
 	}
-	lock.unlock();
-	cv.notify_one();
+	return false;
     }
+
+    const std::string& json = fragment->json();
+    writer.RawValue(json.c_str(),json.size(),rapidjson::kObjectType);
+    return true;
 }
 
-void App::init()
+void App::serialize_stats(rapidjson::Writer<rapidjson::StringBuffer>& writer)
 {
-    db[ResourceType::SliceResource][std::string("default")] = new Slice("default");
+    writer.StartObject();
+    writer.String("pipeline");
+    pipeline.serialize(writer);
+    writer.String("kpm_decoder");
+    writer.StartObject();
+    writer.String("mode");
+    writer.String(e2sm::kpm::kpm_decoder_mode_to_string(kpm->get_decoder_mode()));
+    writer.String("stream_decodes");
+    writer.Uint64(kpm->get_stream_decodes());
+    writer.String("stream_fallbacks");
+    writer.Uint64(kpm->get_stream_fallbacks());
+    writer.String("validate_mismatches");
+    writer.Uint64(kpm->get_validate_mismatches());
+    writer.EndObject();
+    writer.String("e2ap");
+    writer.StartObject();
+    writer.String("pending_controls");
+    writer.Uint64(e2ap.get_num_pending(e2ap::PROCEDURE_CONTROL));
+    writer.String("pending_subscriptions");
+    writer.Uint64(e2ap.get_num_pending(e2ap::PROCEDURE_SUBSCRIPTION));
+    writer.String("pending_subscription_deletes");
+    writer.Uint64(e2ap.get_num_pending(e2ap::PROCEDURE_SUBSCRIPTION_DELETE));
+    writer.String("retransmits");
+    writer.Uint64(e2ap.get_retransmits());
+    writer.String("timeouts");
+    writer.Uint64(e2ap.get_expirations());
+    writer.EndObject();
+    writer.String("batcher");
+    batcher.serialize(writer);
+    writer.String("events");
+    events.serialize(writer);
+    writer.String("equalizer");
+    mutex.lock();
+    equalizer.serialize(writer);
+    mutex.unlock();
+    writer.String("ue_history");
+    writer.StartObject();
+    writer.String("ues");
+    writer.Int(ue_history.get_used());
+    writer.String("dropped");
+    writer.Uint64(ue_history.get_dropped());
+    writer.EndObject();
+    writer.EndObject();
 }
 
-void App::start()
+/*
+ * Maps the RNTIs in a NexRAN slice status report to IMSIs, so that UE
+ * KPM history can be found by IMSI.  A disconnected UE's RNTI is free
+ * for reuse, so its mapping is dropped.  The agent sends C-RNTIs as
+ * decimal or 0x-prefixed hex strings.
+ */
+void App::map_ue_rntis(const std::string& meid,
+		       const std::list<e2sm::nexran::SliceStatus *>& statuses)
 {
-    if (running)
+    if (!ue_history.is_enabled())
 	return;
 
-    should_stop = false;
-	register_xapp();
+    int shard = pipeline.shard_of(meid.c_str());
 
-    /*
-     * Init the E2.  Note there is nothing to do until we are configured
-     * via northbound interface with objects.  Eventually we should
-     * store config in the RNIB and restore things on startup, possibly.
-     */
-    e2ap.init();
+    for (auto it = statuses.begin(); it != statuses.end(); ++it) {
+	for (auto it2 = (*it)->ue_list.begin(); it2 != (*it)->ue_list.end(); ++it2) {
+	    e2sm::nexran::UeStatus *ue = *it2;
+	    const char *s = ue->crnti.c_str();
+	    char *end = NULL;
+	    bool hex = (strncmp(s,"0x",2) == 0 || strncmp(s,"0X",2) == 0);
+	    long rnti = strtol(s,&end,hex ? 16 : 10);
 
-    Add_msg_cb(RIC_SUB_RESP,rmr_callback,this);
-    Add_msg_cb(RIC_SUB_FAILURE,rmr_callback,this);
-    Add_msg_cb(RIC_SUB_DEL_RESP,rmr_callback,this);
-    Add_msg_cb(RIC_SUB_DEL_FAILURE,rmr_callback,this);
-    Add_msg_cb(RIC_CONTROL_ACK,rmr_callback,this);
-    Add_msg_cb(RIC_CONTROL_FAILURE,rmr_callback,this);
-    Add_msg_cb(RIC_INDICATION,rmr_callback,this);
+	    if (ue->imsi.empty() || ue->crnti.empty() || *end != '\0')
+		continue;
+	    ue_history.map_rnti(shard,meid,rnti,
+				ue->connected ? ue->imsi : std::string());
+	}
+    }
+}
 
-    rmr_thread = new std::thread(&App::Listen,this);
-    response_thread = new std::thread(&App::response_handler,this);
+bool App::serialize_ue_metrics(const std::string& imsi,size_t limit,
+			       rapidjson::Writer<rapidjson::StringBuffer>& writer,
+			       AppError **ae)
+{
+    if (!ue_history.serialize(imsi,limit,writer)) {
+	if (ae) {
+	    if (*ae == NULL)
+		*ae = new AppError(404);
+	    (*ae)->add(std::string("no metrics for ue"));
+	}
+	return false;
+    }
+    return true;
+}
 
-    /*
-     * Init and start the northbound interface.
-     * NB: the RMR Messenger superclass is already running at this point.
-     */
-    server.init(this);
-    server.start();
-    running = true;
+static void split_list(const char *s,std::list<std::string>& items)
+{
+    std::string str(s ? s : "");
+    size_t pos = 0;
+
+    while (pos < str.size()) {
+	size_t end = str.find(',',pos);
+	if (end == std::string::npos)
+	    end = str.size();
+	if (end > pos)
+	    items.push_back(str.substr(pos,end - pos));
+	pos = end + 1;
+    }
 }
 
-void App::stop()
+/*
+ * Configures the PDU tracer from our config and starts its writer,
+ * whether or not tracing is enabled, so that it can be enabled later
+ * via the northbound interface.
+ */
+void App::init_pdu_trace()
 {
-    /* Stop the northbound interface. */
-    server.stop();
-	/* Deregister the xApp*/
-	deregister_xapp();
-    /* Stop the RMR Messenger superclass. */
-    Stop();
-    rmr_thread->join();
-    delete rmr_thread;
-    rmr_thread = NULL;
-    response_thread->join();
-    delete response_thread;
-    response_thread = NULL;
-    running = false;
-    should_stop = false;
+    e2ap::PduTraceConfig pdu_config;
+    std::list<std::string> items;
+
+    if (config[Config::ItemName::PDU_TRACE_SAMPLE]->i > 0)
+	pdu_config.sample = config[Config::ItemName::PDU_TRACE_SAMPLE]->i;
+    if (!e2ap::pdu_trace_format_from_string(
+	    config[Config::ItemName::PDU_TRACE_FORMAT]->s,&pdu_config.format))
+	mdclog_write(MDCLOG_WARN,"unknown pdu trace format '%s'; using binary",
+		     config[Config::ItemName::PDU_TRACE_FORMAT]->s);
+    split_list(config[Config::ItemName::PDU_TRACE_PROCEDURES]->s,items);
+    for (auto it = items.begin(); it != items.end(); ++it) {
+	char *end = NULL;
+	long code = strtol(it->c_str(),&end,10);
+	if (*end != '\0' || code < 0 || code > 255) {
+	    mdclog_write(MDCLOG_WARN,"ignoring invalid pdu trace procedure code '%s'",
+			 it->c_str());
+	    continue;
+	}
+	pdu_config.procedures.insert(code);
+    }
+    items.clear();
+    split_list(config[Config::ItemName::PDU_TRACE_MEIDS]->s,items);
+    pdu_config.meids.insert(items.begin(),items.end());
+
+    e2ap.get_pdu_tracer().configure(pdu_config);
+    e2ap.get_pdu_tracer().start(config[Config::ItemName::PDU_TRACE_FILE]->s);
 }
 
-void App::serialize(ResourceType rt,
-		    rapidjson::Writer<rapidjson::StringBuffer>& writer)
+void App::serialize_pdu_trace(rapidjson::Writer<rapidjson::StringBuffer>& writer)
 {
-    const char *label;
+    e2ap::PduTracer& tracer = e2ap.get_pdu_tracer();
+    std::shared_ptr<const e2ap::PduTraceConfig> pdu_config = tracer.get_config();
 
-    mutex.lock();
     writer.StartObject();
-    writer.String(rtype_to_label_plural[rt]);
+    writer.String("sample");
+    writer.Uint(pdu_config->sample);
+    writer.String("format");
+    writer.String(e2ap::pdu_trace_format_to_string(pdu_config->format));
+    writer.String("procedures");
     writer.StartArray();
-    for (auto it = db[rt].begin(); it != db[rt].end(); ++it)
-	it->second->serialize(writer);
+    for (auto it = pdu_config->procedures.begin(); it != pdu_config->procedures.end(); ++it)
+	writer.Int64(*it);
+    writer.EndArray();
+    writer.String("meids");
+    writer.StartArray();
+    for (auto it = pdu_config->meids.begin(); it != pdu_config->meids.end(); ++it)
+	writer.String(it->c_str());
     writer.EndArray();
+    writer.String("file");
+    writer.String(tracer.get_path().c_str());
+    writer.String("matched");
+    writer.Uint64(tracer.get_matched());
+    writer.String("queued");
+    writer.Uint64(tracer.get_queued());
+    writer.String("written");
+    writer.Uint64(tracer.get_written());
+    writer.String("dropped");
+    writer.Uint64(tracer.get_dropped());
     writer.EndObject();
-    mutex.unlock();
 }
 
-bool App::serialize(ResourceType rt,std::string& rname,
-		    rapidjson::Writer<rapidjson::StringBuffer>& writer,
-		    AppError **ae)
+/*
+ * Changes only the settings present in d; the trace file is fixed at
+ * startup.
+ */
+bool App::update_pdu_trace(rapidjson::Document& d,AppError **ae)
 {
-    mutex.lock();
-    if (db[rt].count(rname) < 1) {
-	mutex.unlock();
-	if (ae) {
-	    if (*ae == NULL)
-		*ae = new AppError(404);
-	    (*ae)->add(std::string(rtype_to_label[rt])
-		       + std::string(" does not exist"));
-	}
+    e2ap::PduTraceConfig pdu_config = *e2ap.get_pdu_tracer().get_config();
+
+    if (!d.IsObject()) {
+	*ae = new AppError(400,"request is not an object");
 	return false;
     }
+    if (d.HasMember("sample")) {
+	if (!d["sample"].IsUint()) {
+	    *ae = new AppError(400,"sample must be a non-negative integer");
+	    return false;
+	}
+	pdu_config.sample = d["sample"].GetUint();
+    }
+    if (d.HasMember("format")) {
+	if (!d["format"].IsString()
+	    || !e2ap::pdu_trace_format_from_string(d["format"].GetString(),
+						   &pdu_config.format)) {
+	    *ae = new AppError(400,"format must be binary or xer");
+	    return false;
+	}
+    }
+    if (d.HasMember("procedures")) {
+	if (!d["procedures"].IsArray()) {
+	    *ae = new AppError(400,"procedures must be an array of procedure codes");
+	    return false;
+	}
+	pdu_config.procedures.clear();
+	for (auto& v : d["procedures"].GetArray()) {
+	    if (!v.IsUint() || v.GetUint() > 255) {
+		*ae = new AppError(400,"procedures must be an array of procedure codes");
+		return false;
+	    }
+	    pdu_config.procedures.insert(v.GetUint());
+	}
+    }
+    if (d.HasMember("meids")) {
+	if (!d["meids"].IsArray()) {
+	    *ae = new AppError(400,"meids must be an array of strings");
+	    return false;
+	}
+	pdu_config.meids.clear();
+	for (auto& v : d["meids"].GetArray()) {
+	    if (!v.IsString()) {
+		*ae = new AppError(400,"meids must be an array of strings");
+		return false;
+	    }
+	    pdu_config.meids.insert(v.GetString());
+	}
+    }
+
+    e2ap.get_pdu_tracer().configure(pdu_config);
 
-    db[rt][rname]->serialize(writer);
-    mutex.unlock();
     return true;
 }
 
+/*
+ * Writes spans in the Chrome trace event format (complete events, with
+ * microsecond timestamps), so a dump loads directly in chrome://tracing
+ * or Perfetto.  Each thread is a track; a trace's spans share args.
+ */
+void App::serialize_traces(rapidjson::Writer<rapidjson::StringBuffer>& writer,
+			   uint64_t trace_id)
+{
+    std::vector<e2ap::Span> spans;
+
+    e2ap::tracer().collect(spans,trace_id);
+    std::sort(spans.begin(),spans.end(),
+	      [](const e2ap::Span& a,const e2ap::Span& b) {
+		  return a.start_ns < b.start_ns;
+	      });
+
+    writer.StartObject();
+    writer.String("traceEvents");
+    writer.StartArray();
+    for (auto it = spans.begin(); it != spans.end(); ++it) {
+	writer.StartObject();
+	writer.String("name");
+	writer.String(it->name);
+	writer.String("cat");
+	writer.String("nexran");
+	writer.String("ph");
+	writer.String("X");
+	writer.String("ts");
+	writer.Double(it->start_ns / 1000.0);
+	writer.String("dur");
+	writer.Double((it->end_ns - it->start_ns) / 1000.0);
+	writer.String("pid");
+	writer.Int(1);
+	writer.String("tid");
+	writer.Uint(it->tid);
+	writer.String("args");
+	writer.StartObject();
+	writer.String("trace_id");
+	writer.Uint64(it->trace_id);
+	if (it->instance_id >= 0) {
+	    writer.String("instance_id");
+	    writer.Int64(it->instance_id);
+	}
+	writer.EndObject();
+	writer.EndObject();
+    }
+    writer.EndArray();
+    writer.String("displayTimeUnit");
+    writer.String("ns");
+    writer.EndObject();
+}
+
 bool App::add(ResourceType rt,AbstractResource *resource,
 	      rapidjson::Writer<rapidjson::StringBuffer>& writer,
-	      AppError **ae)
+	      AppError **ae,std::shared_ptr<RequestGroup> group)
 {
     std::string& rname = resource->getName();
 
@@ -575,8 +1593,29 @@ bool App::add(ResourceType rt,AbstractResource *resource,
 	return false;
     }
 
+    /* Only resources that are kept hold an ID; App::del releases it. */
+    if ((rt == App::ResourceType::SliceResource
+	 && !((Slice *)resource)->intern_id())
+	|| (rt == App::ResourceType::UeResource
+	    && !((Ue *)resource)->intern_id())) {
+	if (ae) {
+	    if (*ae == NULL)
+		*ae = new AppError(507);
+	    (*ae)->add(std::string("too many distinct ")
+		       + std::string(rtype_to_label_plural[rt]));
+	}
+	mutex.unlock();
+	return false;
+    }
+
     db[rt][rname] = resource;
-    resource->serialize(writer);
+    if (rt == App::ResourceType::SliceResource) {
+	index_slice((Slice *)resource);
+	equalizer.add((Slice *)resource);
+    }
+    publish(rt,std::list<std::string>({ rname }));
+    std::shared_ptr<const std::string> json = resource->get_fragment();
+    writer.RawValue(json->c_str(),json->size(),rapidjson::kObjectType);
     mutex.unlock();
 
     if (rt == App::ResourceType::NodeBResource) {
@@ -593,13 +1632,13 @@ bool App::add(ResourceType rt,AbstractResource *resource,
 	e2ap.send_subscription_request(req,rname);
 	*/
 
-	e2sm::nexran::SliceStatusRequest *sreq = \
-	    new e2sm::nexran::SliceStatusRequest(nexran);
+	std::shared_ptr<e2sm::nexran::SliceStatusRequest> sreq = \
+	    std::make_shared<e2sm::nexran::SliceStatusRequest>(nexran);
 	std::shared_ptr<e2ap::ControlRequest> creq = std::make_shared<e2ap::ControlRequest>(
             e2ap.get_requestor_id(),e2ap.get_next_instance_id(),
 	    1,sreq,e2ap::CONTROL_REQUEST_ACK);
 	creq->set_meid(rname);
-	e2ap.send_control_request(creq,rname);
+	send_control(creq,group);
 
 	e2sm::kpm::EventTrigger *trigger = \
 	    new e2sm::kpm::EventTrigger(kpm);
@@ -610,17 +1649,17 @@ bool App::add(ResourceType rt,AbstractResource *resource,
 		e2ap.get_requestor_id(),e2ap.get_next_instance_id(),
 		0,trigger,actions);
 	req->set_meid(rname);
-	e2ap.send_subscription_request(req,rname);
+	send_subscription(req,group);
     }
 
-    mdclog_write(MDCLOG_DEBUG,"added %s %s",
-		 rtype_to_label[rt],resource->getName().c_str());
+    E2AP_LOG(MDCLOG_DEBUG,"added %s %s",
+	     rtype_to_label[rt],resource->getName().c_str());
 
     return true;
 }
 
 bool App::del(ResourceType rt,std::string& rname,
-	      AppError **ae)
+	      AppError **ae,std::shared_ptr<RequestGroup> group)
 {
     mutex.lock();
     if (db[rt].count(rname) < 1) {
@@ -633,19 +1672,21 @@ bool App::del(ResourceType rt,std::string& rname,
 	return false;
     }
 
-    mdclog_write(MDCLOG_DEBUG,"deleting %s %s",
-		 rtype_to_label[rt],rname.c_str());
+    E2AP_LOG(MDCLOG_DEBUG,"deleting %s %s",
+	     rtype_to_label[rt],rname.c_str());
+
+    // Other resources whose serialization the deletion changes.
+    std::list<std::string> republish;
 
     if (rt == App::ResourceType::UeResource) {
 	Ue *ue = (Ue *)db[App::ResourceType::UeResource][rname];
 	std::string &imsi = ue->getName();
+	Slice *slice = NULL;
 
-	if (ue->is_bound()
-	    && db[App::ResourceType::SliceResource].count(ue->get_bound_slice()) > 0) {
-	    std::string &slice_name = ue->get_bound_slice();
-	    Slice *slice = (Slice *)db[App::ResourceType::SliceResource][slice_name];
-
-	    if (!slice->unbind_ue(imsi)) {
+	if (ue->is_bound())
+	    slice = get_slice_by_id(ue->get_bound_slice());
+	if (slice) {
+	    if (!slice->unbind_ue(ue->getId())) {
 		mutex.unlock();
 		if (ae) {
 		    if (!*ae)
@@ -655,77 +1696,97 @@ bool App::del(ResourceType rt,std::string& rname,
 		return false;
 	    }
 
-	    e2sm::nexran::SliceUeUnbindRequest *sreq = \
-		new e2sm::nexran::SliceUeUnbindRequest(nexran,slice_name,imsi);
+	    std::shared_ptr<e2sm::nexran::SliceUeUnbindRequest> sreq = \
+		std::make_shared<e2sm::nexran::SliceUeUnbindRequest>(nexran,slice->getName(),imsi);
 
+	    std::list<std::string> meids;
 	    for (auto it = db[ResourceType::NodeBResource].begin();
 		 it != db[ResourceType::NodeBResource].end();
 		 ++it) {
 		NodeB *nodeb = (NodeB *)it->second;
 
-		if (!nodeb->is_slice_bound(slice_name))
+		if (!nodeb->is_slice_bound(slice->getId()))
 		    continue;
 
-		// Each request needs a different RequestId, so we have to
-		// re-encode each time.
-		std::shared_ptr<e2ap::ControlRequest> creq = std::make_shared<e2ap::ControlRequest>(
-                    e2ap.get_requestor_id(),e2ap.get_next_instance_id(),
-		    1,sreq,e2ap::CONTROL_REQUEST_ACK);
-		creq->set_meid(nodeb->getName());
-		e2ap.send_control_request(creq,nodeb->getName());
+		meids.push_back(nodeb->getName());
 	    }
+	    send_control(sreq,meids,group);
+	    republish.push_back(slice->getName());
 	}
     }
     else if (rt == App::ResourceType::SliceResource) {
 	Slice *slice = (Slice *)db[App::ResourceType::SliceResource][rname];
 
-        e2sm::nexran::SliceDeleteRequest *sreq = \
-	    new e2sm::nexran::SliceDeleteRequest(nexran,rname);
+        std::shared_ptr<e2sm::nexran::SliceDeleteRequest> sreq = \
+	    std::make_shared<e2sm::nexran::SliceDeleteRequest>(nexran,rname);
 
+	std::list<std::string> meids;
 	for (auto it = db[ResourceType::NodeBResource].begin();
 	     it != db[ResourceType::NodeBResource].end();
 	     ++it) {
 	    NodeB *nodeb = (NodeB *)it->second;
 
-	    if (!nodeb->is_slice_bound(rname))
+	    if (!nodeb->is_slice_bound(slice->getId()))
 		continue;
 
-	    // Each request needs a different RequestId, so we have to
-	    // re-encode each time.
-	    std::shared_ptr<e2ap::ControlRequest> creq = std::make_shared<e2ap::ControlRequest>(
-                e2ap.get_requestor_id(),e2ap.get_next_instance_id(),
-		1,sreq,e2ap::CONTROL_REQUEST_ACK);
-	    creq->set_meid(nodeb->getName());
-	    e2ap.send_control_request(creq,nodeb->getName());
+	    meids.push_back(nodeb->getName());
 	}
+	send_control(sreq,meids,group);
+
+	/* Don't leave the NodeBs pointing at the deleted slice. */
+	for (auto it = db[ResourceType::NodeBResource].begin();
+	     it != db[ResourceType::NodeBResource].end();
+	     ++it)
+	    ((NodeB *)it->second)->unbind_slice(slice->getId());
+	republish = meids;
 
 	slice->unbind_all_ues();
+	unindex_slice(slice);
+	equalizer.remove(slice);
     }
     else if (rt == App::ResourceType::NodeBResource) {
 	NodeB *nodeb = (NodeB *)db[App::ResourceType::NodeBResource][rname];
-	std::map<std::string,Slice *>& slices = nodeb->get_slices();
+	std::map<uint32_t,Slice *>& slices = nodeb->get_slices();
 
 	if (!slices.empty()) {
 	    std::list<std::string> deletes;
 	    for (auto it = slices.begin(); it != slices.end(); ++it)
-		deletes.push_back(it->first);
+		deletes.push_back(it->second->getName());
 
-	    e2sm::nexran::SliceDeleteRequest *sreq = \
-		new e2sm::nexran::SliceDeleteRequest(nexran,deletes);
+	    std::shared_ptr<e2sm::nexran::SliceDeleteRequest> sreq = \
+		std::make_shared<e2sm::nexran::SliceDeleteRequest>(nexran,deletes);
 
 	    std::shared_ptr<e2ap::ControlRequest> creq = std::make_shared<e2ap::ControlRequest>(
                 e2ap.get_requestor_id(),e2ap.get_next_instance_id(),
 		1,sreq,e2ap::CONTROL_REQUEST_ACK);
 	    creq->set_meid(nodeb->getName());
-	    e2ap.send_control_request(creq,nodeb->getName());
+	    send_control(creq,group);
 	}
 
 	e2ap.delete_all_subscriptions(rname);
+	kpm_aggregator.forget(rname);
+	ue_history.forget(rname);
+	meid_cache_mutex.lock();
+	meid_cache.erase(rname);
+	meid_cache_mutex.unlock();
     }
 
+    /* Nothing refers to the ID now, so it can go to the next name. */
+    if (rt == App::ResourceType::UeResource)
+	((Ue *)db[rt][rname])->release_id();
+    else if (rt == App::ResourceType::SliceResource)
+	((Slice *)db[rt][rname])->release_id();
+
+    std::string name(rname);
     delete db[rt][rname];
     db[rt].erase(rname);
 
+    publish(rt,std::list<std::string>({ name }));
+    if (rt == App::ResourceType::UeResource && !republish.empty())
+	publish(ResourceType::SliceResource,republish);
+    else if (rt == App::ResourceType::SliceResource && !republish.empty())
+	publish(ResourceType::NodeBResource,republish);
+
     mutex.unlock();
 
     return true;
@@ -733,7 +1794,7 @@ bool App::del(ResourceType rt,std::string& rname,
 
 bool App::update(ResourceType rt,std::string& rname,
 		 rapidjson::Document& d,
-		 AppError **ae)
+		 AppError **ae,std::shared_ptr<RequestGroup> group)
 {
     mutex.lock();
     if (db[rt].count(rname) < 1) {
@@ -746,49 +1807,55 @@ bool App::update(ResourceType rt,std::string& rname,
 	return false;
     }
 
+    int old_share = -1;
+    if (rt == App::ResourceType::SliceResource) {
+	ProportionalAllocationPolicy *policy = \
+	    dynamic_cast<ProportionalAllocationPolicy *>(
+		((Slice *)db[rt][rname])->getPolicy());
+	if (policy)
+	    old_share = policy->getShare();
+    }
+
     if (!db[rt][rname]->update(d,ae)) {
 	mutex.unlock();
 	return false;
     }
+    db[rt][rname]->invalidate();
 
     if (rt == App::ResourceType::SliceResource) {
 	Slice *slice = (Slice *)db[App::ResourceType::SliceResource][rname];
+	equalizer.update(slice);
 
 	ProportionalAllocationPolicy *policy = dynamic_cast<ProportionalAllocationPolicy *>(slice->getPolicy());
-	e2sm::nexran::ProportionalAllocationPolicy *npolicy = \
-	    new e2sm::nexran::ProportionalAllocationPolicy(policy->getShare());
-	e2sm::nexran::SliceConfig *sc = new e2sm::nexran::SliceConfig(slice->getName(),npolicy);
-	e2sm::nexran::SliceConfigRequest *sreq = new e2sm::nexran::SliceConfigRequest(nexran,sc);
-	sreq->encode();
 
+	std::list<std::string> meids;
 	for (auto it = db[ResourceType::NodeBResource].begin();
 	     it != db[ResourceType::NodeBResource].end();
 	     ++it) {
 	    NodeB *nodeb = (NodeB *)it->second;
 
-	    if (!nodeb->is_slice_bound(rname))
+	    if (!nodeb->is_slice_bound(slice->getId()))
 		continue;
 
-	    // Each request needs a different RequestId, so we have to
-	    // re-encode each time.
-	    std::shared_ptr<e2ap::ControlRequest> creq = std::make_shared<e2ap::ControlRequest>(
-                e2ap.get_requestor_id(),e2ap.get_next_instance_id(),
-		1,sreq,e2ap::CONTROL_REQUEST_ACK);
-	    creq->set_meid(nodeb->getName());
-	    e2ap.send_control_request(creq,nodeb->getName());
+	    meids.push_back(nodeb->getName());
 	}
+	send_slice_config(slice,policy->getShare(),meids,group);
+	if (policy->getShare() != old_share
+	    && events.wants(EventStream::EventType::ShareEvent))
+	    publish_share_event(slice,old_share,policy->getShare(),"api");
     }
+    publish(rt,std::list<std::string>({ rname }));
 
     mutex.unlock();
 
-    mdclog_write(MDCLOG_DEBUG,"updated %s %s",
-		 rtype_to_label[rt],rname.c_str());
+    E2AP_LOG(MDCLOG_DEBUG,"updated %s %s",
+	     rtype_to_label[rt],rname.c_str());
 
     return true;
 }
 
 bool App::bind_slice_nodeb(std::string& slice_name,std::string& nodeb_name,
-			   AppError **ae)
+			   AppError **ae,std::shared_ptr<RequestGroup> group)
 {
     mutex.lock();
     if (db[App::ResourceType::SliceResource].count(slice_name) < 1) {
@@ -823,26 +1890,21 @@ bool App::bind_slice_nodeb(std::string& slice_name,std::string& nodeb_name,
     }
 
     ProportionalAllocationPolicy *policy = dynamic_cast<ProportionalAllocationPolicy *>(slice->getPolicy());
-    e2sm::nexran::ProportionalAllocationPolicy *npolicy = \
-	new e2sm::nexran::ProportionalAllocationPolicy(policy->getShare());
-    e2sm::nexran::SliceConfig *sc = new e2sm::nexran::SliceConfig(slice->getName(),npolicy);
-    e2sm::nexran::SliceConfigRequest *sreq = new e2sm::nexran::SliceConfigRequest(nexran,sc);
-    std::shared_ptr<e2ap::ControlRequest> creq = std::make_shared<e2ap::ControlRequest>(
-        e2ap.get_requestor_id(),e2ap.get_next_instance_id(),
-	1,sreq,e2ap::CONTROL_REQUEST_ACK);
-    creq->set_meid(nodeb->getName());
-    e2ap.send_control_request(creq,nodeb->getName());
+    send_slice_config(slice,policy->getShare(),
+		      std::list<std::string>({ nodeb->getName() }),group);
+    publish(ResourceType::NodeBResource,
+	    std::list<std::string>({ nodeb->getName() }));
 
     mutex.unlock();
 
-    mdclog_write(MDCLOG_DEBUG,"bound slice %s to nodeb %s",
-		 slice_name.c_str(),nodeb->getName().c_str());
+    E2AP_LOG(MDCLOG_DEBUG,"bound slice %s to nodeb %s",
+	     slice_name.c_str(),nodeb->getName().c_str());
 
     return true;
 }
 
 bool App::unbind_slice_nodeb(std::string& slice_name,std::string& nodeb_name,
-			     AppError **ae)
+			     AppError **ae,std::shared_ptr<RequestGroup> group)
 {
     mutex.lock();
     if (db[App::ResourceType::SliceResource].count(slice_name) < 1) {
@@ -863,9 +1925,10 @@ bool App::unbind_slice_nodeb(std::string& slice_name,std::string& nodeb_name,
 	}
 	return false;
     }
+    Slice *slice = (Slice *)db[App::ResourceType::SliceResource][slice_name];
     NodeB *nodeb = (NodeB *)db[App::ResourceType::NodeBResource][nodeb_name];
 	
-    if (!nodeb->unbind_slice(slice_name)) {
+    if (!nodeb->unbind_slice(slice->getId())) {
 	mutex.unlock();
 	if (ae) {
 	    if (!*ae)
@@ -875,24 +1938,26 @@ bool App::unbind_slice_nodeb(std::string& slice_name,std::string& nodeb_name,
 	return false;
     }
 
-    e2sm::nexran::SliceDeleteRequest *sreq = \
-	new e2sm::nexran::SliceDeleteRequest(nexran,slice_name);
+    std::shared_ptr<e2sm::nexran::SliceDeleteRequest> sreq = \
+	std::make_shared<e2sm::nexran::SliceDeleteRequest>(nexran,slice_name);
     std::shared_ptr<e2ap::ControlRequest> creq = std::make_shared<e2ap::ControlRequest>(
         e2ap.get_requestor_id(),e2ap.get_next_instance_id(),
 	1,sreq,e2ap::CONTROL_REQUEST_ACK);
     creq->set_meid(nodeb->getName());
-    e2ap.send_control_request(creq,nodeb->getName());
+    send_control(creq,group);
+    publish(ResourceType::NodeBResource,
+	    std::list<std::string>({ nodeb->getName() }));
 
     mutex.unlock();
 
-    mdclog_write(MDCLOG_DEBUG,"unbound slice %s from nodeb %s",
-		 slice_name.c_str(),nodeb->getName().c_str());
+    E2AP_LOG(MDCLOG_DEBUG,"unbound slice %s from nodeb %s",
+	     slice_name.c_str(),nodeb->getName().c_str());
 
     return true;
 }
 
 bool App::bind_ue_slice(std::string& imsi,std::string& slice_name,
-			AppError **ae)
+			AppError **ae,std::shared_ptr<RequestGroup> group)
 {
     mutex.lock();
     if (db[App::ResourceType::SliceResource].count(slice_name) < 1) {
@@ -925,38 +1990,36 @@ bool App::bind_ue_slice(std::string& imsi,std::string& slice_name,
 	}
 	return false;
     }
-    ue->bind_slice(slice_name);
+    ue->bind_slice(slice->getId());
 
-    e2sm::nexran::SliceUeBindRequest *sreq = \
-	new e2sm::nexran::SliceUeBindRequest(nexran,slice->getName(),ue->getName());
+    std::shared_ptr<e2sm::nexran::SliceUeBindRequest> sreq = \
+	std::make_shared<e2sm::nexran::SliceUeBindRequest>(nexran,slice->getName(),ue->getName());
 
+    std::list<std::string> meids;
     for (auto it = db[ResourceType::NodeBResource].begin();
 	 it != db[ResourceType::NodeBResource].end();
 	 ++it) {
 	NodeB *nodeb = (NodeB *)it->second;
 
-	if (!nodeb->is_slice_bound(slice_name))
+	if (!nodeb->is_slice_bound(slice->getId()))
 	    continue;
 
-	// Each request needs a different RequestId, so we have to
-	// re-encode each time.
-	std::shared_ptr<e2ap::ControlRequest> creq = std::make_shared<e2ap::ControlRequest>(
-            e2ap.get_requestor_id(),e2ap.get_next_instance_id(),
-	    1,sreq,e2ap::CONTROL_REQUEST_ACK);
-	creq->set_meid(nodeb->getName());
-	e2ap.send_control_request(creq,nodeb->getName());
+	meids.push_back(nodeb->getName());
     }
+    send_control(sreq,meids,group);
+    publish(ResourceType::SliceResource,
+	    std::list<std::string>({ slice->getName() }));
 
     mutex.unlock();
 
-    mdclog_write(MDCLOG_DEBUG,"bound ue %s to nodeb %s",
-		 imsi.c_str(),slice_name.c_str());
+    E2AP_LOG(MDCLOG_DEBUG,"bound ue %s to slice %s",
+	     imsi.c_str(),slice_name.c_str());
 
     return true;
 }
 
 bool App::unbind_ue_slice(std::string& imsi,std::string& slice_name,
-			  AppError **ae)
+			  AppError **ae,std::shared_ptr<RequestGroup> group)
 {
     mutex.lock();
     if (db[App::ResourceType::SliceResource].count(slice_name) < 1) {
@@ -977,9 +2040,10 @@ bool App::unbind_ue_slice(std::string& imsi,std::string& slice_name,
 	}
 	return false;
     }
+    Ue *ue = (Ue *)db[App::ResourceType::UeResource][imsi];
     Slice *slice = (Slice *)db[App::ResourceType::SliceResource][slice_name];
 
-    if (!slice->unbind_ue(imsi)) {
+    if (!slice->unbind_ue(ue->getId())) {
 	mutex.unlock();
 	if (ae) {
 	    if (!*ae)
@@ -988,31 +2052,221 @@ bool App::unbind_ue_slice(std::string& imsi,std::string& slice_name,
 	}
 	return false;
     }
+    ue->unbind_slice();
 
-    e2sm::nexran::SliceUeUnbindRequest *sreq = \
-	new e2sm::nexran::SliceUeUnbindRequest(nexran,slice->getName(),imsi);
+    std::shared_ptr<e2sm::nexran::SliceUeUnbindRequest> sreq = \
+	std::make_shared<e2sm::nexran::SliceUeUnbindRequest>(nexran,slice->getName(),imsi);
 
+    std::list<std::string> meids;
     for (auto it = db[ResourceType::NodeBResource].begin();
 	 it != db[ResourceType::NodeBResource].end();
 	 ++it) {
 	NodeB *nodeb = (NodeB *)it->second;
 
-	if (!nodeb->is_slice_bound(slice_name))
+	if (!nodeb->is_slice_bound(slice->getId()))
 	    continue;
 
-	// Each request needs a different RequestId, so we have to
-	// re-encode each time.
-	std::shared_ptr<e2ap::ControlRequest> creq = std::make_shared<e2ap::ControlRequest>(
-            e2ap.get_requestor_id(),e2ap.get_next_instance_id(),
-	    1,sreq,e2ap::CONTROL_REQUEST_ACK);
-	creq->set_meid(nodeb->getName());
-	e2ap.send_control_request(creq,nodeb->getName());
+	meids.push_back(nodeb->getName());
+    }
+    send_control(sreq,meids,group);
+    publish(ResourceType::SliceResource,
+	    std::list<std::string>({ slice->getName() }));
+
+    mutex.unlock();
+
+    E2AP_LOG(MDCLOG_DEBUG,"unbound ue %s from slice %s",
+	     imsi.c_str(),slice_name.c_str());
+
+    return true;
+}
+
+/*
+ * Creates UEs and binds UEs to slices in bulk.  The whole request is
+ * validated under one acquisition of mutex, and applied only if every
+ * item is valid.  Bindings are then coalesced per slice, so each NodeB
+ * the slice is bound to gets one SliceUeBindRequest per MAX_OF_UES
+ * IMSIs, rather than one per UE.
+ */
+bool App::bulk(rapidjson::Document& d,
+	       rapidjson::Writer<rapidjson::StringBuffer>& writer,
+	       AppError **ae,std::shared_ptr<RequestGroup> group)
+{
+    std::vector<Ue *> ues;
+    std::map<std::string,Ue *> new_ues;
+    /* By slice name, so that controls go out in a stable order. */
+    std::map<std::string,std::list<std::string>> bindings;
+    std::map<std::string,bool> bound;
+    int nbindings = 0;
+    int ncontrols = 0;
+    bool valid = true;
+
+    auto fail = [&](int status,const std::string& message) {
+	valid = false;
+	if (ae) {
+	    if (!*ae)
+		*ae = new AppError(status);
+	    (*ae)->add(message);
+	}
+    };
+
+    if (!d.IsObject()) {
+	fail(400,"request is not an object");
+	return false;
+    }
+    if ((d.HasMember("ues") && !d["ues"].IsArray())
+	|| (d.HasMember("bindings") && !d["bindings"].IsArray())) {
+	fail(400,"ues and bindings must be arrays");
+	return false;
+    }
+
+    if (d.HasMember("ues")) {
+	const rapidjson::Value& a = d["ues"];
+	for (rapidjson::SizeType i = 0; i < a.Size(); ++i) {
+	    std::string prefix = std::string("ues[") + std::to_string(i) + "]: ";
+	    AppError *uae = NULL;
+	    Ue *ue = Ue::create(a[i],&uae);
+	    if (!ue) {
+		if (!uae)
+		    fail(400,prefix + "invalid ue");
+		else {
+		    for (auto it = uae->messages.begin(); it != uae->messages.end(); ++it)
+			fail(uae->http_status,prefix + *it);
+		    delete uae;
+		}
+		continue;
+	    }
+	    ues.push_back(ue);
+	    if (new_ues.count(ue->getName()) > 0)
+		fail(400,prefix + "duplicate ue");
+	    else
+		new_ues[ue->getName()] = ue;
+	}
+    }
+
+    mutex.lock();
+
+    for (auto it = new_ues.begin(); it != new_ues.end(); ++it)
+	if (db[ResourceType::UeResource].count(it->first) > 0)
+	    fail(403,std::string("ue ") + it->first + " already exists");
+
+    if (d.HasMember("bindings")) {
+	const rapidjson::Value& a = d["bindings"];
+	for (rapidjson::SizeType i = 0; i < a.Size(); ++i) {
+	    std::string prefix = std::string("bindings[") + std::to_string(i) + "]: ";
+	    const rapidjson::Value& b = a[i];
+	    if (!b.IsObject()
+		|| !b.HasMember("slice") || !b["slice"].IsString()
+		|| !b.HasMember("imsi") || !b["imsi"].IsString()) {
+		fail(400,prefix + "binding requires slice and imsi strings");
+		continue;
+	    }
+	    std::string slice_name(b["slice"].GetString());
+	    std::string imsi(b["imsi"].GetString());
+	    if (db[ResourceType::SliceResource].count(slice_name) < 1) {
+		fail(404,prefix + "slice does not exist");
+		continue;
+	    }
+	    Ue *ue = NULL;
+	    if (new_ues.count(imsi) > 0)
+		ue = new_ues[imsi];
+	    else if (db[ResourceType::UeResource].count(imsi) > 0)
+		ue = (Ue *)db[ResourceType::UeResource][imsi];
+	    if (!ue) {
+		fail(404,prefix + "ue does not exist");
+		continue;
+	    }
+	    if (ue->is_bound() || bound.count(imsi) > 0) {
+		fail(403,prefix + "ue already bound to slice");
+		continue;
+	    }
+	    bound[imsi] = true;
+	    bindings[slice_name].push_back(imsi);
+	    ++nbindings;
+	}
     }
 
+    /* Intern last, so that a rejected request leaves no IDs behind. */
+    if (valid) {
+	for (auto it = ues.begin(); it != ues.end(); ++it) {
+	    if (!(*it)->intern_id()) {
+		fail(507,std::string("too many distinct ues"));
+		break;
+	    }
+	}
+    }
+
+    if (!valid) {
+	mutex.unlock();
+	for (auto it = ues.begin(); it != ues.end(); ++it) {
+	    (*it)->release_id();
+	    delete *it;
+	}
+	return false;
+    }
+
+    for (auto it = ues.begin(); it != ues.end(); ++it)
+	db[ResourceType::UeResource][(*it)->getName()] = *it;
+
+    for (auto it = bindings.begin(); it != bindings.end(); ++it) {
+	Slice *slice = (Slice *)db[ResourceType::SliceResource][it->first];
+
+	for (auto it2 = it->second.begin(); it2 != it->second.end(); ++it2) {
+	    Ue *ue = (Ue *)db[ResourceType::UeResource][*it2];
+	    slice->bind_ue(ue);
+	    ue->bind_slice(slice->getId());
+	}
+
+	std::list<std::string> meids;
+	for (auto it2 = db[ResourceType::NodeBResource].begin();
+	     it2 != db[ResourceType::NodeBResource].end();
+	     ++it2) {
+	    NodeB *nodeb = (NodeB *)it2->second;
+
+	    if (!nodeb->is_slice_bound(slice->getId()))
+		continue;
+
+	    meids.push_back(nodeb->getName());
+	}
+	if (meids.empty())
+	    continue;
+
+	auto it2 = it->second.begin();
+	while (it2 != it->second.end()) {
+	    std::list<std::string> imsis;
+	    while (it2 != it->second.end()
+		   && imsis.size() < (size_t)e2sm::nexran::MAX_OF_UES)
+		imsis.push_back(*it2++);
+
+	    std::shared_ptr<e2sm::nexran::SliceUeBindRequest> sreq = \
+		std::make_shared<e2sm::nexran::SliceUeBindRequest>(nexran,slice->getName(),imsis);
+	    ncontrols += send_control(sreq,meids,group);
+	}
+    }
+
+    std::list<std::string> names;
+    for (auto it = ues.begin(); it != ues.end(); ++it)
+	names.push_back((*it)->getName());
+    if (!names.empty())
+	publish(ResourceType::UeResource,names);
+    names.clear();
+    for (auto it = bindings.begin(); it != bindings.end(); ++it)
+	names.push_back(it->first);
+    if (!names.empty())
+	publish(ResourceType::SliceResource,names);
+
+    writer.StartObject();
+    writer.String("ues");
+    writer.Int(ues.size());
+    writer.String("bindings");
+    writer.Int(nbindings);
+    writer.String("controls");
+    writer.Int(ncontrols);
+    writer.EndObject();
+
     mutex.unlock();
 
-    mdclog_write(MDCLOG_DEBUG,"unbound ue %s from nodeb %s",
-		 imsi.c_str(),slice_name.c_str());
+    E2AP_LOG(MDCLOG_DEBUG,"bulk added %lu ues and bound %d ues (%d controls)",
+	     ues.size(),nbindings,ncontrols);
 
     return true;
 }
@@ -118,11 +118,13 @@ void NodeB::serialize(rapidjson::Writer<rapidjson::StringBuffer>& writer)
     writer.String("total_prbs");
     writer.Int(total_prbs);
     writer.EndObject();
+    /* slices is keyed by interned ID; list by name, so output is stable. */
     writer.String("slices");
     writer.StartArray();
-    for (auto it = slices.begin(); it != slices.end(); ++it) {
-	writer.String(it->first.c_str());
-    }
+    slice_names.visit([&writer](const std::string& name,uint32_t id) {
+	writer.String(name.c_str());
+	return true;
+    });
     writer.EndArray();
     writer.EndObject();
 };
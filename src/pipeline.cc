@@ -0,0 +1,328 @@
+#include <cstring>
+
+#include "mdclog/mdclog.h"
+#include "rmr/RIC_message_types.h"
+#include "e2ap_log.h"
+
+#include "pipeline.h"
+
+namespace nexran {
+
+void StageCounters::serialize(
+    rapidjson::Writer<rapidjson::StringBuffer>& writer)
+{
+    uint64_t c = count.load(std::memory_order_relaxed);
+    uint64_t t = total_ns.load(std::memory_order_relaxed);
+
+    writer.StartObject();
+    writer.String("count");
+    writer.Uint64(c);
+    writer.String("total_ns");
+    writer.Uint64(t);
+    writer.String("mean_ns");
+    writer.Uint64(c ? t / c : 0);
+    writer.String("max_ns");
+    writer.Uint64(max_ns.load(std::memory_order_relaxed));
+    writer.EndObject();
+}
+
+MessageRing::MessageRing(size_t capacity_)
+{
+    capacity = 2;
+    while (capacity < capacity_)
+	capacity <<= 1;
+    mask = capacity - 1;
+    cells = new Cell[capacity];
+    for (size_t i = 0; i < capacity; ++i) {
+	cells[i].sequence.store(i,std::memory_order_relaxed);
+	cells[i].mtype.store(-1,std::memory_order_relaxed);
+    }
+    enqueue_pos.store(0,std::memory_order_relaxed);
+    dequeue_pos.store(0,std::memory_order_relaxed);
+}
+
+MessageRing::~MessageRing()
+{
+    delete [] cells;
+}
+
+bool MessageRing::try_push(int mtype,int subid,const char *meid,
+			   const char *xid,const unsigned char *buf,int len,
+			   uint64_t now_ns,uint64_t trace_id)
+{
+    Cell *cell;
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+
+    while (true) {
+	cell = &cells[pos & mask];
+	size_t seq = cell->sequence.load(std::memory_order_acquire);
+	intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+	if (diff == 0) {
+	    if (enqueue_pos.compare_exchange_weak(
+		    pos,pos + 1,std::memory_order_relaxed))
+		break;
+	}
+	else if (diff < 0)
+	    return false;
+	else
+	    pos = enqueue_pos.load(std::memory_order_relaxed);
+    }
+
+    cell->msg.set(mtype,subid,meid,xid,buf,len,trace_id);
+    cell->msg.enqueue_ns = now_ns;
+    cell->mtype.store(mtype,std::memory_order_relaxed);
+    cell->sequence.store(pos + 1,std::memory_order_release);
+
+    return true;
+}
+
+bool MessageRing::try_pop(PipelineMessage& msg)
+{
+    return pop(msg,-1);
+}
+
+bool MessageRing::try_pop_if(int mtype,PipelineMessage& msg)
+{
+    return pop(msg,mtype);
+}
+
+/*
+ * If mtype is not -1, the oldest message is only popped if it has that
+ * type.  Its type is read before claiming the cell; if the cell is
+ * popped and refilled meanwhile, dequeue_pos has moved and the claim
+ * fails, so a stale type is never acted on.
+ */
+bool MessageRing::pop(PipelineMessage& msg,int mtype)
+{
+    Cell *cell;
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+
+    while (true) {
+	cell = &cells[pos & mask];
+	size_t seq = cell->sequence.load(std::memory_order_acquire);
+	intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+	if (diff == 0) {
+	    if (mtype != -1
+		&& cell->mtype.load(std::memory_order_relaxed) != mtype)
+		return false;
+	    if (dequeue_pos.compare_exchange_weak(
+		    pos,pos + 1,std::memory_order_relaxed))
+		break;
+	}
+	else if (diff < 0)
+	    return false;
+	else
+	    pos = dequeue_pos.load(std::memory_order_relaxed);
+    }
+
+    msg.take(cell->msg);
+    cell->sequence.store(pos + mask + 1,std::memory_order_release);
+
+    return true;
+}
+
+bool Pipeline::overload_policy_from_string(const char *s,
+					   OverloadPolicy *policy)
+{
+    if (!s)
+	return false;
+    if (strcmp(s,"backpressure") == 0)
+	*policy = Backpressure;
+    else if (strcmp(s,"drop-oldest") == 0)
+	*policy = DropOldest;
+    else
+	return false;
+
+    return true;
+}
+
+Pipeline::~Pipeline()
+{
+    stop();
+    for (auto it = shards.begin(); it != shards.end(); ++it)
+	delete *it;
+}
+
+bool Pipeline::start(int num_shards_,size_t queue_size,
+		     OverloadPolicy policy)
+{
+    if (running)
+	return true;
+
+    if (num_shards_ < 0 || queue_size < 1) {
+	mdclog_write(MDCLOG_ERR,"invalid pipeline config (%d shards, queue size %lu)",
+		     num_shards_,queue_size);
+	return false;
+    }
+
+    num_shards = num_shards_;
+    overload_policy = policy;
+    should_stop = false;
+    for (int i = 0; i < num_shards; ++i)
+	shards.push_back(new Shard(queue_size));
+    for (auto it = shards.begin(); it != shards.end(); ++it)
+	(*it)->thread = new std::thread(&Pipeline::worker,this,*it);
+    running = true;
+
+    mdclog_write(MDCLOG_INFO,"started message pipeline (%d shards, queue size %lu, %s)",
+		 num_shards,shards.empty() ? 0 : shards.front()->ring.get_capacity(),
+		 overload_policy_to_string(overload_policy));
+
+    return true;
+}
+
+/*
+ * Workers drain their rings before exiting, so stop only once nothing
+ * more will be submitted.
+ */
+void Pipeline::stop()
+{
+    if (!running)
+	return;
+
+    should_stop = true;
+    for (auto it = shards.begin(); it != shards.end(); ++it) {
+	Shard *shard = *it;
+	{
+	    std::lock_guard<std::mutex> lock(shard->wait_mutex);
+	    shard->wait_cv.notify_all();
+	}
+	shard->thread->join();
+	delete shard->thread;
+	shard->thread = NULL;
+    }
+    running = false;
+}
+
+/*
+ * Only ever called from the RMR listener thread, so the scratch message
+ * used to discard the oldest entry is not shared.
+ */
+bool Pipeline::submit(int mtype,int subid,const char *meid,const char *xid,
+		      const unsigned char *buf,int len,uint64_t trace_id)
+{
+    if (shards.empty()) {
+	PipelineMessage& msg = scratch;
+	uint64_t start = now_ns();
+
+	msg.set(mtype,subid,meid,xid,buf,len,trace_id);
+	msg.enqueue_ns = start;
+	enqueued.fetch_add(1,std::memory_order_relaxed);
+	handler->handle_pipeline_message(msg);
+	process_stage.record(now_ns() - start);
+	return true;
+    }
+
+    if (should_stop)
+	return false;
+
+    Shard *shard = shards[shard_of(meid)];
+    bool stalled = false;
+    while (!shard->ring.try_push(mtype,subid,meid,xid,buf,len,now_ns(),trace_id)) {
+	if (should_stop)
+	    return false;
+	if (!stalled) {
+	    shard->stalls.fetch_add(1,std::memory_order_relaxed);
+	    stalled = true;
+	}
+	if (overload_policy == DropOldest
+	    && shard->ring.try_pop_if(RIC_INDICATION,scratch)) {
+	    shard->dropped.fetch_add(1,std::memory_order_relaxed);
+	    E2AP_LOG_LIMIT(MDCLOG_DEBUG,1,"pipeline full; dropped oldest indication (source %s)",
+			   scratch.meid);
+	}
+	else
+	    std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    shard->enqueued.fetch_add(1,std::memory_order_relaxed);
+    enqueued.fetch_add(1,std::memory_order_relaxed);
+
+    uint64_t depth = shard->ring.size();
+    uint64_t hw = shard->high_water.load(std::memory_order_relaxed);
+    while (depth > hw
+	   && !shard->high_water.compare_exchange_weak(hw,depth,std::memory_order_relaxed))
+	;
+
+    /* Pairs with the fence in worker(): one of us sees the other. */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (shard->idle.load(std::memory_order_relaxed)) {
+	std::lock_guard<std::mutex> lock(shard->wait_mutex);
+	shard->wait_cv.notify_one();
+    }
+
+    return true;
+}
+
+void Pipeline::worker(Shard *shard)
+{
+    PipelineMessage msg;
+
+    while (true) {
+	if (!shard->ring.try_pop(msg)) {
+	    if (should_stop)
+		break;
+	    std::unique_lock<std::mutex> lock(shard->wait_mutex);
+	    shard->idle.store(true,std::memory_order_relaxed);
+	    std::atomic_thread_fence(std::memory_order_seq_cst);
+	    shard->wait_cv.wait(lock,[this,shard] {
+		return should_stop || shard->ring.size() > 0;
+	    });
+	    shard->idle.store(false,std::memory_order_relaxed);
+	    continue;
+	}
+
+	uint64_t start = now_ns();
+	queue_stage.record(start - msg.enqueue_ns);
+	handler->handle_pipeline_message(msg);
+	process_stage.record(now_ns() - start);
+    }
+}
+
+void Pipeline::serialize(rapidjson::Writer<rapidjson::StringBuffer>& writer)
+{
+    uint64_t dropped = 0,stalls = 0;
+
+    writer.StartObject();
+    writer.String("shards");
+    writer.Int(num_shards);
+    writer.String("queue_size");
+    writer.Uint64(shards.empty() ? 0 : shards.front()->ring.get_capacity());
+    writer.String("overload_policy");
+    writer.String(overload_policy_to_string(overload_policy));
+    writer.String("enqueued");
+    writer.Uint64(enqueued.load(std::memory_order_relaxed));
+    writer.String("shard_stats");
+    writer.StartArray();
+    for (auto it = shards.begin(); it != shards.end(); ++it) {
+	Shard *shard = *it;
+	dropped += shard->dropped.load(std::memory_order_relaxed);
+	stalls += shard->stalls.load(std::memory_order_relaxed);
+	writer.StartObject();
+	writer.String("depth");
+	writer.Uint64(shard->ring.size());
+	writer.String("high_water");
+	writer.Uint64(shard->high_water.load(std::memory_order_relaxed));
+	writer.String("enqueued");
+	writer.Uint64(shard->enqueued.load(std::memory_order_relaxed));
+	writer.String("dropped");
+	writer.Uint64(shard->dropped.load(std::memory_order_relaxed));
+	writer.String("stalls");
+	writer.Uint64(shard->stalls.load(std::memory_order_relaxed));
+	writer.EndObject();
+    }
+    writer.EndArray();
+    writer.String("dropped");
+    writer.Uint64(dropped);
+    writer.String("stalls");
+    writer.Uint64(stalls);
+    writer.String("stages");
+    writer.StartObject();
+    writer.String("queue");
+    queue_stage.serialize(writer);
+    writer.String("process");
+    process_stage.serialize(writer);
+    writer.EndObject();
+    writer.EndObject();
+}
+
+}
@@ -1,17 +1,83 @@
 
+#include <cstring>
+#include <climits>
+
 #include "nexran.h"
 
 namespace nexran {
 
 std::map<AllocationPolicy::Type,const char *> AllocationPolicy::type_to_string = {
     { Proportional, "proportional" },
+    { WeightedFair, "weighted_fair" },
+    { MinMaxGuarantee, "min_max" },
+    { PrbTarget, "prb_target" },
 };
 
-int ProportionalAllocationPolicy::maybeEndThrottling()
+template <class P>
+static AllocationPolicy *new_policy()
+{
+    return new P();
+}
+
+/*
+ * The policy registry.  A new policy type needs an entry here, a
+ * type_to_string name, and an equalizer kernel (src/equalizer.cc).
+ */
+static const struct {
+    AllocationPolicy::Type type;
+    AllocationPolicy *(*factory)();
+} policy_registry[] = {
+    { AllocationPolicy::Proportional,new_policy<ProportionalAllocationPolicy> },
+    { AllocationPolicy::WeightedFair,new_policy<WeightedFairAllocationPolicy> },
+    { AllocationPolicy::MinMaxGuarantee,new_policy<MinMaxGuaranteeAllocationPolicy> },
+    { AllocationPolicy::PrbTarget,new_policy<PrbTargetAllocationPolicy> },
+};
+
+static void policy_error(AppError **ae,const char *message)
+{
+    if (ae) {
+	if (!*ae)
+	    *ae = new AppError(400);
+	(*ae)->add(std::string(message));
+    }
+}
+
+static bool valid_int(const rapidjson::Value& obj,const char *key,
+		      int min,int max)
+{
+    if (!obj.HasMember(key))
+	return true;
+    return obj[key].IsInt()
+	&& obj[key].GetInt() >= min && obj[key].GetInt() <= max;
+}
+
+AllocationPolicy *AllocationPolicy::create(const rapidjson::Value& obj,AppError **ae)
+{
+    if (!obj.IsObject() || !obj.HasMember("type") || !obj["type"].IsString()) {
+	policy_error(ae,"malformed allocation_policy property");
+	return NULL;
+    }
+
+    for (auto& entry : policy_registry) {
+	if (strcmp(type_to_string[entry.type],obj["type"].GetString()) != 0)
+	    continue;
+	AllocationPolicy *policy = entry.factory();
+	if (!policy->update(obj,ae)) {
+	    delete policy;
+	    return NULL;
+	}
+	return policy;
+    }
+
+    policy_error(ae,"unknown allocation_policy type");
+    return NULL;
+}
+
+int ProportionalAllocationPolicy::maybeEndThrottling(time_t now)
 {
     if (!isThrottling())
 	return -1;
-    else if (throttle && std::time(nullptr) < throttle_end)
+    else if (throttle && now < throttle_end)
 	return -1;
 
     int ret = throttle_saved_share;
@@ -24,7 +90,7 @@ int ProportionalAllocationPolicy::maybeEndThrottling()
     
 }
 
-int ProportionalAllocationPolicy::maybeStartThrottling()
+int ProportionalAllocationPolicy::maybeStartThrottling(time_t now)
 {
     if (!throttle)
 	return -1;
@@ -35,7 +101,7 @@ int ProportionalAllocationPolicy::maybeStartThrottling()
 
     throttle_saved_share = share;
     is_throttling = true;
-    throttle_end = std::time(nullptr) + throttle_period;
+    throttle_end = now + throttle_period;
 
     // Caller must call setShare() on the new value.
     return throttle_share;
@@ -45,48 +111,152 @@ int ProportionalAllocationPolicy::maybeStartThrottling()
 bool ProportionalAllocationPolicy::update(const rapidjson::Value& obj,AppError **ae)
 {
     if (!obj.IsObject()) {
-	if (ae) {
-	    if (!*ae)
-		*ae = new AppError(400);
-	    (*ae)->add(std::string("request is not an object"));
-	}
-	return NULL;
+	policy_error(ae,"request is not an object");
+	return false;
     }
 
     if (!obj.HasMember("type")
 	|| !obj["type"].IsString()
 	|| strcmp(obj["type"].GetString(),getName()) != 0
 	|| !obj.HasMember("share")
-	|| !obj["share"].IsInt()
-	|| obj["share"].GetInt() < 0
-	|| obj["share"].GetInt() > 1024) {
-	if (ae) {
-	    if (!*ae)
-		*ae = new AppError(400);
-	    (*ae)->add(std::string("malformed allocation_policy property"));
-	}
-	return NULL;
+	|| !valid_int(obj,"share",0,1024)) {
+	policy_error(ae,"malformed allocation_policy property");
+	return false;
     }
 
     if ((obj.HasMember("auto_equalize")
 	 && !obj["auto_equalize"].IsBool())
 	|| (obj.HasMember("throttle")
-	    && !obj["throttle"].IsBool())) {
-	if (ae) {
-	    if (!*ae)
-		*ae = new AppError(400);
-	    (*ae)->add(std::string("malformed allocation_policy property"));
-	}
-	return NULL;
+	    && !obj["throttle"].IsBool())
+	|| !valid_int(obj,"throttle_threshold",INT_MIN,INT_MAX)
+	|| !valid_int(obj,"throttle_period",1,INT_MAX)
+	|| !valid_int(obj,"throttle_share",0,1024)) {
+	policy_error(ae,"malformed allocation_policy property");
+	return false;
     }
 
+    if (!validate_properties(obj,ae))
+	return false;
+
     share = obj["share"].GetInt();
     if (obj.HasMember("auto_equalize"))
 	auto_equalize = obj["auto_equalize"].GetBool();
     if (obj.HasMember("throttle"))
 	throttle = obj["throttle"].GetBool();
+    if (obj.HasMember("throttle_threshold"))
+	throttle_threshold = obj["throttle_threshold"].GetInt();
+    if (obj.HasMember("throttle_share"))
+	throttle_share = obj["throttle_share"].GetInt();
+    if (obj.HasMember("throttle_period")
+	&& obj["throttle_period"].GetInt() != throttle_period) {
+	throttle_period = obj["throttle_period"].GetInt();
+	metrics.reset(throttle_period);
+    }
+    update_properties(obj);
+
+    return true;
+}
+
+void ProportionalAllocationPolicy::serialize_properties(
+    rapidjson::Writer<rapidjson::StringBuffer>& writer)
+{
+    writer.String("share");
+    writer.Int(share);
+    writer.String("auto_equalize");
+    writer.Bool(auto_equalize);
+    writer.String("throttle");
+    writer.Bool(throttle);
+    writer.String("throttle_threshold");
+    writer.Int(throttle_threshold);
+    writer.String("throttle_period");
+    writer.Int(throttle_period);
+    writer.String("throttle_share");
+    writer.Int(throttle_share);
+}
+
+void WeightedFairAllocationPolicy::serialize_properties(
+    rapidjson::Writer<rapidjson::StringBuffer>& writer)
+{
+    ProportionalAllocationPolicy::serialize_properties(writer);
+    writer.String("weight");
+    writer.Int(weight);
+}
+
+bool WeightedFairAllocationPolicy::validate_properties(
+    const rapidjson::Value& obj,AppError **ae)
+{
+    if (!valid_int(obj,"weight",1,1024)) {
+	policy_error(ae,"malformed allocation_policy weight (1-1024)");
+	return false;
+    }
+    return true;
+}
+
+void WeightedFairAllocationPolicy::update_properties(const rapidjson::Value& obj)
+{
+    if (obj.HasMember("weight"))
+	weight = obj["weight"].GetInt();
+}
+
+void MinMaxGuaranteeAllocationPolicy::serialize_properties(
+    rapidjson::Writer<rapidjson::StringBuffer>& writer)
+{
+    ProportionalAllocationPolicy::serialize_properties(writer);
+    writer.String("min_share");
+    writer.Int(min_share);
+    writer.String("max_share");
+    writer.Int(max_share);
+}
+
+bool MinMaxGuaranteeAllocationPolicy::validate_properties(
+    const rapidjson::Value& obj,AppError **ae)
+{
+    if (!valid_int(obj,"min_share",0,1024)
+	|| !valid_int(obj,"max_share",0,1024)) {
+	policy_error(ae,"malformed allocation_policy min_share/max_share (0-1024)");
+	return false;
+    }
 
+    int new_min = obj.HasMember("min_share") ? obj["min_share"].GetInt() : min_share;
+    int new_max = obj.HasMember("max_share") ? obj["max_share"].GetInt() : max_share;
+    if (new_min > new_max) {
+	policy_error(ae,"allocation_policy min_share exceeds max_share");
+	return false;
+    }
     return true;
 }
 
+void MinMaxGuaranteeAllocationPolicy::update_properties(const rapidjson::Value& obj)
+{
+    if (obj.HasMember("min_share"))
+	min_share = obj["min_share"].GetInt();
+    if (obj.HasMember("max_share"))
+	max_share = obj["max_share"].GetInt();
+}
+
+void PrbTargetAllocationPolicy::serialize_properties(
+    rapidjson::Writer<rapidjson::StringBuffer>& writer)
+{
+    ProportionalAllocationPolicy::serialize_properties(writer);
+    writer.String("target_prb_pct");
+    writer.Int(target_prb_pct);
+}
+
+bool PrbTargetAllocationPolicy::validate_properties(
+    const rapidjson::Value& obj,AppError **ae)
+{
+    if (!valid_int(obj,"target_prb_pct",1,100)
+	|| (target_prb_pct < 0 && !obj.HasMember("target_prb_pct"))) {
+	policy_error(ae,"malformed or missing allocation_policy target_prb_pct (1-100)");
+	return false;
+    }
+    return true;
+}
+
+void PrbTargetAllocationPolicy::update_properties(const rapidjson::Value& obj)
+{
+    if (obj.HasMember("target_prb_pct"))
+	target_prb_pct = obj["target_prb_pct"].GetInt();
+}
+
 }
@@ -0,0 +1,191 @@
+
+#include "mdclog/mdclog.h"
+
+#include "nexran.h"
+
+namespace nexran {
+
+RequestGroup::~RequestGroup()
+{
+    for (auto it = requests.begin(); it != requests.end(); ++it)
+	delete it->second;
+}
+
+void RequestGroup::add(std::shared_ptr<e2ap::Request> req)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+
+    if (requests.count(req->instance_id) > 0)
+	return;
+    requests[req->instance_id] = new RequestStatus(req);
+    ++outstanding;
+}
+
+void RequestGroup::add_unsent(const std::string& meid)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+
+    unsent.push_back(meid);
+    ++failed;
+}
+
+bool RequestGroup::update(long instance_id,RequestState state)
+{
+    if (state == PENDING)
+	return false;
+
+    {
+	const std::lock_guard<std::mutex> lock(mutex);
+
+	auto it = requests.find(instance_id);
+	if (it == requests.end() || it->second->state != PENDING)
+	    return false;
+	it->second->state = state;
+    }
+
+    if (state == SUCCESS)
+	++succeeded;
+    else
+	++failed;
+    if (--outstanding == 0)
+	return finish();
+    return false;
+}
+
+bool RequestGroup::seal()
+{
+    if (--outstanding == 0)
+	return finish();
+    return false;
+}
+
+bool RequestGroup::finish()
+{
+    if (done.exchange(true))
+	return false;
+    respond();
+    return true;
+}
+
+bool RequestGroup::cancel()
+{
+    if (done.exchange(true))
+	return false;
+    respond(true);
+    return true;
+}
+
+bool RequestGroup::is_done(int *succeeded_,int *failed_,int *pending_)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    bool ret = true;
+
+    for (auto it = requests.begin(); it != requests.end(); ++it) {
+	switch (it->second->state) {
+	case PENDING:
+	    if (pending_)
+		++*pending_;
+	    ret = false;
+	    break;
+	case SUCCESS:
+	    if (succeeded_)
+		++*succeeded_;
+	    break;
+	case FAILURE:
+	    if (failed_)
+		++*failed_;
+	    break;
+	default:
+	    break;
+	}
+    }
+    return ret;
+}
+
+void RequestGroup::get_pending(std::list<long>& instance_ids)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto it = requests.begin(); it != requests.end(); ++it)
+	if (it->second->state == PENDING)
+	    instance_ids.push_back(it->first);
+}
+
+static const char *request_state_to_string(RequestGroup::RequestState state)
+{
+    switch (state) {
+    case RequestGroup::PENDING:
+	return "pending";
+    case RequestGroup::SUCCESS:
+	return "success";
+    case RequestGroup::FAILURE:
+	return "failure";
+    default:
+	return "unknown";
+    }
+}
+
+/*
+ * Responds with the caller's code if every request succeeded, 502 if
+ * any failed, or 504 if any are still pending (503 if cancelled).  The body has the
+ * members the request would have returned without waiting (e.g., the
+ * new resource, or bulk counts), then each NodeB's outcome.
+ */
+void RequestGroup::respond(bool cancelled)
+{
+    rapidjson::Writer<rapidjson::StringBuffer>& writer = ctx->get_writer();
+    const std::lock_guard<std::mutex> lock(mutex);
+    int npending = 0;
+
+    writer.StartObject();
+    if (!ctx->get_body().empty()) {
+	rapidjson::Document d;
+	d.Parse(ctx->get_body().c_str());
+	if (d.IsObject()) {
+	    for (auto it = d.MemberBegin(); it != d.MemberEnd(); ++it) {
+		writer.String(it->name.GetString());
+		it->value.Accept(writer);
+	    }
+	}
+    }
+    writer.String("outcomes");
+    writer.StartArray();
+    for (auto it = requests.begin(); it != requests.end(); ++it) {
+	if (it->second->state == PENDING)
+	    ++npending;
+	writer.StartObject();
+	writer.String("nodeb");
+	writer.String(it->second->req->meid.c_str());
+	writer.String("instance_id");
+	writer.Int64(it->first);
+	writer.String("status");
+	writer.String(request_state_to_string(it->second->state));
+	writer.EndObject();
+    }
+    for (auto it = unsent.begin(); it != unsent.end(); ++it) {
+	writer.StartObject();
+	writer.String("nodeb");
+	writer.String(it->c_str());
+	writer.String("status");
+	writer.String("unsent");
+	writer.EndObject();
+    }
+    writer.EndArray();
+    writer.String("succeeded");
+    writer.Int(succeeded);
+    writer.String("failed");
+    writer.Int(failed);
+    writer.String("pending");
+    writer.Int(npending);
+    writer.EndObject();
+
+    if (cancelled)
+	ctx->set_code(static_cast<Pistache::Http::Code>(503));
+    else if (npending)
+	ctx->set_code(static_cast<Pistache::Http::Code>(504));
+    else if (failed)
+	ctx->set_code(static_cast<Pistache::Http::Code>(502));
+    ctx->send();
+}
+
+}
@@ -6,17 +6,20 @@
 #include "version.h"
 #include "restserver.h"
 
-#define HANDLE_APP_ERROR(ae,default_code)				\
+#define HANDLE_APP_ERROR_TO(rw,ae,default_code)			\
     do {								\
         if (ae) {							\
 	    ae->serialize(writer);				\
-	    response.send((Pistache::Http::Code)ae->http_status,	\
-			  sb.GetString());				\
+	    rw.send((Pistache::Http::Code)ae->http_status,		\
+		    sb.GetString());					\
 	}								\
 	else								\
-	    response.send(default_code);				\
+	    rw.send(default_code);					\
     } while (0);
 
+#define HANDLE_APP_ERROR(ae,default_code)				\
+    HANDLE_APP_ERROR_TO(response,ae,default_code)
+
 namespace nexran {
 
 #define VERSION_PREFIX "/v1/"
@@ -27,6 +30,30 @@ void RestServer::setupRoutes()
 	router,VERSION_PREFIX "/version",
 	Pistache::Rest::Routes::bind(&RestServer::getVersion,this));
 
+    Pistache::Rest::Routes::Get(
+	router,VERSION_PREFIX "/stats",
+	Pistache::Rest::Routes::bind(&RestServer::getStats,this));
+
+    Pistache::Rest::Routes::Get(
+	router,VERSION_PREFIX "/events",
+	Pistache::Rest::Routes::bind(&RestServer::getEvents,this));
+
+    Pistache::Rest::Routes::Get(
+	router,VERSION_PREFIX "/traces",
+	Pistache::Rest::Routes::bind(&RestServer::getTraces,this));
+
+    Pistache::Rest::Routes::Get(
+	router,VERSION_PREFIX "/pdutrace",
+	Pistache::Rest::Routes::bind(&RestServer::getPduTrace,this));
+    Pistache::Rest::Routes::Put(
+	router,VERSION_PREFIX "/pdutrace",
+	Pistache::Rest::Routes::bind(&RestServer::putPduTrace,this));
+
+    /* Unversioned, where Prometheus looks by default. */
+    Pistache::Rest::Routes::Get(
+	router,"/metrics",
+	Pistache::Rest::Routes::bind(&RestServer::getMetrics,this));
+
     Pistache::Rest::Routes::Get(
 	router,VERSION_PREFIX "/nodebs/:name",
 	Pistache::Rest::Routes::bind(&RestServer::getNodeB,this));
@@ -76,6 +103,9 @@ void RestServer::setupRoutes()
     Pistache::Rest::Routes::Get(
 	router,VERSION_PREFIX "/ues/:imsi",
 	Pistache::Rest::Routes::bind(&RestServer::getUe,this));
+    Pistache::Rest::Routes::Get(
+	router,VERSION_PREFIX "/ues/:imsi/metrics",
+	Pistache::Rest::Routes::bind(&RestServer::getUeMetrics,this));
     Pistache::Rest::Routes::Get(
 	router,VERSION_PREFIX "/ues",
 	Pistache::Rest::Routes::bind(&RestServer::getUes,this));
@@ -88,6 +118,10 @@ void RestServer::setupRoutes()
     Pistache::Rest::Routes::Delete(
 	router,VERSION_PREFIX "/ues/:imsi",
 	Pistache::Rest::Routes::bind(&RestServer::deleteUe,this));
+
+    Pistache::Rest::Routes::Post(
+	router,VERSION_PREFIX "/bulk",
+	Pistache::Rest::Routes::bind(&RestServer::postBulk,this));
 }
 
 void RestServer::init(App *app_)
@@ -99,6 +133,10 @@ void RestServer::init(App *app_)
 	port);
 
     app = app_;
+    /* Distinguish our ETags from those of a previous instance. */
+    char buf[32];
+    snprintf(buf,sizeof(buf),"%lx",(unsigned long)time(NULL));
+    etag_prefix = std::string(buf);
 
     setupRoutes();
     auto options = Pistache::Http::Endpoint::options().logger(
@@ -152,6 +190,177 @@ std::string RestServer::buildVersionJson()
     return sb.GetString();
 }
 
+/*
+ * Mutating requests with ?wait=ack respond only once the NodeBs have
+ * answered the E2 requests they caused.  If the caller asked to wait,
+ * this moves response into a new RequestGroup, which will respond with
+ * code if all those requests succeed.
+ */
+std::shared_ptr<RequestGroup> RestServer::wait_group(
+    const Pistache::Rest::Request &request,
+    Pistache::Http::ResponseWriter& response,
+    Pistache::Http::Code code)
+{
+    const Pistache::Http::Uri::Query& query = request.query();
+
+    for (auto it = query.parameters_begin(); it != query.parameters_end(); ++it) {
+	if (it->first != "wait" || it->second != "ack")
+	    continue;
+
+	std::shared_ptr<RequestContext> ctx = \
+	    std::make_shared<RequestContext>(request,response);
+	ctx->make_async();
+	ctx->set_code(code);
+	return std::make_shared<RequestGroup>(ctx,app->get_group_timeout());
+    }
+
+    return NULL;
+}
+
+static bool etag_matches(const std::string& header,const std::string& etag)
+{
+    size_t pos = 0;
+
+    while (pos < header.size()) {
+	size_t end = header.find(',',pos);
+	if (end == std::string::npos)
+	    end = header.size();
+	size_t b = header.find_first_not_of(" \t",pos);
+	size_t e = header.find_last_not_of(" \t",end - 1);
+	if (b != std::string::npos && b < end && e >= b) {
+	    std::string tag = header.substr(b,e - b + 1);
+	    if (tag.compare(0,2,"W/") == 0)
+		tag = tag.substr(2);
+	    if (tag == "*" || tag == etag)
+		return true;
+	}
+	pos = end + 1;
+    }
+    return false;
+}
+
+/*
+ * Tags the response with an ETag for version (a DbSnapshot version), and
+ * if the request's If-None-Match names it, responds 304 instead.
+ */
+bool RestServer::not_modified(
+    const Pistache::Rest::Request &request,
+    Pistache::Http::ResponseWriter& response,
+    uint64_t version)
+{
+    std::string etag = std::string("\"") + etag_prefix + "-"
+	+ std::to_string(version) + "\"";
+
+    response.headers().addRaw(Pistache::Http::Header::Raw("ETag",etag));
+
+    auto& raw = request.headers().rawList();
+    auto it = raw.find("If-None-Match");
+    if (it == raw.end() || !etag_matches(it->second.value(),etag))
+	return false;
+
+    response.send(Pistache::Http::Code::Not_Modified);
+    return true;
+}
+
+static bool parse_collection_query(
+    const Pistache::Rest::Request &request,
+    App::ResourceType rt,
+    CollectionQuery& cq,
+    AppError **ae)
+{
+    const Pistache::Http::Uri::Query& query = request.query();
+
+    for (auto it = query.parameters_begin(); it != query.parameters_end(); ++it) {
+	const std::string& value = it->second;
+
+	if (it->first == "limit") {
+	    char *end = NULL;
+	    long l = strtol(value.c_str(),&end,10);
+	    if (value.empty() || *end != '\0' || l < 1 || l > INT32_MAX) {
+		*ae = new AppError(400,"limit must be a positive integer");
+		return false;
+	    }
+	    cq.limit = (int)l;
+	}
+	else if (it->first == "cursor")
+	    cq.cursor = value;
+	else if (it->first == "slice") {
+	    if (rt == App::ResourceType::SliceResource) {
+		*ae = new AppError(400,"slice filter does not apply to slices");
+		return false;
+	    }
+	    cq.slice = value;
+	}
+	else if (it->first == "nodeb") {
+	    if (rt != App::ResourceType::SliceResource) {
+		*ae = new AppError(400,"nodeb filter applies only to slices");
+		return false;
+	    }
+	    cq.nodeb = value;
+	}
+	else if (it->first == "bound") {
+	    if (rt != App::ResourceType::UeResource) {
+		*ae = new AppError(400,"bound filter applies only to ues");
+		return false;
+	    }
+	    if (value == "true")
+		cq.bound = 1;
+	    else if (value == "false")
+		cq.bound = 0;
+	    else {
+		*ae = new AppError(400,"bound must be true or false");
+		return false;
+	    }
+	}
+	else if (it->first == "fields") {
+	    size_t pos = 0;
+	    while (pos <= value.size()) {
+		size_t end = value.find(',',pos);
+		if (end == std::string::npos)
+		    end = value.size();
+		if (end > pos)
+		    cq.fields.insert(value.substr(pos,end - pos));
+		pos = end + 1;
+	    }
+	    if (cq.fields.empty()) {
+		*ae = new AppError(400,"fields must name at least one field");
+		return false;
+	    }
+	}
+    }
+
+    return true;
+}
+
+/*
+ * Serves a collection GET from the current snapshot.  A filtered or
+ * paged listing can change when other types change (e.g. a UE is bound
+ * to a slice), so its ETag uses the snapshot's overall version.
+ */
+void RestServer::getCollection(
+    const Pistache::Rest::Request &request,
+    Pistache::Http::ResponseWriter& response,
+    int rt)
+{
+    rapidjson::StringBuffer sb;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+    AppError *ae = NULL;
+    CollectionQuery query;
+    App::ResourceType type = (App::ResourceType)rt;
+
+    if (!parse_collection_query(request,type,query,&ae)) {
+	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Bad_Request);
+	return;
+    }
+
+    std::shared_ptr<const DbSnapshot> snap = app->get_snapshot();
+    if (not_modified(request,response,
+		     query.is_empty() ? snap->versions[type] : snap->version))
+	return;
+    app->serialize(snap,type,query,writer);
+    response.send(Pistache::Http::Code::Ok,sb.GetString());
+}
+
 void RestServer::getVersion(
     const Pistache::Rest::Request &request,
     Pistache::Http::ResponseWriter response)
@@ -160,17 +369,164 @@ void RestServer::getVersion(
         Pistache::Http::Code::Ok,versionJson.c_str());
 }
 
-void RestServer::getNodeBs(
+void RestServer::getStats(
+    const Pistache::Rest::Request &request,
+    Pistache::Http::ResponseWriter response)
+{
+    rapidjson::StringBuffer sb;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+
+    app->serialize_stats(writer);
+    response.send(Pistache::Http::Code::Ok,sb.GetString());
+}
+
+void RestServer::getMetrics(
+    const Pistache::Rest::Request &request,
+    Pistache::Http::ResponseWriter response)
+{
+    std::string out;
+
+    e2ap::metrics().write_prometheus(out);
+    response.headers().addRaw(
+	Pistache::Http::Header::Raw("Content-Type","text/plain; version=0.0.4"));
+    response.send(Pistache::Http::Code::Ok,out);
+}
+
+void RestServer::getTraces(
+    const Pistache::Rest::Request &request,
+    Pistache::Http::ResponseWriter response)
+{
+    rapidjson::StringBuffer sb;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+    AppError *ae = NULL;
+    uint64_t trace_id = 0;
+    const Pistache::Http::Uri::Query& query = request.query();
+
+    for (auto it = query.parameters_begin(); it != query.parameters_end(); ++it) {
+	const std::string& value = it->second;
+	char *end = NULL;
+
+	if (it->first != "trace_id")
+	    continue;
+	trace_id = strtoull(value.c_str(),&end,10);
+	if (value.empty() || *end != '\0' || value[0] == '-' || trace_id == 0
+	    || trace_id == UINT64_MAX) {
+	    ae = new AppError(400,"trace_id must be a positive integer");
+	    HANDLE_APP_ERROR(ae,Pistache::Http::Code::Bad_Request);
+	    return;
+	}
+    }
+
+    app->serialize_traces(writer,trace_id);
+    response.send(Pistache::Http::Code::Ok,sb.GetString());
+}
+
+void RestServer::getPduTrace(
+    const Pistache::Rest::Request &request,
+    Pistache::Http::ResponseWriter response)
+{
+    rapidjson::StringBuffer sb;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+
+    app->serialize_pdu_trace(writer);
+    response.send(Pistache::Http::Code::Ok,sb.GetString());
+}
+
+void RestServer::putPduTrace(
     const Pistache::Rest::Request &request,
     Pistache::Http::ResponseWriter response)
 {
     rapidjson::StringBuffer sb;
     rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+    AppError *ae = NULL;
+    rapidjson::Document d;
 
-    app->serialize(App::ResourceType::NodeBResource,writer);
+    d.Parse(request.body().c_str());
+    if (!app->update_pdu_trace(d,&ae)) {
+	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Bad_Request);
+	return;
+    }
+
+    app->serialize_pdu_trace(writer);
     response.send(Pistache::Http::Code::Ok,sb.GetString());
 }
 
+/*
+ * An event stream subscriber that writes frames to a client's open
+ * text/event-stream response.
+ */
+class SseSubscriber : public EventSubscriber {
+ public:
+    SseSubscriber(Pistache::Http::ResponseStream&& stream_)
+	: stream(std::move(stream_)) {};
+    virtual ~SseSubscriber() = default;
+
+    virtual bool write(const std::string& frames)
+    {
+	try {
+	    stream << frames.c_str();
+	    stream.flush();
+	}
+	catch (std::exception& e) {
+	    return false;
+	}
+	return true;
+    };
+    virtual void close()
+    {
+	try {
+	    stream.ends();
+	}
+	catch (std::exception& e) {
+	}
+    };
+
+ private:
+    Pistache::Http::ResponseStream stream;
+};
+
+void RestServer::getEvents(
+    const Pistache::Rest::Request &request,
+    Pistache::Http::ResponseWriter response)
+{
+    rapidjson::StringBuffer sb;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+    AppError *ae = NULL;
+    unsigned types = EventStream::ALL_EVENTS;
+    const Pistache::Http::Uri::Query& query = request.query();
+
+    for (auto it = query.parameters_begin(); it != query.parameters_end(); ++it) {
+	if (it->first != "types")
+	    continue;
+	if (!EventStream::types_from_string(it->second,&types)) {
+	    ae = new AppError(400,"types must be a comma-separated list of kpm, share");
+	    HANDLE_APP_ERROR(ae,Pistache::Http::Code::Bad_Request);
+	    return;
+	}
+    }
+
+    if (!app->get_events().accepting()) {
+	ae = new AppError(503,"event stream disabled or at its subscriber limit");
+	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Service_Unavailable);
+	return;
+    }
+
+    response.headers().addRaw(
+	Pistache::Http::Header::Raw("Content-Type","text/event-stream"));
+    response.headers().addRaw(
+	Pistache::Http::Header::Raw("Cache-Control","no-cache"));
+    if (!app->get_events().subscribe(
+	    new SseSubscriber(response.stream(Pistache::Http::Code::Ok)),types))
+	mdclog_write(MDCLOG_WARN,"refused event subscriber (subscriber limit reached)");
+}
+
+void RestServer::getNodeBs(
+    const Pistache::Rest::Request &request,
+    Pistache::Http::ResponseWriter response)
+{
+    getCollection(request,response,App::ResourceType::NodeBResource);
+}
+
 void RestServer::postNodeB(
     const Pistache::Rest::Request &request,
     Pistache::Http::ResponseWriter response)
@@ -179,21 +535,30 @@ void RestServer::postNodeB(
     rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
     AppError *ae = NULL;
     rapidjson::Document d;
+    std::shared_ptr<RequestGroup> group = \
+	wait_group(request,response,Pistache::Http::Code::Created);
+    Pistache::Http::ResponseWriter& rw = \
+	group ? group->get_ctx()->get_response() : response;
 
     d.Parse(request.body().c_str());
 
     NodeB *nb = NodeB::create(d,&ae);
     if (!nb) {
-	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Bad_Request);
+	HANDLE_APP_ERROR_TO(rw,ae,Pistache::Http::Code::Bad_Request);
 	return;
     }
-    if (!app->add(App::ResourceType::NodeBResource,nb,writer,&ae)) {
-	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Bad_Request);
+    if (!app->add(App::ResourceType::NodeBResource,nb,writer,&ae,group)) {
+	HANDLE_APP_ERROR_TO(rw,ae,Pistache::Http::Code::Bad_Request);
 	delete nb;
 	return;
     }
 
-    response.send(Pistache::Http::Code::Created,sb.GetString());
+    if (group) {
+	group->get_ctx()->set_body(sb.GetString());
+	app->start_group(group);
+    }
+    else
+	response.send(Pistache::Http::Code::Created,sb.GetString());
 }
 
 void RestServer::postNodeBSliceBinding(
@@ -205,13 +570,20 @@ void RestServer::postNodeBSliceBinding(
     AppError *ae = NULL;
     auto nodeb_name = request.param(":nodeb_name").as<std::string>();
     auto slice_name = request.param(":slice_name").as<std::string>();
+    std::shared_ptr<RequestGroup> group = \
+	wait_group(request,response,Pistache::Http::Code::Ok);
+    Pistache::Http::ResponseWriter& rw = \
+	group ? group->get_ctx()->get_response() : response;
 
-    if (!app->bind_slice_nodeb(slice_name,nodeb_name,&ae)) {
-	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Bad_Request);
+    if (!app->bind_slice_nodeb(slice_name,nodeb_name,&ae,group)) {
+	HANDLE_APP_ERROR_TO(rw,ae,Pistache::Http::Code::Bad_Request);
 	return;
     }
 
-    response.send(Pistache::Http::Code::Ok);
+    if (group)
+	app->start_group(group);
+    else
+	response.send(Pistache::Http::Code::Ok);
 }
 
 void RestServer::deleteNodeBSliceBinding(
@@ -223,13 +595,20 @@ void RestServer::deleteNodeBSliceBinding(
     AppError *ae = NULL;
     auto nodeb_name = request.param(":nodeb_name").as<std::string>();
     auto slice_name = request.param(":slice_name").as<std::string>();
+    std::shared_ptr<RequestGroup> group = \
+	wait_group(request,response,Pistache::Http::Code::Ok);
+    Pistache::Http::ResponseWriter& rw = \
+	group ? group->get_ctx()->get_response() : response;
 
-    if (!app->unbind_slice_nodeb(slice_name,nodeb_name,&ae)) {
-	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Bad_Request);
+    if (!app->unbind_slice_nodeb(slice_name,nodeb_name,&ae,group)) {
+	HANDLE_APP_ERROR_TO(rw,ae,Pistache::Http::Code::Bad_Request);
 	return;
     }
 
-    response.send(Pistache::Http::Code::Ok);
+    if (group)
+	app->start_group(group);
+    else
+	response.send(Pistache::Http::Code::Ok);
 }
 
 void RestServer::postSliceUeBinding(
@@ -241,13 +620,20 @@ void RestServer::postSliceUeBinding(
     AppError *ae = NULL;
     auto slice_name = request.param(":slice_name").as<std::string>();
     auto imsi = request.param(":imsi").as<std::string>();
+    std::shared_ptr<RequestGroup> group = \
+	wait_group(request,response,Pistache::Http::Code::Ok);
+    Pistache::Http::ResponseWriter& rw = \
+	group ? group->get_ctx()->get_response() : response;
 
-    if (!app->bind_ue_slice(imsi,slice_name,&ae)) {
-	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Bad_Request);
+    if (!app->bind_ue_slice(imsi,slice_name,&ae,group)) {
+	HANDLE_APP_ERROR_TO(rw,ae,Pistache::Http::Code::Bad_Request);
 	return;
     }
 
-    response.send(Pistache::Http::Code::Ok);
+    if (group)
+	app->start_group(group);
+    else
+	response.send(Pistache::Http::Code::Ok);
 }
 
 void RestServer::deleteSliceUeBinding(
@@ -259,13 +645,20 @@ void RestServer::deleteSliceUeBinding(
     AppError *ae = NULL;
     auto slice_name = request.param(":slice_name").as<std::string>();
     auto imsi = request.param(":imsi").as<std::string>();
+    std::shared_ptr<RequestGroup> group = \
+	wait_group(request,response,Pistache::Http::Code::Ok);
+    Pistache::Http::ResponseWriter& rw = \
+	group ? group->get_ctx()->get_response() : response;
 
-    if (!app->unbind_ue_slice(imsi,slice_name,&ae)) {
-	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Bad_Request);
+    if (!app->unbind_ue_slice(imsi,slice_name,&ae,group)) {
+	HANDLE_APP_ERROR_TO(rw,ae,Pistache::Http::Code::Bad_Request);
 	return;
     }
 
-    response.send(Pistache::Http::Code::Ok);
+    if (group)
+	app->start_group(group);
+    else
+	response.send(Pistache::Http::Code::Ok);
 }
 
 void RestServer::putNodeB(
@@ -277,21 +670,22 @@ void RestServer::putNodeB(
     AppError *ae = NULL;
     auto name = request.param(":name").as<std::string>();
     rapidjson::Document d;
+    std::shared_ptr<RequestGroup> group = \
+	wait_group(request,response,Pistache::Http::Code::Ok);
+    Pistache::Http::ResponseWriter& rw = \
+	group ? group->get_ctx()->get_response() : response;
 
     d.Parse(request.body().c_str());
 
-    if (!app->update(App::ResourceType::NodeBResource,name,d,&ae)) {
-	if (ae) {
-	    ae->serialize(writer);
-	    response.send(static_cast<Pistache::Http::Code>(ae->http_status),
-			  sb.GetString());
-	}
-	else
-	    response.send(Pistache::Http::Code::Bad_Request);
+    if (!app->update(App::ResourceType::NodeBResource,name,d,&ae,group)) {
+	HANDLE_APP_ERROR_TO(rw,ae,Pistache::Http::Code::Bad_Request);
 	return;
     }
 
-    response.send(Pistache::Http::Code::Ok);
+    if (group)
+	app->start_group(group);
+    else
+	response.send(Pistache::Http::Code::Ok);
 }
 
 void RestServer::deleteNodeB(
@@ -302,13 +696,20 @@ void RestServer::deleteNodeB(
     rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
     auto name = request.param(":name").as<std::string>();
     AppError *ae = NULL;
+    std::shared_ptr<RequestGroup> group = \
+	wait_group(request,response,Pistache::Http::Code::Ok);
+    Pistache::Http::ResponseWriter& rw = \
+	group ? group->get_ctx()->get_response() : response;
 
-    if (!app->del(App::ResourceType::NodeBResource,name,&ae)) {
-	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Internal_Server_Error);
+    if (!app->del(App::ResourceType::NodeBResource,name,&ae,group)) {
+	HANDLE_APP_ERROR_TO(rw,ae,Pistache::Http::Code::Internal_Server_Error);
 	return;
     }
 
-    response.send(Pistache::Http::Code::Ok);
+    if (group)
+	app->start_group(group);
+    else
+	response.send(Pistache::Http::Code::Ok);
 }
 
 void RestServer::getNodeB(
@@ -319,8 +720,13 @@ void RestServer::getNodeB(
     rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
     auto name = request.param(":name").as<std::string>();
     AppError *ae = NULL;
+    std::shared_ptr<const DbSnapshot> snap = app->get_snapshot();
+    const DbSnapshot::Fragment *fragment = \
+	snap->find(App::ResourceType::NodeBResource,name);
 
-    if (!app->serialize(App::ResourceType::NodeBResource,name,writer,&ae)) {
+    if (fragment && not_modified(request,response,fragment->version))
+	return;
+    if (!app->serialize(snap,App::ResourceType::NodeBResource,name,writer,&ae)) {
 	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Internal_Server_Error);
 	return;
     }
@@ -332,11 +738,7 @@ void RestServer::getSlices(
     const Pistache::Rest::Request &request,
     Pistache::Http::ResponseWriter response)
 {
-    rapidjson::StringBuffer sb;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
-
-    app->serialize(App::ResourceType::SliceResource,writer);
-    response.send(Pistache::Http::Code::Ok,sb.GetString());
+    getCollection(request,response,App::ResourceType::SliceResource);
 }
 
 void RestServer::postSlice(
@@ -347,20 +749,29 @@ void RestServer::postSlice(
     rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
     AppError *ae = NULL;
     rapidjson::Document d;
+    std::shared_ptr<RequestGroup> group = \
+	wait_group(request,response,Pistache::Http::Code::Created);
+    Pistache::Http::ResponseWriter& rw = \
+	group ? group->get_ctx()->get_response() : response;
 
     d.Parse(request.body().c_str());
 
     Slice *slice = Slice::create(d,&ae);
     if (!slice) {
-	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Bad_Request);
+	HANDLE_APP_ERROR_TO(rw,ae,Pistache::Http::Code::Bad_Request);
 	return;
     }
-    if (!app->add(App::ResourceType::SliceResource,slice,writer,&ae)) {
-	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Bad_Request);
+    if (!app->add(App::ResourceType::SliceResource,slice,writer,&ae,group)) {
+	HANDLE_APP_ERROR_TO(rw,ae,Pistache::Http::Code::Bad_Request);
 	return;
     }
 
-    response.send(Pistache::Http::Code::Created,sb.GetString());
+    if (group) {
+	group->get_ctx()->set_body(sb.GetString());
+	app->start_group(group);
+    }
+    else
+	response.send(Pistache::Http::Code::Created,sb.GetString());
 }
 
 void RestServer::putSlice(
@@ -372,21 +783,22 @@ void RestServer::putSlice(
     AppError *ae = NULL;
     auto name = request.param(":name").as<std::string>();
     rapidjson::Document d;
+    std::shared_ptr<RequestGroup> group = \
+	wait_group(request,response,Pistache::Http::Code::Ok);
+    Pistache::Http::ResponseWriter& rw = \
+	group ? group->get_ctx()->get_response() : response;
 
     d.Parse(request.body().c_str());
 
-    if (!app->update(App::ResourceType::SliceResource,name,d,&ae)) {
-	if (ae) {
-	    ae->serialize(writer);
-	    response.send(static_cast<Pistache::Http::Code>(ae->http_status),
-			  sb.GetString());
-	}
-	else
-	    response.send(Pistache::Http::Code::Bad_Request);
+    if (!app->update(App::ResourceType::SliceResource,name,d,&ae,group)) {
+	HANDLE_APP_ERROR_TO(rw,ae,Pistache::Http::Code::Bad_Request);
 	return;
     }
 
-    response.send(Pistache::Http::Code::Ok);
+    if (group)
+	app->start_group(group);
+    else
+	response.send(Pistache::Http::Code::Ok);
 }
 
 void RestServer::getSlice(
@@ -397,8 +809,13 @@ void RestServer::getSlice(
     rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
     AppError *ae = NULL;
     auto name = request.param(":name").as<std::string>();
+    std::shared_ptr<const DbSnapshot> snap = app->get_snapshot();
+    const DbSnapshot::Fragment *fragment = \
+	snap->find(App::ResourceType::SliceResource,name);
 
-    if (!app->serialize(App::ResourceType::SliceResource,name,writer,&ae)) {
+    if (fragment && not_modified(request,response,fragment->version))
+	return;
+    if (!app->serialize(snap,App::ResourceType::SliceResource,name,writer,&ae)) {
 	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Internal_Server_Error);
 	return;
     }
@@ -414,24 +831,27 @@ void RestServer::deleteSlice(
     rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
     auto name = request.param(":name").as<std::string>();
     AppError *ae = NULL;
+    std::shared_ptr<RequestGroup> group = \
+	wait_group(request,response,Pistache::Http::Code::Ok);
+    Pistache::Http::ResponseWriter& rw = \
+	group ? group->get_ctx()->get_response() : response;
 
-    if (!app->del(App::ResourceType::SliceResource,name,&ae)) {
-	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Internal_Server_Error);
+    if (!app->del(App::ResourceType::SliceResource,name,&ae,group)) {
+	HANDLE_APP_ERROR_TO(rw,ae,Pistache::Http::Code::Internal_Server_Error);
 	return;
     }
 
-    response.send(Pistache::Http::Code::Ok);
+    if (group)
+	app->start_group(group);
+    else
+	response.send(Pistache::Http::Code::Ok);
 }
 
 void RestServer::getUes(
     const Pistache::Rest::Request &request,
     Pistache::Http::ResponseWriter response)
 {
-    rapidjson::StringBuffer sb;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
-
-    app->serialize(App::ResourceType::UeResource,writer);
-    response.send(Pistache::Http::Code::Ok,sb.GetString());
+    getCollection(request,response,App::ResourceType::UeResource);
 }
 
 void RestServer::postUe(
@@ -442,20 +862,29 @@ void RestServer::postUe(
     rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
     AppError *ae = NULL;
     rapidjson::Document d;
+    std::shared_ptr<RequestGroup> group = \
+	wait_group(request,response,Pistache::Http::Code::Created);
+    Pistache::Http::ResponseWriter& rw = \
+	group ? group->get_ctx()->get_response() : response;
 
     d.Parse(request.body().c_str());
 
     Ue *ue = Ue::create(d,&ae);
     if (!ue) {
-	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Bad_Request);
+	HANDLE_APP_ERROR_TO(rw,ae,Pistache::Http::Code::Bad_Request);
 	return;
     }
-    if (!app->add(App::ResourceType::UeResource,ue,writer,&ae)) {
-	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Bad_Request);
+    if (!app->add(App::ResourceType::UeResource,ue,writer,&ae,group)) {
+	HANDLE_APP_ERROR_TO(rw,ae,Pistache::Http::Code::Bad_Request);
 	return;
     }
 
-    response.send(Pistache::Http::Code::Created,sb.GetString());
+    if (group) {
+	group->get_ctx()->set_body(sb.GetString());
+	app->start_group(group);
+    }
+    else
+	response.send(Pistache::Http::Code::Created,sb.GetString());
 }
 
 void RestServer::putUe(
@@ -467,21 +896,22 @@ void RestServer::putUe(
     AppError *ae = NULL;
     auto imsi = request.param(":imsi").as<std::string>();
     rapidjson::Document d;
+    std::shared_ptr<RequestGroup> group = \
+	wait_group(request,response,Pistache::Http::Code::Ok);
+    Pistache::Http::ResponseWriter& rw = \
+	group ? group->get_ctx()->get_response() : response;
 
     d.Parse(request.body().c_str());
 
-    if (!app->update(App::ResourceType::UeResource,imsi,d,&ae)) {
-	if (ae) {
-	    ae->serialize(writer);
-	    response.send(static_cast<Pistache::Http::Code>(ae->http_status),
-			  sb.GetString());
-	}
-	else
-	    response.send(Pistache::Http::Code::Bad_Request);
+    if (!app->update(App::ResourceType::UeResource,imsi,d,&ae,group)) {
+	HANDLE_APP_ERROR_TO(rw,ae,Pistache::Http::Code::Bad_Request);
 	return;
     }
 
-    response.send(Pistache::Http::Code::Ok);
+    if (group)
+	app->start_group(group);
+    else
+	response.send(Pistache::Http::Code::Ok);
 }
 
 void RestServer::getUe(
@@ -492,8 +922,13 @@ void RestServer::getUe(
     rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
     AppError *ae = NULL;
     auto imsi = request.param(":imsi").as<std::string>();
+    std::shared_ptr<const DbSnapshot> snap = app->get_snapshot();
+    const DbSnapshot::Fragment *fragment = \
+	snap->find(App::ResourceType::UeResource,imsi);
 
-    if (!app->serialize(App::ResourceType::UeResource,imsi,writer,&ae)) {
+    if (fragment && not_modified(request,response,fragment->version))
+	return;
+    if (!app->serialize(snap,App::ResourceType::UeResource,imsi,writer,&ae)) {
 	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Internal_Server_Error);
 	return;
     }
@@ -501,6 +936,39 @@ void RestServer::getUe(
     response.send(Pistache::Http::Code::Ok,sb.GetString());
 }
 
+void RestServer::getUeMetrics(
+    const Pistache::Rest::Request &request,
+    Pistache::Http::ResponseWriter response)
+{
+    rapidjson::StringBuffer sb;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+    AppError *ae = NULL;
+    auto imsi = request.param(":imsi").as<std::string>();
+    long limit = 0;
+    const Pistache::Http::Uri::Query& query = request.query();
+
+    for (auto it = query.parameters_begin(); it != query.parameters_end(); ++it) {
+	const std::string& value = it->second;
+	char *end = NULL;
+
+	if (it->first != "limit")
+	    continue;
+	limit = strtol(value.c_str(),&end,10);
+	if (value.empty() || *end != '\0' || limit < 1) {
+	    ae = new AppError(400,"limit must be a positive integer");
+	    HANDLE_APP_ERROR(ae,Pistache::Http::Code::Bad_Request);
+	    return;
+	}
+    }
+
+    if (!app->serialize_ue_metrics(imsi,limit,writer,&ae)) {
+	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Not_Found);
+	return;
+    }
+
+    response.send(Pistache::Http::Code::Ok,sb.GetString());
+}
+
 void RestServer::deleteUe(
     const Pistache::Rest::Request &request,
     Pistache::Http::ResponseWriter response)
@@ -509,13 +977,48 @@ void RestServer::deleteUe(
     rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
     auto imsi = request.param(":imsi").as<std::string>();
     AppError *ae = NULL;
+    std::shared_ptr<RequestGroup> group = \
+	wait_group(request,response,Pistache::Http::Code::Ok);
+    Pistache::Http::ResponseWriter& rw = \
+	group ? group->get_ctx()->get_response() : response;
 
-    if (!app->del(App::ResourceType::UeResource,imsi,&ae)) {
-	HANDLE_APP_ERROR(ae,Pistache::Http::Code::Internal_Server_Error);
+    if (!app->del(App::ResourceType::UeResource,imsi,&ae,group)) {
+	HANDLE_APP_ERROR_TO(rw,ae,Pistache::Http::Code::Internal_Server_Error);
+	return;
+    }
+
+    if (group)
+	app->start_group(group);
+    else
+	response.send(Pistache::Http::Code::Ok);
+}
+
+void RestServer::postBulk(
+    const Pistache::Rest::Request &request,
+    Pistache::Http::ResponseWriter response)
+{
+    rapidjson::StringBuffer sb;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+    AppError *ae = NULL;
+    rapidjson::Document d;
+    std::shared_ptr<RequestGroup> group = \
+	wait_group(request,response,Pistache::Http::Code::Ok);
+    Pistache::Http::ResponseWriter& rw = \
+	group ? group->get_ctx()->get_response() : response;
+
+    d.Parse(request.body().c_str());
+
+    if (!app->bulk(d,writer,&ae,group)) {
+	HANDLE_APP_ERROR_TO(rw,ae,Pistache::Http::Code::Bad_Request);
 	return;
     }
 
-    response.send(Pistache::Http::Code::Ok);
+    if (group) {
+	group->get_ctx()->set_body(sb.GetString());
+	app->start_group(group);
+    }
+    else
+	response.send(Pistache::Http::Code::Ok,sb.GetString());
 }
 
 void RestServer::stop()
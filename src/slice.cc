@@ -16,24 +16,54 @@ std::map<HttpMethod,std::list<std::string>> Slice::disallowed = {
     { HttpMethod::PUT,{ "name" } }
 };
 
-void Slice::serialize(rapidjson::Writer<rapidjson::StringBuffer>& writer)
+void Slice::serialize(rapidjson::Writer<rapidjson::StringBuffer>& writer,
+		      const std::string& name,const std::string& policy,
+		      const BoundNames& ue_names)
 {
     writer.StartObject();
     writer.String("name");
     writer.String(name.c_str());
-    if (allocation_policy) {
+    if (!policy.empty()) {
 	writer.String("allocation_policy");
-	allocation_policy->serialize(writer);
+	writer.RawValue(policy.c_str(),policy.size(),rapidjson::kObjectType);
     }
+    /* ues is keyed by interned ID; list by IMSI, so output is stable. */
     writer.String("ues");
     writer.StartArray();
-    for (auto it = ues.begin(); it != ues.end(); ++it) {
-    	writer.String(it->first.c_str());
-    }
+    ue_names.visit([&writer](const std::string& imsi,uint32_t id) {
+	writer.String(imsi.c_str());
+	return true;
+    });
     writer.EndArray();
     writer.EndObject();
+}
+
+std::string Slice::serialize_policy()
+{
+    if (!allocation_policy)
+	return std::string();
+
+    rapidjson::StringBuffer sb;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+    allocation_policy->serialize(writer);
+    return std::string(sb.GetString(),sb.GetSize());
+}
+
+void Slice::serialize(rapidjson::Writer<rapidjson::StringBuffer>& writer)
+{
+    serialize(writer,name,serialize_policy(),ue_names);
 };
 
+AbstractResource::Renderer Slice::get_renderer()
+{
+    return [name = name,policy = serialize_policy(),ue_names = ue_names]() {
+	rapidjson::StringBuffer sb;
+	rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+	serialize(writer,name,policy,ue_names);
+	return std::make_shared<const std::string>(sb.GetString(),sb.GetSize());
+    };
+}
+
 Slice *Slice::create(rapidjson::Document& d,AppError **ae)
 {
     if (!d.IsObject()) {
@@ -52,44 +82,9 @@ Slice *Slice::create(rapidjson::Document& d,AppError **ae)
 
     AllocationPolicy *allocation_policy = NULL;
     if (obj.HasMember("allocation_policy")) {
-	if (!obj["allocation_policy"].IsObject()
-	    || !obj["allocation_policy"].HasMember("type")
-	    || !obj["allocation_policy"]["type"].IsString()
-	    || strcmp(obj["allocation_policy"]["type"].GetString(),
-		      "proportional") != 0
-	    || !obj["allocation_policy"].HasMember("share")
-	    || !obj["allocation_policy"]["share"].IsInt()
-	    || obj["allocation_policy"]["share"].GetInt() < 0
-	    || obj["allocation_policy"]["share"].GetInt() > 1024
-	    || (obj["allocation_policy"].HasMember("auto_equalize")
-		&& !obj["allocation_policy"]["auto_equalize"].IsBool())) {
-	    if (ae) {
-		if (!*ae)
-		    *ae = new AppError(400);
-		(*ae)->add(std::string("malformed allocation_policy property"));
-	    }
+	allocation_policy = AllocationPolicy::create(obj["allocation_policy"],ae);
+	if (!allocation_policy)
 	    return NULL;
-	}
-
-	bool auto_equalize = false;
-	if (obj["allocation_policy"].HasMember("auto_equalize"))
-	    auto_equalize = obj["allocation_policy"]["auto_equalize"].GetBool();
-	bool throttle = false;
-	int throttle_threshold = -1;
-	int throttle_period = 1800;
-	int throttle_share = 128;
-	if (obj["allocation_policy"].HasMember("throttle"))
-	    throttle = obj["allocation_policy"]["throttle"].GetBool();
-	if (obj["allocation_policy"].HasMember("throttle_threshold"))
-	    throttle_threshold = obj["allocation_policy"]["throttle_threshold"].GetInt();
-	if (obj["allocation_policy"].HasMember("throttle_period"))
-	    throttle_period = obj["allocation_policy"]["throttle_period"].GetInt();
-	if (obj["allocation_policy"].HasMember("throttle_share"))
-	    throttle_share = obj["allocation_policy"]["throttle_share"].GetInt();
-
-	allocation_policy = new ProportionalAllocationPolicy(
-	    obj["allocation_policy"]["share"].GetInt(),auto_equalize,
-	    throttle,throttle_threshold,throttle_period,throttle_share);
     }
     if (allocation_policy)
 	return new Slice(std::string(obj["name"].GetString()),
@@ -124,7 +119,19 @@ bool Slice::update(rapidjson::Document& d,AppError **ae)
 	    return NULL;
 	}
 
-	if (!allocation_policy->update(obj["allocation_policy"],ae))
+	// A different policy type replaces the policy outright.
+	if (obj["allocation_policy"].HasMember("type")
+	    && obj["allocation_policy"]["type"].IsString()
+	    && strcmp(obj["allocation_policy"]["type"].GetString(),
+		      allocation_policy->getName()) != 0) {
+	    AllocationPolicy *new_policy = \
+		AllocationPolicy::create(obj["allocation_policy"],ae);
+	    if (!new_policy)
+		return false;
+	    delete allocation_policy;
+	    allocation_policy = new_policy;
+	}
+	else if (!allocation_policy->update(obj["allocation_policy"],ae))
 	    return false;
     }
 
@@ -38,7 +38,7 @@ void Ue::serialize(rapidjson::Writer<rapidjson::StringBuffer>& writer)
     writer.EndObject();
 };
 
-Ue *Ue::create(rapidjson::Document& d,AppError **ae)
+Ue *Ue::create(const rapidjson::Value& d,AppError **ae)
 {
     if (!d.IsObject()) {
 	if (ae) {
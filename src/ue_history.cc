@@ -0,0 +1,263 @@
+#include "mdclog/mdclog.h"
+
+#include "ue_history.h"
+
+namespace nexran {
+
+UeHistory::Shard::~Shard()
+{
+    for (auto it = slabs.begin(); it != slabs.end(); ++it)
+	delete [] *it;
+}
+
+UeHistory::~UeHistory()
+{
+    for (auto it = shards.begin(); it != shards.end(); ++it)
+	delete *it;
+}
+
+void UeHistory::init(int num_shards,int length_,int max_ues_,int idle_sec)
+{
+    if (num_shards < 1)
+	num_shards = 1;
+    length = (length_ > 0) ? length_ : 0;
+    max_ues = (max_ues_ > 0) ? max_ues_ : 0;
+    idle_ms = (idle_sec > 0) ? (uint64_t)idle_sec * 1000 : 1000;
+    for (int i = 0; i < num_shards; ++i)
+	shards.push_back(new Shard());
+
+    if (is_enabled())
+	mdclog_write(MDCLOG_INFO,"ue history: %d samples for up to %d ues (%zu bytes each)",
+		     length,max_ues,length * sizeof(ue_sample_t));
+}
+
+/*
+ * Grows the shard by a slab when its free list is empty.  The cap is
+ * shared by every shard, so a busy shard can use what others do not.
+ */
+bool UeHistory::alloc_ring(Shard *s,uint32_t *ring)
+{
+    if (used.fetch_add(1,std::memory_order_relaxed) >= max_ues) {
+	used.fetch_sub(1,std::memory_order_relaxed);
+	return false;
+    }
+
+    if (s->free_rings.empty()) {
+	uint32_t first = (uint32_t)s->rings.size();
+	s->slabs.push_back(new ue_sample_t[(size_t)SLAB_UES * length]);
+	s->rings.resize(first + SLAB_UES);
+	for (uint32_t i = first + SLAB_UES; i > first; --i) {
+	    s->rings[i - 1].in_use = false;
+	    s->free_rings.push_back(i - 1);
+	}
+    }
+
+    *ring = s->free_rings.back();
+    s->free_rings.pop_back();
+    Ring& r = s->rings[*ring];
+    r.head = 0;
+    r.count = 0;
+    r.last_ms = 0;
+    r.in_use = true;
+
+    return true;
+}
+
+void UeHistory::free_ring(Shard *s,uint32_t ring)
+{
+    Ring& r = s->rings[ring];
+
+    auto nit = s->nodebs.find(r.meid);
+    if (nit != s->nodebs.end())
+	nit->second.set_ring(r.rnti,0);
+    set_imsi(s,ring,std::string());
+    r.meid.clear();
+    r.in_use = false;
+    s->free_rings.push_back(ring);
+    used.fetch_sub(1,std::memory_order_relaxed);
+}
+
+/* A new IMSI on an RNTI is a different UE, so its history starts over. */
+void UeHistory::set_imsi(Shard *s,uint32_t ring,const std::string& imsi)
+{
+    Ring& r = s->rings[ring];
+
+    if (r.imsi == imsi)
+	return;
+    if (!r.imsi.empty()) {
+	auto range = s->rings_of_imsi.equal_range(r.imsi);
+	for (auto it = range.first; it != range.second; ++it) {
+	    if (it->second == ring) {
+		s->rings_of_imsi.erase(it);
+		break;
+	    }
+	}
+	r.head = 0;
+	r.count = 0;
+    }
+    r.imsi = imsi;
+    if (!imsi.empty())
+	s->rings_of_imsi.emplace(imsi,ring);
+}
+
+void UeHistory::sweep(Shard *s,uint64_t now_ms)
+{
+    s->last_sweep_ms = now_ms;
+    for (uint32_t i = 0; i < s->rings.size(); ++i) {
+	Ring& r = s->rings[i];
+	if (r.in_use && r.last_ms + idle_ms < now_ms)
+	    free_ring(s,i);
+    }
+}
+
+void UeHistory::record(int shard,const std::string& meid,
+		       const e2sm::kpm::KpmReport *report,uint64_t now_ms)
+{
+    if (!is_enabled() || report->ue_rnti.empty())
+	return;
+
+    Shard *s = shards[shard % shards.size()];
+    const e2sm::kpm::EntityMetricsTable& t = report->ues;
+
+    std::lock_guard<std::mutex> lock(s->mutex);
+    if (now_ms >= s->last_sweep_ms + 1000)
+	sweep(s,now_ms);
+
+    NodeBUes& nodeb = s->nodebs[meid];
+    for (size_t i = 0; i < report->ue_rnti.size(); ++i) {
+	long rnti = report->ue_rnti[i];
+	if (rnti < 0 || rnti > 0xffff)
+	    continue;
+
+	uint32_t ring = nodeb.ring_of(rnti);
+	if (ring)
+	    --ring;
+	else {
+	    if (!alloc_ring(s,&ring)) {
+		dropped.fetch_add(1,std::memory_order_relaxed);
+		continue;
+	    }
+	    nodeb.set_ring(rnti,ring + 1);
+	    s->rings[ring].meid = meid;
+	    s->rings[ring].rnti = rnti;
+	    auto mit = nodeb.imsi_of_rnti.find(rnti);
+	    if (mit != nodeb.imsi_of_rnti.end())
+		set_imsi(s,ring,mit->second);
+	}
+
+	Ring& r = s->rings[ring];
+	ue_sample_t& sample = samples(s,ring)[r.head];
+	sample.time_ms = now_ms;
+	sample.dl_bytes = t.dl_bytes[i];
+	sample.ul_bytes = t.ul_bytes[i];
+	sample.dl_prbs = (uint32_t)t.dl_prbs[i];
+	sample.ul_prbs = (uint32_t)t.ul_prbs[i];
+	sample.dl_cqi = (float)t.dl_cqi[i];
+	sample.ul_sinr = (float)t.ul_sinr[i];
+	sample.ul_mcs = (float)t.ul_mcs[i];
+	sample.ul_phr = (float)t.ul_phr[i];
+	r.head = (r.head + 1) % length;
+	if (r.count < (uint32_t)length)
+	    ++r.count;
+	r.last_ms = now_ms;
+    }
+}
+
+void UeHistory::map_rnti(int shard,const std::string& meid,long rnti,
+			 const std::string& imsi)
+{
+    if (!is_enabled() || rnti < 0 || rnti > 0xffff)
+	return;
+
+    Shard *s = shards[shard % shards.size()];
+
+    std::lock_guard<std::mutex> lock(s->mutex);
+    NodeBUes& nodeb = s->nodebs[meid];
+    if (imsi.empty())
+	nodeb.imsi_of_rnti.erase(rnti);
+    else
+	nodeb.imsi_of_rnti[rnti] = imsi;
+    uint32_t ring = nodeb.ring_of(rnti);
+    if (ring)
+	set_imsi(s,ring - 1,imsi);
+}
+
+void UeHistory::forget(const std::string& meid)
+{
+    for (auto it = shards.begin(); it != shards.end(); ++it) {
+	Shard *s = *it;
+	std::lock_guard<std::mutex> lock(s->mutex);
+	for (uint32_t i = 0; i < s->rings.size(); ++i) {
+	    if (s->rings[i].in_use && s->rings[i].meid == meid)
+		free_ring(s,i);
+	}
+	s->nodebs.erase(meid);
+    }
+}
+
+bool UeHistory::serialize(const std::string& imsi,size_t limit,
+			  rapidjson::Writer<rapidjson::StringBuffer>& writer)
+{
+    bool found = false;
+
+    for (auto it = shards.begin(); it != shards.end(); ++it) {
+	Shard *s = *it;
+	std::lock_guard<std::mutex> lock(s->mutex);
+	auto range = s->rings_of_imsi.equal_range(imsi);
+	for (auto rit = range.first; rit != range.second; ++rit) {
+	    Ring& r = s->rings[rit->second];
+	    if (!found) {
+		writer.StartObject();
+		writer.String("imsi");
+		writer.String(imsi.c_str());
+		writer.String("histories");
+		writer.StartArray();
+		found = true;
+	    }
+	    writer.StartObject();
+	    writer.String("nodeb");
+	    writer.String(r.meid.c_str());
+	    writer.String("rnti");
+	    writer.Int64(r.rnti);
+	    writer.String("samples");
+	    writer.StartArray();
+	    uint32_t n = r.count;
+	    if (limit && limit < n)
+		n = (uint32_t)limit;
+	    const ue_sample_t *ss = samples(s,rit->second);
+	    for (uint32_t i = r.head + length - n; i < r.head + length; ++i) {
+		const ue_sample_t& sample = ss[i % length];
+		writer.StartObject();
+		writer.String("time");
+		writer.Uint64(sample.time_ms);
+		writer.String("dl_bytes");
+		writer.Uint64(sample.dl_bytes);
+		writer.String("ul_bytes");
+		writer.Uint64(sample.ul_bytes);
+		writer.String("dl_prbs");
+		writer.Uint(sample.dl_prbs);
+		writer.String("ul_prbs");
+		writer.Uint(sample.ul_prbs);
+		writer.String("dl_cqi");
+		writer.Double(sample.dl_cqi);
+		writer.String("ul_sinr");
+		writer.Double(sample.ul_sinr);
+		writer.String("ul_mcs");
+		writer.Double(sample.ul_mcs);
+		writer.String("ul_phr");
+		writer.Double(sample.ul_phr);
+		writer.EndObject();
+	    }
+	    writer.EndArray();
+	    writer.EndObject();
+	}
+    }
+    if (found) {
+	writer.EndArray();
+	writer.EndObject();
+    }
+
+    return found;
+}
+
+}
@@ -0,0 +1,166 @@
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "batcher.h"
+
+using nexran::ControlBatcher;
+
+namespace {
+
+typedef std::map<std::string,int> Shares;
+
+/* Records each request the batcher sends, in order. */
+class RecordingHandler : public nexran::ControlBatcherHandler {
+ public:
+    void send_slice_configs(const std::string& meid,const Shares& shares)
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	sent.push_back(std::make_pair(meid,shares));
+	cv.notify_all();
+    };
+
+    /* Waits for n requests to have been sent; false on timeout. */
+    bool wait_for(size_t n)
+    {
+	std::unique_lock<std::mutex> lock(mutex);
+	return cv.wait_for(lock,std::chrono::seconds(5),
+			   [this,n] { return sent.size() >= n; });
+    };
+    size_t count()
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	return sent.size();
+    };
+
+    std::vector<std::pair<std::string,Shares>> sent;
+
+ private:
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+}
+
+TEST(ControlBatcher,DisabledSendsDirectly)
+{
+    RecordingHandler handler;
+    ControlBatcher batcher(&handler);
+
+    ASSERT_TRUE(batcher.start(0,8));
+    EXPECT_FALSE(batcher.is_enabled());
+    batcher.submit("enb1","a",1);
+    batcher.submit("enb1","b",2);
+    ASSERT_EQ(handler.count(),2u);
+    EXPECT_EQ(handler.sent[0].second,(Shares{ { "a",1 } }));
+    EXPECT_EQ(handler.sent[1].second,(Shares{ { "b",2 } }));
+}
+
+TEST(ControlBatcher,CoalescesPerNode)
+{
+    RecordingHandler handler;
+    ControlBatcher batcher(&handler);
+
+    ASSERT_TRUE(batcher.start(60000,8));
+    batcher.submit("enb1","a",1);
+    batcher.submit("enb2","a",5);
+    batcher.submit("enb1","b",2);
+    /* Replaces the share still queued for a. */
+    batcher.submit("enb1","a",3);
+    EXPECT_EQ(handler.count(),0u);
+
+    batcher.flush("enb1");
+    ASSERT_EQ(handler.count(),1u);
+    EXPECT_EQ(handler.sent[0].first,"enb1");
+    EXPECT_EQ(handler.sent[0].second,(Shares{ { "a",3 },{ "b",2 } }));
+    batcher.flush("enb1");
+    EXPECT_EQ(handler.count(),1u);
+
+    /* stop() sends whatever is left. */
+    batcher.stop();
+    ASSERT_EQ(handler.count(),2u);
+    EXPECT_EQ(handler.sent[1].first,"enb2");
+    EXPECT_EQ(handler.sent[1].second,(Shares{ { "a",5 } }));
+
+    batcher.submit("enb2","a",6);
+    ASSERT_EQ(handler.count(),3u);
+    EXPECT_EQ(handler.sent[2].second,(Shares{ { "a",6 } }));
+}
+
+TEST(ControlBatcher,SendsFullBatch)
+{
+    RecordingHandler handler;
+    ControlBatcher batcher(&handler);
+
+    ASSERT_TRUE(batcher.start(60000,2));
+    batcher.submit("enb1","a",1);
+    batcher.submit("enb1","a",2);
+    EXPECT_EQ(handler.count(),0u);
+    batcher.submit("enb1","b",3);
+    ASSERT_EQ(handler.count(),1u);
+    EXPECT_EQ(handler.sent[0].second,(Shares{ { "a",2 },{ "b",3 } }));
+    batcher.stop();
+    EXPECT_EQ(handler.count(),1u);
+}
+
+TEST(ControlBatcher,SendsAfterWindow)
+{
+    RecordingHandler handler;
+    ControlBatcher batcher(&handler);
+    auto start = std::chrono::steady_clock::now();
+
+    ASSERT_TRUE(batcher.start(20,8));
+    batcher.submit("enb1","a",1);
+    batcher.submit("enb1","b",2);
+    ASSERT_TRUE(handler.wait_for(1));
+    EXPECT_GE(std::chrono::steady_clock::now() - start,
+	      std::chrono::milliseconds(20));
+    EXPECT_EQ(handler.sent[0].second,(Shares{ { "a",1 },{ "b",2 } }));
+    batcher.stop();
+    EXPECT_EQ(handler.count(),1u);
+}
+
+/*
+ * Explicit flushes race with the flusher thread's window expiries; a
+ * NodeB must still see each slice's shares in the order they were
+ * submitted, and the last one must arrive.
+ */
+TEST(ControlBatcher,FlushOrdering)
+{
+    RecordingHandler handler;
+    ControlBatcher batcher(&handler);
+    const int changes = 5000;
+
+    ASSERT_TRUE(batcher.start(1,4));
+    std::thread other([&] {
+	for (int i = 1; i <= changes; ++i)
+	    batcher.submit("enb2","a",i);
+    });
+    for (int i = 1; i <= changes; ++i) {
+	batcher.submit("enb1","a",i);
+	if (i % 3 == 0)
+	    batcher.submit("enb1","b",i);
+	if (i % 7 == 0)
+	    batcher.flush("enb1");
+    }
+    other.join();
+    batcher.stop();
+
+    std::map<std::string,int> last;
+    for (auto it = handler.sent.begin(); it != handler.sent.end(); ++it) {
+	for (auto it2 = it->second.begin(); it2 != it->second.end(); ++it2) {
+	    std::string key = it->first + "/" + it2->first;
+	    EXPECT_GT(it2->second,last[key]) << key;
+	    last[key] = it2->second;
+	}
+    }
+    EXPECT_EQ(last["enb1/a"],changes);
+    EXPECT_EQ(last["enb1/b"],changes - changes % 3);
+    EXPECT_EQ(last["enb2/a"],changes);
+}
@@ -0,0 +1,119 @@
+#include <memory>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+#include <gtest/gtest.h>
+
+#include "e2ap.h"
+#include "e2sm.h"
+
+using e2ap::ControlRequest;
+using e2ap::ControlTemplate;
+
+namespace {
+
+/* A control whose header and message are opaque filler bytes. */
+class OpaqueControl : public e2sm::Control {
+ public:
+    OpaqueControl(size_t header_len_,size_t message_len_,
+		  size_t call_process_id_len_)
+	: e2sm::Control(NULL)
+    {
+	header_len = header_len_;
+	message_len = message_len_;
+	call_process_id_len = call_process_id_len_;
+    };
+
+    bool encode()
+    {
+	header = fill(header_len,0x11);
+	message = fill(message_len,0x22);
+	call_process_id = fill(call_process_id_len,0x33);
+	encoded = true;
+	return true;
+    };
+
+ private:
+    static unsigned char *fill(size_t len,unsigned char seed)
+    {
+	if (len == 0)
+	    return NULL;
+	unsigned char *buf = (unsigned char *)malloc(len);
+	for (size_t i = 0; i < len; ++i)
+	    buf[i] = seed + i;
+	return buf;
+    };
+};
+
+const long instance_ids[] = {
+    0,1,0x7f,0x80,0xff,0x100,0x1234,0x7fff,0x8000,0xffff
+};
+
+/*
+ * Patching the template for each instance ID must give exactly the
+ * PDU that a full encode of that request does, however long the
+ * variable-length fields before and after the instance ID are.
+ */
+void check_patch_matches_encode(std::shared_ptr<e2sm::Control> control)
+{
+    ControlRequest probe(3,42,1,control,e2ap::CONTROL_REQUEST_ACK);
+    std::shared_ptr<const ControlTemplate> tmpl(ControlTemplate::create(&probe));
+
+    ASSERT_TRUE(tmpl);
+    EXPECT_EQ(probe.instance_id,42);
+
+    for (long id : instance_ids) {
+	ControlRequest full(3,id,1,control,e2ap::CONTROL_REQUEST_ACK);
+	ASSERT_GT(full.get_len(),0);
+	ASSERT_EQ(tmpl->len,full.get_len());
+
+	std::vector<unsigned char> patched(tmpl->len);
+	ASSERT_EQ(tmpl->patch_into(patched.data(),patched.size(),id),
+		  tmpl->len);
+	EXPECT_EQ(memcmp(patched.data(),full.get_buf(),full.get_len()),0)
+	    << "instance id " << id;
+
+	/* And so must the request's own encoders, given the template. */
+	ControlRequest fast(3,id,1,control,e2ap::CONTROL_REQUEST_ACK);
+	fast.tmpl = tmpl;
+	std::vector<unsigned char> into(tmpl->len + 16);
+	ASSERT_EQ(fast.encode_into(into.data(),into.size()),tmpl->len);
+	EXPECT_EQ(memcmp(into.data(),full.get_buf(),full.get_len()),0);
+	ASSERT_EQ(fast.get_len(),full.get_len());
+	EXPECT_EQ(memcmp(fast.get_buf(),full.get_buf(),full.get_len()),0);
+    }
+}
+
+}
+
+TEST(ControlTemplate,PatchMatchesFullEncode)
+{
+    size_t lens[] = { 1,16,127,128,300,5000 };
+
+    for (size_t header_len : lens) {
+	for (size_t message_len : lens) {
+	    SCOPED_TRACE(testing::Message() << "header " << header_len
+			 << " message " << message_len);
+	    check_patch_matches_encode(
+		std::make_shared<OpaqueControl>(header_len,message_len,0));
+	    check_patch_matches_encode(
+		std::make_shared<OpaqueControl>(header_len,message_len,8));
+	}
+    }
+}
+
+TEST(ControlTemplate,PatchRejectsBadInput)
+{
+    auto control = std::make_shared<OpaqueControl>(16,16,0);
+    ControlRequest probe(3,0,1,control,e2ap::CONTROL_REQUEST_NONE);
+    std::unique_ptr<ControlTemplate> tmpl(ControlTemplate::create(&probe));
+
+    ASSERT_TRUE(tmpl);
+    std::vector<unsigned char> dst(tmpl->len);
+    EXPECT_EQ(tmpl->patch_into(dst.data(),dst.size(),-1),-1);
+    EXPECT_EQ(tmpl->patch_into(dst.data(),dst.size(),0x10000),-1);
+    EXPECT_EQ(tmpl->patch_into(dst.data(),dst.size() - 1,1),-1);
+    EXPECT_EQ(tmpl->patch_into(dst.data(),dst.size(),1),tmpl->len);
+    EXPECT_EQ(tmpl->control,control);
+}
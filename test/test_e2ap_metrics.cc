@@ -0,0 +1,98 @@
+#include <random>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include <gtest/gtest.h>
+
+#include "e2ap_metrics.h"
+
+using e2ap::Histogram;
+
+/* A copy: the assertions take their arguments by reference. */
+static const int NUM_BUCKETS = Histogram::NUM_BUCKETS;
+
+TEST(Histogram,SmallValuesAreExact)
+{
+    for (uint64_t v = 0; v < 4; ++v) {
+	EXPECT_EQ(Histogram::bucket(v),(int)v);
+	EXPECT_EQ(Histogram::bucket_max((int)v),v);
+    }
+}
+
+/*
+ * The buckets tile [0,UINT64_MAX] with no gaps or overlaps: each
+ * starts just past the previous one's max, and the last ends at
+ * UINT64_MAX.
+ */
+TEST(Histogram,BucketsAreContiguous)
+{
+    for (int i = 1; i < NUM_BUCKETS; ++i) {
+	uint64_t lo = Histogram::bucket_max(i - 1) + 1;
+	uint64_t hi = Histogram::bucket_max(i);
+	ASSERT_LE(lo,hi) << "bucket " << i;
+	EXPECT_EQ(Histogram::bucket(lo),i);
+	EXPECT_EQ(Histogram::bucket(hi),i);
+    }
+    EXPECT_EQ(Histogram::bucket_max(NUM_BUCKETS - 1),UINT64_MAX);
+    EXPECT_EQ(Histogram::bucket(UINT64_MAX),NUM_BUCKETS - 1);
+}
+
+/* Four buckets per power of two: none is more than 25% wider than its values. */
+TEST(Histogram,BucketWidth)
+{
+    for (int i = 4; i < NUM_BUCKETS; ++i) {
+	uint64_t lo = Histogram::bucket_max(i - 1) + 1;
+	uint64_t width = Histogram::bucket_max(i) - lo + 1;
+	EXPECT_LE(width,lo / 4) << "bucket " << i;
+    }
+    for (int e = 2; e < 63; ++e)
+	EXPECT_EQ(Histogram::bucket(1ULL << e),(e - 1) * 4);
+}
+
+TEST(Histogram,RandomValues)
+{
+    std::mt19937_64 rng(1);
+
+    for (int n = 0; n < 100000; ++n) {
+	uint64_t v = rng() >> (rng() % 64);
+	int i = Histogram::bucket(v);
+	ASSERT_GE(i,0);
+	ASSERT_LT(i,NUM_BUCKETS);
+	EXPECT_LE(v,Histogram::bucket_max(i));
+	if (i > 0) {
+	    EXPECT_GT(v,Histogram::bucket_max(i - 1));
+	}
+    }
+}
+
+/* Counts recorded on different threads (so shards) all add up. */
+TEST(Histogram,RecordAndGet)
+{
+    Histogram histogram;
+    std::vector<std::thread> threads;
+    std::vector<uint64_t> counts;
+    uint64_t sum;
+
+    for (int t = 0; t < 4; ++t) {
+	threads.emplace_back([&histogram] {
+	    for (uint64_t v = 0; v < 1000; ++v)
+		histogram.record(v);
+	});
+    }
+    for (auto it = threads.begin(); it != threads.end(); ++it)
+	it->join();
+
+    histogram.get(counts,&sum);
+    ASSERT_EQ(counts.size(),(size_t)NUM_BUCKETS);
+    EXPECT_EQ(sum,4 * (999 * 1000 / 2));
+    uint64_t total = 0;
+    for (int i = 0; i < NUM_BUCKETS; ++i) {
+	uint64_t expected = 0;
+	for (uint64_t v = 0; v < 1000; ++v)
+	    expected += (Histogram::bucket(v) == i) ? 4 : 0;
+	EXPECT_EQ(counts[i],expected) << "bucket " << i;
+	total += counts[i];
+    }
+    EXPECT_EQ(total,4000u);
+}
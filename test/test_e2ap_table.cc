@@ -0,0 +1,185 @@
+#include <atomic>
+#include <map>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "e2ap_table.h"
+
+using e2ap::RequestTable;
+
+namespace {
+
+/* Counts live values, so tests can check the table frees them. */
+std::atomic<long> live(0);
+
+class Value {
+ public:
+    Value(long v_) : v(v_) { ++live; };
+    ~Value() { --live; };
+
+    long v;
+};
+
+std::shared_ptr<Value> make(long v)
+{
+    return std::make_shared<Value>(v);
+}
+
+}
+
+TEST(RequestTable,InsertFindErase)
+{
+    RequestTable<Value> table(16);
+
+    EXPECT_FALSE(table.insert(-1,make(-1)));
+    EXPECT_TRUE(table.insert(7,make(7)));
+    EXPECT_FALSE(table.insert(7,make(8)));
+    EXPECT_EQ(table.find(7)->v,7);
+    EXPECT_TRUE(table.contains(7));
+    EXPECT_FALSE(table.contains(8));
+    EXPECT_FALSE(table.find(-1));
+
+    EXPECT_TRUE(table.set(7,make(70)));
+    EXPECT_EQ(table.find(7)->v,70);
+    EXPECT_EQ(table.size(),1u);
+
+    auto value = table.erase(7);
+    ASSERT_TRUE(value);
+    EXPECT_EQ(value->v,70);
+    EXPECT_FALSE(table.erase(7));
+    EXPECT_EQ(table.size(),0u);
+}
+
+TEST(RequestTable,Capacity)
+{
+    RequestTable<Value> table(16);
+
+    for (long k = 0; k < 16; ++k)
+	EXPECT_TRUE(table.insert(k,make(k)));
+    EXPECT_TRUE(table.full());
+    EXPECT_FALSE(table.insert(16,make(16)));
+    /* Replacing a present key does not need room. */
+    EXPECT_TRUE(table.set(3,make(30)));
+    table.erase(0);
+    EXPECT_TRUE(table.insert(16,make(16)));
+
+    table.resize(64);
+    EXPECT_EQ(table.size(),0u);
+    for (long k = 0; k < 64; ++k)
+	EXPECT_TRUE(table.insert(k,make(k)));
+    EXPECT_FALSE(table.insert(64,make(64)));
+}
+
+/*
+ * Churns a small, nearly full table (so probe runs are long and
+ * wrap) against a std::map; every erase shifts entries back, and
+ * every present key must still be found afterwards.
+ */
+TEST(RequestTable,BackwardShiftKeepsRuns)
+{
+    RequestTable<Value> table(16);
+    std::map<long,long> expected;
+    std::mt19937 rng(1);
+
+    for (int step = 0; step < 20000; ++step) {
+	long k = rng() % 48;
+	if (expected.count(k)) {
+	    auto value = table.erase(k);
+	    ASSERT_TRUE(value);
+	    EXPECT_EQ(value->v,expected[k]);
+	    expected.erase(k);
+	}
+	else if (expected.size() < 16) {
+	    ASSERT_TRUE(table.insert(k,make(step)));
+	    expected[k] = step;
+	}
+	ASSERT_EQ(table.size(),expected.size());
+	for (long j = 0; j < 48; ++j) {
+	    auto value = table.find(j);
+	    if (expected.count(j)) {
+		ASSERT_TRUE(value) << "lost key " << j << " at step " << step;
+		EXPECT_EQ(value->v,expected[j]);
+	    }
+	    else {
+		EXPECT_FALSE(value) << "stale key " << j << " at step " << step;
+	    }
+	}
+    }
+
+    size_t n = 0;
+    table.for_each([&](long k,const std::shared_ptr<Value>& v) {
+	EXPECT_EQ(expected[k],v->v);
+	++n;
+    });
+    EXPECT_EQ(n,expected.size());
+}
+
+/*
+ * Readers look up a fixed set of keys while the writer inserts and
+ * erases others around them and replaces their values; the shifts must
+ * never hide a stable key from a reader, nor free a value under one.
+ */
+TEST(RequestTable,ConcurrentReaders)
+{
+    const long stable = 1000000000L,num_stable = 10;
+
+    {
+	RequestTable<Value> table(1024);
+	std::atomic<bool> stop(false);
+	std::atomic<long> misses(0),wrong(0),finds(0);
+	std::vector<std::thread> readers;
+
+	for (long i = 0; i < num_stable; ++i)
+	    table.insert(stable + i * 7919,make(i));
+	for (int r = 0; r < 4; ++r) {
+	    readers.emplace_back([&,r] {
+		while (!stop) {
+		    for (long i = 0; i < num_stable; ++i) {
+			auto value = table.find(stable + i * 7919);
+			if (!value)
+			    ++misses;
+			else if (value->v != i)
+			    ++wrong;
+			++finds;
+		    }
+		    for (long k = r; k < 2000; k += 4) {
+			auto value = table.find(k);
+			if (value && value->v != k)
+			    ++wrong;
+		    }
+		}
+	    });
+	}
+
+	long lo = 0,hi = 0;
+	for (int step = 0; step < 200000 || finds < 100000; ++step) {
+	    if (hi - lo < 900) {
+		ASSERT_TRUE(table.insert(hi,make(hi)));
+		++hi;
+	    }
+	    else {
+		auto value = table.erase(lo);
+		ASSERT_TRUE(value);
+		EXPECT_EQ(value->v,lo);
+		++lo;
+	    }
+	    if (step % 7 == 0)
+		table.set(stable + (step % num_stable) * 7919,
+			  make(step % num_stable));
+	}
+	stop = true;
+	for (auto it = readers.begin(); it != readers.end(); ++it)
+	    it->join();
+
+	EXPECT_EQ(misses,0);
+	EXPECT_EQ(wrong,0);
+	for (long k = lo; k < hi; ++k)
+	    EXPECT_TRUE(table.contains(k));
+	EXPECT_EQ(table.size(),(size_t)(hi - lo + num_stable));
+    }
+    EXPECT_EQ(live,0);
+}
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <map>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "e2ap_timer.h"
+
+using e2ap::DeadlineWheel;
+
+namespace {
+
+/* Tags each deadline with an id in its attempt field. */
+DeadlineWheel::Deadline deadline(unsigned int id,uint64_t expires_ms)
+{
+    return DeadlineWheel::Deadline(
+	e2ap::PROCEDURE_CONTROL,std::weak_ptr<e2ap::Request>(),id,expires_ms);
+}
+
+std::vector<unsigned int> advance(DeadlineWheel& wheel,uint64_t now_ms)
+{
+    std::vector<DeadlineWheel::Deadline> expired;
+    std::vector<unsigned int> ids;
+
+    wheel.advance(now_ms,expired);
+    for (auto it = expired.begin(); it != expired.end(); ++it)
+	ids.push_back(it->attempt);
+    return ids;
+}
+
+const uint64_t START = 1000000;
+
+}
+
+TEST(DeadlineWheel,ExpiresOnItsTick)
+{
+    DeadlineWheel wheel(10,8);
+
+    advance(wheel,START);
+    wheel.schedule(deadline(1,START + 25));
+    wheel.schedule(deadline(2,START + 40));
+    EXPECT_EQ(wheel.size(),2u);
+
+    EXPECT_TRUE(advance(wheel,START + 19).empty());
+    /* Deadlines are kept to tick granularity. */
+    EXPECT_EQ(advance(wheel,START + 20),std::vector<unsigned int>{ 1 });
+    EXPECT_TRUE(advance(wheel,START + 39).empty());
+    EXPECT_EQ(advance(wheel,START + 40),std::vector<unsigned int>{ 2 });
+    EXPECT_EQ(wheel.size(),0u);
+}
+
+TEST(DeadlineWheel,PastDeadlineExpiresNext)
+{
+    DeadlineWheel wheel(10,8);
+
+    advance(wheel,START + 100);
+    wheel.schedule(deadline(1,START));
+    EXPECT_EQ(advance(wheel,START + 100),std::vector<unsigned int>{ 1 });
+}
+
+TEST(DeadlineWheel,BeyondOneRevolution)
+{
+    DeadlineWheel wheel(10,8);
+
+    advance(wheel,START);
+    /* Shares a slot with deadline 1, three revolutions later. */
+    wheel.schedule(deadline(1,START + 10));
+    wheel.schedule(deadline(2,START + 10 + 3 * 80));
+
+    EXPECT_EQ(advance(wheel,START + 10),std::vector<unsigned int>{ 1 });
+    for (uint64_t t = START + 20; t < START + 250; t += 10)
+	EXPECT_TRUE(advance(wheel,t).empty()) << "at " << t - START;
+    EXPECT_EQ(advance(wheel,START + 250),std::vector<unsigned int>{ 2 });
+}
+
+TEST(DeadlineWheel,LongStallExpiresEverything)
+{
+    DeadlineWheel wheel(10,8);
+
+    advance(wheel,START);
+    for (unsigned int i = 0; i < 20; ++i)
+	wheel.schedule(deadline(i,START + 10 + i * 30));
+    /* Many revolutions in one step: each slot is visited once. */
+    EXPECT_EQ(advance(wheel,START + 100000).size(),20u);
+    EXPECT_EQ(wheel.size(),0u);
+}
+
+/*
+ * Schedules random deadlines while advancing in random steps, and
+ * checks that each expires exactly once, at the first advance that
+ * reaches its tick.
+ */
+TEST(DeadlineWheel,MatchesSortedDeadlines)
+{
+    const unsigned int tick_ms = 10;
+    DeadlineWheel wheel(tick_ms,64);
+    std::multimap<uint64_t,unsigned int> pending;
+    std::mt19937 rng(1);
+    uint64_t now = START;
+    unsigned int next_id = 0;
+
+    advance(wheel,now);
+    for (int step = 0; step < 5000; ++step) {
+	for (int i = rng() % 4; i > 0; --i) {
+	    uint64_t expires = now + rng() % 2000;
+	    wheel.schedule(deadline(next_id,expires));
+	    pending.emplace(expires / tick_ms,next_id++);
+	}
+	now += rng() % 50;
+
+	std::vector<unsigned int> expected;
+	auto end = pending.upper_bound(now / tick_ms);
+	for (auto it = pending.begin(); it != end; ++it)
+	    expected.push_back(it->second);
+	pending.erase(pending.begin(),end);
+
+	std::vector<unsigned int> expired = advance(wheel,now);
+	std::sort(expired.begin(),expired.end());
+	std::sort(expected.begin(),expected.end());
+	ASSERT_EQ(expired,expected) << "at step " << step;
+	ASSERT_EQ(wheel.size(),pending.size());
+    }
+}
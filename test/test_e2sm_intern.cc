@@ -0,0 +1,127 @@
+#include <atomic>
+#include <set>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "e2sm_intern.h"
+
+using e2sm::InternTable;
+
+/* A copy: the assertions take their arguments by reference. */
+static const uint32_t NONE = InternTable::NONE;
+
+TEST(InternTable,InternAndLookup)
+{
+    InternTable table;
+
+    uint32_t a = table.intern("a");
+    uint32_t b = table.intern("b");
+    EXPECT_NE(a,NONE);
+    EXPECT_NE(a,b);
+    EXPECT_EQ(table.intern("a"),a);
+    EXPECT_EQ(table.lookup("a"),a);
+    EXPECT_EQ(table.lookup("b"),b);
+    EXPECT_EQ(table.lookup("c"),NONE);
+    EXPECT_EQ(table.name(b),"b");
+    EXPECT_EQ(table.size(),2u);
+}
+
+TEST(InternTable,ReleaseDropsLastReference)
+{
+    InternTable table;
+
+    uint32_t a = table.intern("a");
+    EXPECT_EQ(table.intern("a"),a);
+    table.release(a);
+    /* Still held by the second reference. */
+    EXPECT_EQ(table.lookup("a"),a);
+    table.release(a);
+    EXPECT_EQ(table.lookup("a"),NONE);
+    EXPECT_EQ(table.name(a),"");
+    EXPECT_EQ(table.size(),0u);
+}
+
+/*
+ * A released slot goes to the next string, under a new generation, so
+ * the old ID neither matches the new string nor releases it.
+ */
+TEST(InternTable,ReuseBumpsGeneration)
+{
+    InternTable table;
+
+    uint32_t a = table.intern("a");
+    table.release(a);
+    uint32_t c = table.intern("c");
+    EXPECT_EQ(InternTable::index_of(c),InternTable::index_of(a));
+    EXPECT_NE(c,a);
+    EXPECT_EQ(table.name(a),"");
+    EXPECT_EQ(table.name(c),"c");
+
+    table.release(a);
+    EXPECT_EQ(table.lookup("c"),c);
+
+    /* Reusing one slot over and over never hands out an old ID or NONE. */
+    std::set<uint32_t> seen;
+    uint32_t id = c;
+    for (int i = 0; i < 4094; ++i) {
+	EXPECT_TRUE(seen.insert(id).second) << "reuse " << i;
+	table.release(id);
+	id = table.intern("x");
+	ASSERT_NE(id,NONE);
+	EXPECT_EQ(InternTable::index_of(id),InternTable::index_of(a));
+    }
+}
+
+TEST(InternTable,Capped)
+{
+    InternTable table(2);
+
+    uint32_t a = table.intern("a");
+    EXPECT_NE(table.intern("b"),NONE);
+    EXPECT_EQ(table.intern("c"),NONE);
+    /* Already-interned names still resolve when full. */
+    EXPECT_EQ(table.intern("a"),a);
+    table.release(a);
+    table.release(a);
+    EXPECT_NE(table.intern("c"),NONE);
+}
+
+/*
+ * A thread's cached lookups must notice names added and removed by
+ * another thread.
+ */
+TEST(InternTable,LookupCacheSeesChanges)
+{
+    InternTable table;
+
+    EXPECT_EQ(table.lookup("a"),NONE);
+    uint32_t a;
+    std::thread([&] { a = table.intern("a"); }).join();
+    EXPECT_EQ(table.lookup("a"),a);
+    std::thread([&] { table.release(a); }).join();
+    EXPECT_EQ(table.lookup("a"),NONE);
+}
+
+TEST(InternTable,ConcurrentLookup)
+{
+    InternTable table;
+    std::atomic<bool> stop(false);
+    std::atomic<long> wrong(0);
+
+    uint32_t b = table.intern("b");
+    std::thread reader([&] {
+	while (!stop) {
+	    if (table.lookup("b") != b)
+		++wrong;
+	}
+    });
+    for (int i = 0; i < 20000; ++i)
+	table.release(table.intern("z"));
+    stop = true;
+    reader.join();
+
+    EXPECT_EQ(wrong,0);
+    EXPECT_EQ(table.size(),1u);
+}
@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <deque>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include "e2sm_kpm.h"
+
+using e2sm::kpm::entity_metrics_t;
+using e2sm::kpm::MetricsIndex;
+
+namespace {
+
+entity_metrics_t sample(uint64_t dl_bytes,double dl_cqi)
+{
+    entity_metrics_t m = { };
+
+    m.dl_bytes = dl_bytes;
+    m.dl_cqi = dl_cqi;
+    return m;
+}
+
+/*
+ * The samples the index should hold: a sample at t lives until the
+ * last second of its width-second bucket is period seconds old.
+ */
+class Window {
+ public:
+    Window(int period_,int width_) : period(period_),width(width_) {};
+
+    void add(time_t t,uint64_t dl_bytes,double dl_cqi)
+    {
+	samples.push_back({ t,dl_bytes,dl_cqi });
+    };
+    void flush(time_t now)
+    {
+	while (!samples.empty()
+	       && (samples.front().t / width + 1) * width - 1 < now - period)
+	    samples.pop_front();
+    };
+    void check(MetricsIndex& index)
+    {
+	uint64_t bytes = 0;
+	double lo = 0,hi = 0;
+
+	ASSERT_EQ(index.size(),(int)samples.size());
+	for (auto it = samples.begin(); it != samples.end(); ++it) {
+	    bytes += it->dl_bytes;
+	    lo = (it == samples.begin()) ? it->dl_cqi : std::min(lo,it->dl_cqi);
+	    hi = (it == samples.begin()) ? it->dl_cqi : std::max(hi,it->dl_cqi);
+	}
+	EXPECT_EQ(index.get_totals().dl_bytes,bytes);
+	EXPECT_DOUBLE_EQ(index.sum(MetricsIndex::DL_BYTES),(double)bytes);
+	EXPECT_DOUBLE_EQ(index.min(MetricsIndex::DL_CQI),lo);
+	EXPECT_DOUBLE_EQ(index.max(MetricsIndex::DL_CQI),hi);
+    };
+
+ private:
+    struct Sample {
+	time_t t;
+	uint64_t dl_bytes;
+	double dl_cqi;
+    };
+
+    int period;
+    int width;
+    std::deque<Sample> samples;
+};
+
+/*
+ * Feeds random samples at a random rate, with idle gaps, and checks the
+ * window after every step.
+ */
+void check_window(int period,int width)
+{
+    MetricsIndex index(period);
+    Window window(period,width);
+    std::mt19937 rng(period);
+    time_t now = 1000000;
+
+    for (int step = 0; step < 5000; ++step) {
+	if (rng() % 100 == 0)
+	    now += rng() % (3 * period);
+	else
+	    now += rng() % 3;
+	for (int i = rng() % 3; i > 0; --i) {
+	    uint64_t bytes = rng() % 10000;
+	    double cqi = rng() % 16;
+	    index.add(sample(bytes,cqi),now);
+	    window.add(now,bytes,cqi);
+	}
+	index.flush(now);
+	window.flush(now);
+	SCOPED_TRACE(testing::Message() << "step " << step);
+	window.check(index);
+	if (testing::Test::HasFatalFailure())
+	    return;
+    }
+}
+
+}
+
+TEST(MetricsIndex,WindowMatchesSamples)
+{
+    check_window(10,1);
+    /* Too long for one-second buckets. */
+    check_window(600,5);
+}
+
+/*
+ * The report period can change from one equalizer pass to the next; the
+ * window must survive it, and only the EWMA's weight changes.
+ */
+TEST(MetricsIndex,ReportPeriodChangeKeepsWindow)
+{
+    MetricsIndex index(10,1000);
+    time_t now = 1000000;
+
+    for (int i = 0; i < 8; ++i)
+	index.add(sample(100,i),now + i);
+    EXPECT_EQ(index.size(),8);
+    double ewma = index.ewma(MetricsIndex::DL_CQI);
+
+    index.set_report_period(5000);
+    EXPECT_EQ(index.size(),8);
+    EXPECT_DOUBLE_EQ(index.sum(MetricsIndex::DL_BYTES),800.0);
+    EXPECT_DOUBLE_EQ(index.min(MetricsIndex::DL_CQI),0.0);
+    EXPECT_DOUBLE_EQ(index.max(MetricsIndex::DL_CQI),7.0);
+    EXPECT_DOUBLE_EQ(index.ewma(MetricsIndex::DL_CQI),ewma);
+
+    /* Two reports per 10s window: alpha = 2 / (2 + 1). */
+    index.add(sample(100,12),now + 8);
+    EXPECT_DOUBLE_EQ(index.ewma(MetricsIndex::DL_CQI),
+		     ewma + 2.0 / 3.0 * (12 - ewma));
+    EXPECT_EQ(index.size(),9);
+
+    /* The samples still expire on the original schedule. */
+    index.flush(now + 12);
+    EXPECT_EQ(index.size(),7);
+    EXPECT_DOUBLE_EQ(index.min(MetricsIndex::DL_CQI),2.0);
+}
+
+TEST(MetricsIndex,ResetChangesPeriod)
+{
+    MetricsIndex index(10);
+    time_t now = 1000000;
+
+    index.add(sample(100,1),now);
+    index.reset(60);
+    EXPECT_EQ(index.size(),0);
+    EXPECT_DOUBLE_EQ(index.sum(MetricsIndex::DL_BYTES),0.0);
+
+    index.add(sample(100,1),now);
+    index.add(sample(100,2),now + 30);
+    index.flush(now + 60);
+    EXPECT_EQ(index.size(),2);
+    index.flush(now + 61);
+    EXPECT_EQ(index.size(),1);
+    EXPECT_DOUBLE_EQ(index.min(MetricsIndex::DL_CQI),2.0);
+}
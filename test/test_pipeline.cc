@@ -0,0 +1,229 @@
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include <gtest/gtest.h>
+
+#include "rmr/RIC_message_types.h"
+
+#include "pipeline.h"
+
+using namespace nexran;
+
+namespace {
+
+/*
+ * Records each message's (meid, sequence number) in handling order.  If
+ * gated, the handler blocks on the first message until open() is
+ * called, so that the test can fill a shard's ring behind it.
+ */
+class RecordingHandler : public PipelineHandler {
+ public:
+    RecordingHandler(bool gated_ = false)
+	: gated(gated_),entered(false),count(0) {};
+
+    void handle_pipeline_message(PipelineMessage& msg)
+    {
+	int seq;
+
+	if (gated) {
+	    std::unique_lock<std::mutex> lock(gate_mutex);
+	    entered = true;
+	    gate_cv.notify_all();
+	    gate_cv.wait(lock,[this] { return !gated; });
+	}
+
+	ASSERT_EQ(msg.len,(int)sizeof(seq));
+	memcpy(&seq,msg.payload.data(),sizeof(seq));
+	std::lock_guard<std::mutex> lock(mutex);
+	handled[msg.meid].push_back(std::make_pair(msg.mtype,seq));
+	++count;
+    };
+
+    void wait_entered()
+    {
+	std::unique_lock<std::mutex> lock(gate_mutex);
+	gate_cv.wait(lock,[this] { return entered; });
+    };
+    void open()
+    {
+	std::lock_guard<std::mutex> lock(gate_mutex);
+	gated = false;
+	gate_cv.notify_all();
+    };
+
+    std::mutex mutex;
+    std::map<std::string,std::vector<std::pair<int,int>>> handled;
+    std::atomic<int> count;
+
+ private:
+    std::mutex gate_mutex;
+    std::condition_variable gate_cv;
+    bool gated;
+    bool entered;
+};
+
+bool submit(Pipeline& pipeline,int mtype,const char *meid,int seq)
+{
+    return pipeline.submit(mtype,-1,meid,"",(const unsigned char *)&seq,
+			   sizeof(seq));
+}
+
+void expect_in_order(RecordingHandler& handler)
+{
+    for (auto it = handler.handled.begin(); it != handler.handled.end(); ++it) {
+	for (size_t i = 1; i < it->second.size(); ++i)
+	    EXPECT_LT(it->second[i - 1].second,it->second[i].second)
+		<< "meid " << it->first << " out of order at " << i;
+    }
+}
+
+}
+
+TEST(Pipeline,OverloadPolicyStrings)
+{
+    Pipeline::OverloadPolicy policy;
+
+    EXPECT_TRUE(Pipeline::overload_policy_from_string("drop-oldest",&policy));
+    EXPECT_EQ(policy,Pipeline::DropOldest);
+    EXPECT_TRUE(Pipeline::overload_policy_from_string("backpressure",&policy));
+    EXPECT_EQ(policy,Pipeline::Backpressure);
+    EXPECT_FALSE(Pipeline::overload_policy_from_string("bogus",&policy));
+}
+
+TEST(Pipeline,InlineWithoutShards)
+{
+    RecordingHandler handler;
+    Pipeline pipeline(&handler);
+
+    ASSERT_TRUE(pipeline.start(0,8,Pipeline::Backpressure));
+    for (int i = 0; i < 10; ++i) {
+	EXPECT_TRUE(submit(pipeline,RIC_INDICATION,"enb1",i));
+	/* Handled before submit returns. */
+	EXPECT_EQ(handler.count,i + 1);
+    }
+    pipeline.stop();
+    expect_in_order(handler);
+}
+
+TEST(Pipeline,ShardOrderIsPerNode)
+{
+    for (auto policy : { Pipeline::Backpressure,Pipeline::DropOldest }) {
+	RecordingHandler handler;
+	Pipeline pipeline(&handler);
+	const int nodes = 7,messages = 20000;
+	int sent[nodes] = { 0 };
+
+	ASSERT_TRUE(pipeline.start(3,8,policy));
+	for (int i = 0; i < messages; ++i) {
+	    char meid[16];
+	    snprintf(meid,sizeof(meid),"enb%d",i % nodes);
+	    EXPECT_TRUE(submit(pipeline,RIC_INDICATION,meid,i));
+	    ++sent[i % nodes];
+	}
+	pipeline.stop();
+
+	EXPECT_EQ(pipeline.get_queue_depth(),0u);
+	expect_in_order(handler);
+	/* Each node must land on one shard, whatever the policy. */
+	for (int n = 0; n < nodes; ++n) {
+	    char meid[16];
+	    snprintf(meid,sizeof(meid),"enb%d",n);
+	    EXPECT_EQ(pipeline.shard_of(meid),
+		      (int)(Pipeline::hash_meid(meid) % 3));
+	    if (policy == Pipeline::Backpressure) {
+		EXPECT_EQ((int)handler.handled[meid].size(),sent[n]);
+	    }
+	}
+	if (policy == Pipeline::Backpressure) {
+	    EXPECT_EQ(handler.count,messages);
+	}
+    }
+}
+
+TEST(Pipeline,BackpressureBlocksWhenFull)
+{
+    RecordingHandler handler(true);
+    Pipeline pipeline(&handler);
+    std::atomic<bool> done(false);
+
+    ASSERT_TRUE(pipeline.start(1,4,Pipeline::Backpressure));
+    submit(pipeline,RIC_INDICATION,"enb1",0);
+    handler.wait_entered();
+    for (int i = 1; i <= 4; ++i)
+	submit(pipeline,RIC_INDICATION,"enb1",i);
+
+    std::thread producer([&] {
+	submit(pipeline,RIC_INDICATION,"enb1",5);
+	done = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(done);
+    handler.open();
+    producer.join();
+    pipeline.stop();
+
+    EXPECT_EQ(handler.count,6);
+    expect_in_order(handler);
+}
+
+TEST(Pipeline,DropOldestDropsIndications)
+{
+    RecordingHandler handler(true);
+    Pipeline pipeline(&handler);
+    const int messages = 100;
+
+    ASSERT_TRUE(pipeline.start(1,8,Pipeline::DropOldest));
+    submit(pipeline,RIC_INDICATION,"enb1",0);
+    handler.wait_entered();
+    /* Never blocks: each full push drops the oldest queued indication. */
+    for (int i = 1; i < messages; ++i)
+	EXPECT_TRUE(submit(pipeline,RIC_INDICATION,"enb1",i));
+    EXPECT_EQ(pipeline.get_queue_depth(),8u);
+    handler.open();
+    pipeline.stop();
+
+    auto& handled = handler.handled["enb1"];
+    ASSERT_EQ(handled.size(),9u);
+    EXPECT_EQ(handled.front().second,0);
+    /* The survivors are the newest. */
+    for (int i = 1; i < 9; ++i)
+	EXPECT_EQ(handled[i].second,messages - 9 + i);
+}
+
+TEST(Pipeline,DropOldestKeepsOtherMessages)
+{
+    RecordingHandler handler(true);
+    Pipeline pipeline(&handler);
+    std::atomic<bool> done(false);
+
+    ASSERT_TRUE(pipeline.start(1,4,Pipeline::DropOldest));
+    submit(pipeline,RIC_INDICATION,"enb1",0);
+    handler.wait_entered();
+    submit(pipeline,RIC_CONTROL_ACK,"enb1",1);
+    for (int i = 2; i <= 4; ++i)
+	submit(pipeline,RIC_INDICATION,"enb1",i);
+
+    /* The oldest queued message is an ack, so this must wait. */
+    std::thread producer([&] {
+	submit(pipeline,RIC_INDICATION,"enb1",5);
+	done = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(done);
+    handler.open();
+    producer.join();
+    pipeline.stop();
+
+    auto& handled = handler.handled["enb1"];
+    ASSERT_EQ(handled.size(),6u);
+    EXPECT_EQ(handled[1],std::make_pair((int)RIC_CONTROL_ACK,1));
+    expect_in_order(handler);
+}
@@ -0,0 +1,189 @@
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "nexran.h"
+
+using nexran::RequestGroup;
+
+namespace {
+
+class TestRequest : public e2ap::Request {
+ public:
+    TestRequest(long instance_id_,const char *meid_)
+	: e2ap::Request(1,instance_id_)
+    {
+	set_meid(meid_);
+    };
+
+    bool encode() { return true; };
+};
+
+/* Records each response instead of writing it to a REST client. */
+class TestGroup : public RequestGroup {
+ public:
+    TestGroup(std::chrono::milliseconds timeout_ = std::chrono::seconds(8))
+	: RequestGroup(NULL,timeout_),responses(0),cancelled(false),
+	  succeeded_at_response(0),failed_at_response(0),
+	  pending_at_response(0) {};
+
+    void add(long instance_id)
+    {
+	RequestGroup::add(std::make_shared<TestRequest>(instance_id,"enb"));
+    };
+
+    int responses;
+    bool cancelled;
+    int succeeded_at_response;
+    int failed_at_response;
+    int pending_at_response;
+
+ protected:
+    void respond(bool cancelled_)
+    {
+	++responses;
+	cancelled = cancelled_;
+	succeeded_at_response = succeeded;
+	failed_at_response = failed;
+	pending_at_response = 0;
+	is_done(NULL,NULL,&pending_at_response);
+    };
+};
+
+}
+
+TEST(RequestGroup,RespondsWhenLastResolves)
+{
+    TestGroup group;
+
+    group.add(1);
+    group.add(2);
+    group.add(3);
+    EXPECT_FALSE(group.seal());
+    EXPECT_FALSE(group.update(1,RequestGroup::SUCCESS));
+    EXPECT_FALSE(group.update(2,RequestGroup::FAILURE));
+    EXPECT_EQ(group.responses,0);
+    EXPECT_TRUE(group.update(3,RequestGroup::SUCCESS));
+
+    EXPECT_EQ(group.responses,1);
+    EXPECT_FALSE(group.cancelled);
+    EXPECT_EQ(group.succeeded_at_response,2);
+    EXPECT_EQ(group.failed_at_response,1);
+    EXPECT_EQ(group.pending_at_response,0);
+    /* Already responded. */
+    EXPECT_FALSE(group.finish());
+    EXPECT_EQ(group.responses,1);
+}
+
+/* Answers can arrive before the sender has added every request. */
+TEST(RequestGroup,WaitsForSeal)
+{
+    TestGroup group;
+
+    group.add(1);
+    EXPECT_FALSE(group.update(1,RequestGroup::SUCCESS));
+    group.add(2);
+    EXPECT_FALSE(group.update(2,RequestGroup::SUCCESS));
+    EXPECT_EQ(group.responses,0);
+    EXPECT_TRUE(group.seal());
+    EXPECT_EQ(group.responses,1);
+}
+
+TEST(RequestGroup,IgnoresRepeatedAndUnknownUpdates)
+{
+    TestGroup group;
+
+    group.add(1);
+    group.add(1);
+    group.add(2);
+    group.seal();
+    EXPECT_FALSE(group.update(1,RequestGroup::PENDING));
+    EXPECT_FALSE(group.update(1,RequestGroup::SUCCESS));
+    EXPECT_FALSE(group.update(1,RequestGroup::FAILURE));
+    EXPECT_FALSE(group.update(7,RequestGroup::SUCCESS));
+    EXPECT_EQ(group.responses,0);
+    EXPECT_TRUE(group.update(2,RequestGroup::SUCCESS));
+    EXPECT_EQ(group.succeeded_at_response,2);
+    EXPECT_EQ(group.failed_at_response,0);
+}
+
+TEST(RequestGroup,UnsentCountsAsFailed)
+{
+    TestGroup group;
+
+    group.add_unsent("enb2");
+    EXPECT_TRUE(group.seal());
+    EXPECT_EQ(group.failed_at_response,1);
+}
+
+/* At the deadline, the App finishes the group with what it has. */
+TEST(RequestGroup,FinishAtDeadline)
+{
+    auto start = std::chrono::steady_clock::now();
+    TestGroup group(std::chrono::milliseconds(20));
+
+    group.add(1);
+    group.add(2);
+    group.seal();
+    group.update(1,RequestGroup::SUCCESS);
+
+    EXPECT_FALSE(group.is_expired(start));
+    EXPECT_GE(group.get_deadline(),start + std::chrono::milliseconds(20));
+    EXPECT_TRUE(group.is_expired(group.get_deadline()));
+    std::list<long> pending;
+    group.get_pending(pending);
+    EXPECT_EQ(pending,std::list<long>{ 2 });
+
+    std::this_thread::sleep_until(group.get_deadline());
+    EXPECT_TRUE(group.is_expired(std::chrono::steady_clock::now()));
+    EXPECT_TRUE(group.finish());
+    EXPECT_EQ(group.responses,1);
+    EXPECT_EQ(group.pending_at_response,1);
+
+    /* A late answer does not respond again. */
+    EXPECT_FALSE(group.update(2,RequestGroup::SUCCESS));
+    EXPECT_EQ(group.responses,1);
+}
+
+TEST(RequestGroup,Cancel)
+{
+    TestGroup group;
+
+    group.add(1);
+    group.seal();
+    EXPECT_TRUE(group.cancel());
+    EXPECT_TRUE(group.cancelled);
+    EXPECT_FALSE(group.cancel());
+    EXPECT_FALSE(group.finish());
+    EXPECT_FALSE(group.update(1,RequestGroup::SUCCESS));
+    EXPECT_EQ(group.responses,1);
+}
+
+/* Answers race with each other; exactly one of them responds. */
+TEST(RequestGroup,ConcurrentUpdatesRespondOnce)
+{
+    for (int round = 0; round < 50; ++round) {
+	TestGroup group;
+	std::vector<std::thread> threads;
+	std::atomic<int> last(0);
+
+	for (long i = 0; i < 8; ++i)
+	    group.add(i);
+	group.seal();
+	for (long i = 0; i < 8; ++i) {
+	    threads.emplace_back([&group,&last,i] {
+		if (group.update(i,RequestGroup::SUCCESS))
+		    ++last;
+	    });
+	}
+	for (auto it = threads.begin(); it != threads.end(); ++it)
+	    it->join();
+
+	EXPECT_EQ(last,1);
+	EXPECT_EQ(group.responses,1);
+	EXPECT_EQ(group.succeeded_at_response,8);
+    }
+}